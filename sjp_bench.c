@@ -0,0 +1,748 @@
+#include "sjp_lexer.h"
+#include "sjp_parser.h"
+#include "sjp_index.h"
+#include "sjp_push.h"
+#include "sjp_tape.h"
+#include "sjp_cursor.h"
+#include "sjp_filter.h"
+#include "sjp_ndjson.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+// Throughput benchmarks for the lexer and parser.
+//
+// With no arguments, runs over generated documents.  Otherwise, runs
+// over each file named on the command line.
+//
+// Set SJP_SIMD (see sjp_lexer_simd_level()) to compare the lexer
+// kernels.
+
+enum { BENCH_DOC_SIZE = 16 << 20 };
+enum { BENCH_RUN_BYTES = 64 << 20 };
+enum { BENCH_RUNS = 5 };
+
+// CPU time of the process: the benchmarks are single threaded, and
+// this is less noisy than wall time on a busy machine.
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Wall time, for the benchmarks that use threads
+static double wall_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Generates an array of records, pretty printed with the given indent
+// (or compact if indent is zero).
+static size_t gen_records(char *doc, size_t cap, int indent)
+{
+  const char *nl = indent > 0 ? "\n" : "";
+  size_t n = 0;
+  int i;
+
+  n += sprintf(&doc[n], "[%s", nl);
+  for (i=0; n + 512 < cap; i++) {
+    if (i > 0) {
+      n += sprintf(&doc[n], ",%s", nl);
+    }
+
+    n += sprintf(&doc[n],
+        "%*s{%s"
+        "%*s\"id\": %d,%s"
+        "%*s\"name\": \"record number %d\",%s"
+        "%*s\"score\": %d.%02d,%s"
+        "%*s\"tags\": [ \"alpha\", \"beta\" ],%s"
+        "%*s\"active\": true%s"
+        "%*s}",
+        indent, "", nl,
+        2*indent, "", i, nl,
+        2*indent, "", i, nl,
+        2*indent, "", i % 1000, i % 100, nl,
+        2*indent, "", nl,
+        2*indent, "", nl,
+        indent, "");
+  }
+  n += sprintf(&doc[n], "%s", nl);
+  n += sprintf(&doc[n], "]%s", nl);
+
+  return n;
+}
+
+// Generates an array of log records whose messages are JSON documents
+// embedded in strings, so most of the bytes are in escaped strings.
+static size_t gen_escaped(char *doc, size_t cap)
+{
+  size_t n = 0;
+  int i;
+
+  n += sprintf(&doc[n], "[");
+  for (i=0; n + 512 < cap; i++) {
+    n += sprintf(&doc[n],
+        "%s{\"id\":%d,\"msg\":\"{\\\"user\\\": \\\"J\\u00fcrgen %d\\\",\\n"
+        "  \\\"path\\\": \\\"C:\\\\\\\\logs\\\\\\\\app.log\\\",\\n"
+        "  \\\"text\\\": \\\"line one\\\\nline two\\\\t\\ud83d\\ude00\\\"\\n}\"}",
+        i > 0 ? "," : "", i, i);
+  }
+  n += sprintf(&doc[n], "]");
+
+  return n;
+}
+
+// Generates an array of telemetry samples: arrays of numbers with a mix
+// of integers, fractions and exponents.
+static size_t gen_numbers(char *doc, size_t cap)
+{
+  size_t n = 0;
+  int i;
+
+  n += sprintf(&doc[n], "[");
+  for (i=0; n + 512 < cap; i++) {
+    n += sprintf(&doc[n],
+        "%s[%d,%d.%03d,-%d.%06d,%d.%de-%d,0.%05d]",
+        i > 0 ? "," : "",
+        1600000000 + i, i % 1000, i % 1000, i % 100, (i * 7919) % 1000000,
+        1 + i % 9, i % 1000, 1 + i % 12, (i * 31) % 100000);
+  }
+  n += sprintf(&doc[n], "]");
+
+  return n;
+}
+
+// Generates an array of sparse feature flag records, where most of the
+// values are true, false or null.
+static size_t gen_flags(char *doc, size_t cap)
+{
+  static const char *const kw[] = { "true", "false", "null" };
+  size_t n = 0;
+  int i;
+
+  n += sprintf(&doc[n], "[");
+  for (i=0; n + 512 < cap; i++) {
+    n += sprintf(&doc[n],
+        "%s{\"id\":%d,\"a\":%s,\"b\":%s,\"c\":[%s,%s,%s,%s],\"d\":%s}",
+        i > 0 ? "," : "", i,
+        kw[i % 3], kw[(i/3) % 3], kw[(i/2) % 3], kw[(i/5) % 3], kw[(i/7) % 3],
+        kw[(i+1) % 3], kw[(i/11) % 3]);
+  }
+  n += sprintf(&doc[n], "]");
+
+  return n;
+}
+
+// Generates newline delimited log records, one small document per line
+static size_t gen_ndjson(char *doc, size_t cap)
+{
+  size_t n = 0;
+  int i;
+
+  for (i=0; n + 512 < cap; i++) {
+    n += sprintf(&doc[n],
+        "{\"ts\":%d,\"level\":\"%s\",\"msg\":\"request %d done\",\"ms\":%d.%d}\n",
+        1600000000 + i, (i % 7 == 0) ? "warn" : "info", i, i % 500, i % 10);
+  }
+
+  return n;
+}
+
+// Each benchmark parses a fresh copy of the document (the lexer
+// modifies its input) and returns the number of tokens or events.
+typedef size_t (*bench_fn)(char *data, size_t n);
+
+static size_t run_lexer(char *data, size_t n)
+{
+  struct sjp_lexer lex;
+  struct sjp_token tok;
+  size_t ntok = 0;
+
+  sjp_lexer_init(&lex);
+  sjp_lexer_more(&lex, data, n);
+  while (sjp_lexer_token(&lex, &tok) == SJP_OK) {
+    ntok++;
+  }
+
+  return ntok;
+}
+
+static size_t run_lexer_batch(char *data, size_t n)
+{
+  struct sjp_lexer lex;
+  struct sjp_token toks[256];
+  size_t count, ntok = 0;
+
+  sjp_lexer_init(&lex);
+  sjp_lexer_more(&lex, data, n);
+  while (sjp_lexer_tokens(&lex, toks, sizeof toks / sizeof toks[0], &count) == SJP_OK) {
+    ntok += count;
+  }
+
+  return ntok + count - 1;
+}
+
+static size_t run_parser(char *data, size_t n)
+{
+  char stack[256];
+  struct sjp_parser p;
+  struct sjp_event evt;
+  size_t nevt = 0;
+
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  sjp_parser_more(&p, data, n);
+  while (sjp_parser_next(&p, &evt) == SJP_OK) {
+    nevt++;
+  }
+
+  return nevt;
+}
+
+static size_t run_parser_batch(char *data, size_t n)
+{
+  char stack[256];
+  struct sjp_parser p;
+  struct sjp_event evts[256];
+  size_t count, nevt = 0;
+
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  sjp_parser_more(&p, data, n);
+  while (sjp_parser_next_batch(&p, evts, sizeof evts / sizeof evts[0], &count) == SJP_OK && count > 0) {
+    nevt += count;
+  }
+
+  return nevt + count - 1;
+}
+
+static size_t run_parser_raw(char *data, size_t n)
+{
+  char stack[256];
+  struct sjp_parser p;
+  struct sjp_event evt;
+  size_t nevt = 0;
+
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  sjp_parser_set_options(&p, SJP_PARSER_RAW_NUMBERS);
+  sjp_parser_more(&p, data, n);
+  while (sjp_parser_next(&p, &evt) == SJP_OK) {
+    nevt++;
+  }
+
+  return nevt;
+}
+
+static int push_count(void *ctx)
+{
+  ++*(size_t *)ctx;
+  return 0;
+}
+
+static int push_count_bool(void *ctx, int value)
+{
+  (void)value;
+  ++*(size_t *)ctx;
+  return 0;
+}
+
+static int push_count_value(void *ctx, const struct sjp_event *evt, int partial)
+{
+  (void)evt;
+  (void)partial;
+  ++*(size_t *)ctx;
+  return 0;
+}
+
+static const struct sjp_handlers push_handlers = {
+  .on_null = push_count,
+  .on_bool = push_count_bool,
+  .on_number = push_count_value,
+  .on_string = push_count_value,
+  .on_key = push_count_value,
+  .on_begin_object = push_count,
+  .on_end_object = push_count,
+  .on_begin_array = push_count,
+  .on_end_array = push_count,
+};
+
+// Counts the events with handlers called by sjp_parse()
+static size_t run_push(char *data, size_t n)
+{
+  char stack[256];
+  struct sjp_parser p;
+  size_t nevt = 0;
+
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  if (sjp_parse(&p, data, n, &push_handlers, &nevt) == SJP_MORE) {
+    sjp_parse(&p, NULL, 0, &push_handlers, &nevt);
+  }
+
+  return nevt;
+}
+
+// The same, with the handlers inlined by sjp_parse_inline()
+static size_t run_push_inline(char *data, size_t n)
+{
+  char stack[256];
+  struct sjp_parser p;
+  size_t nevt = 0;
+
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  if (sjp_parse_inline(&p, data, n, &push_handlers, &nevt) == SJP_MORE) {
+    sjp_parse_inline(&p, NULL, 0, &push_handlers, &nevt);
+  }
+
+  return nevt;
+}
+
+static void *tape_alloc(void *ud, void *ptr, size_t n)
+{
+  (void)ud;
+
+  if (n == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  return realloc(ptr, n);
+}
+
+// Builds the tape of the document, and returns the number of words.
+// The tape and its arena are kept from one pass to the next, as they
+// would be for a stream of documents.
+static size_t run_tape(char *data, size_t n)
+{
+  static struct sjp_parser p;
+  static struct sjp_tape t;
+  static int init;
+
+  if (!init) {
+    sjp_parser_init(&p, NULL, 0, NULL, 0);
+    sjp_tape_init(&t, &p, NULL, 0, NULL, 0);
+    sjp_tape_set_allocator(&t, tape_alloc, NULL, SIZE_MAX);
+    init = 1;
+  }
+
+  sjp_parser_reset(&p);
+  sjp_tape_reset(&t);
+
+  sjp_parser_more(&p, data, n);
+  if (sjp_tape_build(&t) == SJP_MORE) {
+    sjp_parser_eos(&p);
+    sjp_tape_build(&t);
+  }
+
+  return t.nwords;
+}
+
+// Skips the whole document, and returns the number of elements of the
+// top level array
+static size_t run_parser_skip(char *data, size_t n)
+{
+  char stack[256];
+  struct sjp_parser p;
+  size_t count = 0;
+
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  sjp_parser_more(&p, data, n);
+  sjp_parser_skip(&p, &count);
+
+  return count;
+}
+
+// Fetches the "id" of each record, or the first element of each
+// sample, and skips the rest
+static size_t run_filter(char *data, size_t n)
+{
+  static const char *const paths[] = { "/*/id", "/*/0" };
+  char stack[256];
+  struct sjp_parser p;
+  struct sjp_filter f;
+  struct sjp_event evt;
+  size_t nevt = 0;
+
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  sjp_filter_init(&f, &p, paths, 2);
+  sjp_parser_more(&p, data, n);
+  while (sjp_filter_next(&f, &evt) == SJP_OK) {
+    nevt++;
+  }
+
+  return nevt;
+}
+
+// Fetches the same values as run_filter with the on-demand cursor
+static size_t run_cursor(char *data, size_t n)
+{
+  struct sjp_cursor c;
+  size_t top, h, nval = 0;
+
+  sjp_cursor_init(&c, data, n);
+  if (sjp_cursor_array(&c, &top) != SJP_OK) {
+    return 0;
+  }
+
+  while (sjp_cursor_next_element(&c, top) == 1) {
+    int found = 0;
+
+    if (sjp_cursor_object(&c, &h) == SJP_OK) {
+      found = sjp_cursor_find_field(&c, h, "id", 2);
+    } else if (sjp_cursor_array(&c, &h) == SJP_OK) {
+      found = sjp_cursor_next_element(&c, h);
+    }
+
+    if (found == 1) {
+      int64_t v;
+      sjp_cursor_get_int64(&c, &v);
+      nval++;
+    }
+  }
+
+  sjp_cursor_close(&c);
+  return nval;
+}
+
+// Parses newline delimited documents in stream mode
+static size_t run_stream(char *data, size_t n)
+{
+  char stack[256];
+  struct sjp_parser p;
+  struct sjp_event evt;
+  size_t nevt = 0;
+
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  sjp_parser_set_options(&p, SJP_PARSER_STREAM);
+  sjp_parser_more(&p, data, n);
+  while (sjp_parser_next(&p, &evt) == SJP_OK) {
+    nevt++;
+  }
+
+  return nevt;
+}
+
+// Parses newline delimited documents by resetting the parser for each
+// line
+static size_t run_lines(char *data, size_t n)
+{
+  char stack[256];
+  struct sjp_parser p;
+  struct sjp_event evt;
+  size_t nevt = 0;
+  char *line = data, *end = data + n;
+
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  while (line < end) {
+    char *nl = memchr(line, '\n', end - line);
+    if (nl == NULL) {
+      nl = end;
+    }
+
+    sjp_parser_reset(&p);
+    sjp_parser_more(&p, line, nl - line);
+    while (sjp_parser_next(&p, &evt) == SJP_OK) {
+      nevt++;
+    }
+
+    // one event for the end of each document, as in stream mode
+    nevt++;
+    line = nl + 1;
+  }
+
+  return nevt;
+}
+
+// Reports the best of several runs, each over at least
+// BENCH_RUN_BYTES of input.
+static void bench_run(const char *name, const char *what, bench_fn fn, const char *src, size_t n)
+{
+  char *data;
+  double best = 0.0;
+  size_t count = 0;
+  int run;
+
+  if (data = malloc(n), data == NULL) {
+    return;
+  }
+
+  for (run=0; run < BENCH_RUNS; run++) {
+    size_t total = 0;
+    double t0, t1;
+
+    t0 = now();
+    do {
+      memcpy(data, src, n);
+      count = fn(data, n);
+      total += n;
+    } while (total < BENCH_RUN_BYTES);
+    t1 = now();
+
+    if (total / (t1 - t0) > best) {
+      best = total / (t1 - t0);
+    }
+  }
+
+  printf("%-24s %-7s %8.1f MB/s  (%zu per pass)\n", name, what, best / 1e6, count);
+
+  free(data);
+}
+
+static int ndjson_parse(void *ud, struct sjp_ndjson_record *rec)
+{
+  struct sjp_event evt;
+  size_t nevt = 0;
+  int ret;
+
+  (void)ud;
+
+  while (ret = sjp_ndjson_next(rec, &evt), ret == SJP_OK && evt.type != SJP_NONE) {
+    nevt++;
+  }
+
+  rec->result = (void *)(uintptr_t)nevt;
+  return ret;
+}
+
+static int ndjson_deliver(void *ud, struct sjp_ndjson_record *rec)
+{
+  *(size_t *)ud += (uintptr_t)rec->result;
+  return 0;
+}
+
+// Parses newline delimited documents with sjp_ndjson_run(), in order,
+// with 1, 2, 4, ... threads up to the number of processors.  Reports
+// wall time rather than CPU time.
+static void bench_ndjson_threads(const char *name, const char *src, size_t n)
+{
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  char *data;
+  int nthreads;
+
+  if (data = malloc(n), data == NULL) {
+    return;
+  }
+
+  for (nthreads = 1; nthreads <= ncpu || nthreads == 1; nthreads *= 2) {
+    struct sjp_ndjson nd;
+    double best = 0.0;
+    size_t count = 0;
+    char what[16];
+    int run;
+
+    sjp_ndjson_init(&nd, ndjson_parse, ndjson_deliver, &count);
+    nd.nthreads = nthreads;
+
+    for (run=0; run < BENCH_RUNS; run++) {
+      size_t total = 0;
+      double t0, t1;
+
+      t0 = wall_now();
+      do {
+        memcpy(data, src, n);
+        count = 0;
+        sjp_ndjson_run(&nd, data, n);
+        total += n;
+      } while (total < BENCH_RUN_BYTES);
+      t1 = wall_now();
+
+      if (total / (t1 - t0) > best) {
+        best = total / (t1 - t0);
+      }
+    }
+
+    snprintf(what, sizeof what, "%dthr", nthreads);
+    printf("%-24s %-7s %8.1f MB/s  (%zu per pass)\n", name, what, best / 1e6, count);
+  }
+
+  free(data);
+}
+
+// Stage 1 of the index (s1/), both stages (ix/), or both stages with
+// the tokens lexed on the threads (lx/), of a single document with 1,
+// 2, 4, ... threads up to the number of processors.  Reports wall
+// time, and the chunks that guessed wrong and were indexed again.
+// sjp_parser_next() on one thread is the baseline.
+static void bench_index_threads(const char *name, const char *src, size_t n)
+{
+  static const char *const modes[] = { "", "s1/", "ix/", "lx/" };
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  struct sjp_index_token *tok;
+  struct sjp_index ix;
+  uint32_t *pos;
+  char *data;
+  char stack[4096];
+  size_t ntok;
+  int nthreads, stages;
+
+  if (data = malloc(n), data == NULL) {
+    return;
+  }
+
+  if (pos = malloc(n * sizeof pos[0]), pos == NULL) {
+    free(data);
+    return;
+  }
+
+  // a string, number or keyword has at least one offset
+  memcpy(data, src, n);
+  sjp_index_init(&ix, stack, sizeof stack, pos, n);
+  sjp_index_build(&ix, data, n);
+  ntok = ix.npos + 1;
+  if (tok = malloc(ntok * sizeof tok[0]), tok == NULL) {
+    free(pos);
+    free(data);
+    return;
+  }
+
+  bench_run(name, "parser", run_parser, src, n);
+
+  for (stages = 1; stages <= 3; stages++) {
+    for (nthreads = 1; nthreads <= ncpu || nthreads == 1; nthreads *= 2) {
+      double best = 0.0;
+      size_t count = 0, nredo = 0;
+      char what[24];
+      int run;
+
+      sjp_index_init(&ix, stack, sizeof stack, pos, n);
+      if (stages == 3) {
+        sjp_index_set_tokens(&ix, tok, ntok);
+      }
+
+      for (run=0; run < BENCH_RUNS; run++) {
+        size_t total = 0;
+        double t0, t1;
+
+        t0 = wall_now();
+        do {
+          struct sjp_event evt;
+
+          memcpy(data, src, n);
+          sjp_index_build_parallel(&ix, data, n, nthreads);
+          nredo = ix.nredo;
+
+          count = ix.npos;
+          if (stages >= 2) {
+            count = 0;
+            while (sjp_index_next(&ix, &evt) == SJP_OK && evt.type != SJP_NONE) {
+              count++;
+            }
+          }
+          total += n;
+        } while (total < BENCH_RUN_BYTES);
+        t1 = wall_now();
+
+        if (total / (t1 - t0) > best) {
+          best = total / (t1 - t0);
+        }
+      }
+
+      snprintf(what, sizeof what, "%s%dthr", modes[stages], nthreads);
+      printf("%-24s %-7s %8.1f MB/s  (%zu per pass, %zu redone)\n", name, what, best / 1e6, count, nredo);
+    }
+  }
+
+  free(tok);
+  free(pos);
+  free(data);
+}
+
+static void bench_doc(const char *name, const char *doc, size_t n)
+{
+  bench_run(name, "lexer", run_lexer, doc, n);
+  bench_run(name, "batch", run_lexer_batch, doc, n);
+  bench_run(name, "parser", run_parser, doc, n);
+  bench_run(name, "pbatch", run_parser_batch, doc, n);
+  bench_run(name, "push", run_push, doc, n);
+  bench_run(name, "pushinl", run_push_inline, doc, n);
+  bench_run(name, "tape", run_tape, doc, n);
+  bench_run(name, "raw", run_parser_raw, doc, n);
+  bench_run(name, "skip", run_parser_skip, doc, n);
+  bench_run(name, "filter", run_filter, doc, n);
+  bench_run(name, "cursor", run_cursor, doc, n);
+}
+
+static int bench_file(const char *path)
+{
+  FILE *f;
+  char *doc;
+  long n;
+
+  if (f = fopen(path, "rb"), f == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  if (fseek(f, 0, SEEK_END) != 0 || (n = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+    perror(path);
+    fclose(f);
+    return -1;
+  }
+
+  if (doc = malloc(n > 0 ? n : 1), doc == NULL || fread(doc, 1, n, f) != (size_t)n) {
+    printf("%s: could not read %ld bytes\n", path, n);
+    free(doc);
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  bench_doc(path, doc, n);
+  free(doc);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  char *doc;
+  size_t n;
+  int i, ret;
+
+  printf("simd: %s\n", sjp_lexer_simd_name(sjp_lexer_simd_level()));
+
+  if (argc > 1) {
+    ret = 0;
+    for (i=1; i < argc; i++) {
+      if (bench_file(argv[i]) != 0) {
+        ret = 1;
+      }
+    }
+    return ret;
+  }
+
+  if (doc = malloc(BENCH_DOC_SIZE), doc == NULL) {
+    return 1;
+  }
+
+  n = gen_records(doc, BENCH_DOC_SIZE, 0);
+  bench_doc("records, compact", doc, n);
+  bench_index_threads("records, compact", doc, n);
+
+  n = gen_records(doc, BENCH_DOC_SIZE, 2);
+  bench_doc("records, indent 2", doc, n);
+
+  n = gen_records(doc, BENCH_DOC_SIZE, 8);
+  bench_doc("records, indent 8", doc, n);
+
+  n = gen_escaped(doc, BENCH_DOC_SIZE);
+  bench_doc("escaped strings", doc, n);
+  bench_index_threads("escaped strings", doc, n);
+
+  n = gen_numbers(doc, BENCH_DOC_SIZE);
+  bench_doc("numbers", doc, n);
+
+  n = gen_flags(doc, BENCH_DOC_SIZE);
+  bench_doc("flags", doc, n);
+
+  n = gen_ndjson(doc, BENCH_DOC_SIZE);
+  bench_run("ndjson", "stream", run_stream, doc, n);
+  bench_run("ndjson", "lines", run_lines, doc, n);
+  bench_ndjson_threads("ndjson", doc, n);
+
+  free(doc);
+  return 0;
+}
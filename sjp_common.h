@@ -6,6 +6,9 @@
 enum SJP_RESULT {
   SJP_INTERNAL_ERROR   = -128, // internal error occured
 
+  SJP_WRONG_TYPE       = -13,  // value isn't of the requested type
+  SJP_OUT_OF_MEMORY    = -12,  // allocation failed
+  SJP_NUMBER_RANGE     = -11,  // number can't be converted to the requested type
   SJP_TOO_MUCH_NESTING = -10,  // invalid character encountered
   SJP_INVALID_KEY      = -9,   // invalid character encountered
 
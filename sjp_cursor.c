@@ -0,0 +1,442 @@
+#include "sjp_cursor.h"
+#include "sjp_number.h"
+
+#include <string.h>
+
+void sjp_cursor_init(struct sjp_cursor *c, char *data, size_t n)
+{
+  sjp_lexer_init(&c->lex);
+  sjp_lexer_more(&c->lex, data, n);
+
+  c->depth = 0;
+  c->pending = 1;
+  c->first = 0;
+  c->eos = 0;
+  c->err = SJP_OK;
+}
+
+static int cur_fail(struct sjp_cursor *c, int ret)
+{
+  if (SJP_ERROR(ret) && c->err == SJP_OK) {
+    c->err = ret;
+  }
+
+  return ret;
+}
+
+// Returns the next byte that isn't whitespace, without reading it, or
+// -1 at the end of the data.
+static int cur_peek(const struct sjp_cursor *c)
+{
+  const struct sjp_lexer *l = &c->lex;
+  size_t i;
+
+  for (i = l->off; i < l->sz; i++) {
+    switch (l->data[i]) {
+      case ' ': case '\t': case '\r': case '\n':
+        break;
+
+      default:
+        return (unsigned char)l->data[i];
+    }
+  }
+
+  return -1;
+}
+
+static enum SJP_RESULT cur_token(struct sjp_cursor *c, struct sjp_token *tok)
+{
+  enum SJP_RESULT ret;
+
+  if (ret = sjp_lexer_token(&c->lex, tok), ret == SJP_MORE && !c->eos) {
+    // The token runs to the end of the document, so finish it at the
+    // end of the stream.  Numbers are returned from the lexer's restart
+    // buffer, so keep the text from the document.
+    struct sjp_token rest = { 0 };
+
+    c->eos = 1;
+    sjp_lexer_eos(&c->lex);
+    if (ret = sjp_lexer_token(&c->lex, &rest), !SJP_ERROR(ret) && tok->type != SJP_TOK_NONE) {
+      rest.value = tok->value;
+      rest.n = tok->n;
+
+      // a number too long for the restart buffer isn't converted
+      if (rest.type == SJP_TOK_NUMBER && rest.kind == SJP_NUM_RAW &&
+          (ret = sjp_number_to_double(rest.value, rest.n, &rest.extra.dbl), ret == SJP_OK)) {
+        rest.kind = SJP_NUM_DOUBLE;
+      }
+    }
+    *tok = rest;
+  }
+
+  if (SJP_ERROR(ret)) {
+    return cur_fail(c, ret);
+  }
+
+  // the whole document is in memory, so nothing is left partial
+  if (ret != SJP_OK) {
+    return cur_fail(c, SJP_INTERNAL_ERROR);
+  }
+
+  if (tok->type == SJP_TOK_NONE) {
+    tok->type = SJP_TOK_EOS;
+  }
+
+  return SJP_OK;
+}
+
+static enum SJP_RESULT cur_skip(struct sjp_cursor *c, size_t depth)
+{
+  struct sjp_skip sk = { depth, 0, 0 };
+  enum SJP_RESULT ret;
+
+  if (ret = sjp_lexer_skip(&c->lex, &sk), ret == SJP_MORE && !c->eos) {
+    c->eos = 1;
+    sjp_lexer_eos(&c->lex);
+    ret = sjp_lexer_skip(&c->lex, &sk);
+  }
+
+  return cur_fail(c, ret);
+}
+
+// Skips the unread value and the rest of the arrays and objects inside
+// the one with handle h, so the cursor is after a value in h.
+static enum SJP_RESULT cur_unwind(struct sjp_cursor *c, size_t h)
+{
+  enum SJP_RESULT ret;
+
+  if (c->pending) {
+    if (ret = cur_skip(c, 0), ret != SJP_OK) {
+      return ret;
+    }
+    c->pending = 0;
+    c->first = 0;
+  }
+
+  if (c->depth > h) {
+    if (ret = cur_skip(c, c->depth - h), ret != SJP_OK) {
+      return ret;
+    }
+    c->depth = h;
+    c->first = 0;
+  }
+
+  return SJP_OK;
+}
+
+// The closing bracket of the innermost array or object was read
+static void cur_leave(struct sjp_cursor *c)
+{
+  c->depth--;
+  c->pending = 0;
+  c->first = 0;
+}
+
+enum SJP_EVENT sjp_cursor_type(const struct sjp_cursor *c)
+{
+  int ch;
+
+  if (c->err != SJP_OK || !c->pending) {
+    return SJP_NONE;
+  }
+
+  switch (ch = cur_peek(c)) {
+    case '{': return SJP_OBJECT_BEG;
+    case '[': return SJP_ARRAY_BEG;
+    case '"': return SJP_STRING;
+    case 't': return SJP_TRUE;
+    case 'f': return SJP_FALSE;
+    case 'n': return SJP_NULL;
+    case '-': return SJP_NUMBER;
+
+    default:
+      return (ch >= '0' && ch <= '9') ? SJP_NUMBER : SJP_NONE;
+  }
+}
+
+// Reads the next value, if it is of type t1 or t2
+static enum SJP_RESULT cur_value(struct sjp_cursor *c, enum SJP_EVENT t1, enum SJP_EVENT t2, struct sjp_token *tok)
+{
+  enum SJP_EVENT t;
+  enum SJP_RESULT ret;
+
+  if (c->err != SJP_OK) {
+    return c->err;
+  }
+
+  if (!c->pending) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  if (t = sjp_cursor_type(c), t == SJP_NONE) {
+    return cur_fail(c, SJP_INVALID_INPUT);
+  }
+
+  if (t != t1 && t != t2) {
+    return SJP_WRONG_TYPE;
+  }
+
+  if (ret = cur_token(c, tok), ret != SJP_OK) {
+    return ret;
+  }
+
+  c->pending = 0;
+  if (t == SJP_OBJECT_BEG || t == SJP_ARRAY_BEG) {
+    c->depth++;
+    c->first = 1;
+  }
+
+  return SJP_OK;
+}
+
+enum SJP_RESULT sjp_cursor_object(struct sjp_cursor *c, size_t *h)
+{
+  struct sjp_token tok;
+  enum SJP_RESULT ret;
+
+  if (ret = cur_value(c, SJP_OBJECT_BEG, SJP_OBJECT_BEG, &tok), ret == SJP_OK) {
+    *h = c->depth;
+  }
+
+  return ret;
+}
+
+enum SJP_RESULT sjp_cursor_array(struct sjp_cursor *c, size_t *h)
+{
+  struct sjp_token tok;
+  enum SJP_RESULT ret;
+
+  if (ret = cur_value(c, SJP_ARRAY_BEG, SJP_ARRAY_BEG, &tok), ret == SJP_OK) {
+    *h = c->depth;
+  }
+
+  return ret;
+}
+
+int sjp_cursor_next_field(struct sjp_cursor *c, size_t obj, const char **key, size_t *n)
+{
+  struct sjp_token tok;
+  int ret;
+
+  if (c->err != SJP_OK) {
+    return c->err;
+  }
+
+  if (obj == 0) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  // the object is finished
+  if (obj > c->depth) {
+    return 0;
+  }
+
+  if (ret = cur_unwind(c, obj), ret != SJP_OK) {
+    return ret;
+  }
+
+  if (ret = cur_token(c, &tok), ret != SJP_OK) {
+    return ret;
+  }
+
+  if (tok.type == SJP_TOK_CCURLY) {
+    cur_leave(c);
+    return 0;
+  }
+
+  if (tok.type == SJP_TOK_EOS) {
+    return cur_fail(c, SJP_UNCLOSED_OBJECT);
+  }
+
+  if (!c->first) {
+    if (tok.type != SJP_TOK_COMMA) {
+      return cur_fail(c, SJP_INVALID_INPUT);
+    }
+
+    if (ret = cur_token(c, &tok), ret != SJP_OK) {
+      return ret;
+    }
+  }
+  c->first = 0;
+
+  if (tok.type != SJP_TOK_STRING) {
+    return cur_fail(c, SJP_INVALID_KEY);
+  }
+
+  *key = tok.value;
+  *n = tok.n;
+
+  if (ret = cur_token(c, &tok), ret != SJP_OK) {
+    return ret;
+  }
+
+  if (tok.type != SJP_TOK_COLON) {
+    return cur_fail(c, SJP_INVALID_INPUT);
+  }
+
+  c->pending = 1;
+  return 1;
+}
+
+int sjp_cursor_find_field(struct sjp_cursor *c, size_t obj, const char *key, size_t n)
+{
+  const char *k;
+  size_t nk;
+  int ret;
+
+  if (key == NULL && n > 0) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  // the value of a member that doesn't match is skipped by the next call
+  while (ret = sjp_cursor_next_field(c, obj, &k, &nk), ret == 1) {
+    if (nk == n && memcmp(k, key, n) == 0) {
+      return 1;
+    }
+  }
+
+  return ret;
+}
+
+int sjp_cursor_next_element(struct sjp_cursor *c, size_t arr)
+{
+  struct sjp_token tok;
+  int ret;
+
+  if (c->err != SJP_OK) {
+    return c->err;
+  }
+
+  if (arr == 0) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  // the array is finished
+  if (arr > c->depth) {
+    return 0;
+  }
+
+  if (ret = cur_unwind(c, arr), ret != SJP_OK) {
+    return ret;
+  }
+
+  if (c->first) {
+    // the first element has no comma before it, so look for the end of
+    // the array (or the data) without reading the element
+    int ch = cur_peek(c);
+
+    c->first = 0;
+    if (ch != ']' && ch >= 0) {
+      c->pending = 1;
+      return 1;
+    }
+  }
+
+  if (ret = cur_token(c, &tok), ret != SJP_OK) {
+    return ret;
+  }
+
+  switch (tok.type) {
+    case SJP_TOK_COMMA:
+      c->pending = 1;
+      return 1;
+
+    case SJP_TOK_CBRACKET:
+      cur_leave(c);
+      return 0;
+
+    case SJP_TOK_EOS:
+      return cur_fail(c, SJP_UNCLOSED_ARRAY);
+
+    default:
+      return cur_fail(c, SJP_INVALID_INPUT);
+  }
+}
+
+enum SJP_RESULT sjp_cursor_get_int64(struct sjp_cursor *c, int64_t *v)
+{
+  struct sjp_token tok;
+  enum SJP_RESULT ret;
+
+  if (ret = cur_value(c, SJP_NUMBER, SJP_NUMBER, &tok), ret != SJP_OK) {
+    return ret;
+  }
+
+  if (tok.kind != SJP_NUM_INT64) {
+    return SJP_NUMBER_RANGE;
+  }
+
+  *v = tok.num.i64;
+  return SJP_OK;
+}
+
+enum SJP_RESULT sjp_cursor_get_double(struct sjp_cursor *c, double *v)
+{
+  struct sjp_token tok;
+  enum SJP_RESULT ret;
+
+  if (ret = cur_value(c, SJP_NUMBER, SJP_NUMBER, &tok), ret != SJP_OK) {
+    return ret;
+  }
+
+  *v = tok.extra.dbl;
+  return SJP_OK;
+}
+
+enum SJP_RESULT sjp_cursor_get_bool(struct sjp_cursor *c, int *v)
+{
+  struct sjp_token tok;
+  enum SJP_RESULT ret;
+
+  if (ret = cur_value(c, SJP_TRUE, SJP_FALSE, &tok), ret != SJP_OK) {
+    return ret;
+  }
+
+  *v = (tok.type == SJP_TOK_TRUE);
+  return SJP_OK;
+}
+
+enum SJP_RESULT sjp_cursor_get_string(struct sjp_cursor *c, const char **s, size_t *n)
+{
+  struct sjp_token tok;
+  enum SJP_RESULT ret;
+
+  if (ret = cur_value(c, SJP_STRING, SJP_STRING, &tok), ret != SJP_OK) {
+    return ret;
+  }
+
+  *s = tok.value;
+  *n = tok.n;
+  return SJP_OK;
+}
+
+enum SJP_RESULT sjp_cursor_get_null(struct sjp_cursor *c)
+{
+  struct sjp_token tok;
+
+  return cur_value(c, SJP_NULL, SJP_NULL, &tok);
+}
+
+enum SJP_RESULT sjp_cursor_close(struct sjp_cursor *c)
+{
+  struct sjp_token tok;
+  enum SJP_RESULT ret;
+
+  if (c->err != SJP_OK) {
+    return c->err;
+  }
+
+  if (ret = cur_unwind(c, 0), ret != SJP_OK) {
+    return ret;
+  }
+
+  if (ret = cur_token(c, &tok), ret != SJP_OK) {
+    return ret;
+  }
+
+  if (tok.type != SJP_TOK_EOS) {
+    return cur_fail(c, SJP_INVALID_INPUT);
+  }
+
+  return cur_fail(c, sjp_lexer_close(&c->lex));
+}
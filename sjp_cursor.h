@@ -0,0 +1,105 @@
+#ifndef SJP_CURSOR_H
+#define SJP_CURSOR_H
+
+#include "sjp_common.h"
+#include "sjp_lexer.h"
+#include "sjp_parser.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MODULE_NAME SJP_CURSOR
+
+// On-demand reading of a document that is all in memory: the caller
+// walks the document with a cursor, and asks for the members and
+// elements it wants.  A value is only lexed when it's read, and values
+// that the caller steps over are skipped with sjp_lexer_skip(), which
+// only matches quotes and brackets.  Everything that is read is lexed
+// and validated as the lexer does, but the skipped values are not
+// validated.
+//
+// The cursor moves forward only.  The arrays and objects that it has
+// entered are named by handles (their depth), which
+// sjp_cursor_find_field() and sjp_cursor_next_element() take: given the
+// handle of an array or object that contains the cursor, they first
+// skip whatever is left of the values inside it.  A handle is good
+// until its array or object is finished.
+//
+// As with sjp_lexer_more(), strings with escapes are decoded in place,
+// so the data is modified.
+
+struct sjp_cursor {
+  struct sjp_lexer lex;
+
+  size_t depth;         // arrays and objects entered and not finished
+  int pending;          // a value at this depth hasn't been read
+  int first;            // no elements of the innermost array or object
+                        // have been read
+  int eos;              // the lexer has been given the end of the stream
+  enum SJP_RESULT err;  // first error, returned from then on
+};
+
+// Starts a cursor before the value of the document in data (n bytes).
+void sjp_cursor_init(struct sjp_cursor *c, char *data, size_t n);
+
+// Returns the type of the next value (an enum SJP_EVENT: SJP_OBJECT_BEG
+// or SJP_ARRAY_BEG for an array or object) without reading it, or
+// SJP_NONE if the cursor isn't before a value or the value doesn't
+// start with a valid character.
+enum SJP_EVENT sjp_cursor_type(const struct sjp_cursor *c);
+
+// Enters the object (or array) that is the next value, and sets *h to
+// its handle.  Returns SJP_WRONG_TYPE, without reading the value, if
+// it isn't an object (or array).
+enum SJP_RESULT sjp_cursor_object(struct sjp_cursor *c, size_t *h);
+enum SJP_RESULT sjp_cursor_array(struct sjp_cursor *c, size_t *h);
+
+// Moves to the value of the next member of the object obj, skipping
+// what is left of the member before it, and sets *key to the decoded
+// text of its key (in the data) and *n to its length.
+//
+// Returns 1 if there is a member, and the cursor is before its value.
+// Returns 0 at the end of the object, and the object is finished.
+// Otherwise, returns an error.
+int sjp_cursor_next_field(struct sjp_cursor *c, size_t obj, const char **key, size_t *n);
+
+// Moves to the value of the next member of the object obj with the key
+// (n bytes).  Members are searched from the cursor onward, as with an
+// object's members read in order, so a member before the cursor isn't
+// found.  The values of the other members are skipped.
+//
+// Returns 1 if the member is found, and the cursor is before its value.
+// Returns 0 if it isn't, and the object is finished.  Otherwise,
+// returns an error.
+int sjp_cursor_find_field(struct sjp_cursor *c, size_t obj, const char *key, size_t n);
+
+// Moves to the next element of the array arr, skipping what is left of
+// the element before it.
+//
+// Returns 1 if there is an element, and the cursor is before it.
+// Returns 0 at the end of the array, and the array is finished.
+// Otherwise, returns an error.
+int sjp_cursor_next_element(struct sjp_cursor *c, size_t arr);
+
+// Reads the next value.  A number that isn't an integer that fits in an
+// int64_t returns SJP_NUMBER_RANGE.  A value of another type returns
+// SJP_WRONG_TYPE, and isn't read.
+//
+// sjp_cursor_get_null() reads a null.
+//
+// sjp_cursor_get_string() sets *s to the decoded text of the string,
+// which is in the data, and *n to its length.  It is not '\0'
+// terminated.
+enum SJP_RESULT sjp_cursor_get_int64(struct sjp_cursor *c, int64_t *v);
+enum SJP_RESULT sjp_cursor_get_double(struct sjp_cursor *c, double *v);
+enum SJP_RESULT sjp_cursor_get_bool(struct sjp_cursor *c, int *v);
+enum SJP_RESULT sjp_cursor_get_string(struct sjp_cursor *c, const char **s, size_t *n);
+enum SJP_RESULT sjp_cursor_get_null(struct sjp_cursor *c);
+
+// Skips the rest of the document, and checks that nothing but
+// whitespace follows it.  Returns SJP_OK, or the first error.
+enum SJP_RESULT sjp_cursor_close(struct sjp_cursor *c);
+
+#undef MODULE_NAME
+
+#endif /* SJP_CURSOR_H */
@@ -0,0 +1,345 @@
+#include "sjp_cursor.h"
+
+#define TEST_LOG_LEVEL 0
+#include "sjp_testing.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define MAX_DOC     1024
+
+struct walk_out {
+  char text[4096];
+  size_t n;
+};
+
+static void walk_put(struct walk_out *out, const char *prefix, const char *text, size_t n)
+{
+  if (out->n + n + 16 > sizeof out->text) {
+    return;
+  }
+
+  out->n += sprintf(&out->text[out->n], "%s%.*s ", prefix, (int)n, text);
+}
+
+// Reads the whole value at the cursor, and writes it to out
+static int walk_value(struct sjp_cursor *c, struct walk_out *out)
+{
+  const char *s;
+  size_t h, n;
+  double d;
+  int b, ret;
+
+  switch (sjp_cursor_type(c)) {
+    case SJP_OBJECT_BEG:
+      if (ret = sjp_cursor_object(c, &h), ret != SJP_OK) {
+        return ret;
+      }
+
+      walk_put(out, "{", "", 0);
+      while (ret = sjp_cursor_next_field(c, h, &s, &n), ret == 1) {
+        walk_put(out, "k:", s, n);
+        if (ret = walk_value(c, out), ret != SJP_OK) {
+          return ret;
+        }
+      }
+
+      if (ret != 0) {
+        return ret;
+      }
+      walk_put(out, "}", "", 0);
+      return SJP_OK;
+
+    case SJP_ARRAY_BEG:
+      if (ret = sjp_cursor_array(c, &h), ret != SJP_OK) {
+        return ret;
+      }
+
+      walk_put(out, "[", "", 0);
+      while (ret = sjp_cursor_next_element(c, h), ret == 1) {
+        if (ret = walk_value(c, out), ret != SJP_OK) {
+          return ret;
+        }
+      }
+
+      if (ret != 0) {
+        return ret;
+      }
+      walk_put(out, "]", "", 0);
+      return SJP_OK;
+
+    case SJP_STRING:
+      if (ret = sjp_cursor_get_string(c, &s, &n), ret == SJP_OK) {
+        walk_put(out, "s:", s, n);
+      }
+      return ret;
+
+    case SJP_NUMBER:
+      if (ret = sjp_cursor_get_double(c, &d), ret == SJP_OK) {
+        char buf[32];
+        walk_put(out, "n:", buf, sprintf(buf, "%g", d));
+      }
+      return ret;
+
+    case SJP_TRUE:
+    case SJP_FALSE:
+      if (ret = sjp_cursor_get_bool(c, &b), ret == SJP_OK) {
+        walk_put(out, b ? "true" : "false", "", 0);
+      }
+      return ret;
+
+    case SJP_NULL:
+      if (ret = sjp_cursor_get_null(c), ret == SJP_OK) {
+        walk_put(out, "null", "", 0);
+      }
+      return ret;
+
+    default:
+      // not a value: reading it reports the error
+      return sjp_cursor_get_null(c);
+  }
+}
+
+struct walk_case {
+  const char *doc;
+  int ret;
+  const char *values;
+};
+
+static void test_cursor_walk(void)
+{
+  static const struct walk_case cases[] = {
+    {
+      "{\"a\": [1, -2.5e3, \"x\\u0041y\"], \"bb\": {\"c\": null, \"d\": true}, \"e\": false}",
+      SJP_OK, "{ k:a [ n:1 n:-2500 s:xAy ] k:bb { k:c null k:d true } k:e false } ",
+    },
+
+    { "[[], {}, [[]], \"\\ud83d\\ude00\"]", SJP_OK, "[ [ ] { } [ [ ] ] s:\xf0\x9f\x98\x80 ] " },
+    { "  17  ", SJP_OK, "n:17 " },
+    { "17", SJP_OK, "n:17 " },
+    { "true", SJP_OK, "true " },
+    { "[true,null]", SJP_OK, "[ true null ] " },
+    { "123456789012345678901234567890123456789.5", SJP_OK, "n:1.23457e+38 " },
+    { "1234567890123456789012345678901", SJP_OK, "n:1.23457e+30 " },
+    { "12345678901234567890123456789012", SJP_OK, "n:1.23457e+31 " },
+    { "[1234567890123456789012345678901234567890]", SJP_OK, "[ n:1.23457e+39 ] " },
+
+    { "{\"a\" 1}", SJP_INVALID_INPUT, "{ " },
+    { "{\"a\": 1,}", SJP_INVALID_KEY, "{ k:a n:1 " },
+    { "{1: 2}", SJP_INVALID_KEY, "{ " },
+    { "[1 2]", SJP_INVALID_INPUT, "[ n:1 " },
+    { "[1,]", SJP_INVALID_INPUT, "[ n:1 " },
+    { "[1, {\"x\": ", SJP_INVALID_INPUT, "[ n:1 { k:x " },
+    { "[1, 2", SJP_UNCLOSED_ARRAY, "[ n:1 n:2 " },
+    { "[", SJP_UNCLOSED_ARRAY, "[ " },
+    { "{\"a\": 1", SJP_UNCLOSED_OBJECT, "{ k:a n:1 " },
+    { "[tru]", SJP_INVALID_INPUT, "[ " },
+    { "[\"\\x\"]", SJP_INVALID_ESCAPE, "[ " },
+    { "1 2", SJP_INVALID_INPUT, "n:1 " },
+    { "", SJP_INVALID_INPUT, "" },
+  };
+
+  size_t i;
+
+  for (i=0; i < sizeof cases / sizeof cases[0]; i++) {
+    const struct walk_case *wc = &cases[i];
+    static struct walk_out out;
+    struct sjp_cursor c;
+    char data[MAX_DOC];
+    size_t n = strlen(wc->doc);
+    int ret;
+
+    ntest++;
+
+    memcpy(data, wc->doc, n);
+    memset(&out, 0, sizeof out);
+
+    sjp_cursor_init(&c, data, n);
+    if (ret = walk_value(&c, &out), ret == SJP_OK) {
+      ret = sjp_cursor_close(&c);
+    }
+
+    if (ret != wc->ret || strcmp(out.text, wc->values) != 0) {
+      nfail++;
+      printf("FAILED: %s\n", __func__);
+      printf("  document: %s\n", wc->doc);
+      printf("  expected %d (%s) and values '%s'\n"
+          "  but found %d (%s) and values '%s'\n",
+          wc->ret, ret2name(wc->ret), wc->values, ret, ret2name(ret), out.text);
+    }
+  }
+}
+
+#define CHECK(cond) do {                                   \
+  ntest++;                                                 \
+  if (!(cond)) {                                           \
+    nfail++;                                               \
+    printf("FAILED: %s, line %d: %s\n", __func__, __LINE__, #cond); \
+  }                                                        \
+} while (0)
+
+static const char records[] =
+  "{\"skip\": {\"x\": [1, {\"y\": \"}]\"}], \"z\": \"\\\"]\"}, "
+  "\"id\": 7, \"name\": \"a\\u0041\\\"b\", "
+  "\"big\": 18446744073709551615, \"pi\": -2.5e3, "
+  "\"list\": [1, [2, 3], {\"a\": 4}, 5, \"six\"], "
+  "\"ok\": true}";
+
+// Finds members by name, and reads them
+static void test_cursor_find(void)
+{
+  struct sjp_cursor c;
+  char data[sizeof records];
+  const char *s;
+  size_t obj, arr, n;
+  int64_t v;
+  double d;
+  int b, count;
+
+  memcpy(data, records, sizeof records);
+  sjp_cursor_init(&c, data, sizeof records - 1);
+
+  CHECK(sjp_cursor_type(&c) == SJP_OBJECT_BEG);
+  CHECK(sjp_cursor_array(&c, &arr) == SJP_WRONG_TYPE);
+  CHECK(sjp_cursor_object(&c, &obj) == SJP_OK && obj == 1);
+
+  CHECK(sjp_cursor_find_field(&c, obj, "id", 2) == 1);
+  CHECK(sjp_cursor_get_string(&c, &s, &n) == SJP_WRONG_TYPE);
+  CHECK(sjp_cursor_get_int64(&c, &v) == SJP_OK && v == 7);
+  CHECK(sjp_cursor_get_int64(&c, &v) == SJP_INVALID_PARAMS);
+
+  CHECK(sjp_cursor_find_field(&c, obj, "name", 4) == 1);
+  CHECK(sjp_cursor_get_string(&c, &s, &n) == SJP_OK && n == 4 && memcmp(s, "aA\"b", 4) == 0);
+
+  // an integer that doesn't fit in an int64_t is still a double
+  CHECK(sjp_cursor_find_field(&c, obj, "big", 3) == 1);
+  CHECK(sjp_cursor_get_int64(&c, &v) == SJP_NUMBER_RANGE);
+
+  // a member that isn't read is skipped
+  CHECK(sjp_cursor_find_field(&c, obj, "list", 4) == 1);
+  CHECK(sjp_cursor_array(&c, &arr) == SJP_OK && arr == 2);
+
+  count = 0;
+  while (sjp_cursor_next_element(&c, arr) == 1) {
+    if (sjp_cursor_get_int64(&c, &v) == SJP_OK) {
+      count += (int)v;
+    }
+  }
+  CHECK(count == 6);
+  CHECK(sjp_cursor_next_element(&c, arr) == 0);
+
+  CHECK(sjp_cursor_find_field(&c, obj, "ok", 2) == 1);
+  CHECK(sjp_cursor_get_bool(&c, &b) == SJP_OK && b == 1);
+
+  // members are found in order: "pi" came before the cursor
+  CHECK(sjp_cursor_find_field(&c, obj, "pi", 2) == 0);
+  CHECK(sjp_cursor_find_field(&c, obj, "ok", 2) == 0);
+  CHECK(sjp_cursor_close(&c) == SJP_OK);
+
+  // reading "pi" skips the members before it
+  memcpy(data, records, sizeof records);
+  sjp_cursor_init(&c, data, sizeof records - 1);
+  CHECK(sjp_cursor_object(&c, &obj) == SJP_OK);
+  CHECK(sjp_cursor_find_field(&c, obj, "pi", 2) == 1);
+  CHECK(sjp_cursor_get_double(&c, &d) == SJP_OK && d == -2500.0);
+  CHECK(sjp_cursor_close(&c) == SJP_OK);
+}
+
+// Handles of containing objects and arrays skip what is left of the
+// values inside them
+static void test_cursor_unwind(void)
+{
+  static const char doc[] =
+    "[{\"a\": {\"b\": [1, 2, {\"c\": 3}], \"d\": 4}, \"e\": 5}, "
+    "{\"a\": {\"b\": [6]}, \"e\": 7}, 8]";
+  struct sjp_cursor c;
+  char data[sizeof doc];
+  size_t top, obj, a, b;
+  int64_t v, sum = 0;
+  int ret;
+
+  memcpy(data, doc, sizeof doc);
+  sjp_cursor_init(&c, data, sizeof doc - 1);
+
+  CHECK(sjp_cursor_array(&c, &top) == SJP_OK && top == 1);
+  while (ret = sjp_cursor_next_element(&c, top), ret == 1) {
+    if (sjp_cursor_object(&c, &obj) != SJP_OK) {
+      CHECK(sjp_cursor_get_int64(&c, &v) == SJP_OK && v == 8);
+      continue;
+    }
+
+    // read the first element of "b", then leave it for "e"
+    CHECK(sjp_cursor_find_field(&c, obj, "a", 1) == 1);
+    CHECK(sjp_cursor_object(&c, &a) == SJP_OK && a == 3);
+    CHECK(sjp_cursor_find_field(&c, a, "b", 1) == 1);
+    CHECK(sjp_cursor_array(&c, &b) == SJP_OK && b == 4);
+    CHECK(sjp_cursor_next_element(&c, b) == 1);
+    CHECK(sjp_cursor_get_int64(&c, &v) == SJP_OK);
+    sum += v;
+
+    CHECK(sjp_cursor_find_field(&c, obj, "e", 1) == 1);
+    CHECK(sjp_cursor_get_int64(&c, &v) == SJP_OK);
+    sum += v;
+
+    // the inner handles are finished with their object
+    CHECK(sjp_cursor_next_element(&c, b) == 0);
+  }
+
+  CHECK(ret == 0);
+  CHECK(sum == 1 + 5 + 6 + 7);
+  CHECK(sjp_cursor_close(&c) == SJP_OK);
+}
+
+// Skipped values aren't validated, but read values are, and the first
+// error is returned from then on
+static void test_cursor_errors(void)
+{
+  static const char doc[] = "{\"a\": [tru, \"\\x\", 1.2.3], \"b\": 1, \"c\": [1, 2, tru]}";
+  struct sjp_cursor c;
+  char data[sizeof doc];
+  size_t obj, arr;
+  int64_t v;
+  int b;
+
+  memcpy(data, doc, sizeof doc);
+  sjp_cursor_init(&c, data, sizeof doc - 1);
+
+  CHECK(sjp_cursor_object(&c, &obj) == SJP_OK);
+  CHECK(sjp_cursor_find_field(&c, obj, "b", 1) == 1);
+  CHECK(sjp_cursor_get_int64(&c, &v) == SJP_OK && v == 1);
+
+  CHECK(sjp_cursor_find_field(&c, obj, "c", 1) == 1);
+  CHECK(sjp_cursor_array(&c, &arr) == SJP_OK);
+  CHECK(sjp_cursor_next_element(&c, arr) == 1);
+  CHECK(sjp_cursor_next_element(&c, arr) == 1);
+  CHECK(sjp_cursor_next_element(&c, arr) == 1);
+  CHECK(sjp_cursor_get_int64(&c, &v) == SJP_WRONG_TYPE);
+  CHECK(sjp_cursor_type(&c) == SJP_TRUE);
+  CHECK(sjp_cursor_get_bool(&c, &b) == SJP_INVALID_INPUT);
+  CHECK(sjp_cursor_type(&c) == SJP_NONE);
+  CHECK(sjp_cursor_next_element(&c, arr) == SJP_INVALID_INPUT);
+  CHECK(sjp_cursor_close(&c) == SJP_INVALID_INPUT);
+
+  // skipping an unfinished value
+  memcpy(data, "{\"a\": [1, \"b\": 2", 17);
+  sjp_cursor_init(&c, data, 16);
+  CHECK(sjp_cursor_object(&c, &obj) == SJP_OK);
+  CHECK(sjp_cursor_find_field(&c, obj, "b", 1) == SJP_UNFINISHED_INPUT);
+
+  sjp_cursor_init(&c, data, 16);
+  CHECK(sjp_cursor_object(&c, &obj) == SJP_OK);
+  CHECK(sjp_cursor_find_field(&c, 0, "b", 1) == SJP_INVALID_PARAMS);
+  CHECK(sjp_cursor_next_element(&c, 0) == SJP_INVALID_PARAMS);
+}
+
+int main(void)
+{
+  test_cursor_walk();
+  test_cursor_find();
+  test_cursor_unwind();
+  test_cursor_errors();
+
+  printf("%d tests, %d failures\n", ntest,nfail);
+  return nfail == 0 ? 0 : 1;
+}
@@ -0,0 +1,396 @@
+#include "sjp_filter.h"
+
+#include <string.h>
+
+enum {
+  FILTER_NAV = 0,     // looking for the next matching value
+  FILTER_EMIT,        // returning the events of a matching value
+  FILTER_SKIP_VALUE,  // skipping a value that doesn't match
+  FILTER_SKIP_REST,   // skipping the rest of an array or object
+};
+
+static const char *seg(const struct sjp_filter *f, int i, size_t j)
+{
+  return f->paths[i] + f->segoff[i][j];
+}
+
+static int seg_end(char ch)
+{
+  return ch == '/' || ch == '\0';
+}
+
+static int seg_wild(const char *s)
+{
+  return s[0] == '*' && seg_end(s[1]);
+}
+
+// Returns the array index of a segment, or -1 if the segment isn't an
+// index: digits without leading zeros.
+static int64_t seg_index(const char *s)
+{
+  int64_t idx = 0;
+  size_t k;
+
+  if (seg_end(s[0]) || (s[0] == '0' && !seg_end(s[1]))) {
+    return -1;
+  }
+
+  for (k=0; !seg_end(s[k]); k++) {
+    if (s[k] < '0' || s[k] > '9' || idx > UINT32_MAX) {
+      return -1;
+    }
+    idx = 10*idx + (s[k] - '0');
+  }
+
+  return idx <= UINT32_MAX ? idx : -1;
+}
+
+// Compares the next n bytes of a key to a path segment, from the byte
+// of the segment at *cur.  Advances *cur if they match.
+static int seg_cmp_more(const char *path, uint16_t *cur, const char *s, size_t n)
+{
+  size_t i, k = *cur;
+
+  for (i=0; i < n; i++) {
+    char ch = path[k];
+    if (seg_end(ch)) {
+      return 0;
+    }
+
+    if (ch == '~') {
+      ch = path[k+1] == '0' ? '~' : '/';
+      k += 2;
+    } else {
+      k++;
+    }
+
+    if (ch != s[i]) {
+      return 0;
+    }
+  }
+
+  *cur = k;
+  return 1;
+}
+
+static enum SJP_RESULT parse_path(struct sjp_filter *f, int i, const char *path)
+{
+  size_t k, nseg = 0;
+
+  if (path == NULL || (path[0] != '\0' && path[0] != '/')) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  for (k=0; path[k] != '\0'; k++) {
+    if (k >= UINT16_MAX) {
+      return SJP_INVALID_PARAMS;
+    }
+
+    if (path[k] == '/') {
+      if (nseg >= SJP_FILTER_MAX_DEPTH) {
+        return SJP_INVALID_PARAMS;
+      }
+      f->segoff[i][nseg++] = k+1;
+    } else if (path[k] == '~' && path[k+1] != '0' && path[k+1] != '1') {
+      return SJP_INVALID_PARAMS;
+    }
+  }
+
+  f->nsegs[i] = nseg;
+  return SJP_OK;
+}
+
+enum SJP_RESULT sjp_filter_init(struct sjp_filter *f, struct sjp_parser *p, const char *const *paths, size_t npaths)
+{
+  enum SJP_RESULT ret;
+  size_t i;
+
+  if (p == NULL || npaths > SJP_FILTER_MAX_PATHS || (paths == NULL && npaths > 0)) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  memset(f, 0, sizeof *f);
+  f->p = p;
+  f->paths = paths;
+  f->npaths = npaths;
+  f->match = -1;
+
+  for (i=0; i < npaths; i++) {
+    if (ret = parse_path(f, i, paths[i]), ret != SJP_OK) {
+      return ret;
+    }
+  }
+
+  return SJP_OK;
+}
+
+static void filter_noevent(struct sjp_event *evt)
+{
+  memset(evt, 0, sizeof *evt);
+  evt->type = SJP_NONE;
+}
+
+// Returns the paths in m that end at the current depth
+static uint32_t full_mask(const struct sjp_filter *f, uint32_t m)
+{
+  uint32_t full = 0;
+
+  for (; m != 0; m &= m-1) {
+    int i = __builtin_ctz(m);
+    if (f->nsegs[i] == f->depth) {
+      full |= (uint32_t)1 << i;
+    }
+  }
+
+  return full;
+}
+
+// Called after a value in the innermost array or object is finished.
+// Starts to skip the rest of it if nothing later can match.
+static void after_value(struct sjp_filter *f)
+{
+  struct sjp_filter_level *lvl;
+
+  if (f->depth == 0) {
+    return;
+  }
+
+  lvl = &f->levels[f->depth-1];
+  if (lvl->wild != 0) {
+    return;
+  }
+
+  if (lvl->isobj ? lvl->pending == 0 : (int64_t)lvl->index > lvl->maxidx) {
+    f->mode = FILTER_SKIP_REST;
+  }
+}
+
+// Enters an array or object that the paths in m go through
+static void push_level(struct sjp_filter *f, uint32_t m, int isobj)
+{
+  struct sjp_filter_level *lvl = &f->levels[f->depth];
+  uint32_t bits;
+
+  lvl->match = m;
+  lvl->wild = 0;
+  lvl->index = 0;
+  lvl->maxidx = -1;
+  lvl->isobj = isobj;
+
+  for (bits = m; bits != 0; bits &= bits-1) {
+    int i = __builtin_ctz(bits);
+    const char *s = seg(f, i, f->depth);
+
+    if (seg_wild(s)) {
+      lvl->wild |= (uint32_t)1 << i;
+    } else if (!isobj) {
+      int64_t idx = seg_index(s);
+      if (idx < 0) {
+        lvl->match &= ~((uint32_t)1 << i);
+      } else if (idx > lvl->maxidx) {
+        lvl->maxidx = idx;
+      }
+    }
+  }
+  lvl->pending = lvl->match & ~lvl->wild;
+
+  f->depth++;
+  after_value(f);
+}
+
+// Paths that match the element of the innermost array at index idx
+static uint32_t elem_mask(const struct sjp_filter *f, const struct sjp_filter_level *lvl, uint32_t idx)
+{
+  uint32_t m = lvl->wild, bits;
+
+  for (bits = lvl->pending; bits != 0; bits &= bits-1) {
+    int i = __builtin_ctz(bits);
+    if (seg_index(seg(f, i, f->depth-1)) == idx) {
+      m |= (uint32_t)1 << i;
+    }
+  }
+
+  return m;
+}
+
+// Compares the next part of a key in the innermost object to the paths
+// that haven't matched a key yet.  Returns the paths that match the key
+// when it's finished.
+static void key_part(struct sjp_filter *f, struct sjp_filter_level *lvl, const char *text, size_t n, int finished)
+{
+  uint32_t bits;
+
+  if (!f->inkey) {
+    f->kmask = lvl->pending;
+    for (bits = f->kmask; bits != 0; bits &= bits-1) {
+      int i = __builtin_ctz(bits);
+      f->kcur[i] = f->segoff[i][f->depth-1];
+    }
+    f->inkey = 1;
+  }
+
+  for (bits = f->kmask; bits != 0; bits &= bits-1) {
+    int i = __builtin_ctz(bits);
+    if (!seg_cmp_more(f->paths[i], &f->kcur[i], text, n) ||
+        (finished && !seg_end(f->paths[i][f->kcur[i]]))) {
+      f->kmask &= ~((uint32_t)1 << i);
+    }
+  }
+
+  if (finished) {
+    f->vmask = f->kmask | lvl->wild;
+    lvl->pending &= ~f->kmask;
+    f->inkey = 0;
+    f->atvalue = 1;
+  }
+}
+
+// Tracks the depth of a matching value.  evt is returned to the caller.
+static void emit_event(struct sjp_filter *f, struct sjp_event *evt, enum SJP_RESULT ret)
+{
+  if (ret != SJP_OK) {
+    return;
+  }
+
+  switch (evt->type) {
+    case SJP_OBJECT_BEG:
+    case SJP_ARRAY_BEG:
+      f->edepth++;
+      break;
+
+    case SJP_OBJECT_END:
+    case SJP_ARRAY_END:
+      f->edepth--;
+      break;
+
+    default:
+      break;
+  }
+
+  if (f->edepth == 0) {
+    f->mode = FILTER_NAV;
+    after_value(f);
+  }
+}
+
+// Handles the first event of a value that the paths in m match so far.
+// Returns 1 if the event should be returned to the caller.
+static int value_event(struct sjp_filter *f, uint32_t m, struct sjp_event *evt, enum SJP_RESULT ret)
+{
+  uint32_t full = full_mask(f, m);
+
+  if (full != 0) {
+    f->match = __builtin_ctz(full);
+    f->mode = FILTER_EMIT;
+    f->edepth = 0;
+    emit_event(f, evt, ret);
+    return 1;
+  }
+
+  switch (evt->type) {
+    case SJP_OBJECT_BEG:
+    case SJP_ARRAY_BEG:
+      if (m != 0) {
+        push_level(f, m, evt->type == SJP_OBJECT_BEG);
+      } else {
+        f->mode = FILTER_SKIP_VALUE;
+      }
+      break;
+
+    default:
+      if (ret != SJP_OK) {
+        f->mode = FILTER_SKIP_VALUE;
+      } else {
+        after_value(f);
+      }
+      break;
+  }
+
+  return 0;
+}
+
+enum SJP_RESULT sjp_filter_next(struct sjp_filter *f, struct sjp_event *evt)
+{
+  struct sjp_filter_level *lvl;
+  enum SJP_RESULT ret;
+
+  for (;;) {
+    switch (f->mode) {
+      case FILTER_SKIP_VALUE:
+      case FILTER_SKIP_REST:
+        if (ret = sjp_parser_skip(f->p, NULL), ret != SJP_OK) {
+          filter_noevent(evt);
+          return ret;
+        }
+
+        if (f->mode == FILTER_SKIP_REST) {
+          f->depth--;
+        }
+        f->mode = FILTER_NAV;
+        after_value(f);
+        continue;
+
+      case FILTER_EMIT:
+        if (ret = sjp_parser_next(f->p, evt), !SJP_ERROR(ret)) {
+          emit_event(f, evt, ret);
+        }
+        return ret;
+
+      default:
+        break;
+    }
+
+    // the value after a key can be skipped or returned before reading
+    // it
+    if (f->atvalue) {
+      uint32_t full = full_mask(f, f->vmask);
+
+      if (full != 0) {
+        f->atvalue = 0;
+        f->match = __builtin_ctz(full);
+        f->mode = FILTER_EMIT;
+        f->edepth = 0;
+        continue;
+      }
+
+      if (f->vmask == 0) {
+        f->atvalue = 0;
+        f->mode = FILTER_SKIP_VALUE;
+        continue;
+      }
+    }
+
+    if (ret = sjp_parser_next(f->p, evt), SJP_ERROR(ret) || evt->type == SJP_NONE) {
+      return ret;
+    }
+
+    if (f->atvalue) {
+      f->atvalue = 0;
+      if (value_event(f, f->vmask, evt, ret)) {
+        return ret;
+      }
+    } else if (evt->type == SJP_DOC_END) {
+      // document boundaries in stream mode are always returned
+      f->match = -1;
+      return ret;
+    } else if (f->depth == 0) {
+      uint32_t all = f->npaths < 32 ? ((uint32_t)1 << f->npaths) - 1 : ~(uint32_t)0;
+      if (value_event(f, all, evt, ret)) {
+        return ret;
+      }
+    } else if (lvl = &f->levels[f->depth-1], evt->type == SJP_OBJECT_END || evt->type == SJP_ARRAY_END) {
+      f->depth--;
+      after_value(f);
+    } else if (lvl->isobj) {
+      key_part(f, lvl, evt->text, evt->n, ret == SJP_OK);
+    } else if (value_event(f, elem_mask(f, lvl, lvl->index++), evt, ret)) {
+      return ret;
+    }
+
+    // the event isn't returned
+    if (ret == SJP_MORE) {
+      filter_noevent(evt);
+      return ret;
+    }
+  }
+}
@@ -0,0 +1,112 @@
+#ifndef SJP_FILTER_H
+#define SJP_FILTER_H
+
+#include "sjp_common.h"
+#include "sjp_lexer.h"
+#include "sjp_parser.h"
+
+#include <stdint.h>
+
+#define MODULE_NAME SJP_FILTER
+
+// Path filtered parsing: fetches only the events of the values at a set
+// of paths, and skips everything else with sjp_parser_skip(), so the
+// skipped values are not decoded.
+//
+// Paths are JSON Pointers (RFC 6901), like "/user/id", with one
+// extension: a segment of "*" matches any key or array index, as in
+// "/items/*/price".  The pointer "" is the whole document.  A segment
+// of digits matches that index of an array, as well as the key with
+// those digits.
+//
+// The events of a matched value are the same as sjp_parser_next()
+// returns for it: one event for a number, string or keyword (or
+// several for a partial string or number), and for an array or object,
+// all of the events from its SJP_ARRAY_BEG or SJP_OBJECT_BEG through
+// its SJP_ARRAY_END or SJP_OBJECT_END.  The events of the arrays and
+// objects that contain it, including its key, are not returned.  Use
+// sjp_filter_path() to find which path a value matched.  In stream mode
+// (SJP_PARSER_STREAM), the SJP_DOC_END events are returned too, and
+// the paths apply to each document.
+//
+// Within an object, only the first member with a matching name is
+// matched: once all of the names that the paths ask for have been seen,
+// the rest of the object is skipped.  Likewise, the rest of an array is
+// skipped after its highest matching index, unless a path has "*" at
+// that depth.
+
+enum {
+  SJP_FILTER_MAX_PATHS = 32,
+  SJP_FILTER_MAX_DEPTH = 16,
+};
+
+// An array or object that contains a matching path
+struct sjp_filter_level {
+  uint32_t match;    // paths that go through this array or object
+  uint32_t pending;  // object: paths whose key hasn't been seen
+  uint32_t wild;     // paths with "*" at this depth
+  uint32_t index;    // array: index of the next element
+  int64_t maxidx;    // array: highest index of a path, or -1
+  int isobj;
+};
+
+struct sjp_filter {
+  struct sjp_parser *p;
+
+  const char *const *paths;
+  size_t npaths;
+
+  // segment j of path i starts at paths[i][segoff[i][j]], and ends at
+  // the next '/' or the end of the path.
+  uint8_t nsegs[SJP_FILTER_MAX_PATHS];
+  uint16_t segoff[SJP_FILTER_MAX_PATHS][SJP_FILTER_MAX_DEPTH];
+
+  struct sjp_filter_level levels[SJP_FILTER_MAX_DEPTH];
+  size_t depth;  // number of arrays and objects in levels
+
+  // compares a key to the paths as the parts of the key arrive
+  uint32_t kmask;   // paths that match the key so far
+  uint16_t kcur[SJP_FILTER_MAX_PATHS];
+  int inkey;
+
+  uint32_t vmask;   // paths that match the value after the last key
+  int atvalue;      // the next event is the value after the last key
+
+  int mode;         // what sjp_filter_next() does next
+  size_t edepth;    // depth in a matched array or object
+  int match;        // path matched by the current value
+};
+
+// Initializes a filter over the parser p, with npaths paths.  The
+// filter keeps pointers to the paths, which must remain valid while
+// the filter is used.  The filter starts at the parser's next value.
+//
+// Returns SJP_INVALID_PARAMS if npaths is more than
+// SJP_FILTER_MAX_PATHS, if a path is not a JSON Pointer, has more than
+// SJP_FILTER_MAX_DEPTH segments, or is longer than 65535 bytes.
+enum SJP_RESULT sjp_filter_init(struct sjp_filter *f, struct sjp_parser *p, const char *const *paths, size_t npaths);
+
+// Fetches the next event of a value that matches one of the paths.
+//
+// Return values and restarts are the same as sjp_parser_next(): on
+// SJP_MORE, give the parser more data (sjp_parser_more() or
+// sjp_parser_eos()) and call sjp_filter_next() again.  SJP_MORE with
+// evt->type set to SJP_NONE may be returned while skipping.
+//
+// Keys are compared after their escapes are decoded, except for keys
+// in const data (sjp_parser_more_const) when the parser has no scratch
+// buffer, which are compared as written.
+enum SJP_RESULT sjp_filter_next(struct sjp_filter *f, struct sjp_event *evt);
+
+// Returns the index of the path that the current value matched, as
+// given to sjp_filter_init().  If a value matches more than one path,
+// this is the lowest index.  Valid after sjp_filter_next() returns an
+// event, and -1 for SJP_DOC_END.
+static inline int sjp_filter_path(const struct sjp_filter *f)
+{
+  return f->match;
+}
+
+#undef MODULE_NAME
+
+#endif /* SJP_FILTER_H */
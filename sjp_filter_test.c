@@ -0,0 +1,305 @@
+#include "sjp_filter.h"
+
+#define TEST_LOG_LEVEL 0
+#include "sjp_testing.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define DEFAULT_STACK 16
+#define MAX_DOC     1024
+
+// Filters doc, fed to the parser in chunks of the given size, and
+// writes the matching events to out as "path:text" separated by spaces,
+// with partial events joined.  An error is written as its name.  opts
+// are the parser options.
+static void filter_doc(const char *doc, const char *const *paths, size_t npaths, size_t chunk, size_t nbuf,
+    unsigned opts, char *out, size_t nout)
+{
+  char stack[DEFAULT_STACK];
+  char data[MAX_DOC];
+  char buf[64];
+  struct sjp_parser p;
+  struct sjp_filter f;
+  size_t n, off, k;
+  int eos, start;
+
+  n = strlen(doc);
+  memcpy(data, doc, n);
+
+  if (sjp_parser_init(&p, stack, sizeof stack, nbuf > 0 ? buf : NULL, nbuf) != SJP_OK ||
+      sjp_filter_init(&f, &p, paths, npaths) != SJP_OK) {
+    snprintf(out, nout, "init failed");
+    return;
+  }
+  sjp_parser_set_options(&p, opts);
+
+  off = (chunk < n) ? chunk : n;
+  sjp_parser_more(&p, data, off);
+
+  eos = 0;
+  k = 0;
+  start = 1;
+  out[0] = '\0';
+  for (;;) {
+    struct sjp_event evt = {0};
+    enum SJP_RESULT ret;
+
+    // outside of stream mode, the parser doesn't expect the end of the
+    // stream after the document
+    if (eos && !(opts & SJP_PARSER_STREAM) && p.lex.state == SJP_LST_VALUE &&
+        sjp_parser_state(&p) == SJP_PARSER_VALUE && !p.skipping) {
+      if (ret = sjp_parser_close(&p), ret != SJP_OK) {
+        k += snprintf(&out[k], nout-k, "%s", ret2name(ret));
+      }
+      break;
+    }
+
+    ret = sjp_filter_next(&f, &evt);
+    if (SJP_ERROR(ret)) {
+      k += snprintf(&out[k], nout-k, "%s", ret2name(ret));
+      break;
+    }
+
+    if (ret == SJP_OK && evt.type == SJP_NONE) {
+      sjp_parser_close(&p);
+      break;
+    }
+
+    if (evt.type != SJP_NONE && start) {
+      k += snprintf(&out[k], nout-k, "%d:", sjp_filter_path(&f));
+      start = 0;
+    }
+
+    if (evt.n > 0) {
+      if (k + evt.n >= nout) {
+        snprintf(out, nout, "output overflow");
+        return;
+      }
+      memcpy(&out[k], evt.text, evt.n);
+      k += evt.n;
+      out[k] = '\0';
+    }
+
+    if (ret == SJP_OK) {
+      k += snprintf(&out[k], nout-k, " ");
+      start = 1;
+      continue;
+    }
+
+    if (ret == SJP_MORE) {
+      if (off < n) {
+        size_t m = (n - off < chunk) ? n - off : chunk;
+        sjp_parser_more(&p, &data[off], m);
+        off += m;
+      } else if (!eos) {
+        sjp_parser_eos(&p);
+        eos = 1;
+      }
+    }
+  }
+}
+
+struct filter_case {
+  const char *doc;
+  const char *paths[4];
+  const char *expected;
+  unsigned opts;
+};
+
+static void run_filter_case(const char *name, const struct filter_case *c)
+{
+  static const size_t bufs[] = { 0, 40 };
+  char out[4*MAX_DOC];
+  size_t npaths, chunk, b, n;
+
+  for (npaths=0; npaths < 4 && c->paths[npaths] != NULL; npaths++) {
+    continue;
+  }
+
+  n = strlen(c->doc);
+  for (b=0; b < sizeof bufs / sizeof bufs[0]; b++) {
+    for (chunk = 1; chunk <= n; chunk++) {
+      ntest++;
+
+      filter_doc(c->doc, c->paths, npaths, chunk, bufs[b], c->opts, out, sizeof out);
+      if (strcmp(out, c->expected) != 0) {
+        nfail++;
+        printf("FAILED: %s\n", name);
+        printf("  document: %s\n", c->doc);
+        printf("  chunk %zu, nbuf %zu\n", chunk, bufs[b]);
+        printf("  expected '%s'\n", c->expected);
+        printf("  found    '%s'\n", out);
+        return;
+      }
+    }
+  }
+}
+
+static void test_filter_paths(void)
+{
+  static const struct filter_case cases[] = {
+    // fields of a request body
+    {
+      "{\"user\":{\"name\":\"ann\",\"id\":7},\"items\":[{\"price\":1.5,\"qty\":2},"
+      "{\"qty\":1,\"price\":20}],\"note\":\"x\"}",
+      { "/user/id", "/items/*/price" },
+      "0:7 1:1.5 1:20 ",
+    },
+
+    // all of the events of a matching array or object, but not of the
+    // ones around it
+    {
+      "{\"a\":[1,{\"b\":[true,null]}],\"c\":{\"d\":\"e\"}}",
+      { "/a/1", "/c" },
+      "0:{ 0:b 0:[ 0:true 0:null 0:] 0:} 1:{ 1:d 1:e 1:} ",
+    },
+
+    // the whole document
+    {
+      "[1,\"two\"]",
+      { "" },
+      "0:[ 0:1 0:two 0:] ",
+    },
+
+    // array indexes, and digits as keys
+    {
+      "[[10,11,12],{\"1\":\"one\",\"01\":\"x\"},[20,21]]",
+      { "/0/2", "/1/1", "/2/1", "/*/01" },
+      "0:12 1:one 3:x 2:21 ",
+    },
+
+    // escaped keys and escaped pointers
+    {
+      "{\"a/b\":1,\"m~n\":2,\"\\u0071\\\"\":3,\"a\":{\"b\":4}}",
+      { "/a~1b", "/m~0n", "/q\"" },
+      "0:1 1:2 2:3 ",
+    },
+
+    // partial keys that diverge late
+    {
+      "{\"abcdefghijklmno\":1,\"abcdefghijklmnop\":2,\"abcdefghijklmnoq\":3}",
+      { "/abcdefghijklmnoq" },
+      "0:3 ",
+    },
+
+    // only the first member with a name matches
+    {
+      "{\"k\":1,\"k\":2}",
+      { "/k" },
+      "0:1 ",
+    },
+
+    // the rest of an object is skipped after its last matching member,
+    // and the rest of an array after its last matching index
+    {
+      "[{\"k\":1,\"x\":{\"y\" 2}, 5:3},[4,5,6 7]]",
+      { "/0/k", "/1/1" },
+      "0:1 1:5 ",
+    },
+
+    // paths that go through scalars, or through the wrong kind of
+    // container, match nothing
+    {
+      "{\"a\":5,\"b\":[1,2],\"c\":{\"0\":3}}",
+      { "/a/x", "/b/x", "/c/0", "/c/0/y" },
+      "2:3 ",
+    },
+
+    // skipped values are not decoded, so they aren't validated
+    {
+      "{\"junk\":[\"\\q\",01,tru],\"id\":\"\\u00e9\"}",
+      { "/id" },
+      "0:\xc3\xa9 ",
+    },
+
+    // nothing matches
+    {
+      "{\"a\":[1,2,{\"b\":\"c\"}],\"d\":\"long string value\"}",
+      { "/z" },
+      "",
+    },
+
+    // long matching strings
+    {
+      "[\"a string that is longer than the value buffer\",\"b\"]",
+      { "/0" },
+      "0:a string that is longer than the value buffer ",
+    },
+
+    // errors outside of skipped values are still errors
+    {
+      "{\"a\":1,\"b\" 2}",
+      { "/b" },
+      "INVALID_INPUT",
+    },
+
+    {
+      "{\"a\":[1,2",
+      { "/z" },
+      "UNFINISHED_INPUT",
+    },
+
+    // the paths apply to each document of a stream
+    {
+      "{\"id\":1,\"x\":[1]}\n{\"x\":{\"id\":2},\"id\":3}\n4\n{}",
+      { "/id" },
+      "0:1 -1: 0:3 -1: -1: -1: ",
+      SJP_PARSER_STREAM,
+    },
+  };
+  size_t i;
+
+  for (i=0; i < sizeof cases / sizeof cases[0]; i++) {
+    run_filter_case(__func__, &cases[i]);
+  }
+}
+
+static void test_filter_init(void)
+{
+  static const char *const bad[] = {
+    "a/b", "/a~2", "/a~", "/1/2/3/4/5/6/7/8/9/10/11/12/13/14/15/16/17",
+  };
+  static const char *const many[SJP_FILTER_MAX_PATHS+1] = { "" };
+  const char *const good[] = { "/1/2/3/4/5/6/7/8/9/10/11/12/13/14/15/16", "/~0~1", "" };
+  char stack[DEFAULT_STACK];
+  struct sjp_parser p;
+  struct sjp_filter f;
+  size_t i;
+  int ret;
+
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+
+  for (i=0; i < sizeof bad / sizeof bad[0]; i++) {
+    ntest++;
+    if (ret = sjp_filter_init(&f, &p, &bad[i], 1), ret != SJP_INVALID_PARAMS) {
+      nfail++;
+      printf("FAILED: %s\n", __func__);
+      printf("  path '%s' returned %d (%s)\n", bad[i], ret, ret2name(ret));
+    }
+  }
+
+  ntest++;
+  if (ret = sjp_filter_init(&f, &p, many, SJP_FILTER_MAX_PATHS+1), ret != SJP_INVALID_PARAMS) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  too many paths returned %d (%s)\n", ret, ret2name(ret));
+  }
+
+  ntest++;
+  if (ret = sjp_filter_init(&f, &p, good, sizeof good / sizeof good[0]), ret != SJP_OK) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  valid paths returned %d (%s)\n", ret, ret2name(ret));
+  }
+}
+
+int main(void)
+{
+  test_filter_init();
+  test_filter_paths();
+
+  printf("%d tests, %d failures\n", ntest,nfail);
+  return nfail == 0 ? 0 : 1;
+}
@@ -0,0 +1,849 @@
+#include "sjp_index.h"
+
+#include <pthread.h>
+#include <string.h>
+
+// Vector kernels
+//
+// Classification has scalar, SSE2 and AVX2 versions, and the prefix XOR
+// has a shift version and a carry-less multiply (PCLMUL) version.  As in
+// the lexer, with gcc or clang on x86 every version is built with a
+// target attribute, and sjp_index_build() picks one at run time: the
+// lexer's level (see sjp_lexer_simd_level()) for classification, and
+// PCLMUL if the CPU has it.  Elsewhere, only the versions the compiler
+// flags allow are built.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(SJP_NO_DISPATCH)
+#  include <immintrin.h>
+#  define IDX_DISPATCH 1
+#  define IDX_SSE2     1
+#  define IDX_AVX2     1
+#  if defined(__x86_64__)
+#    define IDX_CLMUL  1
+#  endif
+#  define IDX_TARGET(t) __attribute__((target(t)))
+#else
+#  if defined(__AVX2__)
+#    define IDX_AVX2   1
+#  endif
+#  if defined(__SSE2__)
+#    define IDX_SSE2   1
+#  endif
+#  if defined(__PCLMUL__) && defined(__x86_64__)
+#    define IDX_CLMUL  1
+#  endif
+#  if defined(IDX_AVX2)
+#    include <immintrin.h>
+#  elif defined(IDX_SSE2)
+#    include <emmintrin.h>
+#  endif
+#  if defined(IDX_CLMUL)
+#    include <wmmintrin.h>
+#  endif
+#  define IDX_TARGET(t)
+#endif
+
+enum { IDX_BLOCK = 64 };
+
+// bitmasks of the interesting characters in a 64 byte block
+struct idx_block {
+  uint64_t quote;
+  uint64_t bslash;
+  uint64_t ws;
+  uint64_t op;
+};
+
+// carries between blocks
+struct idx_carry {
+  uint64_t odd_bslash;  // 1 if the last block ended in an odd run of '\'
+  uint64_t in_str;      // all ones if the last block ended in a string
+  uint64_t scalar;      // 1 if the last block ended in a scalar
+};
+
+static inline void classify_scalar(const char *b, struct idx_block *m)
+{
+  int i;
+
+  memset(m, 0, sizeof *m);
+  for (i=0; i < IDX_BLOCK; i++) {
+    uint64_t bit = (uint64_t)1 << i;
+    switch (b[i]) {
+      case '"':  m->quote  |= bit; break;
+      case '\\': m->bslash |= bit; break;
+
+      case ' ': case '\t': case '\n': case '\r':
+        m->ws |= bit;
+        break;
+
+      case '{': case '}': case '[': case ']': case ':': case ',':
+        m->op |= bit;
+        break;
+    }
+  }
+}
+
+#if defined(IDX_SSE2)
+IDX_TARGET("sse2")
+static inline void classify_sse2(const char *b, struct idx_block *m)
+{
+  int i;
+
+  memset(m, 0, sizeof *m);
+  for (i=0; i < IDX_BLOCK; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&b[i]);
+    __m128i lc = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i ws = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+          _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+          _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+    // '[' | 0x20 == '{' and ']' | 0x20 == '}'
+    __m128i op = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(lc, _mm_set1_epi8('{')),
+          _mm_cmpeq_epi8(lc, _mm_set1_epi8('}'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+          _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+
+    m->quote  |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << i;
+    m->bslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << i;
+    m->ws     |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << i;
+    m->op     |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << i;
+  }
+}
+#endif /* IDX_SSE2 */
+
+#if defined(IDX_AVX2)
+IDX_TARGET("avx2")
+static inline void classify_avx2(const char *b, struct idx_block *m)
+{
+  int i;
+
+  memset(m, 0, sizeof *m);
+  for (i=0; i < IDX_BLOCK; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)&b[i]);
+    __m256i lc = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i ws = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+          _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+          _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+    // '[' | 0x20 == '{' and ']' | 0x20 == '}'
+    __m256i op = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(lc, _mm256_set1_epi8('{')),
+          _mm256_cmpeq_epi8(lc, _mm256_set1_epi8('}'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')),
+          _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))));
+
+    m->quote  |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << i;
+    m->bslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))) << i;
+    m->ws     |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << i;
+    m->op     |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << i;
+  }
+}
+#endif /* IDX_AVX2 */
+
+// Returns the mask of characters that are escaped: the characters
+// after each odd length run of backslashes.
+//
+// Runs that start on an even bit have an odd length if they end on an
+// odd bit, and vice versa.  Adding the start of each run to the run
+// carries through to the bit after the run.
+static inline uint64_t find_escaped(uint64_t bs, struct idx_carry *c)
+{
+  const uint64_t even = 0x5555555555555555ULL;
+  const uint64_t odd  = ~even;
+  uint64_t starts, even_start_mask, even_starts, odd_starts;
+  uint64_t even_carries, odd_carries;
+  uint64_t ends_odd;
+
+  starts = bs & ~(bs << 1);
+
+  // flip the lowest bit if the last block ended in an odd run
+  even_start_mask = even ^ c->odd_bslash;
+  even_starts = starts & even_start_mask;
+  odd_starts = starts & ~even_start_mask;
+
+  even_carries = bs + even_starts;
+  odd_carries = bs + odd_starts;
+
+  // the odd carries overflow if this block ends in an odd run
+  ends_odd = odd_carries < bs;
+
+  odd_carries |= c->odd_bslash;
+  c->odd_bslash = ends_odd;
+
+  return ((even_carries & ~bs) & odd) | ((odd_carries & ~bs) & even);
+}
+
+// Returns the mask with each bit set to the XOR of itself and all of
+// the bits below it.  For quotes, this is the mask of characters inside
+// of strings, including the opening quote but not the closing quote.
+static inline uint64_t prefix_xor_shift(uint64_t x)
+{
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+#if defined(IDX_CLMUL)
+IDX_TARGET("sse2,pclmul")
+static inline uint64_t prefix_xor_clmul(uint64_t x)
+{
+  // carry-less multiply by all ones
+  __m128i r = _mm_clmulepi64_si128(_mm_set_epi64x(0, (long long)x), _mm_set1_epi8((char)0xff), 0);
+  return (uint64_t)_mm_cvtsi128_si64(r);
+}
+#endif /* IDX_CLMUL */
+
+// Records the offsets of a classified block, given the prefix XOR of
+// its quotes (px) and its quotes (quote)
+static inline size_t index_bits(const struct idx_block *m, uint64_t quote, uint64_t px,
+    uint32_t base, struct idx_carry *c, uint32_t *pos)
+{
+  uint64_t in_str, outside, scalar, starts, bits;
+  size_t n = 0;
+
+  in_str = px ^ c->in_str;
+  c->in_str = (uint64_t)((int64_t)in_str >> 63);
+
+  // closing quotes aren't in in_str
+  outside = ~in_str & ~quote;
+
+  scalar = outside & ~m->op & ~m->ws;
+  starts = scalar & ~((scalar << 1) | c->scalar);
+  c->scalar = scalar >> 63;
+
+  bits = (m->op & outside) | (quote & in_str) | starts;
+  while (bits != 0) {
+    pos[n++] = base + __builtin_ctzll(bits);
+    bits &= bits - 1;
+  }
+
+  return n;
+}
+
+// Indexes data[beg..end), which is whole blocks except perhaps at the
+// end, with one classifier and one prefix XOR.  Returns the number of
+// offsets written to pos.
+typedef size_t (*idx_scan_fn)(const char *data, size_t beg, size_t end, struct idx_carry *c, uint32_t *pos);
+
+#define IDX_SCAN(name, target, classify, prefix_xor)                          \
+  target                                                                      \
+  static size_t name(const char *data, size_t beg, size_t end,                \
+      struct idx_carry *c, uint32_t *pos)                                     \
+  {                                                                           \
+    struct idx_block m;                                                       \
+    size_t off, npos = 0;                                                     \
+    uint64_t quote;                                                           \
+                                                                              \
+    for (off = beg; end - off >= IDX_BLOCK; off += IDX_BLOCK) {               \
+      classify(&data[off], &m);                                               \
+      quote = m.quote & ~find_escaped(m.bslash, c);                           \
+      npos += index_bits(&m, quote, prefix_xor(quote), off, c, &pos[npos]);   \
+    }                                                                         \
+                                                                              \
+    if (off < end) {                                                          \
+      /* pad the last block with whitespace */                               \
+      char tail[IDX_BLOCK];                                                   \
+      memset(tail, ' ', sizeof tail);                                         \
+      memcpy(tail, &data[off], end - off);                                    \
+      classify(tail, &m);                                                     \
+      quote = m.quote & ~find_escaped(m.bslash, c);                           \
+      npos += index_bits(&m, quote, prefix_xor(quote), off, c, &pos[npos]);   \
+    }                                                                         \
+                                                                              \
+    return npos;                                                              \
+  }
+
+IDX_SCAN(scan_scalar, , classify_scalar, prefix_xor_shift)
+
+#if defined(IDX_SSE2)
+IDX_SCAN(scan_sse2, IDX_TARGET("sse2"), classify_sse2, prefix_xor_shift)
+#endif
+#if defined(IDX_AVX2)
+IDX_SCAN(scan_avx2, IDX_TARGET("avx2"), classify_avx2, prefix_xor_shift)
+#endif
+#if defined(IDX_SSE2) && defined(IDX_CLMUL)
+IDX_SCAN(scan_sse2_clmul, IDX_TARGET("sse2,pclmul"), classify_sse2, prefix_xor_clmul)
+#endif
+#if defined(IDX_AVX2) && defined(IDX_CLMUL)
+IDX_SCAN(scan_avx2_clmul, IDX_TARGET("avx2,pclmul"), classify_avx2, prefix_xor_clmul)
+#endif
+
+// Returns the best scanner for the lexer's level and the CPU
+static idx_scan_fn idx_scan_select(void)
+{
+  enum SJP_SIMD level = sjp_lexer_simd_level();
+  int clmul = 0;
+
+#if defined(IDX_CLMUL)
+#  if defined(IDX_DISPATCH)
+  __builtin_cpu_init();
+  clmul = __builtin_cpu_supports("pclmul") != 0;
+#  else
+  clmul = 1;
+#  endif
+#endif
+  (void)clmul;
+
+#if defined(IDX_AVX2)
+  if (level >= SJP_SIMD_AVX2) {
+#  if defined(IDX_CLMUL)
+    if (clmul) {
+      return scan_avx2_clmul;
+    }
+#  endif
+    return scan_avx2;
+  }
+#endif
+
+#if defined(IDX_SSE2)
+  if (level >= SJP_SIMD_SSE2) {
+#  if defined(IDX_CLMUL)
+    if (clmul) {
+      return scan_sse2_clmul;
+    }
+#  endif
+    return scan_sse2;
+  }
+#endif
+
+  (void)level;
+  return scan_scalar;
+}
+
+enum SJP_RESULT sjp_index_init(struct sjp_index *ix, char *stack, size_t nstack, uint32_t *pos, size_t npos)
+{
+  enum SJP_RESULT ret;
+
+  if (pos == NULL && npos > 0) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  if (ret = sjp_parser_init(&ix->p, stack, nstack, NULL, 0), ret != SJP_OK) {
+    return ret;
+  }
+
+  ix->data = NULL;
+  ix->n = 0;
+
+  ix->pos = pos;
+  ix->npos = 0;
+  ix->cap = npos;
+
+  ix->cur = 0;
+  ix->off = 0;
+  ix->nredo = 0;
+
+  ix->tok = NULL;
+  ix->ntok = 0;
+  ix->tokcap = 0;
+  ix->tcur = 0;
+
+  return SJP_OK;
+}
+
+enum SJP_RESULT sjp_index_set_tokens(struct sjp_index *ix, struct sjp_index_token *tok, size_t ntok)
+{
+  if (tok == NULL && ntok > 0) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  ix->tok = tok;
+  ix->ntok = 0;
+  ix->tokcap = ntok;
+  ix->tcur = 0;
+
+  return SJP_OK;
+}
+
+enum SJP_RESULT sjp_index_build(struct sjp_index *ix, char *data, size_t n)
+{
+  struct idx_carry c = { 0 };
+  size_t npos;
+
+  if (n > ix->cap || n > UINT32_MAX || (data == NULL && n > 0)) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  npos = idx_scan_select()(data, 0, n, &c, ix->pos);
+
+  ix->data = data;
+  ix->n = n;
+  ix->npos = npos;
+  ix->cur = 0;
+  ix->off = 0;
+  ix->nredo = 0;
+  ix->ntok = 0;
+  ix->tcur = 0;
+
+  sjp_parser_reset(&ix->p);
+
+  return SJP_OK;
+}
+
+
+static int is_ws(int ch)
+{
+  return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+
+static int is_op(int ch)
+{
+  return ch == '[' || ch == ']' || ch == '{' || ch == '}' || ch == ':' || ch == ',';
+}
+
+// A chunk of the document for sjp_index_build_parallel().  Its offsets
+// are written to pos starting at pos[beg], which has room for them.
+struct idx_chunk {
+  const struct sjp_index *ix;
+  idx_scan_fn scan;
+  size_t beg;
+  size_t end;
+
+  struct idx_carry cin;   // carry into the chunk, guessed or known
+  struct idx_carry cout;  // carry out of the chunk, given cin
+  size_t npos;
+
+  // offsets in ix->pos once they're stitched together, and the
+  // chunk's share of ix->tok
+  size_t pbeg;
+  size_t tbeg;
+  size_t tcap;
+  size_t ntok;
+
+  pthread_t tid;
+  int started;
+};
+
+// Returns 1 if the byte at off is escaped: it follows an odd run of
+// backslashes.  This is exact, whether or not off is in a string.
+static int idx_escaped(const char *data, size_t off)
+{
+  size_t k = off;
+
+  while (k > 0 && data[k-1] == '\\') {
+    k--;
+  }
+
+  return (off - k) % 2;
+}
+
+// The carry into a block at off, given whether the byte before it is
+// in a string.  Only in_str has to be known: the others follow from it
+// and the bytes before off.
+static struct idx_carry idx_carry_at(const char *data, size_t off, int in_str)
+{
+  struct idx_carry c = { 0 };
+  char ch;
+
+  if (off == 0) {
+    return c;
+  }
+
+  ch = data[off-1];
+
+  c.odd_bslash = idx_escaped(data, off);
+  c.in_str = in_str ? ~(uint64_t)0 : 0;
+  c.scalar = !in_str && !is_ws(ch) && !is_op(ch) &&
+    !(ch == '"' && !idx_escaped(data, off-1));
+
+  return c;
+}
+
+enum { IDX_GUESS_WINDOW = 1024 };
+
+// Guesses whether the byte before off is in a string, from the nearest
+// quote before it.  A quote followed by a colon, comma or closing
+// bracket probably closes a string; a quote after an opening bracket,
+// comma or colon probably opens one.  Wrong guesses are found and fixed
+// after the chunks are indexed, so this only has to be right most of
+// the time.
+static int idx_guess_in_str(const char *data, size_t n, size_t off)
+{
+  size_t lim = (off > IDX_GUESS_WINDOW) ? off - IDX_GUESS_WINDOW : 0;
+  size_t q, k;
+  int closes, opens;
+
+  for (q = off; q > lim; q--) {
+    if (data[q-1] == '"' && !idx_escaped(data, q-1)) {
+      break;
+    }
+  }
+
+  if (q == lim) {
+    return 0;
+  }
+  q--;
+
+  for (k = q+1; k < n && is_ws(data[k]); k++) {
+    continue;
+  }
+  closes = k < n && (data[k] == ':' || data[k] == ',' || data[k] == ']' || data[k] == '}');
+
+  for (k = q; k > 0 && is_ws(data[k-1]); k--) {
+    continue;
+  }
+  opens = k > 0 && (data[k-1] == '[' || data[k-1] == '{' || data[k-1] == ',' || data[k-1] == ':');
+
+  return opens && !closes;
+}
+
+// Indexes a chunk, starting from its carry in
+static void *idx_chunk_run(void *arg)
+{
+  struct idx_chunk *ck = arg;
+  const struct sjp_index *ix = ck->ix;
+  const char *data = ix->data;
+  struct idx_carry c = ck->cin;
+
+  // only the last chunk can end with a partial block
+  ck->npos = ck->scan(data, ck->beg, ck->end, &c, &ix->pos[ck->beg]);
+  ck->cout = c;
+
+  return NULL;
+}
+
+// Lexes the token at data[q], which isn't an operator, with l as the
+// streaming parser would, and sets *end to the offset after it.
+static enum SJP_RESULT idx_lex(struct sjp_lexer *l, char *data, size_t n, size_t q,
+    struct sjp_token *tok, size_t *end)
+{
+  enum SJP_RESULT ret;
+
+  sjp_lexer_more(l, &data[q], n - q);
+  ret = sjp_lexer_token(l, tok);
+  *end = q + l->off;
+
+  if (SJP_ERROR(ret)) {
+    tok->type = SJP_TOK_NONE;
+    return ret;
+  }
+
+  if (ret == SJP_MORE) {
+    // The token runs to the end of the document, so finish it as if
+    // at the end of the stream.  Numbers are returned from the lexer's
+    // restart buffer, so keep the text from the document.
+    struct sjp_token rest = { 0 };
+
+    sjp_lexer_eos(l);
+    ret = sjp_lexer_token(l, &rest);
+    if (SJP_ERROR(ret)) {
+      // leave the partial token for sjp_index_next
+      return ret;
+    }
+
+    rest.value = tok->value;
+    rest.n = tok->n;
+    *tok = rest;
+  }
+
+  return ret;
+}
+
+// Lexes the strings, numbers and keywords that start in a chunk, in the
+// order that stage 2 reads them, into the chunk's share of ix->tok.
+//
+// Tokens don't run past the next offset, and lexing a token only reads
+// and writes the data from there, so a token lexes the same on any
+// thread.  The one exception is that the lexer reads up to a block
+// past the end of a token.  The chunk before this one may lex a token
+// that ends at this chunk's first offset, so the tokens in the block
+// after that are left for stage 2, which doesn't run until the threads
+// are done.
+static void *idx_chunk_lex(void *arg)
+{
+  struct idx_chunk *ck = arg;
+  const struct sjp_index *ix = ck->ix;
+  struct sjp_index_token *t = &ix->tok[ck->tbeg];
+  size_t cur = ck->pbeg, lim = ck->pbeg + ck->npos;
+  size_t off, q, from, end;
+  struct sjp_lexer l;
+  enum SJP_RESULT ret;
+
+  ck->ntok = 0;
+  if (cur == lim) {
+    return NULL;
+  }
+
+  sjp_lexer_init(&l);
+  l.opts = ix->p.lex.opts;
+
+  off = ix->pos[cur];
+  from = (ck->beg > 0) ? off + IDX_BLOCK : 0;
+
+  // as index_token() does
+  while (ck->ntok < ck->tcap) {
+    while (cur < lim && ix->pos[cur] < off) {
+      cur++;
+    }
+
+    if (off < ix->n && (cur == lim || ix->pos[cur] > off) && !is_ws(ix->data[off])) {
+      q = off;
+    } else if (cur < lim) {
+      q = ix->pos[cur++];
+    } else {
+      break;
+    }
+
+    if (q >= ck->end) {
+      break;
+    }
+
+    if (is_op(ix->data[q])) {
+      off = q+1;
+      continue;
+    }
+
+    if (q < from) {
+      // skip to the next offset
+      off = (cur < lim) ? ix->pos[cur] : ck->end;
+      continue;
+    }
+
+    ret = idx_lex(&l, ix->data, ix->n, q, &t[ck->ntok].tok, &end);
+
+    // a keyword at the end of the document is returned from the
+    // lexer's restart buffer, which is gone with the thread
+    if (t[ck->ntok].tok.value != NULL &&
+        (t[ck->ntok].tok.value < ix->data || t[ck->ntok].tok.value > &ix->data[ix->n])) {
+      break;
+    }
+
+    t[ck->ntok].beg = q;
+    t[ck->ntok].end = end;
+    t[ck->ntok].ret = ret;
+    ck->ntok++;
+
+    if (SJP_ERROR(ret)) {
+      break;
+    }
+    off = end;
+  }
+
+  return NULL;
+}
+
+// Runs fn on the chunks in redo[], on their own threads, and on the
+// first on the caller's.  If a thread can't be created, its chunk runs
+// on the caller's thread.
+static void idx_run_chunks(struct idx_chunk **redo, size_t nredo, void *(*fn)(void *))
+{
+  size_t i;
+
+  for (i=1; i < nredo; i++) {
+    redo[i]->started = (pthread_create(&redo[i]->tid, NULL, fn, redo[i]) == 0);
+  }
+
+  if (nredo > 0) {
+    fn(redo[0]);
+  }
+
+  for (i=1; i < nredo; i++) {
+    if (redo[i]->started) {
+      pthread_join(redo[i]->tid, NULL);
+    } else {
+      fn(redo[i]);
+    }
+  }
+}
+
+enum SJP_RESULT sjp_index_build_parallel(struct sjp_index *ix, char *data, size_t n, int nthreads)
+{
+  struct idx_chunk chunks[SJP_INDEX_MAX_THREADS];
+  struct idx_chunk *redo[SJP_INDEX_MAX_THREADS];
+  idx_scan_fn scan;
+  size_t size, nchunks, nredo, npos, i;
+  int in_str;
+
+  if (n > ix->cap || n > UINT32_MAX || (data == NULL && n > 0) ||
+      nthreads < 1 || nthreads > SJP_INDEX_MAX_THREADS) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  // chunks are whole blocks, except for the last
+  size = (n / nthreads + IDX_BLOCK - 1) & ~(size_t)(IDX_BLOCK - 1);
+  if (size == 0) {
+    size = IDX_BLOCK;
+  }
+
+  nchunks = (n + size - 1) / size;
+  if (nchunks <= 1) {
+    return sjp_index_build(ix, data, n);
+  }
+
+  ix->data = data;
+  ix->n = n;
+  scan = idx_scan_select();
+
+  // speculate: each chunk guesses whether it starts in a string
+  for (i=0; i < nchunks; i++) {
+    struct idx_chunk *ck = &chunks[i];
+
+    ck->ix = ix;
+    ck->scan = scan;
+    ck->beg = i * size;
+    ck->end = (i+1 < nchunks) ? (i+1) * size : n;
+    ck->cin = idx_carry_at(data, ck->beg, (i > 0) ? idx_guess_in_str(data, n, ck->beg) : 0);
+    redo[i] = ck;
+  }
+
+  idx_run_chunks(redo, nchunks, idx_chunk_run);
+
+  // Fix up: the carry out of each chunk gives whether the next starts
+  // in a string.  A chunk that guessed wrong has every bit of in_str
+  // flipped, including the one it carries out, but finds the same
+  // quotes, so the true carries are known without running it again.
+  nredo = 0;
+  in_str = 0;
+  for (i=0; i < nchunks; i++) {
+    struct idx_chunk *ck = &chunks[i];
+    int guess = (ck->cin.in_str != 0);
+
+    if (guess != in_str) {
+      ck->cin = idx_carry_at(data, ck->beg, in_str);
+      redo[nredo++] = ck;
+    }
+
+    in_str = (ck->cout.in_str != 0) ^ (guess != in_str);
+  }
+
+  idx_run_chunks(redo, nredo, idx_chunk_run);
+  ix->nredo = nredo;
+
+  // stitch the offsets of the chunks together
+  npos = 0;
+  for (i=0; i < nchunks; i++) {
+    if (npos != chunks[i].beg) {
+      memmove(&ix->pos[npos], &ix->pos[chunks[i].beg], chunks[i].npos * sizeof ix->pos[0]);
+    }
+    chunks[i].pbeg = npos;
+    npos += chunks[i].npos;
+  }
+
+  ix->npos = npos;
+  ix->cur = 0;
+  ix->off = 0;
+  ix->ntok = 0;
+  ix->tcur = 0;
+
+  if (ix->tokcap > 0 && npos > 0) {
+    // lex the tokens of each chunk, with a share of ix->tok by its
+    // offsets, and stitch them together
+    for (i=0; i < nchunks; i++) {
+      redo[i] = &chunks[i];
+      chunks[i].tbeg = (size_t)((double)ix->tokcap * chunks[i].pbeg / npos);
+      if (i > 0) {
+        chunks[i-1].tcap = chunks[i].tbeg - chunks[i-1].tbeg;
+      }
+    }
+    chunks[nchunks-1].tcap = ix->tokcap - chunks[nchunks-1].tbeg;
+
+    idx_run_chunks(redo, nchunks, idx_chunk_lex);
+
+    for (i=0; i < nchunks; i++) {
+      if (ix->ntok != chunks[i].tbeg) {
+        memmove(&ix->tok[ix->ntok], &ix->tok[chunks[i].tbeg], chunks[i].ntok * sizeof ix->tok[0]);
+      }
+      ix->ntok += chunks[i].ntok;
+    }
+  }
+
+  sjp_parser_reset(&ix->p);
+
+  return SJP_OK;
+}
+
+static enum SJP_RESULT index_token(struct sjp_index *ix, struct sjp_token *tok)
+{
+  size_t q;
+
+  // skip any offsets covered by the last token
+  while (ix->cur < ix->npos && ix->pos[ix->cur] < ix->off) {
+    ix->cur++;
+  }
+
+  if (ix->off < ix->n && (ix->cur == ix->npos || ix->pos[ix->cur] > ix->off) &&
+      !is_ws(ix->data[ix->off])) {
+    // The last token ended in the middle of a run of characters (ie:
+    // "12abc").  Lex the rest of the run like the streaming parser
+    // would.
+    q = ix->off;
+  } else if (ix->cur < ix->npos) {
+    q = ix->pos[ix->cur++];
+  } else {
+    ix->off = ix->n;
+    tok->type = SJP_TOK_EOS;
+    tok->value = NULL;
+    tok->n = 0;
+    return SJP_OK;
+  }
+
+  switch (ix->data[q]) {
+    case '[': case ']': case '{': case '}': case ':': case ',':
+      tok->type = ix->data[q];
+      tok->value = &ix->data[q];
+      tok->n = 1;
+      ix->off = q+1;
+      return SJP_OK;
+
+    default:
+      break;
+  }
+
+  // a token lexed by sjp_index_build_parallel()
+  while (ix->tcur < ix->ntok && ix->tok[ix->tcur].beg < q) {
+    ix->tcur++;
+  }
+
+  if (ix->tcur < ix->ntok && ix->tok[ix->tcur].beg == q) {
+    const struct sjp_index_token *t = &ix->tok[ix->tcur++];
+
+    *tok = t->tok;
+    ix->off = t->end;
+    return t->ret;
+  }
+
+  return idx_lex(&ix->p.lex, ix->data, ix->n, q, tok, &ix->off);
+}
+
+enum SJP_RESULT sjp_index_next(struct sjp_index *ix, struct sjp_event *evt)
+{
+  struct sjp_token tok = { 0 };
+  int ret;
+
+  // commas and colons don't produce events
+  do {
+    if (ret = index_token(ix, &tok), SJP_ERROR(ret)) {
+      // The streaming parser sees the partial token before the lexer
+      // reaches the end of the input, so report its error first.
+      int perr;
+      if (tok.type != SJP_TOK_NONE &&
+          (perr = sjp_parser_feed(&ix->p, &tok, SJP_MORE, evt), SJP_ERROR(perr))) {
+        return perr;
+      }
+      return ret;
+    }
+
+    if (tok.type == SJP_TOK_EOS) {
+      evt->type = SJP_NONE;
+      evt->text = NULL;
+      evt->n = 0;
+      evt->extra.d = 0;
+      evt->num.i64 = 0;
+      evt->kind = SJP_NUM_DOUBLE;
+      evt->shape = 0;
+      evt->hash = 0;
+      evt->key = 0;
+      return sjp_parser_close(&ix->p);
+    }
+
+    ret = sjp_parser_feed(&ix->p, &tok, ret, evt);
+  } while (ret == SJP_OK && evt->type == SJP_NONE);
+
+  return ret;
+}
+
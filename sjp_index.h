@@ -0,0 +1,124 @@
+#ifndef SJP_INDEX_H
+#define SJP_INDEX_H
+
+#include "sjp_common.h"
+#include "sjp_lexer.h"
+#include "sjp_parser.h"
+
+#include <stdint.h>
+
+#define MODULE_NAME SJP_INDEX
+
+// Two stage parsing of a document that is entirely in memory.
+//
+// Stage 1 (sjp_index_build) makes one pass over the document, 64 bytes
+// at a time, and records the offsets of every structural character
+// ({}[]:,), every opening quote, and the start of every other value
+// (numbers and keywords).  Characters inside of strings are masked out
+// by tracking escapes and taking the prefix XOR of the quote positions.
+// The vector kernels are chosen at run time, at the lexer's level (see
+// sjp_lexer_simd_level()).
+//
+// Stage 2 (sjp_index_next) walks the offsets and produces the same
+// events as sjp_parser_next() would for the same document, without
+// looking at the bytes between tokens.
+//
+// Stage 1 can also run on several threads (sjp_index_build_parallel).
+// Each thread indexes a chunk of the document without knowing whether
+// the chunk starts inside of a string, so it guesses.  The guesses are
+// checked in order once every chunk is done, and the chunks that
+// guessed wrong are indexed again.
+//
+// Given room for them (sjp_index_set_tokens), the threads then lex the
+// strings, numbers and keywords of their chunks as well, which is most
+// of the work of stage 2.  Stage 2 takes the lexed tokens in order, and
+// only lexes the ones that the threads didn't.  The events are the same
+// either way.
+//
+// Use the streaming parser for input that arrives in chunks.
+
+enum {
+  SJP_INDEX_MAX_THREADS = 64,
+};
+
+// A token lexed by sjp_index_build_parallel() for stage 2
+struct sjp_index_token {
+  struct sjp_token tok;
+  uint32_t beg;   // offset of the token
+  uint32_t end;   // offset after the token
+  int ret;        // the lexer's result
+};
+
+struct sjp_index {
+  char *data;
+  size_t n;
+
+  uint32_t *pos;  // offsets of tokens found by stage 1
+  size_t npos;    // number of offsets in pos
+  size_t cap;     // capacity of pos
+
+  size_t cur;     // next offset in pos to read
+  size_t off;     // end of the last token read
+
+  size_t nredo;   // chunks the last parallel stage 1 indexed twice
+
+  struct sjp_index_token *tok;  // tokens lexed by the threads
+  size_t ntok;    // number of tokens in tok
+  size_t tokcap;  // capacity of tok
+  size_t tcur;    // next token in tok to read
+
+  // tracks the structure in stage 2.  Stage 2 feeds it tokens
+  // directly, so the parser's input buffer is not used.
+  struct sjp_parser p;
+};
+
+// Initializes the index.  stack and nstack are the parser stack (see
+// sjp_parser_init), and pos holds space for npos token offsets.
+//
+// Returns SJP_INVALID_PARAMS if the stack is invalid, or if pos == NULL
+// and npos > 0.
+enum SJP_RESULT sjp_index_init(struct sjp_index *ix, char *stack, size_t nstack, uint32_t *pos, size_t npos);
+
+// Stage 1: indexes a document of n bytes and resets stage 2 to the
+// start of the document.  As with the lexer, the data may be modified
+// while the document is parsed.
+//
+// The index needs at most one offset for each byte of the document.
+// Returns SJP_INVALID_PARAMS if npos < n or if n does not fit in 32
+// bits.
+enum SJP_RESULT sjp_index_build(struct sjp_index *ix, char *data, size_t n);
+
+// Stage 1 on nthreads threads, including the caller's, and the lexing
+// for stage 2 if the index has room for tokens.  The document is split
+// into one chunk per thread, and the offsets are the same as
+// sjp_index_build() finds.  Small documents may use fewer threads.  If
+// a thread can't be created, its chunk is done on the caller's thread.
+//
+// Returns SJP_INVALID_PARAMS for the same reasons as sjp_index_build(),
+// or if nthreads is not between 1 and SJP_INDEX_MAX_THREADS.
+enum SJP_RESULT sjp_index_build_parallel(struct sjp_index *ix, char *data, size_t n, int nthreads);
+
+// Gives sjp_index_build_parallel() room for ntok lexed tokens.  Each
+// thread gets a share of them by the number of offsets in its chunk,
+// and stage 2 lexes what doesn't fit.  A string, number or keyword
+// takes one token, so ntok == n is always enough.  With ntok == 0 (the
+// default), only stage 1 runs on the threads.
+//
+// Returns SJP_INVALID_PARAMS if tok == NULL and ntok > 0.
+enum SJP_RESULT sjp_index_set_tokens(struct sjp_index *ix, struct sjp_index_token *tok, size_t ntok);
+
+// Stage 2: fetches the next event.
+//
+// Return values are the same as sjp_parser_next(), except that the
+// whole document is available, so SJP_MORE and SJP_PARTIAL are never
+// returned.
+//
+// At the end of the document, returns SJP_OK with evt->type set to
+// SJP_NONE, or SJP_UNCLOSED_OBJECT/SJP_UNCLOSED_ARRAY if the document
+// ends inside of an object or array.
+enum SJP_RESULT sjp_index_next(struct sjp_index *ix, struct sjp_event *evt);
+
+#undef MODULE_NAME
+
+#endif /* SJP_INDEX_H */
+
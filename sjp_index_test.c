@@ -0,0 +1,682 @@
+#include "sjp_index.h"
+
+#define TEST_LOG_LEVEL 0
+#include "sjp_testing.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define DEFAULT_STACK 16
+#define MAX_DOC     1024
+
+static int index_is_sentinel(struct parser_output *out)
+{
+  return out->ret == SJP_OK && out->type == SJP_NONE && out->text == NULL;
+}
+
+static int index_test_doc(const char *doc, struct parser_output *outputs)
+{
+  char stack[DEFAULT_STACK];
+  char data[MAX_DOC];
+  uint32_t pos[MAX_DOC];
+  struct sjp_index ix;
+  size_t n;
+  int j, ret;
+
+  n = strlen(doc);
+  memcpy(data, doc, n);
+
+  if (ret = sjp_index_init(&ix, stack, sizeof stack, pos, sizeof pos / sizeof pos[0]), ret != SJP_OK) {
+    printf("error initializing the index (ret=%d %s)\n", ret, ret2name(ret));
+    return -1;
+  }
+
+  if (ret = sjp_index_build(&ix, data, n), ret != SJP_OK) {
+    printf("error building the index (ret=%d %s)\n", ret, ret2name(ret));
+    return -1;
+  }
+
+  for (j=0; !index_is_sentinel(&outputs[j]); j++) {
+    struct sjp_event evt = {0};
+    char buf[1024];
+    size_t outlen;
+
+    ret = sjp_index_next(&ix, &evt);
+
+    memset(buf, 0, sizeof buf);
+    if (evt.n > 0) {
+      memcpy(buf, evt.text, evt.n < sizeof buf ? evt.n : sizeof buf - 1);
+    }
+
+    LOG("[EVT ] %3d %3d %8s %8s | %s\n",
+        ret, evt.type,
+        ret2name(ret), evt2name(evt.type),
+        buf);
+
+    if (ret != outputs[j].ret) {
+      printf("j=%d, expected return %d (%s), but found %d (%s)\n",
+          j, outputs[j].ret, ret2name(outputs[j].ret),
+          ret, ret2name(ret));
+      return -1;
+    }
+
+    if (SJP_ERROR(ret)) {
+      continue;
+    }
+
+    if (evt.type != outputs[j].type) {
+      printf("j=%d, expected type %d (%s), but found %d (%s)\n",
+          j, outputs[j].type, evt2name(outputs[j].type),
+          evt.type, evt2name(evt.type));
+      return -1;
+    }
+
+    outlen = (outputs[j].text != NULL) ? strlen(outputs[j].text) : 0;
+    if ((evt.n != outlen) || (outlen > 0 && memcmp(evt.text,outputs[j].text,outlen) != 0)) {
+      printf("j=%d, expected text '%s' but found '%s'\n",
+          j, outputs[j].text ? outputs[j].text : "<NULL>", buf);
+      return -1;
+    }
+
+    if ((outputs[j].flags & SJP_TEST_NUMBER) && evt.extra.d != outputs[j].num) {
+      printf("j=%d, expected number %f but found %f\n", j, outputs[j].num, evt.extra.d);
+      return -1;
+    }
+
+    if ((outputs[j].flags & SJP_TEST_NUM_CODEPOINTS) && evt.extra.ncp != outputs[j].ncp) {
+      printf("j=%d, expected %zu codepoints but found %zu\n", j, outputs[j].ncp, evt.extra.ncp);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static void run_index_test(const char *name, const char *doc, struct parser_output outputs[])
+{
+  ntest++;
+
+  if (index_test_doc(doc, outputs) != 0) {
+    nfail++;
+    printf("FAILED: %s\n", name);
+    printf("  document: %s\n", doc);
+  }
+}
+
+static void test_index_values(void)
+{
+  {
+    struct parser_output outputs[] = {
+      { SJP_OK, SJP_STRING, "foo bar baz", SJP_TEST_NUM_CODEPOINTS, 0.0, 11 },
+      { SJP_OK, SJP_NONE, "" },
+      { SJP_OK, SJP_NONE, NULL }, // end sentinel
+    };
+
+    run_index_test(__func__, " \"foo bar baz\" ", outputs);
+  }
+
+  {
+    struct parser_output outputs[] = {
+      { SJP_OK, SJP_NUMBER, "1.35e-2", SJP_TEST_NUMBER, 1.35e-2 },
+      { SJP_OK, SJP_NONE, "" },
+      { SJP_OK, SJP_NONE, NULL }, // end sentinel
+    };
+
+    run_index_test(__func__, "1.35e-2", outputs);
+  }
+
+  {
+    struct parser_output outputs[] = {
+      { SJP_OK, SJP_NULL, "null" },
+      { SJP_OK, SJP_NONE, "" },
+      { SJP_OK, SJP_NONE, NULL }, // end sentinel
+    };
+
+    run_index_test(__func__, "null\n", outputs);
+  }
+}
+
+static void test_index_nested(void)
+{
+  struct parser_output outputs[] = {
+    { SJP_OK, SJP_OBJECT_BEG, "{" },
+    { SJP_OK, SJP_STRING, "foo" },
+    { SJP_OK, SJP_ARRAY_BEG, "[" },
+    { SJP_OK, SJP_NUMBER, "1", SJP_TEST_NUMBER, 1 },
+    { SJP_OK, SJP_NUMBER, "-2.5", SJP_TEST_NUMBER, -2.5 },
+    { SJP_OK, SJP_TRUE, "true" },
+    { SJP_OK, SJP_FALSE, "false" },
+    { SJP_OK, SJP_ARRAY_END, "]" },
+    { SJP_OK, SJP_STRING, "b{a}r" },
+    { SJP_OK, SJP_OBJECT_BEG, "{" },
+    { SJP_OK, SJP_STRING, "q\"[,]\"" },
+    { SJP_OK, SJP_STRING, "\xc3\xa9\\" , SJP_TEST_NUM_CODEPOINTS, 0.0, 2 },
+    { SJP_OK, SJP_OBJECT_END, "}" },
+    { SJP_OK, SJP_OBJECT_END, "}" },
+    { SJP_OK, SJP_NONE, "" },
+    { SJP_OK, SJP_NONE, NULL }, // end sentinel
+  };
+
+  run_index_test(__func__,
+      "{ \"foo\" : [1,-2.5,\ttrue , false],\n"
+      "  \"b{a}r\":{\"q\\\"[,]\\\"\" : \"\\u00e9\\\\\"}}",
+      outputs);
+}
+
+static void test_index_errors(void)
+{
+  {
+    struct parser_output outputs[] = {
+      { SJP_OK, SJP_ARRAY_BEG, "[" },
+      { SJP_OK, SJP_NUMBER, "1", SJP_TEST_NUMBER, 1 },
+      { SJP_UNCLOSED_ARRAY, SJP_NONE, NULL },
+      { SJP_OK, SJP_NONE, NULL }, // end sentinel
+    };
+
+    run_index_test(__func__, "[ 1, ", outputs);
+  }
+
+  {
+    struct parser_output outputs[] = {
+      { SJP_OK, SJP_OBJECT_BEG, "{" },
+      { SJP_UNCLOSED_OBJECT, SJP_NONE, NULL },
+      { SJP_OK, SJP_NONE, NULL }, // end sentinel
+    };
+
+    run_index_test(__func__, "{", outputs);
+  }
+
+  {
+    struct parser_output outputs[] = {
+      { SJP_OK, SJP_ARRAY_BEG, "[" },
+      { SJP_UNFINISHED_INPUT, SJP_NONE, NULL },
+      { SJP_OK, SJP_NONE, NULL }, // end sentinel
+    };
+
+    run_index_test(__func__, "[\"foo", outputs);
+  }
+
+  {
+    struct parser_output outputs[] = {
+      { SJP_INVALID_INPUT, SJP_NONE, NULL },
+      { SJP_OK, SJP_NONE, NULL }, // end sentinel
+    };
+
+    run_index_test(__func__, "-", outputs);
+  }
+
+  {
+    struct parser_output outputs[] = {
+      { SJP_OK, SJP_OBJECT_BEG, "{" },
+      { SJP_INVALID_KEY, SJP_NONE, NULL },
+      { SJP_OK, SJP_NONE, NULL }, // end sentinel
+    };
+
+    run_index_test(__func__, "{ 12 : 3 }", outputs);
+  }
+
+  {
+    struct parser_output outputs[] = {
+      { SJP_OK, SJP_ARRAY_BEG, "[" },
+      { SJP_INVALID_INPUT, SJP_NONE, NULL },
+      { SJP_OK, SJP_NONE, NULL }, // end sentinel
+    };
+
+    run_index_test(__func__, "[ nul ]", outputs);
+  }
+}
+
+// Collects the events from the streaming parser for doc, joining
+// partial events.  Returns the number of events; the last one is the
+// end of the document or an error.
+static int stream_events(const char *doc, char *text, struct parser_output *outputs, int max)
+{
+  char stack[DEFAULT_STACK];
+  char data[MAX_DOC];
+  struct sjp_parser p;
+  int j, eos;
+  size_t n;
+  char *beg;
+
+  n = strlen(doc);
+  memcpy(data, doc, n);
+
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  sjp_parser_more(&p, data, n);
+
+  eos = 0;
+  beg = text;
+  for (j=0; j < max;) {
+    struct sjp_event evt = {0};
+    enum SJP_RESULT ret;
+
+    if (eos && p.lex.state == SJP_LST_VALUE) {
+      // the next token is the end of the stream, where the index
+      // returns sjp_parser_close()
+      ret = sjp_parser_close(&p);
+    } else if (ret = sjp_parser_next(&p, &evt), ret == SJP_MORE && !eos && evt.n == 0) {
+      sjp_parser_eos(&p);
+      eos = 1;
+      continue;
+    }
+
+    if (evt.n > 0) {
+      memcpy(text, evt.text, evt.n);
+      text += evt.n;
+    }
+
+    if (ret == SJP_MORE || ret == SJP_PARTIAL) {
+      continue;
+    }
+
+    *text++ = '\0';
+
+    outputs[j].ret = ret;
+    outputs[j].type = SJP_ERROR(ret) ? SJP_NONE : evt.type;
+    outputs[j].text = beg;
+    outputs[j].flags = 0;
+    if (evt.type == SJP_NUMBER) {
+      outputs[j].flags = SJP_TEST_NUMBER;
+      outputs[j].num = evt.extra.d;
+    } else if (evt.type == SJP_STRING) {
+      outputs[j].flags = SJP_TEST_NUM_CODEPOINTS;
+      outputs[j].ncp = evt.extra.ncp;
+    }
+    j++;
+
+    beg = text;
+    if (SJP_ERROR(ret) || evt.type == SJP_NONE) {
+      break;
+    }
+  }
+
+  return j;
+}
+
+static void compare_with_stream(const char *name, const char *doc)
+{
+  static char text[4*MAX_DOC];
+  struct parser_output outputs[64];
+  int n;
+
+  n = stream_events(doc, text, outputs, 63);
+  outputs[n].ret = SJP_OK;
+  outputs[n].type = SJP_NONE;
+  outputs[n].text = NULL;
+
+  run_index_test(name, doc, outputs);
+}
+
+// backslash runs and quotes that straddle the 64 byte blocks of stage 1
+static void test_index_block_boundaries(void)
+{
+  char doc[MAX_DOC];
+  int pad, run;
+
+  for (pad = 48; pad < 72; pad++) {
+    for (run = 1; run <= 6; run++) {
+      int i, k;
+
+      k = 0;
+      doc[k++] = '[';
+      doc[k++] = '"';
+      for (i=0; i < pad; i++) {
+        doc[k++] = 'a' + (i % 26);
+      }
+
+      for (i=0; i < run; i++) {
+        doc[k++] = '\\';
+      }
+
+      // an odd run escapes the quote
+      if (run % 2 == 1) {
+        doc[k++] = '"';
+      }
+
+      k += sprintf(&doc[k], "\",{\"k\":[12,\"v\\\\\"]},true ]");
+
+      compare_with_stream(__func__, doc);
+    }
+  }
+}
+
+// values that run into each other or to the end of the document
+static void test_index_compare(void)
+{
+  static const char *docs[] = {
+    "[1,2,3]",
+    "[1 , 2.0e5 ,-3]",
+    "{\"a\":{\"b\":{\"c\":[]}}}",
+    "[\"\",\"\\\\\",\"\\\"\"]",
+    "[truex]",
+    "[12abc]",
+    "[1\"x\"]",
+    "{\"a\" \"b\"}",
+    "[1,,2]",
+    "]",
+    "  739.80-",
+    "[ 417.165e-8 \"  , false  ] ",
+    "{\"y\\\\\"\"\n:1}",
+    "[\"\x01\"]",
+    "[\"\xc3\"]",
+    NULL
+  };
+  int i;
+
+  for (i=0; docs[i] != NULL; i++) {
+    compare_with_stream(__func__, docs[i]);
+  }
+}
+
+// Generates a document that is hard to split: strings whose contents
+// look like JSON, runs of backslashes, and escaped quotes, mixed with
+// numbers and keywords.
+static size_t gen_tricky(char *doc, size_t cap, unsigned seed)
+{
+  static const char *strs[] = {
+    "\"a\"", "\"\\\"\"", "\"\\\\\"", "\"\\\\\\\"x\"",
+    "\"\\\",\\\"k\\\":[\"", "\", \"", "\"}]\"", "\"{\\\"a\\\": \\\"b\\\"}\"",
+    "\"  ,  :  \"", "\"\\\\\\\\\"",
+  };
+  static const char *vals[] = { "12", "-0.5e3", "true", "null", "[]", "{}" };
+  size_t n = 0;
+  int depth = 0;
+
+  n += sprintf(&doc[n], "[");
+  while (n + 64 < cap) {
+    seed = seed * 1103515245 + 12345;
+
+    switch ((seed >> 16) % 8) {
+      case 0:
+        if (depth < 8) {
+          n += sprintf(&doc[n], "{%s : [", strs[(seed >> 8) % 10]);
+          depth++;
+        }
+        break;
+
+      case 1:
+        if (depth > 0) {
+          n += sprintf(&doc[n], "]},");
+          depth--;
+        }
+        break;
+
+      case 2:
+      case 3:
+        n += sprintf(&doc[n], "%s,", vals[(seed >> 8) % 6]);
+        break;
+
+      default:
+        n += sprintf(&doc[n], "%s%s", strs[(seed >> 8) % 10], (seed & 0x80) ? ",\n  " : ",");
+        break;
+    }
+  }
+
+  while (depth-- > 0) {
+    n += sprintf(&doc[n], "]}");
+  }
+  n += sprintf(&doc[n], "0]");
+
+  return n;
+}
+
+static int compare_parallel(const char *doc, size_t n, int nthreads, size_t *nredo)
+{
+  static char data[16384];
+  static uint32_t pos1[16384], pos2[16384];
+  char stack[DEFAULT_STACK];
+  struct sjp_index ix1, ix2;
+  int ret;
+
+  memcpy(data, doc, n);
+  sjp_index_init(&ix1, stack, sizeof stack, pos1, n);
+  sjp_index_init(&ix2, stack, sizeof stack, pos2, n);
+
+  if (ret = sjp_index_build(&ix1, data, n), ret != SJP_OK) {
+    printf("  sequential build returned %d (%s)\n", ret, ret2name(ret));
+    return -1;
+  }
+
+  if (ret = sjp_index_build_parallel(&ix2, data, n, nthreads), ret != SJP_OK) {
+    printf("  parallel build returned %d (%s)\n", ret, ret2name(ret));
+    return -1;
+  }
+
+  if (ix1.npos != ix2.npos || memcmp(pos1, pos2, ix1.npos * sizeof pos1[0]) != 0) {
+    printf("  %d threads: %zu offsets in parallel, %zu sequential\n", nthreads, ix2.npos, ix1.npos);
+    return -1;
+  }
+
+  *nredo += ix2.nredo;
+  return 0;
+}
+
+// the parallel stage 1 finds the same offsets as the sequential one,
+// wherever the chunks start
+static void test_index_parallel(void)
+{
+  static char doc[16384];
+  static const size_t sizes[] = { 100, 640, 1000, 4096, 16000 };
+  size_t nredo = 0, s;
+  unsigned seed;
+  int nthreads, run, k;
+
+  for (seed=1; seed <= 8; seed++) {
+    for (s=0; s < sizeof sizes / sizeof sizes[0]; s++) {
+      size_t n = gen_tricky(doc, sizes[s], seed);
+
+      for (nthreads = 1; nthreads <= 20; nthreads++) {
+        ntest++;
+        if (compare_parallel(doc, n, nthreads, &nredo) != 0) {
+          nfail++;
+          printf("FAILED: %s\n", __func__);
+          printf("  seed %u, %zu bytes\n", seed, n);
+        }
+      }
+    }
+  }
+
+  // one long string, split everywhere, that looks like it closes after
+  // each chunk starts
+  for (run = 0; run < 3; run++) {
+    k = sprintf(doc, "[\"");
+    while (k < 8000) {
+      k += sprintf(&doc[k], "%s", (run == 0) ? "\\\", " : (run == 1) ? "x\":{\"" : "\\\\\\\"]");
+    }
+    k += sprintf(&doc[k], "\",1]");
+
+    for (nthreads = 2; nthreads <= 64; nthreads *= 2) {
+      ntest++;
+      if (compare_parallel(doc, k, nthreads, &nredo) != 0) {
+        nfail++;
+        printf("FAILED: %s\n", __func__);
+        printf("  long string %d\n", run);
+      }
+    }
+  }
+
+  // the fix-up pass has to have run for the tests to mean anything
+  ntest++;
+  if (nredo == 0) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  no chunk guessed wrong\n");
+  }
+}
+
+// Compares the events from the sequential index with those from the
+// parallel one with room for ntok lexed tokens.  Adds the tokens that
+// the threads lexed to *nlexed.
+static int compare_parallel_events(const char *doc, size_t n, int nthreads, size_t ntok, size_t *nlexed)
+{
+  static char data1[16384], data2[16384];
+  static uint32_t pos1[16384], pos2[16384];
+  static struct sjp_index_token tok[16384];
+  char stack1[DEFAULT_STACK], stack2[DEFAULT_STACK];
+  struct sjp_index ix1, ix2;
+  int i, ret1, ret2;
+
+  memcpy(data1, doc, n);
+  memcpy(data2, doc, n);
+  sjp_index_init(&ix1, stack1, sizeof stack1, pos1, n);
+  sjp_index_init(&ix2, stack2, sizeof stack2, pos2, n);
+  sjp_index_set_tokens(&ix2, tok, ntok);
+
+  sjp_index_build(&ix1, data1, n);
+  if (ret2 = sjp_index_build_parallel(&ix2, data2, n, nthreads), ret2 != SJP_OK) {
+    printf("  parallel build returned %d (%s)\n", ret2, ret2name(ret2));
+    return -1;
+  }
+  *nlexed += ix2.ntok;
+
+  for (i=0; ; i++) {
+    struct sjp_event e1 = {0}, e2 = {0};
+
+    ret1 = sjp_index_next(&ix1, &e1);
+    ret2 = sjp_index_next(&ix2, &e2);
+
+    if (ret1 != ret2 || (!SJP_ERROR(ret1) && e1.type != e2.type)) {
+      printf("  event %d: sequential returned %d (%s) type %d, parallel %d (%s) type %d\n",
+          i, ret1, ret2name(ret1), e1.type, ret2, ret2name(ret2), e2.type);
+      return -1;
+    }
+
+    if (SJP_ERROR(ret1) || e1.type == SJP_NONE) {
+      return 0;
+    }
+
+    if (e1.n != e2.n || (e1.n > 0 && memcmp(e1.text, e2.text, e1.n) != 0) ||
+        (e1.type == SJP_NUMBER && (e1.extra.d != e2.extra.d || e1.kind != e2.kind || e1.num.i64 != e2.num.i64))) {
+      printf("  event %d: sequential '%.*s', parallel '%.*s'\n", i, (int)e1.n, e1.text, (int)e2.n, e2.text);
+      return -1;
+    }
+  }
+}
+
+// The events are the same when the threads lex the tokens, whether
+// or not all of them fit, and with errors anywhere in the document
+static void test_index_parallel_lex(void)
+{
+  static char doc[16384];
+  static const size_t ntoks[] = { 16384, 100, 3 };
+  static const char bad[] = { '"', '\\', 'x', ']', '\x01' };
+  size_t nlexed = 0, t;
+  unsigned seed;
+  int nthreads;
+
+  for (seed=1; seed <= 8; seed++) {
+    size_t n = gen_tricky(doc, 16000, seed);
+
+    // all but the first seed have an error
+    if (seed > 1) {
+      doc[(seed * 7919) % n] = bad[seed % sizeof bad];
+    }
+
+    for (t=0; t < sizeof ntoks / sizeof ntoks[0]; t++) {
+      for (nthreads = 2; nthreads <= 16; nthreads *= 2) {
+        ntest++;
+        if (compare_parallel_events(doc, n, nthreads, ntoks[t], &nlexed) != 0) {
+          nfail++;
+          printf("FAILED: %s\n", __func__);
+          printf("  seed %u, %zu bytes, %d threads, %zu tokens\n", seed, n, nthreads, ntoks[t]);
+        }
+      }
+    }
+  }
+
+  ntest++;
+  if (nlexed == 0) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  no tokens were lexed on the threads\n");
+  }
+}
+
+static void test_index_parallel_params(void)
+{
+  char stack[DEFAULT_STACK];
+  char doc[] = "[1,2,3]";
+  uint32_t pos[16];
+  struct sjp_index ix;
+  int ret;
+
+  sjp_index_init(&ix, stack, sizeof stack, pos, 16);
+
+  ntest++;
+  if (ret = sjp_index_build_parallel(&ix, doc, strlen(doc), 0), ret != SJP_INVALID_PARAMS) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  zero threads returned %d (%s)\n", ret, ret2name(ret));
+  }
+
+  ntest++;
+  if (ret = sjp_index_build_parallel(&ix, doc, strlen(doc), SJP_INDEX_MAX_THREADS+1), ret != SJP_INVALID_PARAMS) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  too many threads returned %d (%s)\n", ret, ret2name(ret));
+  }
+}
+
+// Each level of the vector kernels finds the same offsets as the
+// scalar one
+static void test_index_levels(void)
+{
+  static char doc[16384], data[16384];
+  static uint32_t pos0[16384], pos[16384];
+  char stack[DEFAULT_STACK];
+  struct sjp_index ix;
+  enum SJP_SIMD saved, lv;
+  unsigned seed;
+  size_t n, npos0;
+
+  saved = sjp_lexer_simd_level();
+
+  for (seed=1; seed <= 8; seed++) {
+    n = gen_tricky(doc, 1000 + 1000*seed, seed);
+
+    sjp_lexer_set_simd_level(SJP_SIMD_SCALAR);
+    memcpy(data, doc, n);
+    sjp_index_init(&ix, stack, sizeof stack, pos0, n);
+    sjp_index_build(&ix, data, n);
+    npos0 = ix.npos;
+
+    for (lv = SJP_SIMD_SSE2; lv <= SJP_SIMD_AVX512; lv++) {
+      if (sjp_lexer_set_simd_level(lv) != lv) {
+        continue;
+      }
+
+      ntest++;
+
+      memcpy(data, doc, n);
+      sjp_index_init(&ix, stack, sizeof stack, pos, n);
+      sjp_index_build(&ix, data, n);
+      if (ix.npos != npos0 || memcmp(pos, pos0, npos0 * sizeof pos[0]) != 0) {
+        nfail++;
+        printf("FAILED: %s\n", __func__);
+        printf("  seed %u, level %s: %zu offsets, %zu with scalar\n",
+            seed, sjp_lexer_simd_name(lv), ix.npos, npos0);
+      }
+    }
+  }
+
+  sjp_lexer_set_simd_level(saved);
+}
+
+int main(void)
+{
+  test_index_values();
+  test_index_nested();
+  test_index_errors();
+
+  test_index_block_boundaries();
+  test_index_compare();
+
+  test_index_parallel();
+  test_index_parallel_params();
+  test_index_parallel_lex();
+  test_index_levels();
+
+  printf("%d tests, %d failures\n", ntest,nfail);
+  return nfail == 0 ? 0 : 1;
+}
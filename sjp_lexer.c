@@ -1,14 +1,87 @@
 #include "sjp_lexer.h"
+#include "sjp_number.h"
 
 #include <string.h>
-#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 
-#include "hoerhmann.h"
+// Vector kernels
+//
+// The string and whitespace scanners have a scalar version and
+// versions for SSE2, SSSE3, AVX2 and AVX-512, chosen at run time (see
+// sjp_lexer_simd_level()).  With gcc or clang on x86, every version is
+// built with a target attribute and the CPU is checked with
+// __builtin_cpu_supports().  Elsewhere, only the versions the compiler
+// flags allow are built.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(SJP_NO_DISPATCH)
+#  include <immintrin.h>
+#  define LEX_DISPATCH 1
+#  define LEX_SSE2     1
+#  define LEX_SSSE3    1
+#  define LEX_AVX2     1
+#  define LEX_AVX512   1
+#  define LEX_TARGET(t) __attribute__((target(t)))
+#else
+#  if defined(__AVX512F__) && defined(__AVX512BW__)
+#    define LEX_AVX512 1
+#  endif
+#  if defined(__AVX2__)
+#    define LEX_AVX2   1
+#  endif
+#  if defined(__SSSE3__)
+#    define LEX_SSSE3  1
+#  endif
+#  if defined(__SSE2__)
+#    define LEX_SSE2   1
+#  endif
+#  if defined(LEX_AVX2) || defined(LEX_AVX512)
+#    include <immintrin.h>
+#  elif defined(LEX_SSSE3)
+#    include <tmmintrin.h>
+#  elif defined(LEX_SSE2)
+#    include <emmintrin.h>
+#  endif
+#  define LEX_TARGET(t)
+#endif
+
+#define LEX_TARGET_SSE2   LEX_TARGET("sse2")
+#define LEX_TARGET_SSSE3  LEX_TARGET("ssse3")
+#define LEX_TARGET_AVX2   LEX_TARGET("avx2")
+#define LEX_TARGET_AVX512 LEX_TARGET("avx512f,avx512bw")
 
 #define BORDER_DELIMS "{}[]:,"
 
+// Character classes of the bytes outside of strings.
+//
+// JSON whitespace is only space, tab, newline and carriage return
+// (RFC 8259, section 2).  isspace() also accepts '\v' and '\f', and
+// depends on the locale.
+//
+// A keyword must be followed by whitespace, a structural character
+// (BORDER_DELIMS) or the end of the input.
+//
+// sjp_lexer_skip() stops at the LEX_SKIP bytes outside of strings, and
+// at the LEX_SKIP_STR bytes in strings.  Both include newlines, to
+// keep the line count.
+enum {
+  LEX_WS       = 1 << 0,
+  LEX_DELIM    = 1 << 1,
+  LEX_SKIP     = 1 << 2,
+  LEX_SKIP_STR = 1 << 3,
+};
+
+static const uint8_t lex_class[256] = {
+  ['\t'] = LEX_WS, ['\r'] = LEX_WS, [' '] = LEX_WS,
+  ['\n'] = LEX_WS | LEX_SKIP | LEX_SKIP_STR,
+  ['{'] = LEX_DELIM | LEX_SKIP, ['}'] = LEX_DELIM | LEX_SKIP,
+  ['['] = LEX_DELIM | LEX_SKIP, [']'] = LEX_DELIM | LEX_SKIP,
+  [','] = LEX_DELIM | LEX_SKIP,
+  [':'] = LEX_DELIM,
+  ['"'] = LEX_SKIP | LEX_SKIP_STR,
+  ['\\'] = LEX_SKIP_STR,
+};
+
 static int jl_eos(struct sjp_lexer *l)
 {
   return l->data == NULL;
@@ -23,26 +96,983 @@ static int jl_getc(struct sjp_lexer *l)
   }
 
   ch = (unsigned char)l->data[l->off++];
-  if (ch == '\n') {
-    l->line++;
-    l->prev_lbeg = l->lbeg;
-    l->lbeg = l->off;
-  }
-
   return ch;
 }
 
+// Steps back over ch, which must be the last character read
 static void jl_ungetc(struct sjp_lexer *l, int ch)
 {
   if (l->off > 0) {
     l->off--;
-    l->data[l->off] = ch;
+    assert(l->data[l->off] == (char)ch);
+  }
+}
+
+// UTF-8 validation
+//
+// Strings are validated with the lookup table algorithm from Keiser and
+// Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte".
+// Each byte is checked against the three bytes before it: the high and
+// low nibbles of the previous byte and the high nibble of the current
+// byte index three tables whose AND has a bit set for each error the
+// pair could be.  Whether a byte must be the second or third
+// continuation byte of a sequence is checked separately against the
+// bytes two and three back.
+//
+// The same tables drive the scalar and the vector code, so the only
+// state carried between calls (and across restarts) is the last three
+// bytes of the string, in sjp_lexer.u8prev.  The bytes are packed in
+// memory order: the oldest in bits 0-7 and the newest in bits 16-23.
+
+enum {
+  U8_TOO_SHORT   = 1 << 0, // 11______ 0_______, 11______ 11______
+  U8_TOO_LONG    = 1 << 1, // 0_______ 10______
+  U8_OVERLONG_3  = 1 << 2, // 11100000 100_____
+  U8_TOO_LARGE   = 1 << 3, // 11110100 1001____, 11110100 101_____, 11110101+
+  U8_SURROGATE   = 1 << 4, // 11101101 101_____
+  U8_OVERLONG_2  = 1 << 5, // 1100000_ 10______
+  U8_TOO_LARGE_1000 = 1 << 6, // 11110101+ 1000____
+  U8_OVERLONG_4  = 1 << 6, // 11110000 1000____
+  U8_TWO_CONTS   = 1 << 7, // 10______ 10______
+
+  U8_CARRY = U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS,
+};
+
+// indexed by the high nibble of the previous byte
+static const uint8_t u8_byte1_high[16] = {
+  // 0_______ <ASCII>
+  U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+  U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+  // 10______ <continuation>
+  U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS,
+  // 1100____ <two byte lead>
+  U8_TOO_SHORT | U8_OVERLONG_2,
+  // 1101____ <two byte lead>
+  U8_TOO_SHORT,
+  // 1110____ <three byte lead>
+  U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,
+  // 1111____ <four byte lead>
+  U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+};
+
+// indexed by the low nibble of the previous byte
+static const uint8_t u8_byte1_low[16] = {
+  // ____0000
+  U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4,
+  // ____0001
+  U8_CARRY | U8_OVERLONG_2,
+  // ____001_
+  U8_CARRY,
+  U8_CARRY,
+  // ____0100
+  U8_CARRY | U8_TOO_LARGE,
+  // ____0101
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  // ____011_
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  // ____1___
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  // ____1101
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+  U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+};
+
+// indexed by the high nibble of the current byte
+static const uint8_t u8_byte2_high[16] = {
+  // 0_______ <ASCII>
+  U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+  U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+  // 1000____
+  U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+  // 1001____
+  U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE,
+  // 101_____
+  U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE  | U8_TOO_LARGE,
+  U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE  | U8_TOO_LARGE,
+  // 11______
+  U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+};
+
+// Checks the next byte against the previous three, and shifts it into
+// the state.  Returns non-zero if the byte is invalid.
+static inline int u8_next(uint32_t *prev, unsigned ch)
+{
+  uint32_t p = *prev;
+  unsigned p1 = (p >> 16) & 0xff;
+  unsigned p2 = (p >>  8) & 0xff;
+  unsigned p3 = p & 0xff;
+  unsigned sc, must23;
+
+  sc = u8_byte1_high[p1 >> 4] & u8_byte1_low[p1 & 0x0f] & u8_byte2_high[ch >> 4];
+  must23 = (p2 >= 0xe0 || p3 >= 0xf0) ? U8_TWO_CONTS : 0;
+
+  *prev = (p >> 8) | (ch << 16);
+  return sc != must23;
+}
+
+// Returns non-zero if the state is not in the middle of a sequence, so
+// that it can be followed by ASCII.
+static inline int u8_clean(uint32_t prev)
+{
+  return ((prev >> 16) & 0xff) < 0xc0 && ((prev >> 8) & 0xff) < 0xe0 && (prev & 0xff) < 0xf0;
+}
+
+// Reloads the state from the three bytes before data[off]
+static inline uint32_t u8_reload(const char *data, size_t off)
+{
+  return (uint32_t)(unsigned char)data[off-3] |
+    ((uint32_t)(unsigned char)data[off-2] << 8) |
+    ((uint32_t)(unsigned char)data[off-1] << 16);
+}
+
+#if defined(LEX_SSSE3)
+static inline LEX_TARGET_SSSE3 __m128i u8_check16(__m128i in, __m128i prev_in)
+{
+  const __m128i nib = _mm_set1_epi8(0x0f);
+  const __m128i t1h = _mm_loadu_si128((const __m128i *)u8_byte1_high);
+  const __m128i t1l = _mm_loadu_si128((const __m128i *)u8_byte1_low);
+  const __m128i t2h = _mm_loadu_si128((const __m128i *)u8_byte2_high);
+
+  __m128i prev1 = _mm_alignr_epi8(in, prev_in, 15);
+  __m128i prev2 = _mm_alignr_epi8(in, prev_in, 14);
+  __m128i prev3 = _mm_alignr_epi8(in, prev_in, 13);
+
+  __m128i sc = _mm_and_si128(
+      _mm_and_si128(
+        _mm_shuffle_epi8(t1h, _mm_and_si128(_mm_srli_epi16(prev1, 4), nib)),
+        _mm_shuffle_epi8(t1l, _mm_and_si128(prev1, nib))),
+      _mm_shuffle_epi8(t2h, _mm_and_si128(_mm_srli_epi16(in, 4), nib)));
+
+  __m128i must23 = _mm_and_si128(
+      _mm_or_si128(
+        _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xe0 - 0x80))),
+        _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xf0 - 0x80)))),
+      _mm_set1_epi8((char)0x80));
+
+  return _mm_xor_si128(must23, sc);
+}
+#endif /* LEX_SSSE3 */
+
+#if defined(LEX_AVX2)
+static inline LEX_TARGET_AVX2 __m256i u8_check32(__m256i in, __m256i prev_in)
+{
+  const __m256i nib = _mm256_set1_epi8(0x0f);
+  const __m256i t1h = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)u8_byte1_high));
+  const __m256i t1l = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)u8_byte1_low));
+  const __m256i t2h = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)u8_byte2_high));
+
+  __m256i carry = _mm256_permute2x128_si256(prev_in, in, 0x21);
+  __m256i prev1 = _mm256_alignr_epi8(in, carry, 15);
+  __m256i prev2 = _mm256_alignr_epi8(in, carry, 14);
+  __m256i prev3 = _mm256_alignr_epi8(in, carry, 13);
+
+  __m256i sc = _mm256_and_si256(
+      _mm256_and_si256(
+        _mm256_shuffle_epi8(t1h, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nib)),
+        _mm256_shuffle_epi8(t1l, _mm256_and_si256(prev1, nib))),
+      _mm256_shuffle_epi8(t2h, _mm256_and_si256(_mm256_srli_epi16(in, 4), nib)));
+
+  __m256i must23 = _mm256_and_si256(
+      _mm256_or_si256(
+        _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xe0 - 0x80))),
+        _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xf0 - 0x80)))),
+      _mm256_set1_epi8((char)0x80));
+
+  return _mm256_xor_si256(must23, sc);
+}
+#endif /* LEX_AVX2 */
+
+#if defined(LEX_AVX512)
+// Same as u8_check32.  The byte shuffles and shifts work within 128 bit
+// lanes, so the bytes before each lane are moved in a lane at a time.
+static inline LEX_TARGET_AVX512 __m512i u8_check64(__m512i in, __m512i prev_in)
+{
+  const __m512i nib = _mm512_set1_epi8(0x0f);
+  const __m512i t1h = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)u8_byte1_high));
+  const __m512i t1l = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)u8_byte1_low));
+  const __m512i t2h = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)u8_byte2_high));
+
+  __m512i carry = _mm512_alignr_epi64(in, prev_in, 6);
+  __m512i prev1 = _mm512_alignr_epi8(in, carry, 15);
+  __m512i prev2 = _mm512_alignr_epi8(in, carry, 14);
+  __m512i prev3 = _mm512_alignr_epi8(in, carry, 13);
+
+  __m512i sc = _mm512_and_si512(
+      _mm512_and_si512(
+        _mm512_shuffle_epi8(t1h, _mm512_and_si512(_mm512_srli_epi16(prev1, 4), nib)),
+        _mm512_shuffle_epi8(t1l, _mm512_and_si512(prev1, nib))),
+      _mm512_shuffle_epi8(t2h, _mm512_and_si512(_mm512_srli_epi16(in, 4), nib)));
+
+  __m512i must23 = _mm512_and_si512(
+      _mm512_or_si512(
+        _mm512_subs_epu8(prev2, _mm512_set1_epi8((char)(0xe0 - 0x80))),
+        _mm512_subs_epu8(prev3, _mm512_set1_epi8((char)(0xf0 - 0x80)))),
+      _mm512_set1_epi8((char)0x80));
+
+  return _mm512_xor_si512(must23, sc);
+}
+#endif /* LEX_AVX512 */
+
+// Kernels of one level
+struct sjp_lexer_simd {
+  enum SJP_SIMD level;
+  int (*scan_str)(const char *data, size_t *offp, size_t sz, uint32_t *prev, size_t *ncp);
+  size_t (*skip_ws)(struct sjp_lexer *l, size_t off, size_t sz);
+  size_t (*skip_find)(struct sjp_lexer *l, size_t off, size_t sz, int instr);
+};
+
+// Results of the string kernels
+enum {
+  SCAN_INVALID = -1, // invalid utf8
+  SCAN_TAIL    =  0, // less than a block is left
+  SCAN_STOP    =  1, // found the byte that ends the fast path
+};
+
+// The string kernels scan string data from data[*offp..sz) a block at a
+// time, validating utf8 and counting codepoints, up to and including
+// the first byte that ends the fast path: '"', '\\', or a control
+// character (U+0000 to U+001F).  See scan_str().
+//
+// On SCAN_STOP, *offp is the offset of that byte.  On SCAN_TAIL, it is
+// the offset of the last partial block.  *prev and *ncp are updated for
+// the bytes scanned.
+
+static int scan_str_scalar(const char *data, size_t *offp, size_t sz, uint32_t *prev, size_t *ncp)
+{
+  (void)data;
+  (void)offp;
+  (void)sz;
+  (void)prev;
+  (void)ncp;
+  return SCAN_TAIL;
+}
+
+#if defined(LEX_SSE2)
+// No byte shuffles, so blocks that aren't ASCII are checked a byte at
+// a time.
+static LEX_TARGET_SSE2 int scan_str_sse2(const char *data, size_t *offp, size_t sz, uint32_t *prev, size_t *ncp)
+{
+  const __m128i quote  = _mm_set1_epi8('"');
+  const __m128i bslash = _mm_set1_epi8('\\');
+  const __m128i ctrl   = _mm_set1_epi8(0x1f);
+  size_t off = *offp;
+  size_t cnt = *ncp;
+  uint32_t p = *prev;
+  int ret = SCAN_TAIL;
+
+  for (; sz - off >= 16; off += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&data[off]);
+    __m128i stop = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+        _mm_cmpeq_epi8(_mm_subs_epu8(v, ctrl), _mm_setzero_si128()));
+    uint32_t smask = (uint32_t)_mm_movemask_epi8(stop);
+    uint32_t hmask = (uint32_t)_mm_movemask_epi8(v);
+    uint32_t lanes = 0xffff;
+
+    if (smask != 0) {
+      int k = __builtin_ctz(smask);
+      lanes = ((uint32_t)2 << k) - 1;
+    }
+
+    if ((hmask & lanes) == 0 && u8_clean(p)) {
+      // plain ASCII
+      cnt += __builtin_popcount(lanes);
+    } else {
+      int i, nl = __builtin_popcount(lanes);
+
+      for (i=0; i < nl; i++) {
+        unsigned ch = (unsigned char)data[off+i];
+        if (u8_next(&p, ch)) {
+          ret = SCAN_INVALID;
+          goto done;
+        }
+        cnt += (ch & 0xc0) != 0x80;
+      }
+    }
+
+    if (smask != 0) {
+      off += __builtin_ctz(smask);
+      p = (uint32_t)(unsigned char)data[off] << 16;
+      ret = SCAN_STOP;
+      goto done;
+    }
+
+    p = u8_reload(data, off+16);
+  }
+
+done:
+  *offp = off;
+  *prev = p;
+  *ncp = cnt;
+  return ret;
+}
+#endif /* LEX_SSE2 */
+
+#if defined(LEX_SSSE3)
+static LEX_TARGET_SSSE3 int scan_str_ssse3(const char *data, size_t *offp, size_t sz, uint32_t *prev, size_t *ncp)
+{
+  const __m128i quote  = _mm_set1_epi8('"');
+  const __m128i bslash = _mm_set1_epi8('\\');
+  const __m128i ctrl   = _mm_set1_epi8(0x1f);
+  const __m128i cont   = _mm_set1_epi8((char)0xc0);
+  size_t off = *offp;
+  size_t cnt = *ncp;
+  uint32_t p = *prev;
+  int ret = SCAN_TAIL;
+
+  for (; sz - off >= 16; off += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&data[off]);
+    __m128i stop = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+        _mm_cmpeq_epi8(_mm_subs_epu8(v, ctrl), _mm_setzero_si128()));
+    uint32_t smask = (uint32_t)_mm_movemask_epi8(stop);
+    uint32_t hmask = (uint32_t)_mm_movemask_epi8(v);
+    uint32_t lanes = 0xffff;
+
+    if (smask != 0) {
+      int k = __builtin_ctz(smask);
+      lanes = ((uint32_t)2 << k) - 1;
+    }
+
+    if ((hmask & lanes) == 0 && u8_clean(p)) {
+      // plain ASCII
+      cnt += __builtin_popcount(lanes);
+    } else {
+      __m128i err = u8_check16(v, _mm_set_epi32((int)(p << 8), 0, 0, 0));
+      uint32_t emask = 0xffff & ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(err, _mm_setzero_si128()));
+      uint32_t cmask;
+
+      if (emask & lanes) {
+        ret = SCAN_INVALID;
+        goto done;
+      }
+
+      cmask = (uint32_t)_mm_movemask_epi8(_mm_cmplt_epi8(v, cont));
+      cnt += __builtin_popcount(~cmask & lanes);
+    }
+
+    if (smask != 0) {
+      off += __builtin_ctz(smask);
+      p = (uint32_t)(unsigned char)data[off] << 16;
+      ret = SCAN_STOP;
+      goto done;
+    }
+
+    p = u8_reload(data, off+16);
+  }
+
+done:
+  *offp = off;
+  *prev = p;
+  *ncp = cnt;
+  return ret;
+}
+#endif /* LEX_SSSE3 */
+
+#if defined(LEX_AVX2)
+static LEX_TARGET_AVX2 int scan_str_avx2(const char *data, size_t *offp, size_t sz, uint32_t *prev, size_t *ncp)
+{
+  const __m256i quote  = _mm256_set1_epi8('"');
+  const __m256i bslash = _mm256_set1_epi8('\\');
+  const __m256i ctrl   = _mm256_set1_epi8(0x1f);
+  const __m256i cont   = _mm256_set1_epi8((char)0xc0);
+  size_t off = *offp;
+  size_t cnt = *ncp;
+  uint32_t p = *prev;
+  int ret = SCAN_TAIL;
+
+  for (; sz - off >= 32; off += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)&data[off]);
+    __m256i stop = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, bslash)),
+        _mm256_cmpeq_epi8(_mm256_subs_epu8(v, ctrl), _mm256_setzero_si256()));
+    uint32_t smask = (uint32_t)_mm256_movemask_epi8(stop);
+    uint32_t hmask = (uint32_t)_mm256_movemask_epi8(v);
+    uint32_t lanes = ~(uint32_t)0;
+    uint32_t emask, cmask;
+
+    if (smask != 0) {
+      int k = __builtin_ctz(smask);
+      lanes = (uint32_t)(((uint64_t)2 << k) - 1);
+    }
+
+    if ((hmask & lanes) == 0 && u8_clean(p)) {
+      // plain ASCII
+      cnt += __builtin_popcount(lanes);
+    } else {
+      __m256i err = u8_check32(v, _mm256_set_epi32((int)(p << 8), 0, 0, 0, 0, 0, 0, 0));
+      emask = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(err, _mm256_setzero_si256()));
+      if (emask & lanes) {
+        ret = SCAN_INVALID;
+        goto done;
+      }
+
+      cmask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(cont, v));
+      cnt += __builtin_popcount(~cmask & lanes);
+    }
+
+    if (smask != 0) {
+      off += __builtin_ctz(smask);
+      p = (uint32_t)(unsigned char)data[off] << 16;
+      ret = SCAN_STOP;
+      goto done;
+    }
+
+    p = u8_reload(data, off+32);
+  }
+
+  *offp = off;
+  *prev = p;
+  *ncp = cnt;
+  return scan_str_ssse3(data, offp, sz, prev, ncp);
+
+done:
+  *offp = off;
+  *prev = p;
+  *ncp = cnt;
+  return ret;
+}
+#endif /* LEX_AVX2 */
+
+#if defined(LEX_AVX512)
+static LEX_TARGET_AVX512 int scan_str_avx512(const char *data, size_t *offp, size_t sz, uint32_t *prev, size_t *ncp)
+{
+  const __m512i quote  = _mm512_set1_epi8('"');
+  const __m512i bslash = _mm512_set1_epi8('\\');
+  const __m512i ctrl   = _mm512_set1_epi8(0x1f);
+  const __m512i cont   = _mm512_set1_epi8((char)0xc0);
+  size_t off = *offp;
+  size_t cnt = *ncp;
+  uint32_t p = *prev;
+  int ret = SCAN_TAIL;
+
+  for (; sz - off >= 64; off += 64) {
+    __m512i v = _mm512_loadu_si512((const void *)&data[off]);
+    uint64_t smask = _mm512_cmpeq_epi8_mask(v, quote) | _mm512_cmpeq_epi8_mask(v, bslash) |
+      _mm512_cmple_epu8_mask(v, ctrl);
+    uint64_t hmask = _mm512_movepi8_mask(v);
+    uint64_t lanes = ~(uint64_t)0;
+
+    if (smask != 0) {
+      int k = __builtin_ctzll(smask);
+      lanes = ((uint64_t)2 << k) - 1;
+    }
+
+    if ((hmask & lanes) == 0 && u8_clean(p)) {
+      // plain ASCII
+      cnt += __builtin_popcountll(lanes);
+    } else {
+      __m512i err = u8_check64(v, _mm512_set_epi32((int)(p << 8), 0, 0, 0, 0, 0, 0, 0,
+            0, 0, 0, 0, 0, 0, 0, 0));
+      uint64_t emask = _mm512_test_epi8_mask(err, err);
+      uint64_t cmask;
+
+      if (emask & lanes) {
+        ret = SCAN_INVALID;
+        goto done;
+      }
+
+      cmask = _mm512_cmplt_epi8_mask(v, cont);
+      cnt += __builtin_popcountll(~cmask & lanes);
+    }
+
+    if (smask != 0) {
+      off += __builtin_ctzll(smask);
+      p = (uint32_t)(unsigned char)data[off] << 16;
+      ret = SCAN_STOP;
+      goto done;
+    }
+
+    p = u8_reload(data, off+64);
+  }
+
+  *offp = off;
+  *prev = p;
+  *ncp = cnt;
+  return scan_str_avx2(data, offp, sz, prev, ncp);
+
+done:
+  *offp = off;
+  *prev = p;
+  *ncp = cnt;
+  return ret;
+}
+#endif /* LEX_AVX512 */
+
+// Scans string data from data[*offp..sz), validating utf8 and counting
+// codepoints, up to and including the first byte that ends the fast
+// path: '"', '\\', or a control character (U+0000 to U+001F).  Whole
+// blocks are scanned by the lexer's string kernel, and the rest a byte
+// at a time.
+//
+// On return, *offp is the offset of that byte or sz if there isn't one,
+// *prev holds the utf8 state and *ncp has been advanced by the number
+// of codepoints scanned.  Codepoints are counted by their leading
+// bytes, so a sequence split across restarts is counted once.
+//
+// Returns non-zero if the data is not valid utf8.
+static int scan_str(const struct sjp_lexer_simd *simd, const char *data, size_t *offp, size_t sz, uint32_t *prev, size_t *ncp)
+{
+  size_t off, cnt;
+  uint32_t p;
+  int ret;
+
+  if (ret = simd->scan_str(data, offp, sz, prev, ncp), ret != SCAN_TAIL) {
+    return ret == SCAN_INVALID ? -1 : 0;
+  }
+
+  off = *offp;
+  cnt = *ncp;
+  p = *prev;
+
+  for (; off < sz; off++) {
+    unsigned ch = (unsigned char)data[off];
+
+    if (u8_next(&p, ch)) {
+      goto invalid;
+    }
+
+    cnt += (ch & 0xc0) != 0x80;
+    if (ch == '"' || ch == '\\' || ch < 0x20) {
+      break;
+    }
+  }
+
+  *offp = off;
+  *prev = p;
+  *ncp = cnt;
+  return 0;
+
+invalid:
+  *offp = off;
+  return -1;
+}
+
+// Updates the line position for the newlines in a block of data
+// starting at off.  Bit i of nl is set if data[off+i] is a newline.
+static inline void jl_newlines(struct sjp_lexer *l, size_t off, uint64_t nl)
+{
+  if (nl != 0) {
+    l->line += __builtin_popcountll(nl);
+    l->lbeg = l->base + off + (64 - __builtin_clzll(nl));
+  }
+}
+
+// Skips whitespace in data[off..end) a byte at a time.  Returns the
+// offset of the first byte that is not whitespace, or end.
+static inline size_t skip_ws_bytes(struct sjp_lexer *l, size_t off, size_t end)
+{
+  for (; off < end; off++) {
+    int ch = (unsigned char)l->data[off];
+
+    if (!(lex_class[ch] & LEX_WS)) {
+      break;
+    }
 
     if (ch == '\n') {
-      l->line--;
-      l->lbeg = l->prev_lbeg;
+      l->line++;
+      l->lbeg = l->base + off + 1;
+    }
+  }
+
+  return off;
+}
+
+// The whitespace kernels skip whitespace in data[off..sz) a block at a
+// time.  They return the offset of the first byte that is not
+// whitespace, or of the last partial block.
+
+static size_t skip_ws_scalar(struct sjp_lexer *l, size_t off, size_t sz)
+{
+  (void)l;
+  (void)sz;
+  return off;
+}
+
+#if defined(LEX_SSE2)
+static LEX_TARGET_SSE2 size_t skip_ws_sse2(struct sjp_lexer *l, size_t off, size_t sz)
+{
+  const __m128i sp = _mm_set1_epi8(' ');
+  const __m128i ht = _mm_set1_epi8('\t');
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+
+  for (; sz - off >= 16; off += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&l->data[off]);
+    __m128i vnl = _mm_cmpeq_epi8(v, nl);
+    __m128i ws = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, ht)),
+        _mm_or_si128(vnl, _mm_cmpeq_epi8(v, cr)));
+    uint32_t wmask = (uint32_t)_mm_movemask_epi8(ws);
+    uint32_t nlmask = (uint32_t)_mm_movemask_epi8(vnl);
+
+    if (wmask != 0xffff) {
+      int k = __builtin_ctz(~wmask);
+      jl_newlines(l, off, nlmask & (((uint32_t)1 << k) - 1));
+      return off + k;
+    }
+
+    jl_newlines(l, off, nlmask);
+  }
+
+  return off;
+}
+#endif /* LEX_SSE2 */
+
+#if defined(LEX_AVX2)
+static LEX_TARGET_AVX2 size_t skip_ws_avx2(struct sjp_lexer *l, size_t off, size_t sz)
+{
+  const __m256i sp = _mm256_set1_epi8(' ');
+  const __m256i ht = _mm256_set1_epi8('\t');
+  const __m256i nl = _mm256_set1_epi8('\n');
+  const __m256i cr = _mm256_set1_epi8('\r');
+
+  for (; sz - off >= 32; off += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)&l->data[off]);
+    __m256i vnl = _mm256_cmpeq_epi8(v, nl);
+    __m256i ws = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, ht)),
+        _mm256_or_si256(vnl, _mm256_cmpeq_epi8(v, cr)));
+    uint32_t wmask = (uint32_t)_mm256_movemask_epi8(ws);
+    uint32_t nlmask = (uint32_t)_mm256_movemask_epi8(vnl);
+
+    if (wmask != ~(uint32_t)0) {
+      int k = __builtin_ctz(~wmask);
+      jl_newlines(l, off, nlmask & (((uint32_t)1 << k) - 1));
+      return off + k;
+    }
+
+    jl_newlines(l, off, nlmask);
+  }
+
+  return skip_ws_sse2(l, off, sz);
+}
+#endif /* LEX_AVX2 */
+
+#if defined(LEX_AVX512)
+static LEX_TARGET_AVX512 size_t skip_ws_avx512(struct sjp_lexer *l, size_t off, size_t sz)
+{
+  const __m512i sp = _mm512_set1_epi8(' ');
+  const __m512i ht = _mm512_set1_epi8('\t');
+  const __m512i nl = _mm512_set1_epi8('\n');
+  const __m512i cr = _mm512_set1_epi8('\r');
+
+  for (; sz - off >= 64; off += 64) {
+    __m512i v = _mm512_loadu_si512((const void *)&l->data[off]);
+    uint64_t nlmask = _mm512_cmpeq_epi8_mask(v, nl);
+    uint64_t wmask = _mm512_cmpeq_epi8_mask(v, sp) | _mm512_cmpeq_epi8_mask(v, ht) |
+      _mm512_cmpeq_epi8_mask(v, cr) | nlmask;
+
+    if (wmask != ~(uint64_t)0) {
+      int k = __builtin_ctzll(~wmask);
+      jl_newlines(l, off, nlmask & (((uint64_t)1 << k) - 1));
+      return off + k;
+    }
+
+    jl_newlines(l, off, nlmask);
+  }
+
+  return skip_ws_avx2(l, off, sz);
+}
+#endif /* LEX_AVX512 */
+
+// The skip kernels find the next byte that sjp_lexer_skip() looks at in
+// data[off..sz) a block at a time: '"' or '\\' in a string (instr is
+// non-zero), and '"', ',' or a bracket outside of one.  They count the
+// newlines before that byte, and return its offset, or the offset of
+// the last partial block.
+
+static size_t skip_find_scalar(struct sjp_lexer *l, size_t off, size_t sz, int instr)
+{
+  (void)l;
+  (void)sz;
+  (void)instr;
+  return off;
+}
+
+#if defined(LEX_SSE2)
+static LEX_TARGET_SSE2 size_t skip_find_sse2(struct sjp_lexer *l, size_t off, size_t sz, int instr)
+{
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i bslash = _mm_set1_epi8('\\');
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i lower = _mm_set1_epi8(0x20);   // '[' | 0x20 == '{', ']' | 0x20 == '}'
+  const __m128i ocurly = _mm_set1_epi8('{');
+  const __m128i ccurly = _mm_set1_epi8('}');
+
+  for (; sz - off >= 16; off += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&l->data[off]);
+    __m128i m = _mm_cmpeq_epi8(v, quote);
+    uint32_t mask, nlmask;
+
+    if (instr) {
+      m = _mm_or_si128(m, _mm_cmpeq_epi8(v, bslash));
+    } else {
+      __m128i vl = _mm_or_si128(v, lower);
+      m = _mm_or_si128(_mm_or_si128(m, _mm_cmpeq_epi8(v, comma)),
+          _mm_or_si128(_mm_cmpeq_epi8(vl, ocurly), _mm_cmpeq_epi8(vl, ccurly)));
+    }
+
+    mask = (uint32_t)_mm_movemask_epi8(m);
+    nlmask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+
+    if (mask != 0) {
+      int k = __builtin_ctz(mask);
+      jl_newlines(l, off, nlmask & (((uint32_t)1 << k) - 1));
+      return off + k;
+    }
+
+    jl_newlines(l, off, nlmask);
+  }
+
+  return off;
+}
+#endif /* LEX_SSE2 */
+
+#if defined(LEX_AVX2)
+static LEX_TARGET_AVX2 size_t skip_find_avx2(struct sjp_lexer *l, size_t off, size_t sz, int instr)
+{
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i bslash = _mm256_set1_epi8('\\');
+  const __m256i comma = _mm256_set1_epi8(',');
+  const __m256i nl = _mm256_set1_epi8('\n');
+  const __m256i lower = _mm256_set1_epi8(0x20);
+  const __m256i ocurly = _mm256_set1_epi8('{');
+  const __m256i ccurly = _mm256_set1_epi8('}');
+
+  for (; sz - off >= 32; off += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)&l->data[off]);
+    __m256i m = _mm256_cmpeq_epi8(v, quote);
+    uint32_t mask, nlmask;
+
+    if (instr) {
+      m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, bslash));
+    } else {
+      __m256i vl = _mm256_or_si256(v, lower);
+      m = _mm256_or_si256(_mm256_or_si256(m, _mm256_cmpeq_epi8(v, comma)),
+          _mm256_or_si256(_mm256_cmpeq_epi8(vl, ocurly), _mm256_cmpeq_epi8(vl, ccurly)));
+    }
+
+    mask = (uint32_t)_mm256_movemask_epi8(m);
+    nlmask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+
+    if (mask != 0) {
+      int k = __builtin_ctz(mask);
+      jl_newlines(l, off, nlmask & (((uint32_t)1 << k) - 1));
+      return off + k;
     }
+
+    jl_newlines(l, off, nlmask);
   }
+
+  return skip_find_sse2(l, off, sz, instr);
+}
+#endif /* LEX_AVX2 */
+
+#if defined(LEX_AVX512)
+static LEX_TARGET_AVX512 size_t skip_find_avx512(struct sjp_lexer *l, size_t off, size_t sz, int instr)
+{
+  const __m512i quote = _mm512_set1_epi8('"');
+  const __m512i bslash = _mm512_set1_epi8('\\');
+  const __m512i comma = _mm512_set1_epi8(',');
+  const __m512i nl = _mm512_set1_epi8('\n');
+  const __m512i lower = _mm512_set1_epi8(0x20);
+  const __m512i ocurly = _mm512_set1_epi8('{');
+  const __m512i ccurly = _mm512_set1_epi8('}');
+
+  for (; sz - off >= 64; off += 64) {
+    __m512i v = _mm512_loadu_si512((const void *)&l->data[off]);
+    uint64_t mask = _mm512_cmpeq_epi8_mask(v, quote);
+    uint64_t nlmask = _mm512_cmpeq_epi8_mask(v, nl);
+
+    if (instr) {
+      mask |= _mm512_cmpeq_epi8_mask(v, bslash);
+    } else {
+      __m512i vl = _mm512_or_si512(v, lower);
+      mask |= _mm512_cmpeq_epi8_mask(v, comma) |
+        _mm512_cmpeq_epi8_mask(vl, ocurly) | _mm512_cmpeq_epi8_mask(vl, ccurly);
+    }
+
+    if (mask != 0) {
+      int k = __builtin_ctzll(mask);
+      jl_newlines(l, off, nlmask & (((uint64_t)1 << k) - 1));
+      return off + k;
+    }
+
+    jl_newlines(l, off, nlmask);
+  }
+
+  return skip_find_avx2(l, off, sz, instr);
+}
+#endif /* LEX_AVX512 */
+
+// Kernels for each level, in order
+static const struct sjp_lexer_simd simd_kernels[] = {
+  { SJP_SIMD_SCALAR, scan_str_scalar, skip_ws_scalar, skip_find_scalar },
+#if defined(LEX_SSE2)
+  { SJP_SIMD_SSE2,   scan_str_sse2,   skip_ws_sse2,   skip_find_sse2 },
+#endif
+#if defined(LEX_SSSE3)
+  { SJP_SIMD_SSSE3,  scan_str_ssse3,  skip_ws_sse2,   skip_find_sse2 },
+#endif
+#if defined(LEX_AVX2)
+  { SJP_SIMD_AVX2,   scan_str_avx2,   skip_ws_avx2,   skip_find_avx2 },
+#endif
+#if defined(LEX_AVX512)
+  { SJP_SIMD_AVX512, scan_str_avx512, skip_ws_avx512, skip_find_avx512 },
+#endif
+};
+
+// names for SJP_SIMD, indexed by level
+static const char *const simd_names[] = { "scalar", "sse2", "ssse3", "avx2", "avx512" };
+
+enum { SIMD_NKERNELS = sizeof simd_kernels / sizeof simd_kernels[0] };
+
+// kernels for new lexers, or NULL before the first lexer
+static const struct sjp_lexer_simd *simd_current;
+
+// Lexers can be initialized on several threads at once, so
+// simd_current is read and set atomically where the compiler has the
+// builtins.
+static const struct sjp_lexer_simd *simd_load(void)
+{
+#if defined(__GNUC__)
+  return __atomic_load_n(&simd_current, __ATOMIC_ACQUIRE);
+#else
+  return simd_current;
+#endif
+}
+
+static void simd_store(const struct sjp_lexer_simd *k)
+{
+#if defined(__GNUC__)
+  __atomic_store_n(&simd_current, k, __ATOMIC_RELEASE);
+#else
+  simd_current = k;
+#endif
+}
+
+// Sets simd_current to k unless it's already set, and returns what it
+// is, so the default doesn't replace a level set in the meantime
+static const struct sjp_lexer_simd *simd_store_default(const struct sjp_lexer_simd *k)
+{
+#if defined(__GNUC__)
+  const struct sjp_lexer_simd *cur = NULL;
+
+  if (!__atomic_compare_exchange_n(&simd_current, &cur, k, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    return cur;
+  }
+#else
+  simd_current = k;
+#endif
+  return k;
+}
+
+// Returns the best kernels that the CPU supports
+static const struct sjp_lexer_simd *simd_best(void)
+{
+  int i = SIMD_NKERNELS-1;
+
+#if defined(LEX_DISPATCH)
+  __builtin_cpu_init();
+  while (i > 0) {
+    switch (simd_kernels[i].level) {
+      case SJP_SIMD_AVX512:
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+          return &simd_kernels[i];
+        }
+        break;
+
+      case SJP_SIMD_AVX2:
+        if (__builtin_cpu_supports("avx2")) {
+          return &simd_kernels[i];
+        }
+        break;
+
+      case SJP_SIMD_SSSE3:
+        if (__builtin_cpu_supports("ssse3")) {
+          return &simd_kernels[i];
+        }
+        break;
+
+      case SJP_SIMD_SSE2:
+        if (__builtin_cpu_supports("sse2")) {
+          return &simd_kernels[i];
+        }
+        break;
+
+      default:
+        break;
+    }
+    i--;
+  }
+#endif /* LEX_DISPATCH */
+
+  return &simd_kernels[i];
+}
+
+// Returns the best kernels at or below level
+static const struct sjp_lexer_simd *simd_lower(const struct sjp_lexer_simd *best, enum SJP_SIMD level)
+{
+  const struct sjp_lexer_simd *k = best;
+
+  while (k > simd_kernels && k->level > level) {
+    k--;
+  }
+
+  return k;
+}
+
+static const struct sjp_lexer_simd *simd_kernels_default(void)
+{
+  const struct sjp_lexer_simd *k;
+  const char *env;
+  int i;
+
+  if (k = simd_load(), k != NULL) {
+    return k;
+  }
+
+  k = simd_best();
+  if (env = getenv("SJP_SIMD"), env != NULL) {
+    for (i=0; i < (int)(sizeof simd_names / sizeof simd_names[0]); i++) {
+      if (strcmp(env, simd_names[i]) == 0) {
+        k = simd_lower(k, (enum SJP_SIMD)i);
+        break;
+      }
+    }
+  }
+
+  return simd_store_default(k);
+}
+
+enum SJP_SIMD sjp_lexer_simd_level(void)
+{
+  return simd_kernels_default()->level;
+}
+
+enum SJP_SIMD sjp_lexer_set_simd_level(enum SJP_SIMD level)
+{
+  const struct sjp_lexer_simd *k = simd_lower(simd_best(), level);
+
+  simd_store(k);
+  return k->level;
+}
+
+const char *sjp_lexer_simd_name(enum SJP_SIMD level)
+{
+  if ((unsigned)level >= sizeof simd_names / sizeof simd_names[0]) {
+    return "unknown";
+  }
+
+  return simd_names[level];
 }
 
 // Initializes the lexer state, reseting its state
@@ -52,12 +1082,24 @@ void sjp_lexer_init(struct sjp_lexer *l)
   l->off = 0;
   l->data = NULL;
 
+  l->base = 0;
   l->line = 0;
   l->lbeg = 0;
-  l->prev_lbeg = 0;
 
-  l->u8st = 0;
-  l->u8cp = 0;
+  l->u8prev = 0;
+  l->ncp = 0;
+
+  l->inum = 0;
+  l->shape = 0;
+  l->opts = 0;
+  l->hash = SJP_HASH_INIT;
+
+  l->simd = simd_kernels_default();
+
+  l->ro = 0;
+  l->scratch = NULL;
+  l->nscratch = 0;
+  l->scratch_off = 0;
 
   memset(l->buf, 0, sizeof l->buf);
   l->state = SJP_LST_VALUE;
@@ -69,9 +1111,101 @@ void sjp_lexer_init(struct sjp_lexer *l)
 // The caller may pass the same data buffer to the lexer.
 void sjp_lexer_more(struct sjp_lexer *l, char *data, size_t n)
 {
+  l->base += l->off;
   l->data = data;
   l->sz = n;
   l->off = 0;
+  l->ro = 0;
+}
+
+void sjp_lexer_more_const(struct sjp_lexer *l, const char *data, size_t n)
+{
+  l->base += l->off;
+  l->data = data;
+  l->sz = n;
+  l->off = 0;
+  l->ro = 1;
+}
+
+enum SJP_RESULT sjp_lexer_set_scratch(struct sjp_lexer *l, char *buf, size_t n)
+{
+  if (buf != NULL && n < SJP_LEX_RESTART_SIZE) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  l->scratch = buf;
+  l->nscratch = (buf != NULL) ? n : 0;
+  l->scratch_off = 0;
+  return SJP_OK;
+}
+
+// Loads 8 bytes without alignment.  Keywords are compared as loaded
+// words against words loaded from the keyword text, so the comparison
+// doesn't depend on the byte order.
+static inline uint64_t kw_word(const char *p)
+{
+  uint64_t w;
+  memcpy(&w, p, sizeof w);
+  return w;
+}
+
+static inline int kw_delim(int ch)
+{
+  return (lex_class[(unsigned char)ch] & (LEX_WS|LEX_DELIM)) != 0;
+}
+
+// Matches a keyword with one 8 byte load when the keyword and the
+// character after it are both in the buffer.  The word is masked to the
+// length of the keyword, and the character after it must be a
+// delimiter.
+//
+// Returns zero if the input isn't a keyword followed by a delimiter:
+// parse_kw() then takes the byte-wise path, which also reports errors.
+static inline int parse_kw_word(struct sjp_lexer *l, struct sjp_token *tok)
+{
+  static const char mask4[8] = { -1, -1, -1, -1,  0, 0, 0, 0 };
+  static const char mask5[8] = { -1, -1, -1, -1, -1, 0, 0, 0 };
+  const char *p = &l->data[l->off];
+  uint64_t w, kw, mask;
+  enum SJP_TOKEN type;
+  size_t n;
+
+  w = kw_word(p);
+  switch (p[0]) {
+    case 't':
+      kw = kw_word("true\0\0\0\0");
+      mask = kw_word(mask4);
+      type = SJP_TOK_TRUE;
+      n = 4;
+      break;
+
+    case 'f':
+      kw = kw_word("false\0\0\0");
+      mask = kw_word(mask5);
+      type = SJP_TOK_FALSE;
+      n = 5;
+      break;
+
+    case 'n':
+      kw = kw_word("null\0\0\0\0");
+      mask = kw_word(mask4);
+      type = SJP_TOK_NULL;
+      n = 4;
+      break;
+
+    default:
+      return 0;
+  }
+
+  if ((w & mask) != kw || !kw_delim(p[n])) {
+    return 0;
+  }
+
+  tok->type = type;
+  tok->value = &l->data[l->off];
+  tok->n = n;
+  l->off += n;
+  return 1;
 }
 
 static int parse_kw(struct sjp_lexer *l, struct sjp_token *tok)
@@ -136,6 +1270,17 @@ static int parse_kw(struct sjp_lexer *l, struct sjp_token *tok)
     goto partial;
   }
 
+  // The keyword must end at a delimiter ("truex" isn't a keyword).  At
+  // the end of the buffer, keep it in the restart buffer until the next
+  // byte, or the end of the stream, shows where it ends.
+  if (l->off >= l->sz && !jl_eos(l)) {
+    goto partial;
+  }
+
+  if (l->off < l->sz && !kw_delim(l->data[l->off])) {
+    goto invalid;
+  }
+
   // on restart, return internal buffer
   if (l->state == SJP_LST_KEYWORD) {
     tok->value = &l->buf[0];
@@ -145,15 +1290,6 @@ static int parse_kw(struct sjp_lexer *l, struct sjp_token *tok)
     tok->n = l->off - off0;
   }
 
-  // XXX - this doesn't check that the next character
-  // is a delimiter or whitespace.  the json grammar
-  // doesn't appare to clearly require this, though.
-  //
-  // The grammar essentially requires some kind of delimitter
-  // after a keyword, so omiting the check is probably okay.
-  //
-  // Need to revisit this, though.
-
   l->state = SJP_LST_VALUE;
   return SJP_OK;
 
@@ -179,22 +1315,60 @@ invalid:
   return SJP_INVALID_INPUT;
 }
 
-static int tohex(int ch)
+// Hex digits of \uXYZW escapes.  Each entry is the digit's value with
+// HEX_DIGIT set, or zero if the byte isn't a hex digit.
+enum {
+  HEX_DIGIT = 0x10,
+};
+
+#define HD(v) (HEX_DIGIT | (v))
+static const uint8_t hex_tab[256] = {
+  ['0'] = HD(0x0), ['1'] = HD(0x1), ['2'] = HD(0x2), ['3'] = HD(0x3),
+  ['4'] = HD(0x4), ['5'] = HD(0x5), ['6'] = HD(0x6), ['7'] = HD(0x7),
+  ['8'] = HD(0x8), ['9'] = HD(0x9),
+  ['A'] = HD(0xA), ['B'] = HD(0xB), ['C'] = HD(0xC), ['D'] = HD(0xD), ['E'] = HD(0xE), ['F'] = HD(0xF),
+  ['a'] = HD(0xA), ['b'] = HD(0xB), ['c'] = HD(0xC), ['d'] = HD(0xD), ['e'] = HD(0xE), ['f'] = HD(0xF),
+};
+#undef HD
+
+static inline int tohex(int ch)
 {
-  // XXX - make this portable?
-  if (ch >= '0' && ch <= '9') {
-    return ch-'0';
-  }
+  unsigned h = hex_tab[(unsigned char)ch];
+  return (h & HEX_DIGIT) ? (int)(h & 0xf) : -1;
+}
+
+// Decodes the four hex digits of a \uXYZW escape with one branch for
+// the quad.  Returns -1 if any of them isn't a hex digit.
+static inline long hex4(const char *s)
+{
+  unsigned a = hex_tab[(unsigned char)s[0]];
+  unsigned b = hex_tab[(unsigned char)s[1]];
+  unsigned c = hex_tab[(unsigned char)s[2]];
+  unsigned d = hex_tab[(unsigned char)s[3]];
 
-  if (ch >= 'A' && ch <= 'F') {
-    return ch-'A'+10;
+  if ((a & b & c & d & HEX_DIGIT) == 0) {
+    return -1;
   }
 
-  if (ch >= 'a' && ch <= 'f') {
-    return ch-'a'+10;
+  return ((long)(a & 0xf) << 12) | ((b & 0xf) << 8) | ((c & 0xf) << 4) | (d & 0xf);
+}
+
+// UTF-16 surrogates: a high surrogate (U+D800 to U+DBFF) must be
+// followed by a low surrogate (U+DC00 to U+DFFF)
+static inline int u16_is_surrogate(long u)
+{
+  return u >= 0xD800 && u < 0xE000;
+}
+
+// Combines a surrogate pair into a codepoint.  Returns -1 if the pair
+// isn't a high surrogate followed by a low surrogate.
+static inline long u16_combine(long hi, long lo)
+{
+  if (hi < 0xD800 || hi >= 0xDC00 || lo < 0xDC00 || lo >= 0xE000) {
+    return -1;
   }
 
-  return -1;
+  return 0x10000 + (((hi - 0xD800) << 10) | (lo - 0xDC00));
 }
 
 static int utf8_enc(char buf[4], long cp)
@@ -224,30 +1398,39 @@ static int utf8_enc(char buf[4], long cp)
   return 4;
 }
 
-static int u16cp(const char *buf)
-{
-  return (tohex(buf[0]) << 12) + (tohex(buf[1]) << 8) + (tohex(buf[2]) << 4) + tohex(buf[3]);
-}
-
-static int u16pair(const char buf[8])
-{
-  int p1 = u16cp(&buf[0]);
-  int p2 = u16cp(&buf[4]);
-  int cp = 0x10000 + ((p1 - 0xD800) << 10) | ((p2 - 0xDC00));
-
-  // fprintf(stderr, "0x%04X 0x%04X %d\n", p1,p2,cp);
-  return cp;
-}
+// Where parse_str() writes decoded escapes
+enum {
+  STR_INPLACE = 0,  // over the escapes, in the lexer's data
+  STR_SCRATCH,      // in the scratch buffer (const data)
+  STR_VALIDATE,     // nowhere, the escapes are only validated (const data)
+};
 
 static int parse_str(struct sjp_lexer *l, struct sjp_token *tok)
 {
-  size_t off0, outInd;
+  size_t off0, obeg, outInd;
+  char *out;
+  int mode;
   int ch;
 
   off0 = l->off;
-  outInd = off0;
   tok->type = SJP_TOK_STRING;
 
+  // the decoded string is out[obeg..outInd)
+  if (!l->ro) {
+    mode = STR_INPLACE;
+    out = (char *)l->data;
+    obeg = off0;
+  } else if (l->scratch != NULL) {
+    mode = STR_SCRATCH;
+    out = l->scratch;
+    obeg = l->scratch_off;
+  } else {
+    mode = STR_VALIDATE;
+    out = NULL;
+    obeg = off0;
+  }
+  outInd = obeg;
+
   switch (l->state) {
     case SJP_LST_STR_ESC1: goto read_esc;
     case SJP_LST_STR_ESC2: goto read_udig1; 
@@ -264,9 +1447,9 @@ static int parse_str(struct sjp_lexer *l, struct sjp_token *tok)
 
     case SJP_LST_VALUE:
       l->state = SJP_LST_STR;
-      l->u8st  = 0;
-      l->u8cp  = 0;
+      l->u8prev = 0;
       l->ncp = 0;
+      l->shape = 0;
       /* fallthrough */
 
     case SJP_LST_STR:
@@ -279,39 +1462,58 @@ static int parse_str(struct sjp_lexer *l, struct sjp_token *tok)
 
   // fast path: no escapes, scan for next '"'
 fast_path:
-  while (ch = jl_getc(l), ch != EOF) {
-    uint32_t dec;
-    
-    dec = u8_decode(&l->u8st, &l->u8cp, (uint32_t)ch);
-    if (dec == UTF8_ACCEPT) {
-      l->ncp++;
-    } else if (dec == UTF8_REJECT) {
+  tok->shape = l->shape;
+  if (l->data != NULL) {
+    if (scan_str(l->simd, l->data, &l->off, l->sz, &l->u8prev, &l->ncp) != 0) {
       l->state = SJP_LST_VALUE;
       return SJP_INVALID_CHAR;
     }
 
-    if (ch == '"') {
+    if (l->off < l->sz) {
+      ch = (unsigned char)l->data[l->off++];
+
+      if (ch == '"') {
         l->state = SJP_LST_VALUE;
         tok->value = &l->data[off0];
         tok->n = l->off - off0 - 1; // last -1 is to omit the trailing "
         tok->extra.ncp = l->ncp - 1;
         return SJP_OK;
-    }
+      }
 
-    // control characters aren't allowed.  RFC 7159 defines them
-    // as U+0000 to U+001F
-    if (ch < 0x1f) {
-      l->state = SJP_LST_VALUE;
-      return SJP_INVALID_CHAR;
-    }
+      // control characters aren't allowed.  RFC 7159 defines them
+      // as U+0000 to U+001F
+      if (ch < 0x20) {
+        l->state = SJP_LST_VALUE;
+        return SJP_INVALID_CHAR;
+      }
 
-    if (ch == '\\') {
-      // have to rewrite the string for escapes,
-      // so we can't use the fast path.
-      // 
+      // otherwise ch is '\\', and we have to rewrite the string for
+      // escapes, so we can't use the fast path.
+      //
       // jump into the slow path at the point we read the escape
       // character
-      outInd = l->off-1;
+      l->shape |= SJP_STR_ESCAPED;
+      switch (mode) {
+        case STR_INPLACE:
+          outInd = l->off-1;
+          break;
+
+        case STR_SCRATCH:
+          // copy the run before the escape.  If it doesn't fit, return
+          // it as is and decode the escape on the next call.
+          if (l->off-1 - off0 + 4 > l->nscratch - outInd) {
+            l->state = SJP_LST_STR_ESC1;
+            tok->value = &l->data[off0];
+            tok->n = l->off-1 - off0;
+            return SJP_PARTIAL;
+          }
+
+          memcpy(&out[outInd], &l->data[off0], l->off-1 - off0);
+          outInd += l->off-1 - off0;
+          break;
+      }
+
+      tok->shape = l->shape;
       goto read_esc;
     }
   }
@@ -328,42 +1530,72 @@ fast_path:
   return SJP_MORE;
 
   // slow_path:
-  //   string has escapes, so we need to rewrite it
+  //   string has escapes, so we need to rewrite it.  The runs between
+  //   escapes are validated by scan_str() and moved down over the
+  //   escapes (or copied to the scratch buffer) with a single
+  //   memmove().
 
   // outInd MUST be set correctly at this point
 
-  while (ch = jl_getc(l), ch != EOF) {
-    uint32_t dec;
+  while (l->data != NULL) {
+    size_t run = l->off;
+    size_t lim = l->sz;
     long cp;
     int hexdig;
 
-    dec = u8_decode(&l->u8st, &l->u8cp, (uint32_t)ch);
-    if (dec == UTF8_ACCEPT) {
-      l->ncp++;
-    } else if (dec == UTF8_REJECT) {
+    // in the scratch buffer, leave room for the next escape
+    if (mode == STR_SCRATCH && l->nscratch - outInd < lim - run + 4) {
+      if (l->nscratch - outInd <= 4) {
+        goto full;
+      }
+      lim = run + (l->nscratch - outInd - 4);
+    }
+
+    if (scan_str(l->simd, l->data, &l->off, lim, &l->u8prev, &l->ncp) != 0) {
       l->state = SJP_LST_VALUE;
       return SJP_INVALID_CHAR;
     }
 
+    // escapes only shrink the string, so outInd <= run in place
+    if (mode == STR_SCRATCH || (mode == STR_INPLACE && outInd != run)) {
+      memmove(&out[outInd], &l->data[run], l->off - run);
+    }
+    outInd += l->off - run;
+
+    if (l->off >= lim) {
+      if (lim < l->sz) {
+        goto full;
+      }
+      break;
+    }
+
+    ch = (unsigned char)l->data[l->off++];
+
     if (ch == '"') {
       l->state = SJP_LST_VALUE;
-      tok->value = &l->data[off0];
-      tok->n = outInd - off0;
+      if (mode == STR_VALIDATE) {
+        tok->value = &l->data[off0];
+        tok->n = l->off - off0 - 1;
+      } else {
+        tok->value = &out[obeg];
+        tok->n = outInd - obeg;
+      }
       tok->extra.ncp = l->ncp - 1;
+      tok->shape = l->shape;
+      if (mode == STR_SCRATCH) {
+        l->scratch_off = outInd;
+      }
       return SJP_OK;
     }
 
     // control characters aren't allowed.  RFC 7159 defines them
     // as U+0000 to U+001F
-    if (ch < 0x1f) {
+    if (ch < 0x20) {
       l->state = SJP_LST_VALUE;
       return SJP_INVALID_CHAR;
     }
 
-    if (ch != '\\') {
-      l->data[outInd++] = ch;
-      continue;
-    }
+    // otherwise ch is '\\'
 
 read_esc:
     // handle escapes
@@ -378,35 +1610,59 @@ read_esc:
         return SJP_INVALID_ESCAPE;
 
       case '"': case '\\': case '/':
-        l->data[outInd++] = ch;
         break;
 
       case 'b':
-        l->data[outInd++] = '\b';
+        ch = '\b';
         break;
 
       case 'f':
-        l->data[outInd++] = '\f';
+        ch = '\f';
         break;
 
       case 'n':
-        l->data[outInd++] = '\n';
+        ch = '\n';
         break;
 
       case 'r':
-        l->data[outInd++] = '\r';
+        ch = '\r';
         break;
 
       case 't':
-        l->data[outInd++] = '\t';
+        ch = '\t';
         break;
 
       case 'u':
         // \uXYZW escape
+        //
+        // if all of the digits are in the buffer (and, for a surrogate
+        // pair, the second escape), decode them in place.
+        if (l->sz - l->off >= 4 && (cp = hex4(&l->data[l->off]), cp >= 0)) {
+          if (!u16_is_surrogate(cp)) {
+            l->off += 4;
+            goto encode_utf8;
+          }
+
+          if (l->sz - l->off >= 10) {
+            const char *lo = &l->data[l->off+4];
+            long cp2;
+
+            if (lo[0] == '\\' && lo[1] == 'u' && (cp2 = hex4(&lo[2]), cp2 >= 0)) {
+              if (cp = u16_combine(cp, cp2), cp < 0) {
+                l->state = SJP_LST_VALUE;
+                return SJP_INVALID_U16PAIR;
+              }
+
+              l->off += 10;
+              goto encode_utf8;
+            }
+          }
+        }
 
-        // to enable restarts, we suck the digits into l->buf
-        // and only calculate the codepoint once we have all of the
-        // digits
+        // otherwise the escape is split across buffers or is invalid.
+        // To enable restarts, we suck the digits into l->buf and only
+        // calculate the codepoint once we have all of the digits.  An
+        // invalid escape is found here, too.
 
 read_udig1:
         if (ch = jl_getc(l), ch == EOF) {
@@ -465,13 +1721,12 @@ read_udig4:
         l->buf[3] = ch;  // in case of restart
 
         // check if the character is a surrogate pair
-        if (l->buf[0] == 'D' && tohex(l->buf[1]) >= 8) {
+        if (cp = hex4(&l->buf[0]), u16_is_surrogate(cp)) {
           goto read_pair0;
         }
 
 /* encode_bmp: */
-        // now calculate unicode char for BMP
-        cp = u16cp(&l->buf[0]);
+        // otherwise it's a codepoint in the BMP
         goto encode_utf8;
 
 read_pair0:
@@ -556,7 +1811,10 @@ read_pair5:
 
         l->buf[7] = ch;  // in case of restart
 
-        cp = u16pair(&l->buf[0]);
+        if (cp = u16_combine(hex4(&l->buf[0]), hex4(&l->buf[4])), cp < 0) {
+          l->state = SJP_LST_VALUE;
+          return SJP_INVALID_U16PAIR;
+        }
         goto encode_utf8;
 
 encode_utf8:
@@ -565,14 +1823,18 @@ encode_utf8:
           int i,nb;
           nb = utf8_enc(&l->buf[0], cp);
 
+          if (mode == STR_VALIDATE) {
+            goto esc_done;
+          }
+
           // make sure we have room to emit the utf8 in the string.
           // otherwise, return a PARTIAL with data from the buffer and 
           //
           // utf8 encodes in 1-4 bytes, and \uXYZW is six bytes, so this
           // only matters on a restart.  Because it's a restart, there's
-          // no existing string, so emit the buffer
-          assert(l->off >= outInd);
-          if ((int64_t)nb > (int64_t)(l->off - outInd)) {
+          // no existing string, so emit the buffer.  The scratch buffer
+          // always has room for an escape.
+          if (mode == STR_INPLACE && (int64_t)nb > (int64_t)(l->off - outInd)) {
             assert(outInd == off0);
             tok->value = &l->buf[0];
             tok->n = nb;
@@ -580,16 +1842,25 @@ encode_utf8:
             return SJP_PARTIAL;
           }
 
+          assert(mode == STR_INPLACE || l->nscratch - outInd >= (size_t)nb);
+
           // otherwise keep going...
           for (i=0; i < nb; i++) {
-            l->data[outInd++] = l->buf[i];
-            // fprintf(stderr, "0x%02X ", (unsigned char)l->buf[i]);
+            out[outInd++] = l->buf[i];
           }
-          // fprintf(stderr, "\n");
         }
 
-        break;
+        goto esc_done;
+    }
+
+    if (mode != STR_VALIDATE) {
+      out[outInd++] = ch;
     }
+
+esc_done:
+    // the escape is complete.  If it was restarted, the rest of the
+    // string should not be read as part of the escape.
+    l->state = SJP_LST_STR;
   }
 
 partial:
@@ -600,24 +1871,131 @@ partial:
     return SJP_UNFINISHED_INPUT;
   }
 
-  tok->value = &l->data[off0];
-  tok->n = outInd - off0;
+  tok->shape = l->shape;
+  if (mode == STR_VALIDATE) {
+    tok->value = &l->data[off0];
+    tok->n = l->off - off0;
+  } else {
+    tok->value = &out[obeg];
+    tok->n = outInd - obeg;
+  }
+  if (mode == STR_SCRATCH) {
+    l->scratch_off = outInd;
+  }
   return SJP_MORE;
+
+full:
+  // the scratch buffer is full: return what's been decoded so far, and
+  // continue on the next call
+  l->state = SJP_LST_STR;
+  l->scratch_off = outInd;
+  tok->shape = l->shape;
+  tok->value = &out[obeg];
+  tok->n = outInd - obeg;
+  return SJP_PARTIAL;
+}
+
+enum SJP_RESULT sjp_unescape(const char *text, size_t n, char *out, size_t *nout)
+{
+  size_t i = 0, o = 0;
+
+  while (i < n) {
+    const char *bs = memchr(&text[i], '\\', n - i);
+    size_t run = (bs != NULL) ? (size_t)(bs - &text[i]) : n - i;
+    long cp, lo;
+
+    if (out != text || o != i) {
+      memmove(&out[o], &text[i], run);
+    }
+    i += run;
+    o += run;
+
+    if (i >= n) {
+      break;
+    }
+
+    if (n - i < 2) {
+      return SJP_INVALID_ESCAPE;
+    }
+
+    switch (text[i+1]) {
+      case '"': case '\\': case '/':
+        out[o++] = text[i+1];
+        break;
+
+      case 'b': out[o++] = '\b'; break;
+      case 'f': out[o++] = '\f'; break;
+      case 'n': out[o++] = '\n'; break;
+      case 'r': out[o++] = '\r'; break;
+      case 't': out[o++] = '\t'; break;
+
+      case 'u':
+        // same checks as the lexer: a surrogate must be the first of a
+        // pair of escapes
+        if (n - i < 6 || (cp = hex4(&text[i+2]), cp < 0)) {
+          return SJP_INVALID_ESCAPE;
+        }
+
+        if (u16_is_surrogate(cp)) {
+          if (n - i < 12 || text[i+6] != '\\' || text[i+7] != 'u') {
+            return SJP_INVALID_U16PAIR;
+          }
+
+          if (lo = hex4(&text[i+8]), lo < 0) {
+            return SJP_INVALID_ESCAPE;
+          }
+
+          if (cp = u16_combine(cp, lo), cp < 0) {
+            return SJP_INVALID_U16PAIR;
+          }
+
+          i += 6;
+        }
+
+        // the escape is at least six bytes, so this doesn't overrun the
+        // text when decoding in place
+        o += utf8_enc(&out[o], cp);
+        i += 4;
+        break;
+
+      default:
+        return SJP_INVALID_ESCAPE;
+    }
+
+    i += 2;
+  }
+
+  *nout = o;
+  return SJP_OK;
 }
 
+// sjp_lexer.shape holds the shape of the number (SJP_NUM_NEG,
+// SJP_NUM_FRAC, SJP_NUM_EXP) and:
+enum {
+  LEX_NUM_BIG = 1 << 8, // integer part doesn't fit in 64 bits
+};
+
+enum { LEX_NUM_SHAPE = SJP_NUM_NEG | SJP_NUM_FRAC | SJP_NUM_EXP };
+
 static int parse_num(struct sjp_lexer *l, struct sjp_token *tok)
 {
   size_t off0;
+  uint64_t acc = 0; // integer part
   int ch;
 
   off0 = l->off;
   tok->type = SJP_TOK_NUMBER;
   tok->value = &l->data[off0];
+  tok->kind = SJP_NUM_DOUBLE;
+  tok->num.i64 = 0;
+  tok->shape = 0;
 
   // ch = jl_getc(l);
   switch (l->state) {
     case SJP_LST_VALUE:
       l->buf[0] = 1; // offset in buffer
+      l->inum = 0;
+      l->shape = 0;
       ch = jl_getc(l);
       break;
 
@@ -627,7 +2005,9 @@ static int parse_num(struct sjp_lexer *l, struct sjp_token *tok)
       goto st_neg;   // leading '-'
 
     case SJP_LST_NUM_DIG0: goto st_dig0; // leading '0'
-    case SJP_LST_NUM_DIG:  goto st_dig;  // leading '1' .. '9'
+    case SJP_LST_NUM_DIG:                // leading '1' .. '9'
+      acc = l->inum;
+      goto st_dig;
     case SJP_LST_NUM_DOT:  goto st_dot;  // decimal dot '.'
     case SJP_LST_NUM_DIGF: goto st_digf; // '0' .. '9' after '.'
     case SJP_LST_NUM_EXP:  goto st_exp;  // 'e' or 'E'
@@ -642,11 +2022,15 @@ static int parse_num(struct sjp_lexer *l, struct sjp_token *tok)
 
   if (ch == '-') {
     l->state = SJP_LST_NUM_NEG;
+    l->shape |= SJP_NUM_NEG;
     ch = jl_getc(l);
   }
 
 st_neg:
   if (ch == EOF) {
+    if (jl_eos(l)) {
+      goto invalid;
+    }
     goto more;
   }
 
@@ -658,14 +2042,29 @@ st_neg:
     goto invalid;
   }
 
+  acc = ch - '0';
+
 st_dig:
   l->state = SJP_LST_NUM_DIG;
   for(;;) {
     ch = jl_getc(l);
+    if (ch >= '0' && ch <= '9') {
+      unsigned d = ch - '0';
+
+      // accumulate the integer part, noting if it overflows
+      if (acc > UINT64_MAX / 10 || (acc == UINT64_MAX / 10 && d > UINT64_MAX % 10)) {
+        l->shape |= LEX_NUM_BIG;
+      } else {
+        acc = 10*acc + d;
+      }
+      continue;
+    }
+
     if (ch == EOF) {
       if (jl_eos(l)) {
         goto finish;
       }
+      l->inum = acc;
       goto more;
     }
 
@@ -677,10 +2076,8 @@ st_dig:
       goto st_exp;
     }
 
-    if (ch < '0' || ch > '9') {
-      jl_ungetc(l,ch);
-      goto finish;
-    }
+    jl_ungetc(l,ch);
+    goto finish;
   }
 
 st_dig0:
@@ -712,6 +2109,7 @@ st_dig0:
 
 st_dot:
   l->state = SJP_LST_NUM_DOT;
+  l->shape |= SJP_NUM_FRAC;
   ch = jl_getc(l);
   if (ch == EOF) {
     if (jl_eos(l)) {
@@ -748,6 +2146,7 @@ st_digf:
 
 st_exp:
   l->state = SJP_LST_NUM_EXP;
+  l->shape |= SJP_NUM_EXP;
   ch = jl_getc(l);
 
   if (ch == '-' || ch == '+') {
@@ -794,7 +2193,8 @@ more:
       n = tok->n;
     }
 
-    if (n > 0) {
+    // raw numbers aren't converted, so they don't need the text
+    if (n > 0 && !(l->opts & SJP_LEX_RAW_NUMBERS)) {
       int off = l->buf[0];
       memcpy(&l->buf[off], tok->value, n);
       l->buf[0] = off + n;
@@ -805,9 +2205,46 @@ more:
 finish:
   {
     size_t n;
+    int ret;
 
-    l->state = SJP_LST_VALUE;
     tok->n = l->off - off0;
+    tok->shape = l->shape & LEX_NUM_SHAPE;
+
+    // integers that fit in 64 bits are exact, and don't need to be
+    // converted from the text
+    if ((l->state == SJP_LST_NUM_DIG || l->state == SJP_LST_NUM_DIG0) && !(l->shape & LEX_NUM_BIG)) {
+      l->state = SJP_LST_VALUE;
+      if (!(l->shape & SJP_NUM_NEG)) {
+        tok->kind = (acc <= INT64_MAX) ? SJP_NUM_INT64 : SJP_NUM_UINT64;
+        tok->num.u64 = acc;
+        tok->extra.dbl = (double)acc;
+        return SJP_OK;
+      }
+
+      if (acc <= (uint64_t)INT64_MAX + 1) {
+        tok->kind = SJP_NUM_INT64;
+        tok->num.i64 = (acc == 0) ? 0 : -(int64_t)(acc - 1) - 1;
+        tok->extra.dbl = -(double)acc;
+        return SJP_OK;
+      }
+    }
+
+    l->state = SJP_LST_VALUE;
+
+    if (l->opts & SJP_LEX_RAW_NUMBERS) {
+      tok->kind = SJP_NUM_RAW;
+      tok->extra.dbl = 0;
+      return SJP_OK;
+    }
+
+    // if the number wasn't restarted, convert it where it is
+    if (l->buf[0] == 1) {
+      ret = sjp_number_to_double(tok->value, tok->n, &tok->extra.dbl);
+      assert(ret == SJP_OK);
+      (void)ret;
+      return SJP_OK;
+    }
+
     n = sizeof l->buf - l->buf[0];
     if (n >= tok->n) {
       n = tok->n;
@@ -819,15 +2256,17 @@ finish:
       l->buf[0] = off + n;
     }
 
-    if ((unsigned char)l->buf[0] < sizeof l->buf) {
-      char *ep= NULL;
-      int ind = l->buf[0];
-
-      l->buf[ind] = '\0';
-      tok->extra.dbl = strtod(&l->buf[1], &ep);
-      // XXX - handle overflow, underflow cases?
-      assert(ep && *ep == '\0');
+    // the start of a long number is lost, so it's left for the caller
+    // to convert from the whole text
+    if ((unsigned char)l->buf[0] >= sizeof l->buf) {
+      tok->kind = SJP_NUM_RAW;
+      tok->extra.dbl = 0;
+      return SJP_OK;
     }
+
+    ret = sjp_number_to_double(&l->buf[1], l->buf[0] - 1, &tok->extra.dbl);
+    assert(ret == SJP_OK);
+    (void)ret;
     return SJP_OK;
   }
 
@@ -837,24 +2276,52 @@ invalid:
   return SJP_INVALID_INPUT;
 }
 
-static int parse_value(struct sjp_lexer *l, struct sjp_token *tok)
+// Skips a run of whitespace between tokens.
+//
+// Most runs are short (a space after a colon or comma), so the first
+// few bytes are checked with the class table.  Longer runs, like the
+// indentation of pretty printed documents, are scanned a block at a
+// time.
+static void skip_ws_run(struct sjp_lexer *l)
+{
+  size_t off = l->off;
+  size_t sz = l->sz;
+  size_t end;
+
+  end = (sz - off > 4) ? off + 4 : sz;
+  if (off = skip_ws_bytes(l, off, end), off < end) {
+    goto done;
+  }
+
+  off = l->simd->skip_ws(l, off, sz);
+  off = skip_ws_bytes(l, off, sz);
+
+done:
+  l->off = off;
+}
+
+// Skips whitespace between tokens.  Tokens in compact documents
+// aren't separated by whitespace, so check the first byte inline.
+static inline void skip_ws(struct sjp_lexer *l)
+{
+  if (l->off < l->sz && !(lex_class[(unsigned char)l->data[l->off]] & LEX_WS)) {
+    return;
+  }
+
+  skip_ws_run(l);
+}
+
+static inline int parse_value(struct sjp_lexer *l, struct sjp_token *tok)
 {
   int ch;
 
-  // skip whitespace
   tok->type = SJP_TOK_NONE;
   tok->value = NULL;
+  tok->n = 0;
 
-  while (ch = jl_getc(l), ch != EOF) {
-  // Skip whitespace
-  // XXX - is this the right definition of whitespace in json?
-    if (!isspace(ch)) {
-      jl_ungetc(l,ch);
-      break;
-    }
-  }
+  skip_ws(l);
 
-  if (ch == EOF) {
+  if (l->off >= l->sz) {
     if (!jl_eos(l)) {
       return SJP_MORE;
     }
@@ -883,6 +2350,9 @@ static int parse_value(struct sjp_lexer *l, struct sjp_token *tok)
       return parse_num(l,tok);
 
     default:
+      if (l->sz - l->off >= 8 && parse_kw_word(l,tok)) {
+        return SJP_OK;
+      }
       return parse_kw(l,tok);
   }
 }
@@ -891,7 +2361,7 @@ static int parse_value(struct sjp_lexer *l, struct sjp_token *tok)
 //
 // If the return is a partial token, the buffer is exhausted.  If the
 // token type is not SJP_TOK_NONE, the lexer expects a partial token
-int sjp_lexer_token(struct sjp_lexer *l, struct sjp_token *tok)
+static int lex_token(struct sjp_lexer *l, struct sjp_token *tok)
 {
   switch (l->state) {
   case SJP_LST_VALUE:
@@ -927,7 +2397,284 @@ int sjp_lexer_token(struct sjp_lexer *l, struct sjp_token *tok)
   default:
     return SJP_INTERNAL_ERROR;
   }
-} 
+}
+
+// Hashes the part of a string in tok (SJP_LEX_HASH_STRINGS).  The
+// bytes were just scanned, so they're still in the cache.
+static void hash_string(struct sjp_lexer *l, struct sjp_token *tok, int ret)
+{
+  l->hash = sjp_hash_more(l->hash, tok->value, tok->n);
+  tok->hash = l->hash;
+  if (ret == SJP_OK) {
+    l->hash = SJP_HASH_INIT;
+  }
+}
+
+int sjp_lexer_token(struct sjp_lexer *l, struct sjp_token *tok)
+{
+  int ret;
+
+  l->scratch_off = 0;
+  ret = lex_token(l,tok);
+
+  if ((l->opts & SJP_LEX_HASH_STRINGS) && !SJP_ERROR(ret) && tok->type == SJP_TOK_STRING) {
+    hash_string(l, tok, ret);
+  }
+
+  return ret;
+}
+
+int sjp_lexer_tokens(struct sjp_lexer *l, struct sjp_token *toks, size_t max, size_t *count)
+{
+  size_t n = 0;
+  int ret = SJP_OK;
+
+  if (toks == NULL || max == 0 || count == NULL) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  l->scratch_off = 0;
+
+  // finish the token that the last buffer ended in
+  if (l->state != SJP_LST_VALUE) {
+    // keywords are finished in the restart buffer, which the next
+    // restart would overwrite, so return them by themselves
+    int inbuf = (l->state == SJP_LST_KEYWORD);
+
+    if (ret = lex_token(l, &toks[0]), ret != SJP_OK) {
+      goto done;
+    }
+    n++;
+
+    if (inbuf) {
+      goto done;
+    }
+  }
+
+  // Between tokens, the lexer is always in SJP_LST_VALUE, so skip the
+  // restart dispatch in sjp_lexer_token().
+  while (n < max) {
+    if (ret = parse_value(l, &toks[n]), ret != SJP_OK) {
+      break;
+    }
+
+    if (toks[n++].type == SJP_TOK_EOS) {
+      break;
+    }
+  }
+
+done:
+  if (ret == SJP_MORE || ret == SJP_PARTIAL) {
+    // the last token is the partial token
+    n++;
+  }
+
+  if (l->opts & SJP_LEX_HASH_STRINGS) {
+    size_t i;
+
+    for (i=0; i < n; i++) {
+      if (toks[i].type == SJP_TOK_STRING) {
+        hash_string(l, &toks[i], (i == n-1 && !SJP_ERROR(ret)) ? ret : SJP_OK);
+      }
+    }
+  }
+
+  *count = n;
+  return ret;
+}
+
+// Skips bytes in data[off..sz) until a byte in class cls, and counts
+// newlines.  Returns the offset of that byte, or sz.
+static size_t skip_to_class(struct sjp_lexer *l, size_t off, size_t sz, int cls)
+{
+  for (;;) {
+    off = l->simd->skip_find(l, off, sz, cls == LEX_SKIP_STR);
+    while (off < sz && !(lex_class[(unsigned char)l->data[off]] & cls)) {
+      off++;
+    }
+
+    if (off >= sz || l->data[off] != '\n') {
+      return off;
+    }
+
+    off++;
+    l->line++;
+    l->lbeg = l->base + off;
+  }
+}
+
+enum SJP_RESULT sjp_lexer_skip(struct sjp_lexer *l, struct sjp_skip *sk)
+{
+  size_t off, sz = l->sz;
+  int ch;
+
+  // pick up the token the lexer stopped in
+  if (l->state != SJP_LST_VALUE) {
+    if (l->state >= SJP_LST_STR && l->state <= SJP_LST_STR_PAIR5) {
+      sk->flags |= SJP_SKIP_STR;
+      if (l->state == SJP_LST_STR_ESC1 || l->state == SJP_LST_STR_PAIR1) {
+        sk->flags |= SJP_SKIP_ESC;
+      }
+    } else if (sk->depth == 0) {
+      sk->flags |= SJP_SKIP_SCALAR;
+    }
+
+    l->state = SJP_LST_VALUE;
+    l->u8prev = 0;
+    l->ncp = 0;
+    l->inum = 0;
+    l->shape = 0;
+    l->hash = SJP_HASH_INIT;
+  }
+
+  if (l->data == NULL) {
+    // at the end of the stream, only a number or keyword can end
+    if (sk->flags & SJP_SKIP_SCALAR) {
+      sk->flags &= ~SJP_SKIP_SCALAR;
+      return SJP_OK;
+    }
+    return SJP_UNFINISHED_INPUT;
+  }
+
+  off = l->off;
+
+  for (;;) {
+    if (sk->flags & SJP_SKIP_STR) {
+      if (sk->flags & SJP_SKIP_ESC) {
+        if (off >= sz) {
+          goto more;
+        }
+        off++;
+        sk->flags &= ~SJP_SKIP_ESC;
+      }
+
+      if (off = skip_to_class(l, off, sz, LEX_SKIP_STR), off >= sz) {
+        goto more;
+      }
+
+      if (l->data[off++] == '\\') {
+        sk->flags |= SJP_SKIP_ESC;
+        continue;
+      }
+
+      sk->flags &= ~SJP_SKIP_STR;
+      if (sk->depth == 0) {
+        goto done;
+      }
+      continue;
+    }
+
+    if (sk->depth == 0) {
+      if (sk->flags & SJP_SKIP_SCALAR) {
+        while (off < sz && !(lex_class[(unsigned char)l->data[off]] & (LEX_WS|LEX_DELIM))) {
+          off++;
+        }
+
+        if (off >= sz) {
+          goto more;
+        }
+
+        sk->flags &= ~SJP_SKIP_SCALAR;
+        goto done;
+      }
+
+      l->off = off;
+      skip_ws(l);
+      if (off = l->off, off >= sz) {
+        goto more;
+      }
+
+      ch = (unsigned char)l->data[off];
+      if (sk->flags & SJP_SKIP_COLON) {
+        if (ch != ':') {
+          goto invalid;
+        }
+        sk->flags &= ~SJP_SKIP_COLON;
+        off++;
+        continue;
+      }
+
+      switch (ch) {
+        case '"':
+          sk->flags |= SJP_SKIP_STR;
+          off++;
+          break;
+
+        case '[': case '{':
+          sk->depth = 1;
+          sk->flags |= SJP_SKIP_FIRST;
+          off++;
+          break;
+
+        case ']': case '}': case ',': case ':':
+          goto invalid;
+
+        default:
+          sk->flags |= SJP_SKIP_SCALAR;
+          break;
+      }
+      continue;
+    }
+
+    if (sk->flags & SJP_SKIP_FIRST) {
+      l->off = off;
+      skip_ws(l);
+      if (off = l->off, off >= sz) {
+        goto more;
+      }
+
+      ch = (unsigned char)l->data[off];
+      if (ch != ']' && ch != '}') {
+        sk->count++;
+      }
+      sk->flags &= ~SJP_SKIP_FIRST;
+    }
+
+    if (off = skip_to_class(l, off, sz, LEX_SKIP), off >= sz) {
+      goto more;
+    }
+
+    switch (l->data[off++]) {
+      case '"':
+        sk->flags |= SJP_SKIP_STR;
+        break;
+
+      case '[': case '{':
+        sk->depth++;
+        break;
+
+      case ']': case '}':
+        if (--sk->depth == 0) {
+          goto done;
+        }
+        break;
+
+      case ',':
+        if (sk->depth == 1) {
+          sk->count++;
+        }
+        break;
+    }
+  }
+
+done:
+  l->off = off;
+  return SJP_OK;
+
+more:
+  l->off = sz;
+  return SJP_MORE;
+
+invalid:
+  l->off = off;
+  return SJP_INVALID_INPUT;
+}
+
+void sjp_lexer_position(const struct sjp_lexer *l, size_t *line, size_t *col)
+{
+  *line = l->line;
+  *col = sjp_lexer_offset(l) - l->lbeg;
+}
 
 int sjp_lexer_close(struct sjp_lexer *l)
 {
@@ -4,6 +4,7 @@
 #include "sjp_common.h"
 
 #include <stdlib.h>
+#include <stdint.h>
 
 #define MODULE_NAME SJP_LEXER
 
@@ -74,20 +75,48 @@ enum SJP_LEX_STATE {
 // especially for double numbers where people do odd things.
 enum { SJP_LEX_RESTART_SIZE = 32 };
 
+// Instruction sets for the vector kernels of the lexer: string
+// scanning with utf8 validation, and whitespace skipping.  Each level
+// uses the kernels of the levels below it for the tails of its blocks.
+enum SJP_SIMD {
+  SJP_SIMD_SCALAR = 0,
+  SJP_SIMD_SSE2,
+  SJP_SIMD_SSSE3,
+  SJP_SIMD_AVX2,
+  SJP_SIMD_AVX512,    // AVX-512 F and BW
+};
+
+struct sjp_lexer_simd;
+
 /* Lex JSON tokens.  Makes no attempt to ensure that the JSON has a
  * valid structure, only that its tokens are valid.
  */
 struct sjp_lexer {
   size_t sz;
   size_t off;
-  size_t line;
-  size_t lbeg;
-  size_t prev_lbeg;
-  char *data;
-  uint32_t u8st;
-  uint32_t u8cp;
+  size_t base;  // stream offset of data[0]
+  size_t line;  // newlines read so far
+  size_t lbeg;  // stream offset of the start of the current line
+  const char *data;
+  int ro;       // data is const (sjp_lexer_more_const)
+  uint32_t u8prev;  // last three bytes of a string, for utf8 validation
   size_t ncp;
 
+  uint64_t inum;     // integer part of a number, for restarts
+  unsigned shape;    // shape of a number or string (enum SJP_NUMBER_SHAPE,
+                     // SJP_STRING_SHAPE), for restarts
+
+  unsigned opts;     // enum SJP_LEX_OPTIONS
+  uint32_t hash;     // hash of the string so far (SJP_LEX_HASH_STRINGS)
+
+  const struct sjp_lexer_simd *simd; // kernels, chosen by sjp_lexer_init()
+
+  // scratch for strings with escapes in const data (see
+  // sjp_lexer_set_scratch), and the bytes of it used since the last call
+  char *scratch;
+  size_t nscratch;
+  size_t scratch_off;
+
   // buffer to allow restart during keyword/string/number states
   char buf[SJP_LEX_RESTART_SIZE];
   enum SJP_LEX_STATE state;
@@ -111,6 +140,73 @@ enum SJP_TOKEN {
   SJP_TOK_EOS      = 0xff,
 };
 
+// Lexer options, set in sjp_lexer.opts after sjp_lexer_init()
+enum SJP_LEX_OPTIONS {
+  // Don't convert numbers to doubles.  Numbers that aren't 64 bit
+  // integers are SJP_NUM_RAW, and only their text and shape are
+  // returned.  Convert them with sjp_number_to_double() if needed.
+  SJP_LEX_RAW_NUMBERS = 1 << 0,
+
+  // Hash strings as they are returned (see sjp_hash()).  Each part of a
+  // string carries the hash of the string so far, so the hash of the
+  // part returned with SJP_OK is the hash of the whole string.
+  SJP_LEX_HASH_STRINGS = 1 << 1,
+};
+
+// Hash of strings for SJP_LEX_HASH_STRINGS: 32 bit FNV-1a of the bytes
+// of the decoded string.  Bytes are hashed one at a time, so a string
+// can be hashed in parts.
+//
+// Strings with escapes in const data without a scratch buffer aren't
+// decoded (see sjp_lexer_more_const()), and their hash is of the text
+// with the escapes.
+enum {
+  SJP_HASH_INIT = 2166136261u,
+};
+
+static inline uint32_t sjp_hash_more(uint32_t h, const char *s, size_t n)
+{
+  size_t i;
+
+  for (i=0; i < n; i++) {
+    h = (h ^ (unsigned char)s[i]) * 16777619u;
+  }
+
+  return h;
+}
+
+static inline uint32_t sjp_hash(const char *s, size_t n)
+{
+  return sjp_hash_more(SJP_HASH_INIT, s, n);
+}
+
+// Kinds of complete numbers.  Integers that fit in 64 bits are exact;
+// any other number only has its double value.
+enum SJP_NUMBER_KIND {
+  SJP_NUM_DOUBLE = 0, // has a fraction or exponent, or doesn't fit in 64 bits
+  SJP_NUM_INT64,      // integer in the range of int64_t
+  SJP_NUM_UINT64,     // integer above INT64_MAX, in the range of uint64_t
+  SJP_NUM_RAW,        // not converted (see below)
+};
+
+// Numbers are SJP_NUM_RAW with SJP_LEX_RAW_NUMBERS.  They are also
+// SJP_NUM_RAW when the number was split across buffers and is too long
+// to keep in the restart buffer (SJP_LEX_RESTART_SIZE-1 bytes or more),
+// so the lexer no longer has its whole text.  Join its parts and
+// convert them with sjp_number_to_double().
+
+// Shape of the text of a number
+enum SJP_NUMBER_SHAPE {
+  SJP_NUM_NEG  = 1 << 0, // leading '-'
+  SJP_NUM_FRAC = 1 << 1, // has a fraction
+  SJP_NUM_EXP  = 1 << 2, // has an exponent
+};
+
+// Shape of the text of a string
+enum SJP_STRING_SHAPE {
+  SJP_STR_ESCAPED = 1 << 0, // has escapes
+};
+
 struct sjp_token {
   size_t n;
   const char *value;
@@ -120,7 +216,25 @@ struct sjp_token {
     size_t ncp; // SJP_TOK_STRING: number of codepoints fully parsed in string
     double dbl; // SJP_TOK_NUMBER: double precision value of number
   } extra;
+
+  /* SJP_TOK_NUMBER: exact value of integers, by kind, and the shape of
+   * the number (enum SJP_NUMBER_SHAPE).  Only set for complete
+   * numbers.
+   *
+   * SJP_TOK_STRING: the shape of the string (enum SJP_STRING_SHAPE) so
+   * far.
+   */
+  union {
+    int64_t i64;
+    uint64_t u64;
+  } num;
+  enum SJP_NUMBER_KIND kind;
+  unsigned shape;
+
   enum SJP_TOKEN type;
+
+  // SJP_TOK_STRING with SJP_LEX_HASH_STRINGS: hash of the string so far
+  uint32_t hash;
 };
 
 // Initializes the lexer state, reseting its state
@@ -129,9 +243,47 @@ void sjp_lexer_init(struct sjp_lexer *l);
 // Sets the lexer data, resets the buffer offset.  The lexer may modify
 // the data.
 //
-// The caller may pass the same data buffer to the lexer.
+// The caller may pass the same data buffer to the lexer.  Bytes of the last
+// buffer that the lexer did not read are not counted in the stream
+// offset.
 void sjp_lexer_more(struct sjp_lexer *l, char *data, size_t n);
 
+// Sets the lexer data, like sjp_lexer_more(), but the lexer doesn't
+// modify the data, so it can be a read-only mapping or a shared buffer.
+//
+// Strings without escapes are returned as views of the data, as
+// before.  Strings with escapes (SJP_STR_ESCAPED) can't be decoded in
+// place:
+//
+//   With a scratch buffer (sjp_lexer_set_scratch), they are decoded
+//   into the scratch buffer.  If the scratch buffer fills, the lexer
+//   returns the part decoded so far with SJP_PARTIAL.
+//
+//   Otherwise, their escapes are validated but not decoded, and the
+//   value is the text of the string.  Decode it with sjp_unescape().
+//   The escapes of a string that is split across buffers may be split
+//   too, so join the parts of the string before decoding it.
+void sjp_lexer_more_const(struct sjp_lexer *l, const char *data, size_t n);
+
+// Sets the scratch buffer for strings with escapes in const data.  The
+// buffer is reused on each call to sjp_lexer_token() or
+// sjp_lexer_tokens(), so values in it are valid until the next call.
+// Pass NULL to return strings with escapes undecoded.
+//
+// Returns SJP_INVALID_PARAMS if buf is not NULL and n is less than
+// SJP_LEX_RESTART_SIZE.
+enum SJP_RESULT sjp_lexer_set_scratch(struct sjp_lexer *l, char *buf, size_t n);
+
+// Decodes the escapes in the text of a string, text[0..n), without the
+// quotes.  The decoded string is at most n bytes.  out may be text, to
+// decode in place.  On success, *nout is the length of the decoded
+// string.
+//
+// Returns SJP_INVALID_ESCAPE or SJP_INVALID_U16PAIR if the escapes are
+// invalid.  The text is otherwise not validated: text from the lexer
+// has been validated already.
+enum SJP_RESULT sjp_unescape(const char *text, size_t n, char *out, size_t *nout);
+
 // Tells the lexer that we've reached the end of the stream.
 static inline void sjp_lexer_eos(struct sjp_lexer *l)
 {
@@ -155,6 +307,10 @@ static inline void sjp_lexer_eos(struct sjp_lexer *l)
 //   an end-of-stream, only that the lexer cannot return a partial
 //   token.  Otherwise, a partial token is returned.
 //
+//   Keywords are never partial.  A keyword at the end of the buffer is
+//   held until the next byte, or the end of the stream, shows that it
+//   ends at a delimiter.
+//
 // If the return value is SJP_PARTIAL:
 //   Only a partial token is available, but the lexer input buffer is
 //   not exhausted and sjp_lexer_more() should not be called.
@@ -179,11 +335,107 @@ static inline void sjp_lexer_eos(struct sjp_lexer *l)
 //
 enum SJP_RESULT sjp_lexer_token(struct sjp_lexer *l, struct sjp_token *tok);
 
+// Lexes up to max tokens into toks, and sets *count to the number of
+// tokens filled in.  Use this instead of calling sjp_lexer_token() in a
+// loop when many tokens are read from each buffer.
+//
+// If the return value is SJP_OK, all *count tokens are complete.  The
+// array is full, or the last token is SJP_TOK_EOS.
+//
+// If the return value is SJP_MORE or SJP_PARTIAL, the last token
+// (toks[*count-1]) is what sjp_lexer_token() would have returned: a
+// partial token, or SJP_TOK_NONE if there is no partial token.  The
+// tokens before it are complete.
+//
+// If the return value is negative, *count is the number of complete
+// tokens before the error.
+//
+// Returns SJP_INVALID_PARAMS if toks or count is NULL or max is zero.
+enum SJP_RESULT sjp_lexer_tokens(struct sjp_lexer *l, struct sjp_token *toks, size_t max, size_t *count);
+
+// State of sjp_lexer_skip(), kept across buffers
+struct sjp_skip {
+  size_t depth;    // arrays and objects open in the skipped value
+  size_t count;    // elements or members of the outermost one
+  unsigned flags;  // enum SJP_SKIP_FLAGS
+};
+
+enum SJP_SKIP_FLAGS {
+  SJP_SKIP_STR    = 1 << 0, // in a string
+  SJP_SKIP_ESC    = 1 << 1, // in a string, after a '\'
+  SJP_SKIP_SCALAR = 1 << 2, // in a number or keyword at depth zero
+  SJP_SKIP_COLON  = 1 << 3, // a ':' comes before the value
+  SJP_SKIP_FIRST  = 1 << 4, // before the first element at depth one
+};
+
+// Skips a value without lexing it, for values the caller doesn't want.
+// Only quotes, escapes and brackets are looked at: the skipped bytes
+// aren't validated, and aren't decoded or converted.
+//
+// With sk->depth zero, skips the next value (after a ':' if
+// SJP_SKIP_COLON is set).  With sk->depth > 0, skips the rest of the
+// sk->depth innermost arrays or objects, through the last closing
+// bracket.  If the lexer is in the middle of a token, the token is
+// skipped as part of the value.
+//
+// sk->count counts the elements (or members) of the outermost array or
+// object that are skipped: the commas at depth one, plus one for the
+// first element if SJP_SKIP_FIRST is set.  Initialize it to the
+// elements after the caller's position that have no comma to count.
+//
+// Returns SJP_OK when the value is skipped, and the lexer is at the
+// byte after it.  Returns SJP_MORE at the end of the data: give the
+// lexer more data and call again with the same sk.  Returns
+// SJP_UNFINISHED_INPUT at the end of the stream, and
+// SJP_INVALID_INPUT if a value starts with ',', ':' or a closing
+// bracket.
+enum SJP_RESULT sjp_lexer_skip(struct sjp_lexer *l, struct sjp_skip *sk);
+
+// Returns the offset in the stream of the next byte the lexer will
+// read.
+static inline size_t sjp_lexer_offset(const struct sjp_lexer *l)
+{
+  return l->base + l->off;
+}
+
+// Returns the line and column of the next byte the lexer will read,
+// both counted from zero.  The column is in bytes.
+//
+// Newlines are only counted as the lexer skips whitespace between
+// tokens (JSON strings cannot hold a raw newline), so nothing is
+// tracked per byte.  After an error, the position is in the token that
+// caused the error.
+void sjp_lexer_position(const struct sjp_lexer *l, size_t *line, size_t *col);
+
 // Closes the lexer state.  If the lexer is not at a position where it
 // can be stopped (ie: it's waiting on the close " of a string), the
 // lexer returns SJP_INVALID.
 enum SJP_RESULT sjp_lexer_close(struct sjp_lexer *l);
 
+// Returns the kernels that sjp_lexer_init() gives new lexers.
+//
+// By default, this is the best level supported by both the build and
+// the CPU.  On x86 with gcc or clang, all levels are built and the CPU
+// is checked once, on the first call.  Elsewhere (or with
+// SJP_NO_DISPATCH defined), only the levels enabled by the compiler
+// flags are built.
+//
+// The SJP_SIMD environment variable (scalar, sse2, ssse3, avx2 or
+// avx512) lowers the default, to compare levels without rebuilding.
+enum SJP_SIMD sjp_lexer_simd_level(void);
+
+// Sets the kernels for lexers initialized after this call.  A level
+// that isn't supported is lowered to the best one that is.  Returns the
+// level set.
+//
+// Lexers that are already initialized keep their kernels.  Lexers
+// initialized on other threads during the call get either the old
+// kernels or the new ones.
+enum SJP_SIMD sjp_lexer_set_simd_level(enum SJP_SIMD level);
+
+// Returns the name of the level, as used by SJP_SIMD
+const char *sjp_lexer_simd_name(enum SJP_SIMD level);
+
 #undef MODULE_NAME
 
 #endif /* SJP_LEXER_H */
@@ -5,6 +5,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 
 #include <assert.h>
 
@@ -313,6 +314,865 @@ void test_string_num_codepoints(void)
   }
 }
 
+void test_long_strings(void)
+{
+  // long enough to go through the wide scanning loops
+  const char *inputs[] = {
+    "\"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+      "0123456789abcdef0123456789abcdef\"",
+
+    "\"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+      "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef",
+    "0123456789abcdef0123456789abcdef\"",
+
+    "\"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+      "utf8 \xc3\xbe\xc2\xa2\xe0\xbc\xb2 and an escape\\t at the end\"",
+
+    "\"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+      "0123456789abcdef \x1f control char\"",
+    testing_close_marker,
+
+    NULL
+  };
+
+  struct lexer_output outputs[] = {
+    { SJP_OK, SJP_TOK_STRING,
+      "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+      "0123456789abcdef0123456789abcdef",
+      SJP_TEST_NUM_CODEPOINTS, 0.0, 96 },
+    { SJP_MORE, SJP_TOK_NONE, "" },
+
+    { SJP_MORE, SJP_TOK_STRING,
+      "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+      "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef" },
+    { SJP_OK, SJP_TOK_STRING,
+      "0123456789abcdef0123456789abcdef",
+      SJP_TEST_NUM_CODEPOINTS, 0.0, 160 },
+    { SJP_MORE, SJP_TOK_NONE, "" },
+
+    { SJP_OK, SJP_TOK_STRING,
+      "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+      "utf8 \xc3\xbe\xc2\xa2\xe0\xbc\xb2 and an escape\t at the end",
+      SJP_TEST_NUM_CODEPOINTS, 0.0, 98 },
+    { SJP_MORE, SJP_TOK_NONE, "" },
+
+    { SJP_INVALID_CHAR, SJP_TOK_STRING, "" },
+    { SJP_OK, SJP_TOK_NONE, "" },
+
+    { SJP_OK, SJP_TOK_NONE, NULL }, // end sentinel
+  };
+
+  ntest++;
+
+  int ret;
+  struct sjp_lexer lex = { 0 };
+
+  if (ret = lexer_test_inputs(&lex, inputs, outputs), ret != 0) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+  }
+}
+
+void test_whitespace(void)
+{
+  // runs long enough to go through the wide scanning loops
+  const char *inputs[] = {
+    "[\n    1,\n    \"a\"\n]",
+    "\r\n\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t"
+      "                                                      true   \n",
+    "                                                                ",
+    "                                                                 ",
+    "      null",
+    testing_end_of_stream,
+    testing_close_marker,
+
+    // only space, tab, newline and carriage return are whitespace
+    "\v1",
+    testing_close_marker,
+
+    "\f1",
+    testing_close_marker,
+
+    NULL
+  };
+
+  struct lexer_output outputs[] = {
+    { SJP_OK, '[', "[" },
+    { SJP_OK, SJP_TOK_NUMBER, "1", SJP_TEST_NUMBER, 1 },
+    { SJP_OK, ',', "," },
+    { SJP_OK, SJP_TOK_STRING, "a" },
+    { SJP_OK, ']', "]" },
+    { SJP_MORE, SJP_TOK_NONE, "" },
+
+    { SJP_OK, SJP_TOK_TRUE, "true" },
+    { SJP_MORE, SJP_TOK_NONE, "" },
+    { SJP_MORE, SJP_TOK_NONE, "" },
+    { SJP_MORE, SJP_TOK_NONE, "" },
+    { SJP_MORE, SJP_TOK_NONE, "null" },
+    { SJP_OK, SJP_TOK_NULL, "null" },
+    { SJP_OK, SJP_TOK_NONE, "" },
+
+    { SJP_INVALID_INPUT, SJP_TOK_NONE, "\v1" },
+    { SJP_OK, SJP_TOK_NONE, "" },
+
+    { SJP_INVALID_INPUT, SJP_TOK_NONE, "\f1" },
+    { SJP_OK, SJP_TOK_NONE, "" },
+
+    { SJP_OK, SJP_TOK_NONE, NULL }, // end sentinel
+  };
+
+  ntest++;
+
+  int ret;
+  struct sjp_lexer lex = { 0 };
+
+  if (ret = lexer_test_inputs(&lex, inputs, outputs), ret != 0) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+  }
+}
+
+void test_positions(void)
+{
+  // the error is at the 'x' on the fourth line, split across two
+  // buffers
+  char in1[] = "{\n  \"foo\": [ 1, 2,\n";
+  char in2[] = "\t\t3 ],\n  \"bar\": x }";
+  struct sjp_lexer lex;
+  struct sjp_token tok;
+  size_t line, col;
+  int ret;
+
+  ntest++;
+
+  sjp_lexer_init(&lex);
+  sjp_lexer_more(&lex, in1, strlen(in1));
+  while (ret = sjp_lexer_token(&lex, &tok), ret == SJP_OK) {
+    continue;
+  }
+
+  if (ret != SJP_MORE) {
+    goto failed;
+  }
+
+  sjp_lexer_more(&lex, in2, strlen(in2));
+  while (ret = sjp_lexer_token(&lex, &tok), ret == SJP_OK) {
+    sjp_lexer_position(&lex, &line, &col);
+    if (tok.type == ',' && line == 2 && col != 6) {
+      printf("after ',', expected column 6 but found %zu\n", col);
+      goto failed;
+    }
+  }
+
+  if (ret != SJP_INVALID_INPUT) {
+    printf("expected return %d (%s), but found %d (%s)\n",
+        SJP_INVALID_INPUT, ret2name(SJP_INVALID_INPUT),
+        ret, ret2name(ret));
+    goto failed;
+  }
+
+  sjp_lexer_position(&lex, &line, &col);
+  if (line != 3 || col != 9) {
+    printf("expected line 3, column 9, but found line %zu, column %zu\n", line, col);
+    goto failed;
+  }
+
+  if (sjp_lexer_offset(&lex) - col != strlen(in1) + strlen("\t\t3 ],\n")) {
+    printf("offset %zu does not match column %zu\n", sjp_lexer_offset(&lex), col);
+    goto failed;
+  }
+
+  return;
+
+failed:
+  nfail++;
+  printf("FAILED: %s\n", __func__);
+}
+
+struct lex_result {
+  int ret;
+  enum SJP_TOKEN type;
+  size_t n;
+  size_t ncp;
+  char value[64];
+};
+
+static void lex_record(struct lex_result *r, int ret, const struct sjp_token *tok)
+{
+  r->ret = ret;
+  r->type = tok->type;
+  r->n = 0;
+  r->ncp = (tok->type == SJP_TOK_STRING) ? tok->extra.ncp : 0;
+  if (!SJP_ERROR(ret) && tok->n > 0) {
+    r->n = tok->n < sizeof r->value ? tok->n : sizeof r->value;
+    memcpy(r->value, tok->value, r->n);
+  }
+}
+
+static void lex_next_chunk(struct sjp_lexer *lex, char *data, size_t *off, size_t len, size_t nchunk)
+{
+  size_t n;
+
+  if (*off < len) {
+    n = (len - *off) < nchunk ? len - *off : nchunk;
+    sjp_lexer_more(lex, &data[*off], n);
+    *off += n;
+  } else {
+    sjp_lexer_eos(lex);
+  }
+}
+
+// Lexes doc in chunks of nchunk bytes, one token at a time, and
+// returns the number of results.
+static int lex_one_at_a_time(const char *doc, size_t nchunk, char *data,
+    struct lex_result *res, int max)
+{
+  struct sjp_lexer lex;
+  size_t off, len;
+  int j;
+
+  len = strlen(doc);
+  memcpy(data, doc, len);
+
+  sjp_lexer_init(&lex);
+  off = 0;
+  lex_next_chunk(&lex, data, &off, len, nchunk);
+
+  for (j=0; j < max; j++) {
+    struct sjp_token tok = { 0 };
+    int ret;
+
+    ret = sjp_lexer_token(&lex, &tok);
+    lex_record(&res[j], ret, &tok);
+    if (SJP_ERROR(ret) || tok.type == SJP_TOK_EOS) {
+      return j+1;
+    }
+
+    if (ret == SJP_MORE) {
+      lex_next_chunk(&lex, data, &off, len, nchunk);
+    }
+  }
+
+  return j;
+}
+
+// Same as lex_one_at_a_time, with sjp_lexer_tokens and batches of at
+// most nbatch tokens.
+static int lex_in_batches(const char *doc, size_t nchunk, size_t nbatch, char *data,
+    struct lex_result *res, int max)
+{
+  struct sjp_lexer lex;
+  size_t off, len;
+  int j;
+
+  len = strlen(doc);
+  memcpy(data, doc, len);
+
+  sjp_lexer_init(&lex);
+  off = 0;
+  lex_next_chunk(&lex, data, &off, len, nchunk);
+
+  for (j=0; j < max;) {
+    struct sjp_token toks[64];
+    size_t i, count = 0;
+    int ret;
+
+    ret = sjp_lexer_tokens(&lex, toks, nbatch, &count);
+    for (i=0; i < count && j < max; i++) {
+      int partial = (ret == SJP_MORE || ret == SJP_PARTIAL) && i+1 == count;
+      lex_record(&res[j++], partial ? ret : SJP_OK, &toks[i]);
+    }
+
+    if (SJP_ERROR(ret)) {
+      if (j < max) {
+        lex_record(&res[j++], ret, &toks[count]);
+      }
+      return j;
+    }
+
+    if (ret == SJP_OK && count > 0 && toks[count-1].type == SJP_TOK_EOS) {
+      return j;
+    }
+
+    if (ret == SJP_MORE) {
+      lex_next_chunk(&lex, data, &off, len, nchunk);
+    }
+  }
+
+  return j;
+}
+
+void test_token_batches(void)
+{
+  const char *docs[] = {
+    "[ true, false, null, \"foo\" ]",
+    "{ \"foo\" : [ 1, -2.5e3, 0 ], \"b\\u00e9\\\"r\" : { \"\" : \"\xc3\xbe\\ud834\\udd1e\" } }",
+    "[12345678901234567890, 3.14159265358979, \"a\\n\\t\\u0041b\"]",
+    "[ 1, 2, tru ]",
+    "[ \"unterminated",
+    NULL
+  };
+
+  static const size_t chunks[] = { 1, 2, 3, 5, 8, 1024 };
+  static const size_t batches[] = { 1, 2, 3, 7, 64 };
+  char data1[256], data2[256];
+  int i;
+
+  for (i=0; docs[i] != NULL; i++) {
+    size_t c, b;
+
+    for (c=0; c < sizeof chunks / sizeof chunks[0]; c++) {
+      struct lex_result res1[256], res2[256];
+      int n1, n2, j;
+
+      n1 = lex_one_at_a_time(docs[i], chunks[c], data1, res1, 256);
+
+      for (b=0; b < sizeof batches / sizeof batches[0]; b++) {
+        ntest++;
+
+        n2 = lex_in_batches(docs[i], chunks[c], batches[b], data2, res2, 256);
+        if (n1 != n2) {
+          printf("doc %d, chunk %zu, batch %zu: expected %d tokens, but found %d\n",
+              i, chunks[c], batches[b], n1, n2);
+          goto failed;
+        }
+
+        for (j=0; j < n1; j++) {
+          if (res1[j].ret != res2[j].ret || res1[j].type != res2[j].type) {
+            printf("doc %d, chunk %zu, batch %zu, token %d: expected %d (%s) %s but found %d (%s) %s\n",
+                i, chunks[c], batches[b], j,
+                res1[j].ret, ret2name(res1[j].ret), tok2name(res1[j].type),
+                res2[j].ret, ret2name(res2[j].ret), tok2name(res2[j].type));
+            goto failed;
+          }
+
+          if (res1[j].n != res2[j].n || memcmp(res1[j].value, res2[j].value, res1[j].n) != 0) {
+            printf("doc %d, chunk %zu, batch %zu, token %d: expected '%.*s' but found '%.*s'\n",
+                i, chunks[c], batches[b], j,
+                (int)res1[j].n, res1[j].value, (int)res2[j].n, res2[j].value);
+            goto failed;
+          }
+        }
+
+        continue;
+
+failed:
+        nfail++;
+        printf("FAILED: %s\n", __func__);
+      }
+    }
+  }
+}
+
+// Lexes doc in one buffer and returns the number of results, with the
+// position after the last one in *line and *col.
+static int lex_with_position(const char *doc, char *data, struct lex_result *res, int max,
+    size_t *line, size_t *col)
+{
+  struct sjp_lexer lex;
+  size_t len;
+  int j;
+
+  len = strlen(doc);
+  memcpy(data, doc, len);
+
+  sjp_lexer_init(&lex);
+  sjp_lexer_more(&lex, data, len);
+
+  for (j=0; j < max; j++) {
+    struct sjp_token tok = { 0 };
+    int ret;
+
+    ret = sjp_lexer_token(&lex, &tok);
+    lex_record(&res[j], ret, &tok);
+    if (ret == SJP_MORE) {
+      sjp_lexer_eos(&lex);
+      continue;
+    }
+
+    if (ret != SJP_OK || tok.type == SJP_TOK_EOS) {
+      j++;
+      break;
+    }
+  }
+
+  sjp_lexer_position(&lex, line, col);
+  return j;
+}
+
+// Each SIMD level has its own string and whitespace kernels.  Checks
+// that every level the CPU supports gives the same tokens, errors and
+// positions as the scalar code, with strings and whitespace runs that
+// end and go wrong at each offset of the widest block.
+void test_simd_levels(void)
+{
+  static const char *const bad[] = { "\xc3", "\xe2\x82", "\xed\xa0\x80", "\xf4\x90\x80\x80", "\x80" };
+  static const char *const good[] = { "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80" };
+  enum SJP_SIMD saved, lv, got;
+  char doc[512], data[512];
+  int i, k;
+
+  saved = sjp_lexer_simd_level();
+
+  ntest++;
+  if (sjp_lexer_set_simd_level(SJP_SIMD_SCALAR) != SJP_SIMD_SCALAR ||
+      strcmp(sjp_lexer_simd_name(SJP_SIMD_AVX2), "avx2") != 0) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("could not select the scalar kernels\n");
+  }
+
+  for (i=0; i < 5*140; i++) {
+    struct lex_result res0[16], res[16];
+    size_t line0, col0, line, col;
+    int n0, n, off = i / 5;
+
+    // strings with a stop byte or a utf8 sequence at offset off, and
+    // whitespace runs with a newline at offset off
+    switch (i % 5) {
+      case 0:
+        snprintf(doc, sizeof doc, "[\"%*s%s%*s\"]", off, "", good[off % 3], 70, "");
+        break;
+      case 1:
+        snprintf(doc, sizeof doc, "[\"%*s%s%*s\"]", off, "", bad[off % 5], 70, "");
+        break;
+      case 2:
+        snprintf(doc, sizeof doc, "[\"%*s\\n%*s\"]", off, "", 70, "");
+        break;
+      case 3:
+        snprintf(doc, sizeof doc, "[\"%*s\x01%*s\"]", off, "", 70, "");
+        break;
+      case 4:
+        snprintf(doc, sizeof doc, "[%*s\n%*s1,%*s\t\r\n %*sx]", off, "", 80, "", off, "", off % 7, "");
+        break;
+    }
+
+    sjp_lexer_set_simd_level(SJP_SIMD_SCALAR);
+    n0 = lex_with_position(doc, data, res0, 16, &line0, &col0);
+
+    for (lv = SJP_SIMD_SSE2; lv <= SJP_SIMD_AVX512; lv++) {
+      if (got = sjp_lexer_set_simd_level(lv), got != lv) {
+        continue;
+      }
+
+      ntest++;
+
+      // invalid utf8 is found a block at a time, so the position of the
+      // error is only somewhere in the string
+      n = lex_with_position(doc, data, res, 16, &line, &col);
+      if (n != n0 || (i % 5 != 1 && (line != line0 || col != col0))) {
+        printf("%s, doc %d: expected %d results at %zu:%zu, found %d at %zu:%zu\n",
+            sjp_lexer_simd_name(lv), i, n0, line0, col0, n, line, col);
+        goto failed;
+      }
+
+      for (k=0; k < n; k++) {
+        if (res[k].ret != res0[k].ret || res[k].type != res0[k].type || res[k].n != res0[k].n ||
+            res[k].ncp != res0[k].ncp || memcmp(res[k].value, res0[k].value, res[k].n) != 0) {
+          printf("%s, doc %d, token %d: expected %d (%s) %s but found %d (%s) %s\n",
+              sjp_lexer_simd_name(lv), i, k,
+              res0[k].ret, ret2name(res0[k].ret), tok2name(res0[k].type),
+              res[k].ret, ret2name(res[k].ret), tok2name(res[k].type));
+          goto failed;
+        }
+      }
+
+      continue;
+
+failed:
+      nfail++;
+      printf("FAILED: %s\n", __func__);
+    }
+  }
+
+  sjp_lexer_set_simd_level(saved);
+}
+
+// Keywords are matched a word at a time when the buffer holds the
+// keyword and the character after it, and a byte at a time otherwise.
+// Checks that both agree for every chunk size, and that a keyword must
+// end at a delimiter.
+void test_keyword_delimiters(void)
+{
+  const char *valid[] = {
+    "[true,false,null]",
+    "{\"a\":true,\"b\":false,\"c\":null}",
+    "[ true , false\t,\nnull\r]",
+    "[[true],[false],[null],{\"x\":[null,true,false]}]",
+    "true",
+    "null ",
+    NULL
+  };
+
+  const char *invalid[] = {
+    "truex",
+    "[truex, 1, 2, 3]",
+    "[nullnull]",
+    "[falsey, false, true]",
+    "{\"a\":true\"b\"}",
+    "[true1, 2, 3, 4, 5]",
+    NULL
+  };
+
+  char data[256];
+  int i;
+
+  for (i=0; valid[i] != NULL; i++) {
+    struct lex_result whole[256], res[256];
+    size_t c, len = strlen(valid[i]);
+    int nw, n, j, k;
+
+    nw = lex_one_at_a_time(valid[i], 1024, data, whole, 256);
+
+    for (c=1; c <= len; c++) {
+      ntest++;
+
+      n = lex_one_at_a_time(valid[i], c, data, res, 256);
+      if (SJP_ERROR(res[n-1].ret)) {
+        printf("doc %d, chunk %zu: unexpected error %d (%s)\n",
+            i, c, res[n-1].ret, ret2name(res[n-1].ret));
+        goto failed;
+      }
+
+      // compare the complete tokens, skipping the partial ones.  Strings
+      // split by chunks are returned in parts, so only compare the text
+      // of keywords.
+      for (j=0, k=0; j < nw; j++, k++) {
+        int kw;
+
+        if (whole[j].ret != SJP_OK) {
+          k--;
+          continue;
+        }
+
+        while (k < n && res[k].ret != SJP_OK) {
+          k++;
+        }
+
+        kw = (whole[j].type == SJP_TOK_TRUE || whole[j].type == SJP_TOK_FALSE ||
+            whole[j].type == SJP_TOK_NULL);
+        if (k >= n || res[k].type != whole[j].type ||
+            (kw && (res[k].n != whole[j].n || memcmp(res[k].value, whole[j].value, whole[j].n) != 0))) {
+          printf("doc %d, chunk %zu, token %d: expected %s '%.*s'\n",
+              i, c, j, tok2name(whole[j].type), (int)whole[j].n, whole[j].value);
+          goto failed;
+        }
+      }
+
+      continue;
+
+failed:
+      nfail++;
+      printf("FAILED: %s\n", __func__);
+    }
+  }
+
+  for (i=0; invalid[i] != NULL; i++) {
+    struct lex_result res[256];
+    int n, j;
+
+    ntest++;
+
+    n = lex_one_at_a_time(invalid[i], 1024, data, res, 256);
+    for (j=0; j < n; j++) {
+      if (res[j].type == SJP_TOK_TRUE || res[j].type == SJP_TOK_FALSE ||
+          res[j].type == SJP_TOK_NULL) {
+        break;
+      }
+    }
+
+    if (j < n || res[n-1].ret != SJP_INVALID_INPUT) {
+      nfail++;
+      printf("FAILED: %s\n", __func__);
+      printf("doc '%s': expected SJP_INVALID_INPUT without a keyword, found %d (%s)\n",
+          invalid[i], res[n-1].ret, ret2name(res[n-1].ret));
+    }
+  }
+}
+
+// Lexes doc, which holds a single string, in chunks of nchunk bytes
+// and joins the parts of the string into out.  Sets *hash to the hash
+// of the last part (SJP_LEX_HASH_STRINGS).  Returns the result of the
+// last token.
+static int lex_string_in_chunks(const char *doc, size_t nchunk, char *data, char *out, size_t *nout,
+    uint32_t *hash)
+{
+  struct sjp_lexer lex;
+  size_t off, len;
+
+  len = strlen(doc);
+  memcpy(data, doc, len);
+
+  sjp_lexer_init(&lex);
+  lex.opts |= SJP_LEX_HASH_STRINGS;
+  off = 0;
+  lex_next_chunk(&lex, data, &off, len, nchunk);
+
+  *nout = 0;
+  for (;;) {
+    struct sjp_token tok = { 0 };
+    int ret;
+
+    ret = sjp_lexer_token(&lex, &tok);
+    if (SJP_ERROR(ret)) {
+      return ret;
+    }
+
+    if (tok.type == SJP_TOK_STRING) {
+      memcpy(&out[*nout], tok.value, tok.n);
+      *nout += tok.n;
+      *hash = tok.hash;
+    }
+
+    if (ret == SJP_OK) {
+      return ret;
+    }
+
+    if (ret == SJP_MORE) {
+      lex_next_chunk(&lex, data, &off, len, nchunk);
+    }
+  }
+}
+
+// escapes split at every chunk boundary, with runs between the escapes
+// long enough to go through the wide copies
+static const struct {
+  const char *doc;
+  const char *str;
+} escape_cases[] = {
+  {
+    "\"{\\\"id\\\": 12, \\\"name\\\": \\\"a json string in a json string\\\"}\\n"
+      "0123456789abcdef0123456789abcdef0123456789abcdef\\t\\\\\\/\\b\\f\\r\\n\"",
+    "{\"id\": 12, \"name\": \"a json string in a json string\"}\n"
+      "0123456789abcdef0123456789abcdef0123456789abcdef\t\\/\b\f\r\n"
+  },
+  {
+    "\"G\\u00fcnter \\u2318 \\u65e5\\u672C\\u8A9E \\uD840\\uDE13\\ud834\\udd1e "
+      "\xc3\xbe\xe0\xbc\xb2 0123456789abcdef0123456789abcdef\\u0041\"",
+    "G\xc3\xbcnter \xe2\x8c\x98 \xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e "
+      "\xf0\xa0\x88\x93\xf0\x9d\x84\x9e "
+      "\xc3\xbe\xe0\xbc\xb2 0123456789abcdef0123456789abcdef" "A"
+  },
+  { NULL, NULL }
+};
+
+void test_escape_restarts(void)
+{
+  char data[256], out[256];
+  int i;
+
+  for (i=0; escape_cases[i].doc != NULL; i++) {
+    size_t nchunk, len = strlen(escape_cases[i].doc);
+
+    for (nchunk=1; nchunk <= len; nchunk++) {
+      size_t n, outlen;
+      uint32_t hash = 0;
+      int ret;
+
+      ntest++;
+
+      ret = lex_string_in_chunks(escape_cases[i].doc, nchunk, data, out, &n, &hash);
+      outlen = strlen(escape_cases[i].str);
+      if (ret != SJP_OK) {
+        printf("case %d, chunk %zu: expected return %d (%s) but found %d (%s)\n",
+            i, nchunk, SJP_OK, ret2name(SJP_OK), ret, ret2name(ret));
+        goto failed;
+      }
+
+      if (n != outlen || memcmp(out, escape_cases[i].str, n) != 0) {
+        printf("case %d, chunk %zu: expected '%s' but found '%.*s'\n",
+            i, nchunk, escape_cases[i].str, (int)n, out);
+        goto failed;
+      }
+
+      // the hash is of the decoded string, however it was split
+      if (hash != sjp_hash(escape_cases[i].str, outlen)) {
+        printf("case %d, chunk %zu: expected hash %08x but found %08x\n",
+            i, nchunk, (unsigned)sjp_hash(escape_cases[i].str, outlen), (unsigned)hash);
+        goto failed;
+      }
+
+      continue;
+
+failed:
+      nfail++;
+      printf("FAILED: %s\n", __func__);
+    }
+  }
+}
+
+// Same as lex_string_in_chunks, but with const data.  doc is a string
+// literal, so a write to it would fault.  Decodes strings into a
+// scratch buffer of nscratch bytes, or returns them undecoded if
+// nscratch is zero.  Sets *shape to the shape of the last part.
+static int lex_const_string_in_chunks(const char *doc, size_t nchunk, size_t nscratch,
+    char *out, size_t *nout, unsigned *shape)
+{
+  struct sjp_lexer lex;
+  char scratch[256];
+  size_t off, len;
+
+  len = strlen(doc);
+
+  sjp_lexer_init(&lex);
+  if (nscratch > 0 && sjp_lexer_set_scratch(&lex, scratch, nscratch) != SJP_OK) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  off = 0;
+  *nout = 0;
+  for (;;) {
+    struct sjp_token tok = { 0 };
+    int ret;
+
+    if (off == 0 || lex.off >= lex.sz) {
+      size_t n = (len - off) < nchunk ? len - off : nchunk;
+
+      if (off < len) {
+        sjp_lexer_more_const(&lex, &doc[off], n);
+        off += n;
+      } else {
+        sjp_lexer_eos(&lex);
+      }
+    }
+
+    ret = sjp_lexer_token(&lex, &tok);
+    if (SJP_ERROR(ret)) {
+      return ret;
+    }
+
+    if (tok.type == SJP_TOK_STRING) {
+      memcpy(&out[*nout], tok.value, tok.n);
+      *nout += tok.n;
+      *shape = tok.shape;
+    }
+
+    if (ret == SJP_OK) {
+      return ret;
+    }
+  }
+}
+
+// With const data, strings with escapes are decoded into the scratch
+// buffer, even if it fills up in the middle of the string, or are
+// returned as is for sjp_unescape().
+void test_const_input(void)
+{
+  static const size_t scratch_sizes[] = { 0, SJP_LEX_RESTART_SIZE, 37, 256 };
+  char out[256];
+  int i;
+
+  for (i=0; escape_cases[i].doc != NULL; i++) {
+    size_t nchunk, len = strlen(escape_cases[i].doc);
+    size_t outlen = strlen(escape_cases[i].str);
+
+    for (nchunk=1; nchunk <= len; nchunk++) {
+      size_t s;
+
+      for (s=0; s < sizeof scratch_sizes / sizeof scratch_sizes[0]; s++) {
+        unsigned shape = 0;
+        size_t n;
+        int ret;
+
+        ntest++;
+
+        ret = lex_const_string_in_chunks(escape_cases[i].doc, nchunk, scratch_sizes[s], out, &n, &shape);
+        if (ret != SJP_OK) {
+          printf("case %d, chunk %zu, scratch %zu: expected return %d (%s) but found %d (%s)\n",
+              i, nchunk, scratch_sizes[s], SJP_OK, ret2name(SJP_OK), ret, ret2name(ret));
+          goto failed;
+        }
+
+        if (!(shape & SJP_STR_ESCAPED)) {
+          printf("case %d, chunk %zu, scratch %zu: expected SJP_STR_ESCAPED\n",
+              i, nchunk, scratch_sizes[s]);
+          goto failed;
+        }
+
+        if (scratch_sizes[s] == 0) {
+          // the undecoded string is the text between the quotes
+          if (n != len-2 || memcmp(out, &escape_cases[i].doc[1], n) != 0) {
+            printf("case %d, chunk %zu: expected the text of the string, but found '%.*s'\n",
+                i, nchunk, (int)n, out);
+            goto failed;
+          }
+
+          if (ret = sjp_unescape(out, n, out, &n), ret != SJP_OK) {
+            printf("case %d, chunk %zu: sjp_unescape returned %d (%s)\n",
+                i, nchunk, ret, ret2name(ret));
+            goto failed;
+          }
+        }
+
+        if (n != outlen || memcmp(out, escape_cases[i].str, n) != 0) {
+          printf("case %d, chunk %zu, scratch %zu: expected '%s' but found '%.*s'\n",
+              i, nchunk, scratch_sizes[s], escape_cases[i].str, (int)n, out);
+          goto failed;
+        }
+
+        continue;
+
+failed:
+        nfail++;
+        printf("FAILED: %s\n", __func__);
+      }
+    }
+  }
+}
+
+void test_unescape(void)
+{
+  static const struct {
+    const char *text;
+    int ret;
+    const char *str;
+  } cases[] = {
+    { "plain", SJP_OK, "plain" },
+    { "", SJP_OK, "" },
+    { "a\\tb\\\\c\\\"d\\/e\\b\\f\\n\\r", SJP_OK, "a\tb\\c\"d/e\b\f\n\r" },
+    { "\\u0041\\u00e9\\u20AC\\ud83d\\ude00", SJP_OK, "A\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80" },
+    { "trailing\\", SJP_INVALID_ESCAPE, NULL },
+    { "\\x", SJP_INVALID_ESCAPE, NULL },
+    { "\\u12", SJP_INVALID_ESCAPE, NULL },
+    { "\\u12g4", SJP_INVALID_ESCAPE, NULL },
+    { "\\ud83d", SJP_INVALID_U16PAIR, NULL },
+    { "\\ud83d\\n", SJP_INVALID_U16PAIR, NULL },
+    { "\\ude00\\ud83d", SJP_INVALID_U16PAIR, NULL },
+    { "\\ud83d\\u00zz", SJP_INVALID_ESCAPE, NULL },
+    { NULL, 0, NULL }
+  };
+
+  char buf[64];
+  int i;
+
+  for (i=0; cases[i].text != NULL; i++) {
+    size_t n, len = strlen(cases[i].text);
+    int ret;
+
+    ntest++;
+
+    // decode in place
+    memcpy(buf, cases[i].text, len);
+    ret = sjp_unescape(buf, len, buf, &n);
+    if (ret != cases[i].ret) {
+      printf("case %d: expected %d (%s) but found %d (%s)\n",
+          i, cases[i].ret, ret2name(cases[i].ret), ret, ret2name(ret));
+      goto failed;
+    }
+
+    if (ret == SJP_OK && (n != strlen(cases[i].str) || memcmp(buf, cases[i].str, n) != 0)) {
+      printf("case %d: expected '%s' but found '%.*s'\n", i, cases[i].str, (int)n, buf);
+      goto failed;
+    }
+
+    continue;
+
+failed:
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+  }
+}
+
 void test_simple_restarts(void)
 {
   const char *inputs[] = {
@@ -343,11 +1203,11 @@ void test_simple_restarts(void)
 
     { SJP_OK, ',', "," },
 
+    // a keyword at the end of the buffer waits for its delimiter
     { SJP_MORE, SJP_TOK_NONE, "n" },
+    { SJP_MORE, SJP_TOK_NONE, "null" },
     { SJP_OK, SJP_TOK_NULL, "null" },
 
-    { SJP_MORE, SJP_TOK_NONE, "" },
-
     { SJP_OK, ',', "," },
 
     { SJP_MORE, SJP_TOK_NONE, "fals" },
@@ -515,6 +1375,8 @@ void test_string_with_surrogate_pairs(void)
     "40\\u",
     "DE13\"",
 
+    "\"lower case \\ud840\\ude13\"",
+
     NULL
   };
 
@@ -532,6 +1394,9 @@ void test_string_with_surrogate_pairs(void)
     { SJP_OK, SJP_TOK_STRING, "\xf0\xa0\x88\x93", SJP_TEST_NUM_CODEPOINTS, 0.0, 15 },
     { SJP_MORE, SJP_TOK_NONE, "" },
 
+    { SJP_OK, SJP_TOK_STRING, "lower case \xf0\xa0\x88\x93", SJP_TEST_NUM_CODEPOINTS, 0.0, 12 },
+    { SJP_MORE, SJP_TOK_NONE, "" },
+
     /*
     { SJP_MORE, SJP_TOK_STRING, "this string splits the surrogate pair: ",
     { SJP_MORE, SJP_TOK_NONE, "" },
@@ -623,6 +1488,146 @@ void test_numbers(void)
   }
 }
 
+// number kinds, values and shapes, with the numbers split at every
+// chunk boundary.  With SJP_LEX_RAW_NUMBERS, numbers that aren't 64 bit
+// integers aren't converted.
+static void check_number_kinds(const char *name, unsigned opts)
+{
+  static const char doc[] =
+    "[0, -0, 42, -42, 9007199254740993, 9223372036854775807, 9223372036854775808, "
+    "-9223372036854775808, -9223372036854775809, 18446744073709551615, "
+    "18446744073709551616, 1.0, 1e3, -0.5, 123456789012345678901234, -2.5E+2]";
+
+  static const struct {
+    enum SJP_NUMBER_KIND kind;
+    int64_t i64;
+    uint64_t u64;
+    double dbl;
+    unsigned shape;
+    const char *text;
+  } expected[] = {
+    { SJP_NUM_INT64,  0, 0, 0.0, 0, "0" },
+    { SJP_NUM_INT64,  0, 0, -0.0, SJP_NUM_NEG, "-0" },
+    { SJP_NUM_INT64,  42, 0, 42.0, 0, "42" },
+    { SJP_NUM_INT64,  -42, 0, -42.0, SJP_NUM_NEG, "-42" },
+    { SJP_NUM_INT64,  INT64_C(9007199254740993), 0, 9007199254740992.0, 0, "9007199254740993" },
+    { SJP_NUM_INT64,  INT64_MAX, 0, 9223372036854775807.0, 0, "9223372036854775807" },
+    { SJP_NUM_UINT64, 0, UINT64_C(9223372036854775808), 9223372036854775808.0, 0, "9223372036854775808" },
+    { SJP_NUM_INT64,  INT64_MIN, 0, -9223372036854775808.0, SJP_NUM_NEG, "-9223372036854775808" },
+    { SJP_NUM_DOUBLE, 0, 0, -9223372036854775809.0, SJP_NUM_NEG, "-9223372036854775809" },
+    { SJP_NUM_UINT64, 0, UINT64_MAX, 18446744073709551615.0, 0, "18446744073709551615" },
+    { SJP_NUM_DOUBLE, 0, 0, 18446744073709551616.0, 0, "18446744073709551616" },
+    { SJP_NUM_DOUBLE, 0, 0, 1.0, SJP_NUM_FRAC, "1.0" },
+    { SJP_NUM_DOUBLE, 0, 0, 1e3, SJP_NUM_EXP, "1e3" },
+    { SJP_NUM_DOUBLE, 0, 0, -0.5, SJP_NUM_NEG | SJP_NUM_FRAC, "-0.5" },
+    { SJP_NUM_DOUBLE, 0, 0, 123456789012345678901234.0, 0, "123456789012345678901234" },
+    { SJP_NUM_DOUBLE, 0, 0, -250.0, SJP_NUM_NEG | SJP_NUM_FRAC | SJP_NUM_EXP, "-2.5E+2" },
+  };
+
+  const int nexp = sizeof expected / sizeof expected[0];
+  char data[sizeof doc];
+  size_t nchunk;
+
+  for (nchunk=1; nchunk < sizeof doc; nchunk++) {
+    struct sjp_lexer lex;
+    char text[64];
+    size_t off = 0, ntext = 0;
+    int k = 0;
+
+    ntest++;
+
+    memcpy(data, doc, sizeof doc);
+    sjp_lexer_init(&lex);
+    lex.opts = opts;
+    lex_next_chunk(&lex, data, &off, sizeof doc - 1, nchunk);
+
+    for (;;) {
+      struct sjp_token tok = { 0 };
+      enum SJP_NUMBER_KIND kind;
+      double dbl;
+      int ret;
+
+      ret = sjp_lexer_token(&lex, &tok);
+      if (SJP_ERROR(ret)) {
+        printf("chunk %zu: unexpected return %d (%s)\n", nchunk, ret, ret2name(ret));
+        goto failed;
+      }
+
+      if (tok.type == SJP_TOK_NUMBER && ntext + tok.n < sizeof text) {
+        memcpy(&text[ntext], tok.value, tok.n);
+        ntext += tok.n;
+      }
+
+      if (ret == SJP_MORE) {
+        lex_next_chunk(&lex, data, &off, sizeof doc - 1, nchunk);
+        continue;
+      }
+
+      if (tok.type == SJP_TOK_EOS) {
+        break;
+      }
+
+      if (tok.type != SJP_TOK_NUMBER) {
+        continue;
+      }
+
+      if (k >= nexp) {
+        printf("chunk %zu: more numbers than expected\n", nchunk);
+        goto failed;
+      }
+
+      kind = expected[k].kind;
+      dbl = expected[k].dbl;
+      if ((opts & SJP_LEX_RAW_NUMBERS) && kind == SJP_NUM_DOUBLE) {
+        kind = SJP_NUM_RAW;
+        dbl = 0.0;
+      }
+
+      if (tok.kind != kind || tok.shape != expected[k].shape ||
+          (tok.kind == SJP_NUM_INT64 && tok.num.i64 != expected[k].i64) ||
+          (tok.kind == SJP_NUM_UINT64 && tok.num.u64 != expected[k].u64) ||
+          memcmp(&tok.extra.dbl, &dbl, sizeof tok.extra.dbl) != 0) {
+        printf("chunk %zu, number %d: expected kind %d, shape %u, %" PRId64 ", %" PRIu64 ", %g "
+            "but found kind %d, shape %u, %" PRId64 ", %" PRIu64 ", %g\n",
+            nchunk, k,
+            kind, expected[k].shape, expected[k].i64, expected[k].u64, dbl,
+            tok.kind, tok.shape, tok.num.i64, tok.num.u64, tok.extra.dbl);
+        goto failed;
+      }
+
+      if (ntext != strlen(expected[k].text) || memcmp(text, expected[k].text, ntext) != 0) {
+        printf("chunk %zu, number %d: expected '%s' but found '%.*s'\n",
+            nchunk, k, expected[k].text, (int)ntext, text);
+        goto failed;
+      }
+
+      ntext = 0;
+      k++;
+    }
+
+    if (k != nexp) {
+      printf("chunk %zu: expected %d numbers but found %d\n", nchunk, nexp, k);
+      goto failed;
+    }
+
+    continue;
+
+failed:
+    nfail++;
+    printf("FAILED: %s\n", name);
+  }
+}
+
+void test_number_kinds(void)
+{
+  check_number_kinds(__func__, 0);
+}
+
+void test_raw_numbers(void)
+{
+  check_number_kinds(__func__, SJP_LEX_RAW_NUMBERS);
+}
+
 void test_numbers_with_close(void)
 {
   const char *inputs[] = {
@@ -716,6 +1721,15 @@ void test_invalid_keywords(void)
     "raisin",
     testing_close_marker,
 
+    // keywords split from what follows them
+    "true",
+    "false",
+    testing_close_marker,
+
+    "null",
+    "0",
+    testing_close_marker,
+
     "fals",
     testing_close_marker,
 
@@ -783,6 +1797,14 @@ void test_invalid_keywords(void)
     { SJP_INVALID_INPUT, SJP_TOK_NONE, "raisin" },
     { SJP_OK, SJP_TOK_NONE, "" },
 
+    { SJP_MORE, SJP_TOK_NONE, "true" },
+    { SJP_INVALID_INPUT, SJP_TOK_NONE, "false" },
+    { SJP_OK, SJP_TOK_NONE, "" },
+
+    { SJP_MORE, SJP_TOK_NONE, "null" },
+    { SJP_INVALID_INPUT, SJP_TOK_NONE, "0" },
+    { SJP_OK, SJP_TOK_NONE, "" },
+
     { SJP_MORE, SJP_TOK_NONE, "fals" },
     { SJP_UNFINISHED_INPUT, SJP_TOK_NONE, "" },
 
@@ -800,9 +1822,9 @@ void test_invalid_keywords(void)
     { SJP_UNFINISHED_INPUT, SJP_TOK_TRUE, "" },
     { SJP_UNFINISHED_INPUT, SJP_TOK_NONE, "" }, // for close call
 
+    // the end of the stream shows where the keyword ends
+    { SJP_MORE, SJP_TOK_NONE, "true" },
     { SJP_OK, SJP_TOK_TRUE, "true" },
-    { SJP_MORE, SJP_TOK_NONE, "" },
-    { SJP_OK, SJP_TOK_EOS, "" },
     { SJP_OK, SJP_TOK_NONE, "" },
 
 
@@ -822,9 +1844,9 @@ void test_invalid_keywords(void)
     { SJP_UNFINISHED_INPUT, SJP_TOK_FALSE, "" },
     { SJP_UNFINISHED_INPUT, SJP_TOK_NONE, "" }, // for close call
 
+    // the end of the stream shows where the keyword ends
+    { SJP_MORE, SJP_TOK_NONE, "false" },
     { SJP_OK, SJP_TOK_FALSE, "false" },
-    { SJP_MORE, SJP_TOK_NONE, "" },
-    { SJP_OK, SJP_TOK_EOS, "" },
     { SJP_OK, SJP_TOK_NONE, "" },
 
 
@@ -840,9 +1862,9 @@ void test_invalid_keywords(void)
     { SJP_UNFINISHED_INPUT, SJP_TOK_NULL, "" },
     { SJP_UNFINISHED_INPUT, SJP_TOK_NONE, "" }, // for close call
 
+    // the end of the stream shows where the keyword ends
+    { SJP_MORE, SJP_TOK_NONE, "null" },
     { SJP_OK, SJP_TOK_NULL, "null" },
-    { SJP_MORE, SJP_TOK_NONE, "" },
-    { SJP_OK, SJP_TOK_EOS, "" },
     { SJP_OK, SJP_TOK_NONE, "" },
 
 
@@ -1075,6 +2097,12 @@ void test_invalid_strings(void)
     "\"only half a surrogate pair \\uD840\"",
     testing_close_marker,
 
+    "\"surrogates in the wrong order \\uDE13\\uD840\"",
+    testing_close_marker,
+
+    "\"high surrogate then a bmp escape \\uD840\\u0041\"",
+    testing_close_marker,
+
     "\"invalid \xFF utf8 bytes\"",
     testing_close_marker,
 
@@ -1106,6 +2134,12 @@ void test_invalid_strings(void)
     { SJP_INVALID_U16PAIR, SJP_TOK_STRING, "" },  // XXX - should return up to the invalid part of the token
     { SJP_OK, SJP_TOK_NONE, "" },
 
+    { SJP_INVALID_U16PAIR, SJP_TOK_STRING, "" },  // XXX - should return up to the invalid part of the token
+    { SJP_OK, SJP_TOK_NONE, "" },
+
+    { SJP_INVALID_U16PAIR, SJP_TOK_STRING, "" },  // XXX - should return up to the invalid part of the token
+    { SJP_OK, SJP_TOK_NONE, "" },
+
     { SJP_INVALID_CHAR, SJP_TOK_STRING, "" },  // XXX - should return up to the invalid part of the token
     { SJP_OK, SJP_TOK_NONE, "" },
 
@@ -1206,15 +2240,26 @@ int main(void)
   test_simple_object();
 
   test_string_num_codepoints();
+  test_long_strings();
+  test_whitespace();
+  test_positions();
+  test_token_batches();
+  test_keyword_delimiters();
+  test_simd_levels();
   test_string_with_escapes();
   test_simple_restarts();
   test_string_with_restarts_and_escapes();
+  test_escape_restarts();
+  test_const_input();
+  test_unescape();
 
   test_string_with_surrogate_pairs();
 
   test_numbers();
   test_numbers_with_close();
   test_number_restarts();
+  test_number_kinds();
+  test_raw_numbers();
 
   test_invalid_keywords();
   test_invalid_numbers();
@@ -0,0 +1,476 @@
+#include "sjp_ndjson.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// records of a chunk
+struct ndj_recs {
+  struct sjp_ndjson_record *recs;
+  size_t nrec;
+  size_t cap;
+  int done;   // ordered: parsed, and waiting to be delivered
+};
+
+struct ndj_run {
+  const struct sjp_ndjson *nd;
+  char *data;
+  size_t n;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;    // signaled when a chunk is delivered or the run stops
+  size_t next_off;        // start of the next chunk to parse
+  size_t next_chunk;      // number of the next chunk to parse
+  int ret;                // stops the run if not zero
+
+  // ordered: chunk n is parsed into slots[n % nslots]
+  struct ndj_recs *slots;
+  size_t nslots;
+  size_t next_deliver;    // number of the next chunk to deliver
+  int delivering;         // a thread is delivering chunks
+
+  // unordered: one chunk is delivered at a time
+  pthread_mutex_t dlock;
+};
+
+struct ndj_worker {
+  struct ndj_run *run;
+  pthread_t tid;
+
+  struct sjp_parser p;
+  struct ndj_recs recs;  // unordered: the chunk being parsed
+
+  // the last record, if it doesn't end with a newline, copied to add one
+  char *tail;
+  size_t ntail;
+};
+
+static void *ndj_alloc(void *ud, void *ptr, size_t n)
+{
+  (void)ud;
+
+  if (n == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  return realloc(ptr, n);
+}
+
+void sjp_ndjson_init(struct sjp_ndjson *nd, sjp_ndjson_parse_fn parse, sjp_ndjson_deliver_fn deliver, void *ud)
+{
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+  nd->parse = parse;
+  nd->deliver = deliver;
+  nd->ud = ud;
+  nd->nthreads = (ncpu > 0) ? (int)ncpu : 1;
+  nd->chunk = SJP_NDJSON_DEFAULT_CHUNK;
+  nd->flags = 0;
+  nd->opts = 0;
+  nd->maxstack = 4096;
+}
+
+// Returns the number of bytes at the start of s (n bytes) that are
+// whitespace, or also commas and colons if seps is set
+static size_t ndj_span(const char *s, size_t n, int seps)
+{
+  size_t i;
+
+  for (i=0; i < n; i++) {
+    switch (s[i]) {
+      case ' ': case '\t': case '\r':
+        break;
+
+      case ',': case ':':
+        if (seps) {
+          break;
+        }
+        return i;
+
+      default:
+        return i;
+    }
+  }
+
+  return n;
+}
+
+// Ends the record with ret, and returns it
+static enum SJP_RESULT ndj_end(struct sjp_ndjson_record *rec, struct sjp_event *evt, int ret)
+{
+  static const struct sjp_event none = { SJP_NONE };
+
+  *evt = none;
+  rec->status = (ret == SJP_OK) ? 1 : ret;
+  return ret;
+}
+
+enum SJP_RESULT sjp_ndjson_next(struct sjp_ndjson_record *rec, struct sjp_event *evt)
+{
+  struct sjp_parser *p = rec->p;
+  const char *pos;
+  enum SJP_RESULT ret;
+
+  if (rec->status != 0) {
+    return ndj_end(rec, evt, (rec->status == 1) ? SJP_OK : rec->status);
+  }
+
+  // The document must end on its line.  If it's open and no value is
+  // left on the line, the parser would go on to the next line, so end
+  // the stream here for the parser to report what is unclosed.
+  pos = (p->lex.data != NULL) ? &p->lex.data[p->lex.off] : rec->eol;
+  if (p->top > 0 && pos <= rec->eol && ndj_span(pos, rec->eol - pos, 1) == (size_t)(rec->eol - pos)) {
+    sjp_parser_eos(p);
+    ret = sjp_parser_next(p, evt);
+    return ndj_end(rec, evt, SJP_ERROR(ret) ? ret : SJP_INTERNAL_ERROR);
+  }
+
+  // The parser's data ends with a newline, so every value is finished
+  // before the parser runs out of data.
+  if (ret = sjp_parser_next(p, evt), ret == SJP_MORE && evt->type == SJP_NONE) {
+    sjp_parser_eos(p);
+    ret = sjp_parser_next(p, evt);
+  }
+
+  if (SJP_ERROR(ret)) {
+    return ndj_end(rec, evt, ret);
+  }
+
+  // where the parser is, after the event
+  pos = (p->lex.data != NULL) ? &p->lex.data[p->lex.off] : rec->eol;
+  if (pos > rec->eol) {
+    return ndj_end(rec, evt, SJP_INVALID_INPUT);
+  }
+
+  // one document per record: only whitespace can follow it on the line
+  if (evt->type == SJP_DOC_END || evt->type == SJP_NONE) {
+    return ndj_end(rec, evt, (ndj_span(pos, rec->eol - pos, 0) == (size_t)(rec->eol - pos)) ? SJP_OK : SJP_INVALID_INPUT);
+  }
+
+  return ret;
+}
+
+// Returns the end of the chunk that starts at beg: the byte after the
+// first newline at least nd->chunk bytes in, or the end of the data.
+static size_t ndj_chunk_end(struct ndj_run *run, size_t beg)
+{
+  size_t end = beg + run->nd->chunk;
+  const char *nl;
+
+  if (end >= run->n || end < beg) {
+    return run->n;
+  }
+
+  nl = memchr(&run->data[end-1], '\n', run->n - (end-1));
+  return (nl != NULL) ? (size_t)(nl - run->data) + 1 : run->n;
+}
+
+static int ndj_push(struct ndj_recs *r, const struct sjp_ndjson_record *rec)
+{
+  if (r->nrec >= r->cap) {
+    size_t cap = (r->cap > 0) ? 2*r->cap : 256;
+    struct sjp_ndjson_record *recs = realloc(r->recs, cap * sizeof recs[0]);
+
+    if (recs == NULL) {
+      return SJP_OUT_OF_MEMORY;
+    }
+
+    r->recs = recs;
+    r->cap = cap;
+  }
+
+  r->recs[r->nrec++] = *rec;
+  return SJP_OK;
+}
+
+// Starts the parser on n bytes of data at the start of a line
+static void ndj_restart(struct sjp_parser *p, char *data, size_t n)
+{
+  sjp_parser_reset(p);
+  sjp_parser_more(p, data, n);
+}
+
+// Parses the records in data[beg..end), and keeps them in out if it
+// isn't NULL.
+//
+// The parser reads the chunk in place, as one stream of documents, up
+// to lim.  Only the last record of the data can be after lim: it
+// doesn't end with a newline, so it's copied to add one.
+static int ndj_parse_chunk(struct ndj_worker *w, size_t beg, size_t end, struct ndj_recs *out)
+{
+  struct ndj_run *run = w->run;
+  const struct sjp_ndjson *nd = run->nd;
+  char *data = run->data;
+  size_t off = beg, lim = end;
+
+  while (lim > beg && data[lim-1] != '\n') {
+    lim--;
+  }
+
+  ndj_restart(&w->p, &data[beg], lim - beg);
+
+  while (off < end) {
+    struct sjp_ndjson_record rec;
+    const char *nl = memchr(&data[off], '\n', end - off);
+    size_t lend = (nl != NULL) ? (size_t)(nl - data) : end;
+    size_t next = (nl != NULL) ? lend+1 : end;
+    size_t len = lend - off;
+
+    if (len > 0 && data[off+len-1] == '\r') {
+      len--;
+    }
+
+    if (len == 0) {
+      off = next;
+      continue;
+    }
+
+    rec.text = &data[off];
+    rec.n = len;
+    rec.offset = off;
+    rec.p = &w->p;
+    rec.result = NULL;
+    rec.eol = &data[off+len];
+
+    // a line of whitespace has no document, and the parser skips it
+    rec.status = (ndj_span(rec.text, len, 0) == len) ? 1 : 0;
+
+    if (off >= lim && rec.status == 0) {
+      if (len + 1 > w->ntail) {
+        char *tail = realloc(w->tail, len + 1);
+        if (tail == NULL) {
+          return SJP_OUT_OF_MEMORY;
+        }
+        w->tail = tail;
+        w->ntail = len + 1;
+      }
+
+      memcpy(w->tail, &data[off], len);
+      w->tail[len] = '\n';
+      ndj_restart(&w->p, w->tail, len + 1);
+      rec.eol = &w->tail[len];
+    }
+
+    rec.ret = nd->parse(nd->ud, &rec);
+    rec.p = NULL;
+
+    // After an error, or a document that wasn't read to its end, the
+    // parser is somewhere in the record, so start over at the next line.
+    if (rec.status != 1 && next < lim) {
+      ndj_restart(&w->p, &data[next], lim - next);
+    }
+
+    if (out != NULL && ndj_push(out, &rec) != SJP_OK) {
+      return SJP_OUT_OF_MEMORY;
+    }
+
+    off = next;
+  }
+
+  return SJP_OK;
+}
+
+static int ndj_deliver(struct ndj_run *run, struct ndj_recs *r)
+{
+  size_t i;
+  int ret;
+
+  for (i=0; i < r->nrec; i++) {
+    if (ret = run->nd->deliver(run->nd->ud, &r->recs[i]), ret != 0) {
+      return ret;
+    }
+  }
+
+  return 0;
+}
+
+// Returns 1 if the run has stopped.  run->ret is set under run->lock,
+// so it's read under it too.
+static int ndj_stopped(struct ndj_run *run)
+{
+  int stopped;
+
+  pthread_mutex_lock(&run->lock);
+  stopped = (run->ret != 0);
+  pthread_mutex_unlock(&run->lock);
+
+  return stopped;
+}
+
+static void ndj_stop(struct ndj_run *run, int ret)
+{
+  pthread_mutex_lock(&run->lock);
+  if (run->ret == 0) {
+    run->ret = ret;
+  }
+  pthread_cond_broadcast(&run->cond);
+  pthread_mutex_unlock(&run->lock);
+}
+
+// Marks an ordered chunk as parsed, and delivers the parsed chunks that
+// are next in order, unless another thread is delivering them.
+static void ndj_finish_ordered(struct ndj_run *run, struct ndj_recs *slot)
+{
+  pthread_mutex_lock(&run->lock);
+
+  slot->done = 1;
+  if (!run->delivering) {
+    struct ndj_recs *s;
+
+    run->delivering = 1;
+    while (run->ret == 0 && (s = &run->slots[run->next_deliver % run->nslots])->done) {
+      int ret;
+
+      pthread_mutex_unlock(&run->lock);
+      ret = ndj_deliver(run, s);
+      pthread_mutex_lock(&run->lock);
+
+      if (ret != 0 && run->ret == 0) {
+        run->ret = ret;
+      }
+
+      s->done = 0;
+      s->nrec = 0;
+      run->next_deliver++;
+      pthread_cond_broadcast(&run->cond);
+    }
+    run->delivering = 0;
+  }
+
+  pthread_mutex_unlock(&run->lock);
+}
+
+static void *ndj_work(void *arg)
+{
+  struct ndj_worker *w = arg;
+  struct ndj_run *run = w->run;
+  const struct sjp_ndjson *nd = run->nd;
+  int ordered = !(nd->flags & SJP_NDJSON_UNORDERED) && nd->deliver != NULL;
+
+  for (;;) {
+    struct ndj_recs *out = NULL;
+    size_t beg, end, seq;
+    int ret;
+
+    pthread_mutex_lock(&run->lock);
+    while (ordered && run->ret == 0 && run->next_off < run->n &&
+        run->next_chunk >= run->next_deliver + run->nslots) {
+      pthread_cond_wait(&run->cond, &run->lock);
+    }
+
+    if (run->ret != 0 || run->next_off >= run->n) {
+      pthread_mutex_unlock(&run->lock);
+      break;
+    }
+
+    seq = run->next_chunk++;
+    beg = run->next_off;
+    end = ndj_chunk_end(run, beg);
+    run->next_off = end;
+    pthread_mutex_unlock(&run->lock);
+
+    if (ordered) {
+      out = &run->slots[seq % run->nslots];
+    } else if (nd->deliver != NULL) {
+      out = &w->recs;
+      out->nrec = 0;
+    }
+
+    if (ret = ndj_parse_chunk(w, beg, end, out), ret != SJP_OK) {
+      ndj_stop(run, ret);
+      break;
+    }
+
+    if (ordered) {
+      ndj_finish_ordered(run, out);
+    } else if (out != NULL) {
+      pthread_mutex_lock(&run->dlock);
+      ret = !ndj_stopped(run) ? ndj_deliver(run, out) : 0;
+      pthread_mutex_unlock(&run->dlock);
+
+      if (ret != 0) {
+        ndj_stop(run, ret);
+        break;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+int sjp_ndjson_run(const struct sjp_ndjson *nd, char *data, size_t n)
+{
+  struct ndj_run run;
+  struct ndj_worker *workers;
+  int i, nstarted, ret = SJP_OK;
+
+  if (nd->parse == NULL || nd->nthreads < 1 || nd->chunk == 0 ||
+      nd->maxstack < SJP_PARSER_MIN_STACK || (data == NULL && n > 0)) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  memset(&run, 0, sizeof run);
+  run.nd = nd;
+  run.data = data;
+  run.n = n;
+  run.nslots = 4 * (size_t)nd->nthreads;
+
+  if (workers = calloc(nd->nthreads, sizeof workers[0]), workers == NULL) {
+    return SJP_OUT_OF_MEMORY;
+  }
+
+  if (run.slots = calloc(run.nslots, sizeof run.slots[0]), run.slots == NULL) {
+    free(workers);
+    return SJP_OUT_OF_MEMORY;
+  }
+
+  pthread_mutex_init(&run.lock, NULL);
+  pthread_mutex_init(&run.dlock, NULL);
+  pthread_cond_init(&run.cond, NULL);
+
+  for (i=0; i < nd->nthreads; i++) {
+    struct ndj_worker *w = &workers[i];
+
+    w->run = &run;
+    sjp_parser_init(&w->p, NULL, 0, NULL, 0);
+    sjp_parser_set_allocator(&w->p, ndj_alloc, NULL, nd->maxstack);
+    sjp_parser_set_options(&w->p, nd->opts | SJP_PARSER_STREAM);
+  }
+
+  // the caller's thread is the first worker
+  for (nstarted=1; nstarted < nd->nthreads; nstarted++) {
+    if (pthread_create(&workers[nstarted].tid, NULL, ndj_work, &workers[nstarted]) != 0) {
+      break;
+    }
+  }
+
+  ndj_work(&workers[0]);
+
+  for (i=1; i < nstarted; i++) {
+    pthread_join(workers[i].tid, NULL);
+  }
+
+  if (run.ret != 0) {
+    ret = run.ret;
+  }
+
+  for (i=0; i < nd->nthreads; i++) {
+    sjp_parser_close(&workers[i].p);
+    free(workers[i].recs.recs);
+    free(workers[i].tail);
+  }
+
+  for (i=0; (size_t)i < run.nslots; i++) {
+    free(run.slots[i].recs);
+  }
+
+  pthread_cond_destroy(&run.cond);
+  pthread_mutex_destroy(&run.dlock);
+  pthread_mutex_destroy(&run.lock);
+  free(run.slots);
+  free(workers);
+
+  return ret;
+}
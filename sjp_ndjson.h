@@ -0,0 +1,115 @@
+#ifndef SJP_NDJSON_H
+#define SJP_NDJSON_H
+
+#include "sjp_common.h"
+#include "sjp_lexer.h"
+#include "sjp_parser.h"
+
+#include <stdint.h>
+
+#define MODULE_NAME SJP_NDJSON
+
+// Parallel parsing of newline delimited JSON that is entirely in
+// memory.
+//
+// The data is split into chunks of about the same size, each ending at
+// a newline, and a pool of threads parses the chunks.  Each thread has
+// its own parser in stream mode, which reads a chunk as one stream of
+// documents: a record (line) ends with its document.  The parser is
+// only restarted at the next line after a record that fails, or whose
+// events aren't all read.  Records are handed to two callbacks:
+//
+//   parse    called on the worker threads, concurrently, once for each
+//            record.  It reads the events of the record with
+//            sjp_ndjson_next(), and can leave a result in the record.
+//
+//   deliver  called once for each record after it's parsed, one record
+//            at a time.  Records are delivered in the order of the
+//            data, unless the SJP_NDJSON_UNORDERED flag is set, in
+//            which case each chunk is delivered as soon as it's parsed.
+//
+// In order, a parsed chunk waits until the chunks before it are
+// delivered.  The threads parse at most a few chunks per thread ahead
+// of the oldest undelivered chunk, which bounds the memory held by
+// parsed records.
+//
+// Empty lines are skipped, and a '\r' before the newline is not part of
+// the record.
+
+enum SJP_NDJSON_FLAGS {
+  SJP_NDJSON_UNORDERED = 1 << 0,  // deliver records as they're parsed
+};
+
+enum {
+  SJP_NDJSON_DEFAULT_CHUNK = 1 << 20,
+};
+
+struct sjp_ndjson_record {
+  char *text;     // the record, without the newline
+  size_t n;
+  size_t offset;  // offset of the record in the data
+
+  // the parser for the record, only valid in the parse callback
+  struct sjp_parser *p;
+
+  int ret;        // return value of the parse callback
+  void *result;   // for the parse callback to pass to deliver
+
+  // for sjp_ndjson_next(): the end of the record in the parser's data,
+  // and 1 at the end of the record, or its error
+  const char *eol;
+  int status;
+};
+
+// Parses a record on a worker thread.  The return value is kept in
+// rec->ret, and doesn't stop the run.
+typedef int (*sjp_ndjson_parse_fn)(void *ud, struct sjp_ndjson_record *rec);
+
+// Delivers a parsed record.  Returns 0 to continue, or a value that
+// stops the run and is returned by sjp_ndjson_run().
+typedef int (*sjp_ndjson_deliver_fn)(void *ud, struct sjp_ndjson_record *rec);
+
+struct sjp_ndjson {
+  sjp_ndjson_parse_fn parse;
+  sjp_ndjson_deliver_fn deliver;  // may be NULL
+  void *ud;
+
+  int nthreads;   // number of threads, including the caller's
+  size_t chunk;   // bytes in each chunk, before it's moved to a newline
+  unsigned flags; // enum SJP_NDJSON_FLAGS
+
+  unsigned opts;  // parser options, see sjp_parser_set_options()
+  size_t maxstack;  // most bytes of parser stack per thread
+};
+
+// Initializes the driver with the callbacks, and defaults: one thread
+// for each online processor, chunks of SJP_NDJSON_DEFAULT_CHUNK bytes,
+// records delivered in order, no parser options, and a parser stack
+// that can grow to 4096 bytes (32768 levels of nesting).  Change the
+// fields to change the defaults.
+void sjp_ndjson_init(struct sjp_ndjson *nd, sjp_ndjson_parse_fn parse, sjp_ndjson_deliver_fn deliver, void *ud);
+
+// Parses n bytes of newline delimited JSON, and returns when every
+// record has been delivered.  As with the lexer, the data may be
+// modified while the records are parsed.
+//
+// Returns SJP_OK, the first non-zero return value of deliver (records
+// after it may have been parsed, but aren't delivered), or
+// SJP_INVALID_PARAMS or SJP_OUT_OF_MEMORY.  If threads can't be
+// created, the records are parsed by fewer threads.
+int sjp_ndjson_run(const struct sjp_ndjson *nd, char *data, size_t n);
+
+// Fetches the next event of a record.  At the end of the record,
+// returns SJP_OK with evt->type set to SJP_NONE.  Return values are
+// otherwise the same as sjp_parser_next().  The whole record is in
+// memory, so SJP_MORE is never returned.
+//
+// A record holds one document.  An array or object that isn't closed
+// on its line is SJP_UNCLOSED_ARRAY or SJP_UNCLOSED_OBJECT, and
+// anything but whitespace after the document is SJP_INVALID_INPUT.
+// After an error, the same error is returned.
+enum SJP_RESULT sjp_ndjson_next(struct sjp_ndjson_record *rec, struct sjp_event *evt);
+
+#undef MODULE_NAME
+
+#endif /* SJP_NDJSON_H */
@@ -0,0 +1,351 @@
+#include "sjp_ndjson.h"
+
+#define TEST_LOG_LEVEL 0
+#include "sjp_testing.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define NRECORDS 2000
+
+// Records that aren't valid: a trailing comma, and a second document on
+// the line
+static int bad_record(int i)
+{
+  return (i % 97 == 5) || (i % 101 == 7);
+}
+
+// Generates NRECORDS records, numbered by their "i" member, with blank
+// lines, CRLF line ends, escapes, and no newline after the last record
+static size_t gen_records(char *doc)
+{
+  size_t n = 0;
+  int i;
+
+  for (i=0; i < NRECORDS; i++) {
+    if (i % 97 == 5) {
+      n += sprintf(&doc[n], "{\"i\":%d,}\n", i);
+    } else if (i % 101 == 7) {
+      n += sprintf(&doc[n], "{\"i\":%d} 5\n", i);
+    } else {
+      n += sprintf(&doc[n], "{\"i\":%d,\"s\":\"line\\n%d\",\"a\":[%d,{\"x\":true}]}%s",
+          i, i, i, (i % 13 == 0) ? "\r\n" : "\n");
+    }
+
+    if (i % 17 == 0) {
+      n += sprintf(&doc[n], "\n");
+    }
+  }
+
+  // the last record doesn't have a newline, and ends with a number
+  if (doc[n-1] == '\n') {
+    n--;
+  }
+  if (doc[n-1] == '\r') {
+    n--;
+  }
+  n += sprintf(&doc[n], "\n%d", NRECORDS);
+
+  return n;
+}
+
+// The record number is the first number of the record.  The last
+// record is just that number.
+static int parse_record(void *ud, struct sjp_ndjson_record *rec)
+{
+  struct sjp_event evt;
+  int ret, found = 0;
+
+  (void)ud;
+
+  while (ret = sjp_ndjson_next(rec, &evt), ret == SJP_OK && evt.type != SJP_NONE) {
+    if (evt.type == SJP_NUMBER && !found) {
+      rec->result = (void *)(intptr_t)(evt.num.i64 + 1);
+      found = 1;
+    }
+  }
+
+  return ret;
+}
+
+struct deliveries {
+  int ordered;
+  int count;
+  int errors;
+  int stop_at;
+  char seen[NRECORDS+1];
+};
+
+static int deliver_record(void *ud, struct sjp_ndjson_record *rec)
+{
+  struct deliveries *d = ud;
+  intptr_t i = (intptr_t)rec->result - 1;
+
+  if (i < 0 || i > NRECORDS || d->seen[i]) {
+    d->errors++;
+    return 0;
+  }
+
+  if (d->ordered && i != d->count) {
+    d->errors++;
+  }
+
+  // the record is the line it came from
+  if (rec->n == 0 || rec->text[0] == '\n' || rec->text[rec->n-1] == '\r' || rec->text[rec->n-1] == '\n') {
+    d->errors++;
+  }
+
+  if ((rec->ret != SJP_OK) != (i < NRECORDS && bad_record(i))) {
+    d->errors++;
+  }
+
+  d->seen[i] = 1;
+  d->count++;
+
+  return (d->count == d->stop_at) ? 42 : 0;
+}
+
+static void test_ndjson_run(void)
+{
+  static const int threads[] = { 1, 2, 4, 7 };
+  static const size_t chunks[] = { 1, 10, 100, 4096, SJP_NDJSON_DEFAULT_CHUNK };
+  static char doc[128*NRECORDS], data[128*NRECORDS];
+  size_t n, t, c;
+  int ordered;
+
+  n = gen_records(doc);
+
+  for (t=0; t < sizeof threads / sizeof threads[0]; t++) {
+    for (c=0; c < sizeof chunks / sizeof chunks[0]; c++) {
+      for (ordered=0; ordered < 2; ordered++) {
+        static struct deliveries d;
+        struct sjp_ndjson nd;
+        int ret;
+
+        ntest++;
+
+        memset(&d, 0, sizeof d);
+        d.ordered = ordered;
+
+        sjp_ndjson_init(&nd, parse_record, deliver_record, &d);
+        nd.nthreads = threads[t];
+        nd.chunk = chunks[c];
+        nd.flags = ordered ? 0 : SJP_NDJSON_UNORDERED;
+
+        memcpy(data, doc, n);
+        ret = sjp_ndjson_run(&nd, data, n);
+        if (ret != SJP_OK || d.count != NRECORDS+1 || d.errors != 0) {
+          nfail++;
+          printf("FAILED: %s\n", __func__);
+          printf("  %d threads, chunk %zu, %s: returned %d (%s), %d records, %d errors\n",
+              threads[t], chunks[c], ordered ? "ordered" : "unordered",
+              ret, ret2name(ret), d.count, d.errors);
+        }
+      }
+    }
+  }
+}
+
+// A non-zero return from deliver stops the run
+static void test_ndjson_stop(void)
+{
+  static const int threads[] = { 1, 4 };
+  static char data[128*NRECORDS];
+  size_t n, t;
+  int ordered;
+
+  for (t=0; t < sizeof threads / sizeof threads[0]; t++) {
+    for (ordered=0; ordered < 2; ordered++) {
+      static struct deliveries d;
+      struct sjp_ndjson nd;
+      int ret;
+
+      ntest++;
+
+      memset(&d, 0, sizeof d);
+      d.ordered = ordered;
+      d.stop_at = 100;
+
+      sjp_ndjson_init(&nd, parse_record, deliver_record, &d);
+      nd.nthreads = threads[t];
+      nd.chunk = 64;
+      nd.flags = ordered ? 0 : SJP_NDJSON_UNORDERED;
+
+      n = gen_records(data);
+      ret = sjp_ndjson_run(&nd, data, n);
+      if (ret != 42 || d.count != 100 || d.errors != 0) {
+        nfail++;
+        printf("FAILED: %s\n", __func__);
+        printf("  %d threads, %s: returned %d, %d records, %d errors\n",
+            threads[t], ordered ? "ordered" : "unordered", ret, d.count, d.errors);
+      }
+    }
+  }
+}
+
+// Reads the events of a record and counts them in rec->result.  A
+// record that starts with {"skip" is left after its first event.
+static int count_record(void *ud, struct sjp_ndjson_record *rec)
+{
+  struct sjp_event evt;
+  intptr_t nevt = 0;
+  int ret;
+
+  (void)ud;
+
+  while (ret = sjp_ndjson_next(rec, &evt), ret == SJP_OK && evt.type != SJP_NONE) {
+    nevt++;
+    if (rec->n >= 7 && memcmp(rec->text, "{\"skip\"", 7) == 0) {
+      break;
+    }
+  }
+
+  rec->result = (void *)nevt;
+  return SJP_ERROR(ret) ? ret : SJP_OK;
+}
+
+struct line_counts {
+  int nrec;
+  int ret[16];
+  intptr_t nevt[16];
+};
+
+static int deliver_counts(void *ud, struct sjp_ndjson_record *rec)
+{
+  struct line_counts *lc = ud;
+
+  if (lc->nrec < 16) {
+    lc->ret[lc->nrec] = rec->ret;
+    lc->nevt[lc->nrec] = (intptr_t)rec->result;
+  }
+  lc->nrec++;
+
+  return 0;
+}
+
+// Each record holds one document, which ends on its line.  Records
+// after a bad record, or one that isn't read to its end, are parsed as
+// usual.
+static void test_ndjson_lines(void)
+{
+  static const char doc[] =
+    "[1,\n"
+    "2]\n"
+    "{\"skip\": [1, 2, 3]}\n"
+    "{\"a\": null}  \r\n"
+    " \t \n"
+    "1 2\n"
+    "\"a\"\"b\"\n"
+    "[true]\n"
+    "{\"a\": tru}\n"
+    "false";
+
+  static const struct {
+    int ret;
+    intptr_t nevt;
+  } expected[] = {
+    { SJP_UNCLOSED_ARRAY, 2 }, // [1,
+    { SJP_INVALID_INPUT, 1 },  // 2]
+    { SJP_OK, 1 },             // {"skip": ...
+    { SJP_OK, 4 },             // {"a": null}
+    { SJP_OK, 0 },             // whitespace
+    { SJP_INVALID_INPUT, 1 },  // 1 2
+    { SJP_INVALID_INPUT, 1 },  // "a""b"
+    { SJP_OK, 3 },             // [true]
+    { SJP_INVALID_INPUT, 2 },  // {"a": tru}
+    { SJP_OK, 1 },             // false, without a newline
+  };
+
+  static const size_t chunks[] = { 1, 8, 4096 };
+  char data[sizeof doc];
+  size_t c, i;
+
+  for (c=0; c < sizeof chunks / sizeof chunks[0]; c++) {
+    struct line_counts lc;
+    struct sjp_ndjson nd;
+    int ret;
+
+    ntest++;
+
+    memset(&lc, 0, sizeof lc);
+    sjp_ndjson_init(&nd, count_record, deliver_counts, &lc);
+    nd.nthreads = 1;
+    nd.chunk = chunks[c];
+
+    memcpy(data, doc, sizeof doc);
+    ret = sjp_ndjson_run(&nd, data, sizeof doc - 1);
+    if (ret != SJP_OK || lc.nrec != (int)(sizeof expected / sizeof expected[0])) {
+      nfail++;
+      printf("FAILED: %s\n", __func__);
+      printf("  chunk %zu: returned %d (%s) and %d records\n", chunks[c], ret, ret2name(ret), lc.nrec);
+      continue;
+    }
+
+    for (i=0; i < sizeof expected / sizeof expected[0]; i++) {
+      if (lc.ret[i] != expected[i].ret || lc.nevt[i] != expected[i].nevt) {
+        nfail++;
+        printf("FAILED: %s\n", __func__);
+        printf("  chunk %zu, record %zu: expected %d (%s) after %ld events, "
+            "but found %d (%s) after %ld events\n",
+            chunks[c], i, expected[i].ret, ret2name(expected[i].ret), (long)expected[i].nevt,
+            lc.ret[i], ret2name(lc.ret[i]), (long)lc.nevt[i]);
+        break;
+      }
+    }
+  }
+}
+
+static void test_ndjson_edges(void)
+{
+  static struct deliveries d;
+  struct sjp_ndjson nd;
+  char data[] = "\n\r\n\n";
+  int ret;
+
+  memset(&d, 0, sizeof d);
+  sjp_ndjson_init(&nd, parse_record, deliver_record, &d);
+
+  ntest++;
+  if (ret = sjp_ndjson_run(&nd, NULL, 0), ret != SJP_OK || d.count != 0) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  empty data returned %d (%s), %d records\n", ret, ret2name(ret), d.count);
+  }
+
+  ntest++;
+  if (ret = sjp_ndjson_run(&nd, data, strlen(data)), ret != SJP_OK || d.count != 0) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  blank lines returned %d (%s), %d records\n", ret, ret2name(ret), d.count);
+  }
+
+  ntest++;
+  nd.chunk = 0;
+  if (ret = sjp_ndjson_run(&nd, data, strlen(data)), ret != SJP_INVALID_PARAMS) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  zero chunk size returned %d (%s)\n", ret, ret2name(ret));
+  }
+
+  ntest++;
+  nd.chunk = 1;
+  nd.nthreads = 0;
+  if (ret = sjp_ndjson_run(&nd, data, strlen(data)), ret != SJP_INVALID_PARAMS) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  zero threads returned %d (%s)\n", ret, ret2name(ret));
+  }
+}
+
+int main(void)
+{
+  test_ndjson_run();
+  test_ndjson_stop();
+  test_ndjson_lines();
+  test_ndjson_edges();
+
+  printf("%d tests, %d failures\n", ntest,nfail);
+  return nfail == 0 ? 0 : 1;
+}
@@ -0,0 +1,38 @@
+#ifndef SJP_NUMBER_H
+#define SJP_NUMBER_H
+
+#include "sjp_common.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#define MODULE_NAME SJP_NUMBER
+
+// Conversion of the text of JSON numbers, for numbers that weren't
+// converted while lexing (see SJP_LEX_RAW_NUMBERS).
+//
+// Numbers are converted directly from the token bytes: no copy, no NUL
+// terminator, and no dependence on the locale.  Most numbers are
+// converted exactly with the method of Clinger (small integers times
+// small powers of ten) or of Eisel and Lemire (a 64 bit significand
+// times a 128 bit power of five).  The few that remain fall back to
+// strtod().
+
+// Converts the number in text[0..n) to the nearest double.  Numbers too
+// large for a double become +/-HUGE_VAL, and numbers too small become
+// zero.
+//
+// Returns SJP_INVALID_INPUT if the text is not a JSON number.
+enum SJP_RESULT sjp_number_to_double(const char *text, size_t n, double *d);
+
+// Converts the integer in text[0..n) to an int64_t.
+//
+// Returns SJP_INVALID_INPUT if the text is not a JSON number, and
+// SJP_NUMBER_RANGE if it has a fraction or an exponent, or is out of
+// the range of int64_t.
+enum SJP_RESULT sjp_number_to_int64(const char *text, size_t n, int64_t *v);
+
+#undef MODULE_NAME
+
+#endif /* SJP_NUMBER_H */
+
@@ -0,0 +1,202 @@
+#include "sjp_number.h"
+
+#define TEST_LOG_LEVEL 0
+#include "sjp_testing.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+// checks a conversion against strtod(), which is correctly rounded in
+// the C locale
+static int check_double(const char *text)
+{
+  double d, expected;
+  int ret;
+
+  expected = strtod(text, NULL);
+  if (ret = sjp_number_to_double(text, strlen(text), &d), ret != SJP_OK) {
+    printf("%s: expected return %d (%s), but found %d (%s)\n",
+        text, SJP_OK, ret2name(SJP_OK), ret, ret2name(ret));
+    return -1;
+  }
+
+  if (memcmp(&d, &expected, sizeof d) != 0) {
+    printf("%s: expected %.17g but found %.17g\n", text, expected, d);
+    return -1;
+  }
+
+  return 0;
+}
+
+static void test_number_values(void)
+{
+  static const char *nums[] = {
+    "0", "-0", "0.0", "-0.0e5", "1", "-1", "12345", "0.1", "0.2", "0.3",
+    "3.14159265358979", "2.718281828459045", "1e22", "1e23", "1e-22", "1e-23",
+    "9007199254740992", "9007199254740993", "9007199254740995",
+    "18446744073709551615", "18446744073709551616", "12345678901234567890123",
+
+    // the limits of double
+    "1.7976931348623157e308", "1.7976931348623158e308", "1.7976931348623159e308",
+    "2.2250738585072014e-308", "2.2250738585072011e-308",
+    "4.9406564584124654e-324", "2.4703282292062327e-324", "2.4703282292062328e-324",
+    "1e309", "-1e309", "1e-400", "1e100000000000", "1e-100000000000",
+    "0.000000000000000000000000000000000001",
+
+    // halfway cases that need more than 19 digits
+    "9007199254740993.0000000000000000001",
+    "1.00000000000000011102230246251565404236316680908203125",
+    "1.00000000000000011102230246251565404236316680908203124",
+    "1.00000000000000011102230246251565404236316680908203126",
+    "7.4109846876186981626485318930233205854758970392148714663837852375101326090531312779794975454245398856969484704316857659638998506553390969459816219401617281718945106978546710679176872575177347315553307795408549809608457500958111373034747658096871009590975442271004757307809711118935784838675653998783503015228055934046593739791790738723868299395818481660169122019456499931289798411362062484498678713572180352209017023903285791732520220528974020802906854021606612375549983402671300035812486479041385743401875520901590172592547146296175134159774938718574737870961645638908718119841271673056017045493004705269590165763776884908267986972573366521765567941072508764337560846003984904972149117463085539556354188641513168478436313080237596295773983001708984375e-324",
+
+    // long fractions
+    "0.1000000000000000055511151231257827021181583404541015625",
+    "123456789012345678901234567890.123456789012345678901234567890e-10",
+    NULL
+  };
+  int i;
+
+  for (i=0; nums[i] != NULL; i++) {
+    ntest++;
+    if (check_double(nums[i]) != 0) {
+      nfail++;
+      printf("FAILED: %s\n", __func__);
+    }
+  }
+}
+
+static void test_invalid_numbers(void)
+{
+  static const char *nums[] = {
+    "", "-", "01", "1.", ".5", "1e", "1e+", "+1", "1.5x", "0x10", "1 ", "--1",
+    NULL
+  };
+  int i;
+
+  for (i=0; nums[i] != NULL; i++) {
+    double d;
+    int ret;
+
+    ntest++;
+    if (ret = sjp_number_to_double(nums[i], strlen(nums[i]), &d), ret != SJP_INVALID_INPUT) {
+      nfail++;
+      printf("'%s': expected return %d (%s), but found %d (%s)\n",
+          nums[i], SJP_INVALID_INPUT, ret2name(SJP_INVALID_INPUT), ret, ret2name(ret));
+      printf("FAILED: %s\n", __func__);
+    }
+  }
+}
+
+static void test_number_to_int64(void)
+{
+  static const struct {
+    const char *text;
+    enum SJP_RESULT ret;
+    int64_t v;
+  } cases[] = {
+    { "0", SJP_OK, 0 },
+    { "-0", SJP_OK, 0 },
+    { "42", SJP_OK, 42 },
+    { "-42", SJP_OK, -42 },
+    { "9007199254740993", SJP_OK, INT64_C(9007199254740993) },
+    { "9223372036854775807", SJP_OK, INT64_MAX },
+    { "-9223372036854775808", SJP_OK, INT64_MIN },
+    { "9223372036854775808", SJP_NUMBER_RANGE, 0 },
+    { "-9223372036854775809", SJP_NUMBER_RANGE, 0 },
+    { "18446744073709551616", SJP_NUMBER_RANGE, 0 },
+    { "100000000000000000000000", SJP_NUMBER_RANGE, 0 },
+    { "1.0", SJP_NUMBER_RANGE, 0 },
+    { "1e3", SJP_NUMBER_RANGE, 0 },
+    { "01", SJP_INVALID_INPUT, 0 },
+    { "1x", SJP_INVALID_INPUT, 0 },
+    { NULL, SJP_OK, 0 },
+  };
+  int i;
+
+  for (i=0; cases[i].text != NULL; i++) {
+    int64_t v = 0;
+    int ret;
+
+    ntest++;
+
+    ret = sjp_number_to_int64(cases[i].text, strlen(cases[i].text), &v);
+    if (ret != cases[i].ret || (ret == SJP_OK && v != cases[i].v)) {
+      nfail++;
+      printf("%s: expected %d (%s) and %" PRId64 ", but found %d (%s) and %" PRId64 "\n",
+          cases[i].text, cases[i].ret, ret2name(cases[i].ret), cases[i].v,
+          ret, ret2name(ret), v);
+      printf("FAILED: %s\n", __func__);
+    }
+  }
+}
+
+static uint64_t rand64(uint64_t *s)
+{
+  // xorshift64*
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return *s * 2685821657736338717ULL;
+}
+
+// random doubles printed with enough digits to round trip, and random
+// digit strings that are often far from any double
+static void test_random_numbers(void)
+{
+  uint64_t s = 88172645463325252ULL;
+  int i, nbad = 0;
+
+  for (i=0; i < 200000; i++) {
+    char text[128];
+    uint64_t bits = rand64(&s);
+    double d;
+
+    memcpy(&d, &bits, sizeof d);
+    if (d != d || d - d != 0.0) {
+      continue; // NaN or infinite
+    }
+
+    snprintf(text, sizeof text, "%.*g", 1 + (int)(rand64(&s) % 17), d);
+    nbad += check_double(text) != 0;
+  }
+
+  for (i=0; i < 200000; i++) {
+    char text[128];
+    int k = 0, nd, j;
+
+    nd = 1 + rand64(&s) % 40;
+    text[k++] = '1' + rand64(&s) % 9;
+    for (j=1; j < nd; j++) {
+      text[k++] = '0' + rand64(&s) % 10;
+    }
+
+    if (rand64(&s) % 2) {
+      text[k++] = '.';
+      text[k++] = '0' + rand64(&s) % 10;
+    }
+
+    snprintf(&text[k], sizeof text - k, "e%d", (int)(rand64(&s) % 700) - 350);
+    nbad += check_double(text) != 0;
+  }
+
+  ntest++;
+  if (nbad > 0) {
+    nfail++;
+    printf("FAILED: %s (%d numbers)\n", __func__, nbad);
+  }
+}
+
+int main(void)
+{
+  test_number_values();
+  test_invalid_numbers();
+  test_number_to_int64();
+  test_random_numbers();
+
+  printf("%d tests, %d failures\n", ntest,nfail);
+  return nfail == 0 ? 0 : 1;
+}
@@ -1,6 +1,8 @@
 #include "sjp_parser.h"
+#include "sjp_number.h"
 
 #include <assert.h>
+#include <stdint.h>
 #include <string.h>
 
 #if SJP_DEBUG
@@ -9,27 +11,63 @@
 #  define SHOULD_NOT_REACH()
 #endif /* SJP_DEBUG */
 
+#if defined(__GNUC__)
+#  define JP_COLD __attribute__((noinline, cold))
+#else
+#  define JP_COLD
+#endif
+
 static int jp_pushstate(struct sjp_parser *p, enum SJP_PARSER_STATE st);
+static int jp_growstack(struct sjp_parser *p, enum SJP_PARSER_STATE st);
 static int jp_popstate(struct sjp_parser *p);
 
 static int jp_getstate(struct sjp_parser *p);
 static void jp_setstate(struct sjp_parser *p, enum SJP_PARSER_STATE st);
 
+// Lexer options for parser options
+static unsigned jp_lexopts(unsigned opts)
+{
+  unsigned lopts = 0;
+
+  if (opts & SJP_PARSER_RAW_NUMBERS) {
+    lopts |= SJP_LEX_RAW_NUMBERS;
+  }
+
+  if (opts & SJP_PARSER_HASH_STRINGS) {
+    lopts |= SJP_LEX_HASH_STRINGS;
+  }
+
+  return lopts;
+}
+
 void sjp_parser_reset(struct sjp_parser *p)
 {
   struct sjp_token zero_tok = { 0 };
   sjp_lexer_init(&p->lex);
+  p->lex.opts = jp_lexopts(p->opts);
+  sjp_lexer_set_scratch(&p->lex, p->scratch, p->nscratch);
   p->top = 0;
-  jp_pushstate(p,SJP_PARSER_VALUE);
+  p->state = SJP_PARSER_VALUE;
+  p->partial = 0;
+  p->docend = 0;
+  p->started = 0;
   p->off = 0;
 
   p->spill = zero_tok;
   p->rspill = 0;
   p->has_spilled = 0;
+  p->hash = SJP_HASH_INIT;
+
+  p->skipping = 0;
 }
 
 enum SJP_RESULT sjp_parser_init(struct sjp_parser *p, char *stack, size_t nstack, char *buf, size_t nbuf)
 {
+  if (stack == NULL && nstack == 0) {
+    stack = p->istack;
+    nstack = sizeof p->istack;
+  }
+
   if (nstack < SJP_PARSER_MIN_STACK || stack == NULL) {
     return SJP_INVALID_PARAMS;
   }
@@ -44,44 +82,161 @@ enum SJP_RESULT sjp_parser_init(struct sjp_parser *p, char *stack, size_t nstack
 
   p->stack = stack;
   p->nstack = nstack;
+  p->stack0 = stack;
+  p->nstack0 = nstack;
+
+  p->alloc = NULL;
+  p->alloc_ud = NULL;
+  p->maxstack = nstack;
 
   p->buf = buf;
   p->nbuf = nbuf;
 
+  p->opts = 0;
+  p->scratch = NULL;
+  p->nscratch = 0;
   sjp_parser_reset(p);
 
   return SJP_OK;
 }
 
+void sjp_parser_set_options(struct sjp_parser *p, unsigned opts)
+{
+  p->opts = opts;
+  p->lex.opts = jp_lexopts(opts);
+}
+
+enum SJP_RESULT sjp_parser_set_allocator(struct sjp_parser *p, sjp_parser_alloc_fn alloc, void *ud, size_t maxstack)
+{
+  if (maxstack < SJP_PARSER_MIN_STACK) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  p->alloc = alloc;
+  p->alloc_ud = ud;
+  p->maxstack = maxstack;
+  return SJP_OK;
+}
+
+enum SJP_RESULT sjp_parser_set_scratch(struct sjp_parser *p, char *buf, size_t n)
+{
+  int ret;
+
+  if (ret = sjp_lexer_set_scratch(&p->lex, buf, n), ret != SJP_OK) {
+    return ret;
+  }
+
+  p->scratch = buf;
+  p->nscratch = n;
+  return SJP_OK;
+}
+
 #define PUSHSTATE(p,st) do{        \
   int _e = jp_pushstate((p),(st)); \
   if (SJP_ERROR(_e)) { return _e; } \
 } while(0)
 
+#define PUSHPARTIAL(p) ((p)->partial = 1)
+#define POPPARTIAL(p)  ((p)->partial = 0)
+
 #define POPSTATE(p) do{      \
   int _e = jp_popstate((p)); \
   if (SJP_ERROR(_e)) { return _e; } \
 } while(0)
 
+// The stack has one bit per level of nesting, set for objects and clear
+// for arrays.  Level d (counting from one) is bit d-1.  Only the
+// innermost level needs its full state, and it's kept in p->state; when
+// a level is popped, the state of the enclosing level is always "read a
+// value", so the bit is enough to restore it.
+//
+// A partial value doesn't nest, so it's a flag rather than a level.
+
 static int jp_pushstate(struct sjp_parser *p, enum SJP_PARSER_STATE st)
 {
-  if (p->top >= p->nstack) {
+  size_t i;
+
+  if (p->top >= 8*p->nstack) {
+    return jp_growstack(p, st);
+  }
+
+  i = p->top++;
+  if (st == SJP_PARSER_OBJ_NEW) {
+    p->stack[i/8] |= 1u << (i%8);
+  } else {
+    p->stack[i/8] &= ~(1u << (i%8));
+  }
+  p->state = st;
+
+  return SJP_OK;
+}
+
+// Slow path of jp_pushstate: grows a full stack, and pushes st.  Kept
+// out of line so that pushes on a stack with room cost the same as
+// with a fixed stack.
+static JP_COLD int jp_growstack(struct sjp_parser *p, enum SJP_PARSER_STATE st)
+{
+  size_t n;
+  char *stack;
+
+  if (p->alloc == NULL || p->nstack >= p->maxstack) {
     return SJP_TOO_MUCH_NESTING;
   }
 
-  p->stack[p->top++] = st;
+  n = (p->nstack > p->maxstack / 2) ? p->maxstack : 2 * p->nstack;
+
+  // the first stack belongs to the caller, so it's copied rather than
+  // reallocated
+  if (p->stack == p->stack0) {
+    if (stack = p->alloc(p->alloc_ud, NULL, n), stack == NULL) {
+      return SJP_OUT_OF_MEMORY;
+    }
+    memcpy(stack, p->stack, (p->top + 7) / 8);
+  } else if (stack = p->alloc(p->alloc_ud, p->stack, n), stack == NULL) {
+    return SJP_OUT_OF_MEMORY;
+  }
+
+  p->stack = stack;
+  p->nstack = n;
+
+  return jp_pushstate(p, st);
+}
+
+static void jp_freestack(struct sjp_parser *p)
+{
+  if (p->stack != p->stack0) {
+    p->alloc(p->alloc_ud, p->stack, 0);
+    p->stack = p->stack0;
+    p->nstack = p->nstack0;
+    p->top = 0;
+  }
+}
+
+// Returns 1 if level d (counting from one) is an object, 0 if an array.
+static int jp_isobject(struct sjp_parser *p, size_t d)
+{
+  return (p->stack[(d-1)/8] >> ((d-1)%8)) & 1;
+}
+
+// Reports the innermost unclosed object or array, at the end of the
+// stream
+static enum SJP_RESULT jp_unclosed(struct sjp_parser *p)
+{
+  if (p->top > 0) {
+    return jp_isobject(p, p->top) ? SJP_UNCLOSED_OBJECT : SJP_UNCLOSED_ARRAY;
+  }
 
   return SJP_OK;
 }
 
 static int jp_getstate(struct sjp_parser *p)
 {
-  return p->stack[p->top-1];
+  return p->partial ? SJP_PARSER_PARTIAL : p->state;
 }
 
 static void jp_setstate(struct sjp_parser *p, enum SJP_PARSER_STATE st)
 {
-  p->stack[p->top-1] = st;
+  p->state = st;
 }
 
 static int jp_popstate(struct sjp_parser *p)
@@ -90,7 +245,12 @@ static int jp_popstate(struct sjp_parser *p)
     return SJP_INTERNAL_ERROR;
   }
 
-  p->top--;
+  if (--p->top == 0) {
+    p->state = SJP_PARSER_VALUE;
+  } else {
+    p->state = jp_isobject(p, p->top) ? SJP_PARSER_OBJ_VALUE : SJP_PARSER_ARR_ITEM;
+  }
+
   return SJP_OK;
 }
 
@@ -126,7 +286,7 @@ static int parse_value(struct sjp_parser *p, struct sjp_event *evt, int ret, str
   }
 
   if (ret != SJP_OK) {
-    PUSHSTATE(p, SJP_PARSER_PARTIAL);
+    PUSHPARTIAL(p);
   }
 
   return ret;
@@ -157,6 +317,15 @@ static void returnbuf(struct sjp_parser *p, struct sjp_token *tok)
   p->off = 0;
 }
 
+// Notes the hash of the string returned so far, which a partial string
+// spilled from the buffer starts from
+static void jp_sethash(struct sjp_parser *p, const struct sjp_token *tok, enum SJP_RESULT ret)
+{
+  if (tok->type == SJP_TOK_STRING) {
+    p->hash = (ret == SJP_OK) ? SJP_HASH_INIT : tok->hash;
+  }
+}
+
 static enum SJP_RESULT spill(struct sjp_parser *p, struct sjp_token *tok, enum SJP_RESULT ret)
 {
   assert(p->spill.n == 0);
@@ -165,14 +334,20 @@ static enum SJP_RESULT spill(struct sjp_parser *p, struct sjp_token *tok, enum S
   assert(tok->n > 0);
   assert(tok->value != NULL);
 
-  p->spill.n = tok->n;
-  p->spill.value = tok->value;
+  p->spill = *tok;
   p->rspill = ret;
   p->has_spilled = 1;
 
   returnbuf(p,tok);
 
-  return ret;
+  // The lexer's hash includes the spilled data, which isn't returned yet
+  if (tok->type == SJP_TOK_STRING && (p->opts & SJP_PARSER_HASH_STRINGS)) {
+    tok->hash = p->hash = sjp_hash_more(p->hash, tok->value, tok->n);
+  }
+
+  // The spilled data is still in the caller's buffer, so the caller
+  // must not give the parser more data until it's returned.
+  return SJP_PARTIAL;
 }
 
 static enum SJP_RESULT next_token(struct sjp_parser *p, struct sjp_token *tok)
@@ -215,6 +390,7 @@ next_token:
 
         // fast exit if buffer is empty
         if (p->off == 0) {
+          jp_sethash(p, tok, ret);
           return ret;
         }
       }
@@ -242,6 +418,7 @@ next_token:
         // call?
         if (ret == SJP_OK || p->has_spilled || p->off >= p->nbuf) {
           returnbuf(p,tok);
+          jp_sethash(p, tok, ret);
           return ret;
         }
 
@@ -263,8 +440,7 @@ next_token:
       //   Otherwise, append the data to the buffer, go to state 2.
       {
         if (fillbuf(p, tok)) {
-          spill(p, tok, ret);
-          return SJP_MORE;
+          return spill(p, tok, ret);
         }
 
         // if we didn't spill, request more from the lexer
@@ -277,53 +453,73 @@ next_token:
   }
 }
 
-enum SJP_RESULT sjp_parser_next(struct sjp_parser *p, struct sjp_event *evt)
+static enum SJP_RESULT jp_feed(struct sjp_parser *p, struct sjp_token *tok, enum SJP_RESULT ret, struct sjp_event *evt);
+
+// Returns 1 if the parser is between documents in stream mode
+static int jp_between_docs(struct sjp_parser *p)
 {
-  struct sjp_token tok = {0};
-  int st,ret;
+  return (p->opts & SJP_PARSER_STREAM) && p->top == 0 && !p->partial;
+}
 
-restart:
-  evt->text = NULL;
-  evt->n = 0;
-  evt->extra.d = 0;
+enum SJP_RESULT sjp_parser_feed(struct sjp_parser *p, struct sjp_token *tok, enum SJP_RESULT ret, struct sjp_event *evt)
+{
+  ret = jp_feed(p, tok, ret, evt);
 
-  // XXX - stream of values?
-  if (p->top == 0) {
-    // TODO: this was initially meant to close the stream of input after
-    // the first value is read, but currently the stack should always
-    // have one item.
-    return SJP_INTERNAL_ERROR;
+  if (evt->type != SJP_NONE) {
+    p->started = 1;
   }
 
-  st = jp_getstate(p);
-
-  if (ret = next_token(p, &tok), SJP_ERROR(ret)) {
-    return ret;
+  // the last event of a document
+  if (ret == SJP_OK && evt->type != SJP_NONE && jp_between_docs(p)) {
+    p->docend = 1;
   }
 
-  if (ret == SJP_MORE && tok.type == SJP_NONE) {
-    return ret;
-  }
+  return ret;
+}
 
-  evt->text = tok.value;
-  evt->n = tok.n;
-  if (evt->type == SJP_TOK_NUMBER) {
-    evt->extra.d = tok.extra.dbl;
-  } else if (evt->type == SJP_TOK_STRING) {
-    evt->extra.ncp = tok.extra.ncp;
+static enum SJP_RESULT jp_feed(struct sjp_parser *p, struct sjp_token *tok, enum SJP_RESULT ret, struct sjp_event *evt)
+{
+  int st = jp_getstate(p);
+
+  // The lexer leaves a long number unconverted if it was split across
+  // buffers.  If the value buffer joined it, the whole text is here.
+  if (tok->type == SJP_TOK_NUMBER && ret == SJP_OK && tok->kind == SJP_NUM_RAW &&
+      st != SJP_PARSER_PARTIAL && !(p->opts & SJP_PARSER_RAW_NUMBERS)) {
+    int cret = sjp_number_to_double(tok->value, tok->n, &tok->extra.dbl);
+    assert(cret == SJP_OK);
+    (void)cret;
+    tok->kind = SJP_NUM_DOUBLE;
   }
 
+  evt->text = tok->value;
+  evt->n = tok->n;
+  evt->extra.d = 0;
+  evt->num.i64 = 0;
+  evt->kind = SJP_NUM_DOUBLE;
+  evt->shape = 0;
+  evt->hash = 0;
+  evt->key = 0;
+  if (tok->type == SJP_TOK_NUMBER) {
+    evt->extra.d = tok->extra.dbl;
+    evt->num.u64 = tok->num.u64;
+    evt->kind = tok->kind;
+    evt->shape = tok->shape;
+  } else if (tok->type == SJP_TOK_STRING) {
+    evt->extra.ncp = tok->extra.ncp;
+    evt->shape = tok->shape;
+    evt->hash = tok->hash;
+  }
 
   switch (st) {
     case SJP_PARSER_VALUE:
-      return parse_value(p, evt, ret, &tok);
+      return parse_value(p, evt, ret, tok);
 
     case SJP_PARSER_PARTIAL:
       if (ret == SJP_OK) {
-        POPSTATE(p);
+        POPPARTIAL(p);
       }
 
-      switch (tok.type) {
+      switch (tok->type) {
         case SJP_TOK_NULL:
           evt->type = SJP_NULL;
           break;
@@ -338,12 +534,13 @@ restart:
 
         case SJP_TOK_STRING:
           evt->type = SJP_STRING;
-          evt->extra.ncp = tok.extra.ncp;
+          evt->extra.ncp = tok->extra.ncp;
+          evt->key = (p->state == SJP_PARSER_OBJ_KEY);
           break;
 
         case SJP_TOK_NUMBER:
           evt->type = SJP_NUMBER;
-          evt->extra.d = tok.extra.dbl;
+          evt->extra.d = tok->extra.dbl;
           break;
 
         default:
@@ -354,7 +551,7 @@ restart:
       return ret;
 
     case SJP_PARSER_OBJ_NEW:
-      switch (tok.type) {
+      switch (tok->type) {
         case '}':
           POPSTATE(p);
 
@@ -363,10 +560,11 @@ restart:
 
         case SJP_TOK_STRING:
           evt->type = SJP_STRING;
-          evt->extra.ncp = tok.extra.ncp;
+          evt->extra.ncp = tok->extra.ncp;
+          evt->key = 1;
           jp_setstate(p, SJP_PARSER_OBJ_KEY);
           if (ret != SJP_OK) {
-            PUSHSTATE(p,SJP_PARSER_PARTIAL);
+            PUSHPARTIAL(p);
           }
           return ret;
 
@@ -375,22 +573,24 @@ restart:
       }
 
     case SJP_PARSER_OBJ_KEY:
-      if (tok.type != ':') {
+      if (tok->type != ':') {
         return SJP_INVALID_INPUT;
       }
 
       jp_setstate(p, SJP_PARSER_OBJ_COLON);
-      goto restart;
+      evt->type = SJP_NONE;
+      return SJP_OK;
 
     case SJP_PARSER_OBJ_COLON:
       jp_setstate(p, SJP_PARSER_OBJ_VALUE);
-      return parse_value(p, evt, ret, &tok);
+      return parse_value(p, evt, ret, tok);
 
     case SJP_PARSER_OBJ_VALUE:
-      switch (tok.type) {
+      switch (tok->type) {
         case ',':
           jp_setstate(p, SJP_PARSER_OBJ_NEXT);
-          goto restart;
+          evt->type = SJP_NONE;
+          return SJP_OK;
 
         case '}':
           POPSTATE(p);
@@ -403,20 +603,21 @@ restart:
       }
 
     case SJP_PARSER_OBJ_NEXT:
-      if (tok.type != SJP_TOK_STRING) {
+      if (tok->type != SJP_TOK_STRING) {
         return SJP_INVALID_KEY;
       }
 
       evt->type = SJP_STRING;
-      evt->extra.ncp = tok.extra.ncp;
+      evt->extra.ncp = tok->extra.ncp;
+      evt->key = 1;
       jp_setstate(p, SJP_PARSER_OBJ_KEY);
       if (ret != SJP_OK) {
-        PUSHSTATE(p, SJP_PARSER_PARTIAL);
+        PUSHPARTIAL(p);
       }
       return ret;
 
     case SJP_PARSER_ARR_NEW:
-      if (tok.type == ']') {
+      if (tok->type == ']') {
         POPSTATE(p);
 
         evt->type = SJP_ARRAY_END;
@@ -424,13 +625,14 @@ restart:
       }
 
       jp_setstate(p, SJP_PARSER_ARR_ITEM);
-      return parse_value(p, evt, ret, &tok);
+      return parse_value(p, evt, ret, tok);
 
     case SJP_PARSER_ARR_ITEM:
-      switch (tok.type) {
+      switch (tok->type) {
         case ',':
           jp_setstate(p, SJP_PARSER_ARR_NEXT);
-          goto restart;
+          evt->type = SJP_NONE;
+          return SJP_OK;
 
         case ']':
           POPSTATE(p);
@@ -444,7 +646,7 @@ restart:
 
     case SJP_PARSER_ARR_NEXT:
       jp_setstate(p, SJP_PARSER_ARR_ITEM);
-      return parse_value(p, evt, ret, &tok);
+      return parse_value(p, evt, ret, tok);
 
     default:
       return SJP_INTERNAL_ERROR;
@@ -454,57 +656,317 @@ restart:
   return SJP_INTERNAL_ERROR;
 }
 
-void sjp_parser_more(struct sjp_parser *p, char *data, size_t n)
+static void jp_noevent(struct sjp_event *evt)
 {
-  sjp_lexer_more(&p->lex, data, n);
+  evt->type = SJP_NONE;
+  evt->text = NULL;
+  evt->n = 0;
+  evt->extra.d = 0;
+  evt->num.i64 = 0;
+  evt->kind = SJP_NUM_DOUBLE;
+  evt->shape = 0;
+  evt->hash = 0;
+  evt->key = 0;
 }
 
-int sjp_parser_state(struct sjp_parser *p)
+// Fills in the SJP_DOC_END event after a document in stream mode
+static void jp_docend(struct sjp_parser *p, struct sjp_event *evt)
 {
-    return jp_getstate(p);
+  p->docend = 0;
+  jp_noevent(evt);
+  evt->type = SJP_DOC_END;
 }
 
-enum SJP_RESULT sjp_parser_close(struct sjp_parser *p)
+enum SJP_RESULT sjp_parser_next(struct sjp_parser *p, struct sjp_event *evt)
 {
+  struct sjp_token tok = {0};
   int ret;
-  if (ret = sjp_lexer_close(&p->lex), SJP_ERROR(ret)) {
-    return ret;
+
+  if (p->docend) {
+    jp_docend(p, evt);
+    return SJP_OK;
   }
 
-  if (jp_getstate(p) == SJP_PARSER_PARTIAL) {
-    POPSTATE(p);
+  // commas and colons don't produce events, so keep feeding tokens to
+  // the parser until one does
+  do {
+    evt->type = SJP_NONE;
+    evt->text = NULL;
+    evt->n = 0;
+    evt->extra.d = 0;
+    evt->num.i64 = 0;
+    evt->kind = SJP_NUM_DOUBLE;
+    evt->shape = 0;
+    evt->hash = 0;
+    evt->key = 0;
+
+    if (ret = next_token(p, &tok), SJP_ERROR(ret)) {
+      return ret;
+    }
+
+    if (ret == SJP_MORE && tok.type == SJP_TOK_NONE) {
+      return ret;
+    }
+
+    // the end of a stream of documents
+    if (tok.type == SJP_TOK_EOS && (p->opts & SJP_PARSER_STREAM)) {
+      return jp_unclosed(p);
+    }
+
+    ret = sjp_parser_feed(p, &tok, ret, evt);
+  } while (ret == SJP_OK && evt->type == SJP_NONE);
+
+  return ret;
+}
+
+// Returns 1 if text is in memory that the parser or its lexer reuses
+// when they read the next token: the value buffer, the lexer's restart
+// buffer, or the scratch buffer.
+static int jp_owned(const struct sjp_parser *p, const char *text)
+{
+  uintptr_t t = (uintptr_t)text;
+
+  if (text == NULL) {
+    return 0;
   }
 
-  if (p->top > 1) {
-    int i;
+  if (p->nbuf > 0 && t - (uintptr_t)p->buf < p->nbuf) {
+    return 1;
+  }
+
+  if (t - (uintptr_t)p->lex.buf < sizeof p->lex.buf) {
+    return 1;
+  }
+
+  return p->lex.nscratch > 0 && t - (uintptr_t)p->lex.scratch < p->lex.nscratch;
+}
+
+enum {
+  JP_BATCH_TOKENS = 64,  // tokens lexed at a time by sjp_parser_next_batch
+};
+
+enum SJP_RESULT sjp_parser_next_batch(struct sjp_parser *p, struct sjp_event *evts, size_t max, size_t *count)
+{
+  struct sjp_token toks[JP_BATCH_TOKENS];
+  size_t nevt = 0;
+  int pinned = 0;
+
+  while (nevt < max && !pinned) {
+    enum SJP_RESULT ret;
+    size_t i, ntok;
+
+    if (p->docend) {
+      jp_docend(p, &evts[nevt++]);
+      continue;
+    }
 
-    // look at what we're waiting for...
-    for (i=p->top-1; i >= 1; i--) {
-      switch (p->stack[i]) {
+    // Each token makes at most one event, so lexing no more tokens than
+    // there is room for events never leaves lexed tokens behind.
+    if (p->nbuf > 0) {
+      // the value buffer joins partial tokens one token at a time
+      memset(&toks[0], 0, sizeof toks[0]);
+      ret = next_token(p, &toks[0]);
+      ntok = SJP_ERROR(ret) ? 0 : 1;
+    } else {
+      size_t want = max - nevt;
+
+      // In stream mode, a token can also end a document, and make an
+      // SJP_DOC_END event.  If there's no room for it, it's returned
+      // first by the next call.
+      if ((p->opts & SJP_PARSER_STREAM) && want > 1) {
+        want /= 2;
+      }
+
+      if (want > JP_BATCH_TOKENS) {
+        want = JP_BATCH_TOKENS;
+      }
+      ret = sjp_lexer_tokens(&p->lex, toks, want, &ntok);
+    }
+
+    for (i=0; i < ntok; i++) {
+      struct sjp_event *evt = &evts[nevt];
+      // the tokens before a lexer error are complete
+      enum SJP_RESULT tret = (i == ntok-1 && !SJP_ERROR(ret)) ? ret : SJP_OK;
+
+      if (toks[i].type == SJP_TOK_EOS) {
+        *count = nevt;
+
+        // as with sjp_parser_next(), a document needs a value
+        if (!(p->opts & SJP_PARSER_STREAM) && !p->started) {
+          return SJP_INVALID_INPUT;
+        }
+        return SJP_OK;
+      }
+
+      if (tret == SJP_MORE && toks[i].type == SJP_TOK_NONE) {
+        jp_noevent(evt);
+        *count = nevt+1;
+        return tret;
+      }
+
+      if (tret = sjp_parser_feed(p, &toks[i], tret, evt), SJP_ERROR(tret)) {
+        *count = nevt;
+        return tret;
+      }
+
+      if (evt->type != SJP_NONE || tret != SJP_OK) {
+        // Events in reused memory are valid until the next token is
+        // read, so they end the batch.
+        pinned |= jp_owned(p, evt->text);
+        nevt++;
+      }
+
+      if (p->docend && nevt < max) {
+        jp_docend(p, &evts[nevt++]);
+      }
+
+      if (tret != SJP_OK) {
+        *count = nevt;
+        return tret;
+      }
+    }
+
+    if (SJP_ERROR(ret)) {
+      *count = nevt;
+      return ret;
+    }
+  }
+
+  *count = nevt;
+  return SJP_OK;
+}
+
+enum SJP_RESULT sjp_parser_skip(struct sjp_parser *p, size_t *count)
+{
+  struct sjp_skip *sk = &p->skip;
+  int ret;
+
+  if (!p->skipping) {
+    struct sjp_skip zero_skip = { 0 };
+
+    *sk = zero_skip;
+
+    if (!p->partial) {
+      switch (p->state) {
         case SJP_PARSER_VALUE:
-        case SJP_PARSER_PARTIAL:
+        case SJP_PARSER_OBJ_COLON:
           break;
 
-        case SJP_PARSER_OBJ_NEW:
         case SJP_PARSER_OBJ_KEY:
-        case SJP_PARSER_OBJ_COLON:
-        case SJP_PARSER_OBJ_VALUE:
-        case SJP_PARSER_OBJ_NEXT:
-          return SJP_UNCLOSED_OBJECT;
+          sk->flags = SJP_SKIP_COLON;
+          break;
 
+        case SJP_PARSER_OBJ_NEW:
         case SJP_PARSER_ARR_NEW:
+          // The first element may have started, and be held in the
+          // value buffer, the spill or the lexer's restart buffer.
+          // Then it's counted here, as its bytes are gone.
+          sk->depth = 1;
+          if (p->off > 0 || p->spill.n > 0 || p->lex.state != SJP_LST_VALUE) {
+            sk->count = 1;
+          } else {
+            sk->flags = SJP_SKIP_FIRST;
+          }
+          break;
+
+        case SJP_PARSER_OBJ_VALUE:
         case SJP_PARSER_ARR_ITEM:
+          sk->depth = 1;
+          break;
+
+        case SJP_PARSER_OBJ_NEXT:
         case SJP_PARSER_ARR_NEXT:
-          return SJP_UNCLOSED_ARRAY;
+          // the element after the comma
+          sk->depth = 1;
+          sk->count = 1;
+          break;
 
         default:
-          return SJP_INTERNAL_ERROR;  // unknown state
+          return SJP_INTERNAL_ERROR;
       }
     }
 
-    return SJP_INTERNAL_ERROR;
+    // Buffered data is part of the value.  A spilled token that ended
+    // the value leaves the lexer between tokens, and nothing of the
+    // value is left to skip.
+    p->off = 0;
+    if (p->spill.n > 0) {
+      int ended = (p->rspill == SJP_OK);
+
+      p->spill.n = 0;
+      p->spill.value = NULL;
+      p->rspill = 0;
+
+      if (ended && p->partial) {
+        goto skipped;
+      }
+    }
+
+    p->skipping = 1;
+  }
+
+  if (ret = sjp_lexer_skip(&p->lex, sk), ret != SJP_OK) {
+    return ret;
+  }
+
+  p->skipping = 0;
+
+skipped:
+  p->hash = SJP_HASH_INIT;
+  if (p->partial) {
+    POPPARTIAL(p);
+  } else if (p->state == SJP_PARSER_OBJ_KEY || p->state == SJP_PARSER_OBJ_COLON) {
+    jp_setstate(p, SJP_PARSER_OBJ_VALUE);
+  } else if (p->state != SJP_PARSER_VALUE) {
+    POPSTATE(p);
+  }
+
+  if (jp_between_docs(p)) {
+    p->docend = 1;
+  }
+
+  p->has_spilled = 0;
+
+  if (count != NULL) {
+    *count = sk->count;
   }
 
   return SJP_OK;
 }
 
+void sjp_parser_more(struct sjp_parser *p, char *data, size_t n)
+{
+  sjp_lexer_more(&p->lex, data, n);
+}
+
+void sjp_parser_more_const(struct sjp_parser *p, const char *data, size_t n)
+{
+  sjp_lexer_more_const(&p->lex, data, n);
+}
+
+int sjp_parser_state(struct sjp_parser *p)
+{
+    return jp_getstate(p);
+}
+
+static enum SJP_RESULT jp_close(struct sjp_parser *p);
+
+enum SJP_RESULT sjp_parser_close(struct sjp_parser *p)
+{
+  enum SJP_RESULT ret = jp_close(p);
+  jp_freestack(p);
+  return ret;
+}
+
+static enum SJP_RESULT jp_close(struct sjp_parser *p)
+{
+  int ret;
+  if (ret = sjp_lexer_close(&p->lex), SJP_ERROR(ret)) {
+    return ret;
+  }
+
+  POPPARTIAL(p);
+
+  return jp_unclosed(p);
+}
+
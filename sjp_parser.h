@@ -18,9 +18,10 @@ enum SJP_EVENT {
   SJP_OBJECT_END,
   SJP_ARRAY_BEG,
   SJP_ARRAY_END,
+  SJP_DOC_END,      // end of a document, in stream mode
 };
 
-#define SJP_EVENT_MAX 10
+#define SJP_EVENT_MAX 11
 
 enum SJP_PARSER_STATE {
   SJP_PARSER_VALUE = 0,
@@ -54,16 +55,83 @@ struct sjp_event {
     size_t ncp;
     double d;
   } extra;
+
+  /* SJP_NUMBER: kind of number, the exact value of integers, and the
+   * shape of the number (see struct sjp_token)
+   *
+   * SJP_STRING: the shape of the string (enum SJP_STRING_SHAPE)
+   */
+  union {
+    int64_t i64;
+    uint64_t u64;
+  } num;
+  enum SJP_NUMBER_KIND kind;
+  unsigned shape;
+
+  // SJP_STRING with SJP_PARSER_HASH_STRINGS: hash of the string so far
+  // (see sjp_hash)
+  uint32_t hash;
+
+  // SJP_STRING: 1 if the string is the key of an object member, and 0
+  // if it's a value
+  unsigned char key;
+};
+
+// Parser options (see sjp_parser_set_options)
+enum SJP_PARSER_OPTIONS {
+  // SJP_NUMBER events carry the text and shape of the number, and
+  // numbers are only converted if they are 64 bit integers.  Other
+  // numbers are SJP_NUM_RAW; convert them on demand with
+  // sjp_number_to_double().  For pipelines that pass numbers through
+  // as text.
+  SJP_PARSER_RAW_NUMBERS = 1 << 0,
+
+  // SJP_STRING events carry a hash of the string (see sjp_hash()),
+  // computed as the lexer returns it, so keys can be looked up in a
+  // table built with sjp_hash() without reading them again.  With
+  // partial strings, the event that completes the string has the hash
+  // of the whole string.
+  SJP_PARSER_HASH_STRINGS = 1 << 1,
+
+  // Stream mode: the input is a sequence of documents, separated by
+  // whitespace (or nothing, if they are arrays, objects or strings), as
+  // in newline delimited JSON.  After the last event of each document,
+  // the next event is SJP_DOC_END.  At the end of the stream between
+  // documents, sjp_parser_next() returns SJP_OK with an SJP_NONE event.
+  //
+  // The parser keeps its buffers, stack and stream offsets from one
+  // document to the next, so there is no need to reset it.
+  SJP_PARSER_STREAM = 1 << 2,
 };
 
 enum {
   SJP_PARSER_MIN_STACK  = 16,
 };
 
+// Allocator for a growable parser stack, with the semantics of
+// realloc(): ptr is NULL to allocate, and n is zero to free.  ud is
+// passed through from sjp_parser_set_allocator().
+typedef void *(*sjp_parser_alloc_fn)(void *ud, void *ptr, size_t n);
+
 struct sjp_parser {
-  char *stack;
-  size_t top;
-  size_t nstack;
+  char *stack;     // one bit per level: set for objects, clear for arrays
+  size_t top;      // depth of nesting
+  size_t nstack;   // size of the stack in bytes
+
+  unsigned char state;    // state of the innermost level
+  unsigned char partial;  // finishing a partial value
+  unsigned char docend;   // stream mode: SJP_DOC_END is next
+  unsigned char started;  // an event has been returned since the reset
+
+  // the stack given to sjp_parser_init (or istack), which is used
+  // until the stack grows
+  char *stack0;
+  size_t nstack0;
+  char istack[SJP_PARSER_MIN_STACK];
+
+  sjp_parser_alloc_fn alloc;  // see sjp_parser_set_allocator
+  void *alloc_ud;
+  size_t maxstack;
 
   char *buf;
   size_t off;
@@ -72,23 +140,56 @@ struct sjp_parser {
   struct sjp_token spill;
   enum SJP_RESULT rspill;  // return value of spilled call
   int has_spilled;
+  uint32_t hash;           // hash of the parts of a string returned so far
+
+  unsigned opts;  // enum SJP_PARSER_OPTIONS
+
+  char *scratch;  // see sjp_parser_set_scratch
+  size_t nscratch;
+
+  struct sjp_skip skip;  // see sjp_parser_skip
+  int skipping;
 
   struct sjp_lexer lex;
 };
 
 // Initializes the parser state.  The parser has both a stack and a
-// value buffer.
+// value buffer.  The stack holds a bit for each level of nesting, so a
+// stack of nstack bytes allows 8*nstack levels.
 //
 // Returns SJP_OK on success.
 //
 // Returns SJP_INVALID_PARAMS if:
 //   stack == NULL or nstack < SJP_PARSER_MIN_STACK
-// or if:
+// unless stack == NULL and nstack == 0, or if:
 //   nbuf > 0 and (buf == NULL or nbuf <= SJP_LEX_RESTART_SIZE)
 //
+// If stack == NULL and nstack == 0, the parser uses a small stack of
+// SJP_PARSER_MIN_STACK bytes in the parser struct, which can grow if
+// the parser has an allocator (see sjp_parser_set_allocator).  A parser
+// with the in-struct stack must not be copied.
+//
 // If nbuf == 0, buf must be NULL and the lexer is not buffered.
 enum SJP_RESULT sjp_parser_init(struct sjp_parser *p, char *stack, size_t nstack, char *buf, size_t nbuf);
 
+// Sets an allocator to grow the stack when it fills, up to maxstack
+// bytes (eight levels of nesting per byte).  The stack doubles each time
+// it grows.  A NULL allocator turns off growth, and the stack is
+// limited to its current size.
+//
+// The allocator is kept by sjp_parser_reset(), as is a grown stack.
+// sjp_parser_close() frees the grown stack, and returns the parser to
+// the stack it was given at sjp_parser_init().
+//
+// Returns SJP_INVALID_PARAMS if maxstack is less than
+// SJP_PARSER_MIN_STACK.
+enum SJP_RESULT sjp_parser_set_allocator(struct sjp_parser *p, sjp_parser_alloc_fn alloc, void *ud, size_t maxstack);
+
+// Sets the parser options (enum SJP_PARSER_OPTIONS), which are zero
+// after sjp_parser_init().  Options are kept by sjp_parser_reset(), and
+// should only be changed between documents.
+void sjp_parser_set_options(struct sjp_parser *p, unsigned opts);
+
 // Resets a the parser to its initial state.
 //
 // This can be used on any parser with a valid (non-NULL and unfreed)
@@ -98,12 +199,39 @@ void sjp_parser_reset(struct sjp_parser *p);
 // Feeds more data to the parser.
 void sjp_parser_more(struct sjp_parser *p, char *data, size_t n);
 
+// Feeds more data to the parser, which doesn't modify it.  Strings with
+// escapes are decoded into the scratch buffer, or returned undecoded.
+// See sjp_lexer_more_const().
+void sjp_parser_more_const(struct sjp_parser *p, const char *data, size_t n);
+
+// Sets the scratch buffer for strings with escapes in const data (see
+// sjp_lexer_set_scratch).  The scratch buffer is kept by
+// sjp_parser_reset().
+//
+// Returns SJP_INVALID_PARAMS if buf is not NULL and n is less than
+// SJP_LEX_RESTART_SIZE.
+enum SJP_RESULT sjp_parser_set_scratch(struct sjp_parser *p, char *buf, size_t n);
+
 // Tells the parser that we've reached the end of the stream.
 static inline void sjp_parser_eos(struct sjp_parser *p)
 {
   sjp_parser_more(p, NULL, 0);
 }
 
+// Returns the offset in the stream of the next byte the parser will
+// read.  After an error, this is near the error.
+static inline size_t sjp_parser_offset(const struct sjp_parser *p)
+{
+  return sjp_lexer_offset(&p->lex);
+}
+
+// Returns the line and column of the next byte the parser will read,
+// both counted from zero.  See sjp_lexer_position().
+static inline void sjp_parser_position(const struct sjp_parser *p, size_t *line, size_t *col)
+{
+  sjp_lexer_position(&p->lex, line, col);
+}
+
 // Fetches the next json event.
 //
 // Return values:
@@ -118,6 +246,9 @@ static inline void sjp_parser_eos(struct sjp_parser *p)
 //
 //   SJP_INVALID       an error occured
 //
+// If the stack is full, returns SJP_TOO_MUCH_NESTING, or
+// SJP_OUT_OF_MEMORY if the allocator fails to grow it.
+//
 // To explain restarts (SJP_MORE and SJP_PARTIAL):
 //
 // If the parser exhausts the input data before it has completely parsed
@@ -141,12 +272,83 @@ static inline void sjp_parser_eos(struct sjp_parser *p)
 // calls to sjp_parser_next().  Note that during partial returns, the
 // event has not been fully parsed, and a subsequent call to
 // sjp_parser_next() may return SJP_INVALID.
+//
+// Numbers that the value buffer joins are converted as usual.  A number
+// returned in parts may be too long for the lexer to convert, and the
+// event that completes it is SJP_NUM_RAW: convert the joined parts with
+// sjp_number_to_double().
+//
+// In stream mode (SJP_PARSER_STREAM), SJP_DOC_END follows each
+// document, and the end of the stream returns SJP_OK with an SJP_NONE
+// event.
 enum SJP_RESULT sjp_parser_next(struct sjp_parser *p, struct sjp_event *evt);
 
+// Fetches up to max events into evts, and sets *count to the number of
+// events filled in.  Use this instead of calling sjp_parser_next() in a
+// loop when many events are read from each buffer.  Commas and colons
+// don't produce events.
+//
+// If the return value is SJP_OK, all *count events are complete.  The
+// array is full, or the last event's text is in a buffer that the
+// parser reuses (the value buffer, or the lexer's restart or scratch
+// buffers).  *count is zero only at the end of the stream, after
+// sjp_parser_eos(); close the parser with sjp_parser_close().  Outside
+// of stream mode, the end of a stream without a value returns
+// SJP_INVALID_INPUT, as sjp_parser_next() does.
+//
+// If the return value is SJP_MORE or SJP_PARTIAL, the last event
+// (evts[*count-1]) is what sjp_parser_next() would have returned: a
+// partial value, or SJP_NONE if there is no partial value.  The events
+// before it are complete.
+//
+// If the return value is negative, *count is the number of complete
+// events before the error.
+//
+// The text of all *count events is valid until the next call.
+enum SJP_RESULT sjp_parser_next_batch(struct sjp_parser *p, struct sjp_event *evts, size_t max, size_t *count);
+
+// Skips the rest of the current value without producing events, for
+// values the caller doesn't want.  Skipped values are only scanned for
+// quotes, escapes and brackets: they aren't validated, and strings and
+// numbers in them aren't decoded.  What is skipped depends on where the
+// parser is:
+//
+//   after a key, or at the start of the document: the next value
+//
+//   in the middle of a partial string or number: the rest of it
+//
+//   anywhere else in an array or object (including right after the
+//   SJP_ARRAY_BEG or SJP_OBJECT_BEG event): the rest of the array or
+//   object, through its closing bracket.  There is no SJP_ARRAY_END or
+//   SJP_OBJECT_END event.
+//
+// If count is not NULL, it is set to the number of elements (or
+// members) of the skipped array or object that were skipped, or zero if
+// the skipped value isn't an array or object.
+//
+// Returns SJP_OK when the value is skipped.  Returns SJP_MORE if the
+// parser needs more data: give it more data with sjp_parser_more() and
+// call sjp_parser_skip() again.  Returns SJP_UNFINISHED_INPUT at the
+// end of the stream, and SJP_INVALID_INPUT if a skipped value starts
+// with a ',', ':' or closing bracket.
+enum SJP_RESULT sjp_parser_skip(struct sjp_parser *p, size_t *count);
+
+// Advances the parser with a token that was lexed elsewhere, for token
+// sources other than the parser's own lexer (see sjp_index.h).  ret is
+// the lexer's return value for the token.
+//
+// Returns the same values as sjp_parser_next().  Commas and colons
+// don't produce events: for these, returns SJP_OK with evt->type set
+// to SJP_NONE.
+//
+// Tokens passed this way bypass the parser's value buffer.
+enum SJP_RESULT sjp_parser_feed(struct sjp_parser *p, struct sjp_token *tok, enum SJP_RESULT ret, struct sjp_event *evt);
+
 // Closes the parser.  If the parser is not in a state that's valid to
 // close, returns an error.
 //
-// The caller is responsible for free'ing any allocated buffers.
+// A stack grown by the parser's allocator is freed.  The caller is
+// responsible for free'ing any other allocated buffers.
 enum SJP_RESULT sjp_parser_close(struct sjp_parser *p);
 
 // Returns the current state of the parser.  Undefined if the parser
@@ -1,4 +1,5 @@
 #include "sjp_parser.h"
+#include "sjp_number.h"
 
 #define TEST_LOG_LEVEL 0
 #include "sjp_testing.h"
@@ -36,11 +37,11 @@ static int parser_test_inputs(struct sjp_parser *p, const char *inputs[], struct
     size_t n, outlen;
 
     LOG("[[ i=%d, j=%d | %d %s ]]\n",
-        i,j, p->stack[p->top-1], pst2name(p->stack[p->top-1]));
+        i,j, sjp_parser_state(p), pst2name(sjp_parser_state(p)));
 #if TEST_LOG_LEVEL > 0
     printf("STACK:");
-    for (int k=0; k < p->top; k++) {
-      printf(" %s", pst2name(p->stack[k]));
+    for (size_t k=0; k < p->top; k++) {
+      printf(" %s", (p->stack[k/8] >> (k%8)) & 1 ? "OBJ" : "ARR");
     }
     printf("\n");
 #endif /* TEST_LOG_LEVEL > 0 */
@@ -216,12 +217,15 @@ static void test_values(void)
     testing_close_marker,
 
     "true",
+    testing_end_of_stream,
     testing_close_marker,
 
     "false",
+    testing_end_of_stream,
     testing_close_marker,
 
     "null",
+    testing_end_of_stream,
     testing_close_marker,
 
     "\"string with utf8: \xc3\xbe\xc2\xa2\xe0\xbc\xb2\"", // three codepoints in utf8
@@ -250,16 +254,16 @@ static void test_values(void)
     { SJP_OK, SJP_NUMBER, "", SJP_TEST_NUMBER, 1.35e-2 },
     { SJP_OK, SJP_NONE, "" },
 
-    { SJP_OK, SJP_TRUE, "true" },
     { SJP_MORE, SJP_NONE, "" },
+    { SJP_OK, SJP_TRUE, "true" },
     { SJP_OK, SJP_NONE, "" },
 
-    { SJP_OK, SJP_FALSE, "false" },
     { SJP_MORE, SJP_NONE, "" },
+    { SJP_OK, SJP_FALSE, "false" },
     { SJP_OK, SJP_NONE, "" },
 
-    { SJP_OK, SJP_NULL, "null" },
     { SJP_MORE, SJP_NONE, "" },
+    { SJP_OK, SJP_NULL, "null" },
     { SJP_OK, SJP_NONE, "" },
 
     { SJP_OK, SJP_STRING,
@@ -282,6 +286,1196 @@ static void test_values(void)
   run_parser_test(__func__, DEFAULT_STACK, NO_BUF, inputs, outputs);
 }
 
+static void test_integer_events(void)
+{
+  static const struct {
+    enum SJP_EVENT type;
+    enum SJP_NUMBER_KIND kind;
+    int64_t i64;
+    uint64_t u64;
+  } expected[] = {
+    { SJP_ARRAY_BEG,  SJP_NUM_DOUBLE, 0, 0 },
+    { SJP_NUMBER,     SJP_NUM_INT64,  12345678901234567, 0 },
+    { SJP_NUMBER,     SJP_NUM_INT64,  -2, 0 },
+    { SJP_NUMBER,     SJP_NUM_UINT64, 0, UINT64_MAX },
+    { SJP_NUMBER,     SJP_NUM_DOUBLE, 0, 0 },
+    { SJP_ARRAY_END,  SJP_NUM_DOUBLE, 0, 0 },
+  };
+
+  char doc[] = "[12345678901234567, -2, 18446744073709551615, 2.5]";
+  char stack[DEFAULT_STACK];
+  struct sjp_parser p;
+  size_t i;
+
+  ntest++;
+
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  sjp_parser_more(&p, doc, strlen(doc));
+
+  for (i=0; i < sizeof expected / sizeof expected[0]; i++) {
+    struct sjp_event evt = { 0 };
+    int ret;
+
+    if (ret = sjp_parser_next(&p, &evt), ret != SJP_OK) {
+      printf("event %zu: expected return %d (%s), but found %d (%s)\n",
+          i, SJP_OK, ret2name(SJP_OK), ret, ret2name(ret));
+      goto failed;
+    }
+
+    if (evt.type != expected[i].type || evt.kind != expected[i].kind ||
+        (evt.kind == SJP_NUM_INT64 && evt.num.i64 != expected[i].i64) ||
+        (evt.kind == SJP_NUM_UINT64 && evt.num.u64 != expected[i].u64)) {
+      printf("event %zu: expected %s of kind %d, but found %s of kind %d\n",
+          i, evt2name(expected[i].type), expected[i].kind, evt2name(evt.type), evt.kind);
+      goto failed;
+    }
+  }
+
+  if (sjp_parser_close(&p) == SJP_OK) {
+    return;
+  }
+
+failed:
+  nfail++;
+  printf("FAILED: %s\n", __func__);
+}
+
+static void test_raw_number_events(void)
+{
+  static const struct {
+    enum SJP_EVENT type;
+    enum SJP_NUMBER_KIND kind;
+    unsigned shape;
+    const char *text;
+    double d;
+  } expected[] = {
+    { SJP_ARRAY_BEG, SJP_NUM_DOUBLE, 0, "[", 0.0 },
+    { SJP_NUMBER,    SJP_NUM_RAW,    SJP_NUM_FRAC, "1.5", 1.5 },
+    { SJP_NUMBER,    SJP_NUM_INT64,  0, "7", 7.0 },
+    { SJP_NUMBER,    SJP_NUM_RAW,    SJP_NUM_NEG | SJP_NUM_EXP, "-2e3", -2e3 },
+    { SJP_ARRAY_END, SJP_NUM_DOUBLE, 0, "]", 0.0 },
+  };
+
+  char doc[] = "[1.5, 7, -2e3]";
+  char stack[DEFAULT_STACK];
+  struct sjp_parser p;
+  size_t i;
+
+  ntest++;
+
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  sjp_parser_set_options(&p, SJP_PARSER_RAW_NUMBERS);
+  sjp_parser_more(&p, doc, strlen(doc));
+
+  for (i=0; i < sizeof expected / sizeof expected[0]; i++) {
+    struct sjp_event evt = { 0 };
+    double d;
+    int ret;
+
+    if (ret = sjp_parser_next(&p, &evt), ret != SJP_OK) {
+      printf("event %zu: expected return %d (%s), but found %d (%s)\n",
+          i, SJP_OK, ret2name(SJP_OK), ret, ret2name(ret));
+      goto failed;
+    }
+
+    if (evt.type != expected[i].type || evt.kind != expected[i].kind ||
+        evt.shape != expected[i].shape ||
+        evt.n != strlen(expected[i].text) || memcmp(evt.text, expected[i].text, evt.n) != 0) {
+      printf("event %zu: expected %s '%s' of kind %d, but found %s '%.*s' of kind %d\n",
+          i, evt2name(expected[i].type), expected[i].text, expected[i].kind,
+          evt2name(evt.type), (int)evt.n, evt.text, evt.kind);
+      goto failed;
+    }
+
+    // numbers are converted on demand
+    if (evt.type == SJP_NUMBER &&
+        (sjp_number_to_double(evt.text, evt.n, &d) != SJP_OK || d != expected[i].d)) {
+      printf("event %zu: could not convert '%.*s' to %f\n", i, (int)evt.n, evt.text, expected[i].d);
+      goto failed;
+    }
+  }
+
+  if (sjp_parser_close(&p) == SJP_OK) {
+    return;
+  }
+
+failed:
+  nfail++;
+  printf("FAILED: %s\n", __func__);
+}
+
+// A number too long for the lexer's restart buffer, split across
+// buffers.  The value buffer joins it, and the parser converts it.
+// Without a value buffer, it comes in parts, and the last part is
+// SJP_NUM_RAW, so the caller converts the joined text.
+static void test_long_split_numbers(void)
+{
+  static const char doc[] = "[49303913109802336928974273568449964.8280768]";
+  static const char num[] = "49303913109802336928974273568449964.8280768";
+  static const size_t nbufs[] = { NO_BUF, 64 };
+  double want;
+  size_t k;
+
+  sjp_number_to_double(num, strlen(num), &want);
+
+  for (k=0; k < sizeof nbufs / sizeof nbufs[0]; k++) {
+    char stack[DEFAULT_STACK];
+    char vbuf[64];
+    char chunks[sizeof doc];
+    char text[sizeof num];
+    struct sjp_parser p;
+    size_t off = 0, ntext = 0, nnum = 0;
+    double d = 0;
+    int ret;
+
+    ntest++;
+
+    memcpy(chunks, doc, sizeof doc);
+    sjp_parser_init(&p, stack, sizeof stack, nbufs[k] > 0 ? vbuf : NULL, nbufs[k]);
+    sjp_parser_more(&p, chunks, 10);
+    off = 10;
+
+    for (;;) {
+      struct sjp_event evt = { 0 };
+
+      if (ret = sjp_parser_next(&p, &evt), SJP_ERROR(ret)) {
+        printf("nbuf %zu: unexpected error %d (%s)\n", nbufs[k], ret, ret2name(ret));
+        goto failed;
+      }
+
+      if (evt.type == SJP_NUMBER) {
+        if (ntext + evt.n > sizeof text) {
+          printf("nbuf %zu: number text is too long\n", nbufs[k]);
+          goto failed;
+        }
+        memcpy(&text[ntext], evt.text, evt.n);
+        ntext += evt.n;
+
+        if (ret == SJP_OK) {
+          nnum++;
+          d = evt.extra.d;
+          if (evt.kind == SJP_NUM_RAW) {
+            sjp_number_to_double(text, ntext, &d);
+          } else if (evt.kind != SJP_NUM_DOUBLE) {
+            printf("nbuf %zu: number of kind %d\n", nbufs[k], evt.kind);
+            goto failed;
+          }
+
+          // the value buffer returns the number whole, and converted
+          if (nbufs[k] > 0 && evt.kind != SJP_NUM_DOUBLE) {
+            printf("nbuf %zu: joined number wasn't converted\n", nbufs[k]);
+            goto failed;
+          }
+        }
+      }
+
+      if (ret == SJP_MORE) {
+        size_t n = sizeof doc - 1 - off;
+        if (n > 10) {
+          n = 10;
+        }
+        if (n == 0) {
+          sjp_parser_eos(&p);
+        } else {
+          sjp_parser_more(&p, &chunks[off], n);
+          off += n;
+        }
+        continue;
+      }
+
+      if (evt.type == SJP_ARRAY_END) {
+        break;
+      }
+    }
+
+    if (nnum != 1 || ntext != strlen(num) || memcmp(text, num, ntext) != 0 || d != want) {
+      printf("nbuf %zu: expected %s (%g), but found '%.*s' (%g)\n",
+          nbufs[k], num, want, (int)ntext, text, d);
+      goto failed;
+    }
+
+    if (ret = sjp_parser_close(&p), ret != SJP_OK) {
+      printf("nbuf %zu: close returned %d (%s)\n", nbufs[k], ret, ret2name(ret));
+      goto failed;
+    }
+    continue;
+
+failed:
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+  }
+}
+
+// Const data: the document is a string literal, so the parser can't
+// write to it.  Strings with escapes are decoded into the scratch
+// buffer, or left as is without one.
+static void test_const_input_events(void)
+{
+  static const char doc[] = "{\"plain\": \"a\\tb\", \"caf\\u00e9\": [\"\\\"q\\\"\", null]}";
+
+  static const struct {
+    enum SJP_EVENT type;
+    unsigned shape;
+    const char *decoded;
+    const char *text;
+  } expected[] = {
+    { SJP_OBJECT_BEG, 0, "{", "{" },
+    { SJP_STRING, 0, "plain", "plain" },
+    { SJP_STRING, SJP_STR_ESCAPED, "a\tb", "a\\tb" },
+    { SJP_STRING, SJP_STR_ESCAPED, "caf\xc3\xa9", "caf\\u00e9" },
+    { SJP_ARRAY_BEG, 0, "[", "[" },
+    { SJP_STRING, SJP_STR_ESCAPED, "\"q\"", "\\\"q\\\"" },
+    { SJP_NULL, 0, "null", "null" },
+    { SJP_ARRAY_END, 0, "]", "]" },
+    { SJP_OBJECT_END, 0, "}", "}" },
+  };
+
+  char stack[DEFAULT_STACK];
+  char scratch[64];
+  int mode;
+
+  // modes: decode or not, and read with sjp_parser_next() or
+  // sjp_parser_next_batch()
+  for (mode = 0; mode < 4; mode++) {
+    int decode = mode & 1, batch = mode >> 1;
+    struct sjp_parser p;
+    struct sjp_event evts[4];
+    size_t i, j, count = 0;
+
+    ntest++;
+
+    sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+    if (decode) {
+      sjp_parser_set_scratch(&p, scratch, sizeof scratch);
+    }
+    sjp_parser_more_const(&p, doc, strlen(doc));
+
+    for (i=0, j=0; i < sizeof expected / sizeof expected[0]; i++, j++) {
+      const char *text = decode ? expected[i].decoded : expected[i].text;
+      struct sjp_event *evt;
+      int ret;
+
+      if (j >= count) {
+        ret = batch ? sjp_parser_next_batch(&p, evts, sizeof evts / sizeof evts[0], &count)
+                    : sjp_parser_next(&p, &evts[0]);
+        if (!batch) {
+          count = 1;
+        } else if (ret == SJP_MORE && count > 1 && evts[count-1].type == SJP_NONE) {
+          // the batch ended at the end of the data
+          ret = SJP_OK;
+          count--;
+        }
+        j = 0;
+
+        if (ret != SJP_OK || count == 0) {
+          printf("event %zu: expected return %d (%s), but found %d (%s)\n",
+              i, SJP_OK, ret2name(SJP_OK), ret, ret2name(ret));
+          goto failed;
+        }
+      }
+
+      evt = &evts[j];
+      if (evt->type != expected[i].type || evt->shape != expected[i].shape ||
+          evt->n != strlen(text) || memcmp(evt->text, text, evt->n) != 0) {
+        printf("event %zu: expected %s '%s' of shape %u, but found %s '%.*s' of shape %u\n",
+            i, evt2name(expected[i].type), text, expected[i].shape,
+            evt2name(evt->type), (int)evt->n, evt->text, evt->shape);
+        goto failed;
+      }
+    }
+
+    sjp_parser_eos(&p);
+    if (sjp_parser_close(&p) == SJP_OK) {
+      continue;
+    }
+
+failed:
+    nfail++;
+    printf("FAILED: %s (mode = %d)\n", __func__, mode);
+  }
+}
+
+// Allocator for test_growable_stack: counts live blocks, and fails
+// once nleft allocations have been made.
+struct test_alloc {
+  int nlive;
+  int nleft;
+};
+
+static void *test_alloc_fn(void *ud, void *ptr, size_t n)
+{
+  struct test_alloc *ta = ud;
+
+  if (n == 0) {
+    ta->nlive--;
+    free(ptr);
+    return NULL;
+  }
+
+  if (ta->nleft-- <= 0) {
+    return NULL;
+  }
+
+  if (ptr == NULL) {
+    ta->nlive++;
+  }
+
+  return realloc(ptr, n);
+}
+
+// Parses depth nested arrays, with a stack that starts in the parser
+// struct and grows up to maxstack bytes.
+static int parse_nested(int depth, size_t maxstack, int nalloc, int *nlive)
+{
+  struct test_alloc ta = { 0, nalloc };
+  struct sjp_parser p;
+  struct sjp_event evt;
+  char *doc;
+  int i, ret;
+
+  if (doc = malloc(2*depth), doc == NULL) {
+    return SJP_INTERNAL_ERROR;
+  }
+
+  memset(doc, '[', depth);
+  memset(doc+depth, ']', depth);
+
+  sjp_parser_init(&p, NULL, 0, NULL, 0);
+  sjp_parser_set_allocator(&p, test_alloc_fn, &ta, maxstack);
+  sjp_parser_more(&p, doc, 2*depth);
+
+  for (i=0; i < 2*depth; i++) {
+    if (ret = sjp_parser_next(&p, &evt), ret != SJP_OK) {
+      goto done;
+    }
+  }
+
+  if (ret = sjp_parser_next(&p, &evt), ret == SJP_MORE) {
+    sjp_parser_eos(&p);
+    ret = SJP_OK;
+  }
+
+done:
+  if (ret == SJP_OK) {
+    ret = sjp_parser_close(&p);
+  } else {
+    sjp_parser_close(&p);
+  }
+
+  *nlive = ta.nlive;
+  free(doc);
+  return ret;
+}
+
+static void test_growable_stack(void)
+{
+  static const struct {
+    int depth;
+    size_t maxstack;
+    int nalloc;
+    enum SJP_RESULT ret;
+  } cases[] = {
+    // fits in the in-struct stack
+    { 8, 4096, 0, SJP_OK },
+    { 8*SJP_PARSER_MIN_STACK, 4096, 0, SJP_OK },
+
+    // grows
+    { 8*SJP_PARSER_MIN_STACK+1, 4096, 100, SJP_OK },
+    { 1000, 4096, 100, SJP_OK },
+    { 8*4096, 4096, 100, SJP_OK },
+
+    // hits the cap
+    { 8*4096+1, 4096, 100, SJP_TOO_MUCH_NESTING },
+    { 1000, 64, 100, SJP_TOO_MUCH_NESTING },
+
+    // allocator fails, first to copy the in-struct stack, then to grow
+    // a stack that it allocated
+    { 1000, 4096, 0, SJP_OUT_OF_MEMORY },
+    { 1000, 4096, 2, SJP_OUT_OF_MEMORY },
+  };
+
+  size_t i;
+
+  for (i=0; i < sizeof cases / sizeof cases[0]; i++) {
+    int ret, nlive;
+
+    ntest++;
+
+    ret = parse_nested(cases[i].depth, cases[i].maxstack, cases[i].nalloc, &nlive);
+    if (ret != cases[i].ret) {
+      printf("depth %d, maxstack %zu: expected return %d (%s), but found %d (%s)\n",
+          cases[i].depth, cases[i].maxstack,
+          cases[i].ret, ret2name(cases[i].ret), ret, ret2name(ret));
+      goto failed;
+    }
+
+    if (nlive != 0) {
+      printf("depth %d, maxstack %zu: %d stacks not freed\n",
+          cases[i].depth, cases[i].maxstack, nlive);
+      goto failed;
+    }
+
+    continue;
+
+failed:
+    nfail++;
+    printf("FAILED: %s (case %zu)\n", __func__, i);
+  }
+}
+
+// Nests objects and arrays across several bytes of the stack, and
+// checks that each level closes as the right type.  Level i is an
+// object if i%3 == 0, and an array otherwise.
+static void test_deep_mixed_nesting(void)
+{
+  enum { DEPTH = 40 };
+
+  char stack[DEFAULT_STACK];
+  char doc[8*DEPTH];
+  size_t n = 0;
+  int i, cut;
+
+  for (i=0; i < DEPTH; i++) {
+    n += sprintf(&doc[n], i%3 == 0 ? "{\"k\":" : "[");
+  }
+  n += sprintf(&doc[n], "1");
+  for (i=DEPTH-1; i >= 0; i--) {
+    n += sprintf(&doc[n], i%3 == 0 ? "}" : "]");
+  }
+
+  // cut the document after each close, so that close() reports the
+  // innermost level still open
+  for (cut=0; cut <= DEPTH; cut++) {
+    struct sjp_parser p;
+    struct sjp_event evt;
+    enum SJP_RESULT ret, expected;
+    size_t ncut;
+    int nend = 0;
+
+    ntest++;
+
+    // opens, keys, the number and the first cut closes
+    ncut = n - (DEPTH - cut);
+
+    sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+    sjp_parser_more(&p, doc, ncut);
+
+    while (ret = sjp_parser_next(&p, &evt), ret == SJP_OK) {
+      if (evt.type == SJP_OBJECT_END || evt.type == SJP_ARRAY_END) {
+        int level = DEPTH-1 - nend++;
+        enum SJP_EVENT type = level%3 == 0 ? SJP_OBJECT_END : SJP_ARRAY_END;
+
+        if (evt.type != type) {
+          printf("level %d: expected %s, but found %s\n",
+              level, evt2name(type), evt2name(evt.type));
+          sjp_parser_close(&p);
+          goto failed;
+        }
+      }
+    }
+
+    if (ret != SJP_MORE || nend != cut) {
+      printf("cut %d: expected %d ends and MORE, but found %d ends and %d (%s)\n",
+          cut, cut, nend, ret, ret2name(ret));
+      sjp_parser_close(&p);
+      goto failed;
+    }
+
+    if (cut == DEPTH) {
+      expected = SJP_OK;
+    } else {
+      expected = (DEPTH-1-cut)%3 == 0 ? SJP_UNCLOSED_OBJECT : SJP_UNCLOSED_ARRAY;
+    }
+
+    sjp_parser_eos(&p);
+    if (ret = sjp_parser_close(&p), ret != expected) {
+      printf("cut %d: expected close to return %d (%s), but found %d (%s)\n",
+          cut, expected, ret2name(expected), ret, ret2name(ret));
+      goto failed;
+    }
+
+    continue;
+
+failed:
+    nfail++;
+    printf("FAILED: %s (cut %d)\n", __func__, cut);
+  }
+}
+
+static void feed_chunk(struct sjp_parser *p, const char *doc, size_t len, size_t *off,
+    size_t nchunk, char *chunk)
+{
+  size_t n = (len - *off < nchunk) ? len - *off : nchunk;
+  memcpy(chunk, &doc[*off], n);
+  *off += n;
+  sjp_parser_more(p, chunk, n);
+}
+
+// Appends the events of doc to out, one per line, joining the pieces
+// of partial values.  The document is fed in chunks of nchunk bytes.
+// If max is zero, reads events with sjp_parser_next(), and otherwise
+// reads up to max events at a time with sjp_parser_next_batch().  opts
+// are the parser options.
+//
+// Returns the return value of sjp_parser_close(), or the first error.
+static int collect_events(const char *doc, size_t nchunk, size_t nbuf, unsigned opts, size_t max,
+    char *out, size_t nout)
+{
+  char stack[DEFAULT_STACK];
+  char buf[SMALL_BUF];
+  char chunk[64];
+  struct sjp_event evts[16];
+  struct sjp_parser p;
+  size_t off = 0, len = strlen(doc), nc = 0;
+  int ret, eos = 0;
+
+  assert(max <= sizeof evts / sizeof evts[0]);
+  assert(nchunk <= sizeof chunk);
+
+  out[0] = '\0';
+  sjp_parser_init(&p, stack, sizeof stack, nbuf > 0 ? buf : NULL, nbuf);
+  sjp_parser_set_options(&p, opts);
+  feed_chunk(&p, doc, len, &off, nchunk, chunk);
+
+  for (;;) {
+    size_t i, count;
+
+    if (max == 0) {
+      ret = sjp_parser_next(&p, &evts[0]);
+      count = SJP_ERROR(ret) ? 0 : 1;
+      if (ret == SJP_MORE && evts[0].text == NULL) {
+        evts[0].type = SJP_NONE;
+      }
+
+      // the end of a stream of documents
+      if (ret == SJP_OK && evts[0].type == SJP_NONE) {
+        break;
+      }
+    } else {
+      ret = sjp_parser_next_batch(&p, evts, max, &count);
+      if (ret == SJP_OK && count == 0) {
+        break;
+      }
+    }
+
+    for (i=0; i < count; i++) {
+      // the events before an error are complete
+      enum SJP_RESULT r = (i == count-1 && !SJP_ERROR(ret)) ? ret : SJP_OK;
+
+      if (evts[i].type == SJP_NONE) {
+        continue;
+      }
+
+      if (nc + evts[i].n + 16 > nout) {
+        return SJP_INTERNAL_ERROR;
+      }
+
+      if (evts[i].n > 0) {
+        memcpy(&out[nc], evts[i].text, evts[i].n);
+        nc += evts[i].n;
+      }
+
+      if (r == SJP_OK) {
+        nc += sprintf(&out[nc], " %s\n", evt2name(evts[i].type));
+      }
+    }
+
+    if (SJP_ERROR(ret)) {
+      sjp_parser_close(&p);
+      return ret;
+    }
+
+    if (ret == SJP_MORE) {
+      if (eos) {
+        break;
+      }
+
+      if (off >= len) {
+        sjp_parser_eos(&p);
+        eos = 1;
+
+        // sjp_parser_next() doesn't expect the end of the stream
+        // outside of stream mode, so only call it again to finish a
+        // partial value
+        if (max == 0 && evts[0].type == SJP_NONE && !(opts & SJP_PARSER_STREAM)) {
+          break;
+        }
+        continue;
+      }
+
+      feed_chunk(&p, doc, len, &off, nchunk, chunk);
+    } else if (max == 0 && eos && !(opts & SJP_PARSER_STREAM)) {
+      break;
+    }
+  }
+
+  return sjp_parser_close(&p);
+}
+
+static void test_next_batch(void)
+{
+  static const char *const docs[] = {
+    "[1, 2.5, -3e2, true, false, null, \"str\", {}, []]",
+    "{\"a\": {\"b\": [1, {\"c\": \"d\"}], \"e\": null}, \"f\": \"g\\u00e9\\n\"}",
+    "[\"a longer string that is split across chunks\", 12345678901234567890, "
+      "{\"key\": [true, false, null]}, \"\\ud83d\\ude00\"]",
+    "{\"a\": [1, 2,, 3]}",
+    "[true, falsey]",
+    "[tru]",
+  };
+
+  static const size_t chunks[] = { 1, 3, 7, 64 };
+  static const size_t bufs[] = { NO_BUF, SMALL_BUF };
+  static const size_t maxes[] = { 1, 2, 5, 16 };
+
+  char expected[4096], found[4096];
+  size_t d, c, b, m;
+
+  for (d=0; d < sizeof docs / sizeof docs[0]; d++) {
+    for (c=0; c < sizeof chunks / sizeof chunks[0]; c++) {
+      for (b=0; b < sizeof bufs / sizeof bufs[0]; b++) {
+        int eret = collect_events(docs[d], chunks[c], bufs[b], 0, 0, expected, sizeof expected);
+
+        for (m=0; m < sizeof maxes / sizeof maxes[0]; m++) {
+          int ret;
+
+          ntest++;
+
+          ret = collect_events(docs[d], chunks[c], bufs[b], 0, maxes[m], found, sizeof found);
+          if (ret != eret || strcmp(expected, found) != 0) {
+            printf("doc %zu, chunk %zu, buf %zu, max %zu: expected %d (%s) and events\n%s"
+                "but found %d (%s) and events\n%s",
+                d, chunks[c], bufs[b], maxes[m],
+                eret, ret2name(eret), expected, ret, ret2name(ret), found);
+            nfail++;
+            printf("FAILED: %s\n", __func__);
+          }
+        }
+      }
+    }
+  }
+}
+
+// Outside of stream mode, a stream with no value is invalid, whether
+// events are read one at a time or in batches.  In stream mode, it's an
+// empty stream.
+static void test_next_batch_empty(void)
+{
+  static const char *const docs[] = { "", " \n\t " };
+  static const size_t bufs[] = { NO_BUF, SMALL_BUF };
+  static const unsigned opts[] = { 0, SJP_PARSER_STREAM };
+  size_t d, b, o;
+
+  for (d=0; d < sizeof docs / sizeof docs[0]; d++) {
+    for (b=0; b < sizeof bufs / sizeof bufs[0]; b++) {
+      for (o=0; o < sizeof opts / sizeof opts[0]; o++) {
+        char stack[DEFAULT_STACK];
+        char buf[SMALL_BUF];
+        char data[16];
+        struct sjp_parser p;
+        int batch;
+
+        for (batch=0; batch < 2; batch++) {
+          int want = (opts[o] & SJP_PARSER_STREAM) ? SJP_OK : SJP_INVALID_INPUT;
+          size_t count = 0;
+          int ret, eos = 0;
+
+          ntest++;
+
+          strcpy(data, docs[d]);
+          sjp_parser_init(&p, stack, sizeof stack, bufs[b] > 0 ? buf : NULL, bufs[b]);
+          sjp_parser_set_options(&p, opts[o]);
+          sjp_parser_more(&p, data, strlen(data));
+
+          for (;;) {
+            struct sjp_event evts[4];
+
+            if (batch) {
+              ret = sjp_parser_next_batch(&p, evts, 4, &count);
+            } else {
+              ret = sjp_parser_next(&p, &evts[0]);
+              count = (ret == SJP_OK && evts[0].type != SJP_NONE);
+            }
+
+            if (ret != SJP_MORE || eos) {
+              break;
+            }
+
+            sjp_parser_eos(&p);
+            eos = 1;
+          }
+
+          if (ret != want || count != 0) {
+            printf("doc '%s', buf %zu, opts %u, %s: expected %d (%s) and no events, "
+                "but found %d (%s) and %zu events\n",
+                docs[d], bufs[b], opts[o], batch ? "batch" : "next",
+                want, ret2name(want), ret, ret2name(ret), count);
+            nfail++;
+            printf("FAILED: %s\n", __func__);
+          }
+
+          sjp_parser_close(&p);
+        }
+      }
+    }
+  }
+}
+
+// In stream mode, documents follow each other, and each ends with
+// SJP_DOC_END, however the stream is split and read.
+static void test_stream_mode(void)
+{
+  static const struct {
+    const char *doc;
+    int ret;
+    const char *events;
+  } cases[] = {
+    {
+      "{\"a\": [1, \"x\"]}\n[true]\n\"str\" 12 -3.5e1\nnull{}[]\"q\"\n",
+      SJP_OK,
+      "{ OBJECT_BEG\na STRING\n[ ARRAY_BEG\n1 NUMBER\nx STRING\n] ARRAY_END\n} OBJECT_END\n DOC_END\n"
+      "[ ARRAY_BEG\ntrue TRUE\n] ARRAY_END\n DOC_END\n"
+      "str STRING\n DOC_END\n12 NUMBER\n DOC_END\n-3.5e1 NUMBER\n DOC_END\n"
+      "null NULL\n DOC_END\n{ OBJECT_BEG\n} OBJECT_END\n DOC_END\n[ ARRAY_BEG\n] ARRAY_END\n DOC_END\n"
+      "q STRING\n DOC_END\n",
+    },
+
+    // a number at the end of the stream, and a long string
+    {
+      "\"a string longer than the value buffer of the parser\"\n42",
+      SJP_OK,
+      "a string longer than the value buffer of the parser STRING\n DOC_END\n42 NUMBER\n DOC_END\n",
+    },
+
+    { "", SJP_OK, "" },
+    { " \n\n ", SJP_OK, "" },
+
+    // a keyword must end at a delimiter, wherever the stream is split
+    { "[1] null", SJP_OK, "[ ARRAY_BEG\n1 NUMBER\n] ARRAY_END\n DOC_END\nnull NULL\n DOC_END\n" },
+    { "true false\ntruefalse", SJP_INVALID_INPUT, "true TRUE\n DOC_END\nfalse FALSE\n DOC_END\n" },
+    { "null0", SJP_INVALID_INPUT, "" },
+
+    // an unfinished document at the end of the stream
+    {
+      "[1]\n[2,",
+      SJP_UNCLOSED_ARRAY,
+      "[ ARRAY_BEG\n1 NUMBER\n] ARRAY_END\n DOC_END\n[ ARRAY_BEG\n2 NUMBER\n",
+    },
+  };
+
+  static const size_t chunks[] = { 1, 3, 7, 64 };
+  static const size_t bufs[] = { NO_BUF, SMALL_BUF };
+  static const size_t maxes[] = { 0, 1, 2, 3, 16 };
+
+  char found[4096];
+  size_t i, c, b, m;
+
+  for (i=0; i < sizeof cases / sizeof cases[0]; i++) {
+    for (c=0; c < sizeof chunks / sizeof chunks[0]; c++) {
+      for (b=0; b < sizeof bufs / sizeof bufs[0]; b++) {
+        for (m=0; m < sizeof maxes / sizeof maxes[0]; m++) {
+          int ret;
+
+          ntest++;
+
+          ret = collect_events(cases[i].doc, chunks[c], bufs[b], SJP_PARSER_STREAM, maxes[m], found, sizeof found);
+          if (ret != cases[i].ret || strcmp(cases[i].events, found) != 0) {
+            printf("case %zu, chunk %zu, buf %zu, max %zu: expected %d (%s) and events\n%s"
+                "but found %d (%s) and events\n%s",
+                i, chunks[c], bufs[b], maxes[m],
+                cases[i].ret, ret2name(cases[i].ret), cases[i].events,
+                ret, ret2name(ret), found);
+            nfail++;
+            printf("FAILED: %s\n", __func__);
+          }
+        }
+      }
+    }
+  }
+
+  // skipping a whole document still ends it
+  {
+    static const char doc[] = "[1, [2]] {\"a\": \"b\"}\n3";
+    char data[sizeof doc];
+    struct sjp_parser p;
+    struct sjp_event evt;
+    int k, ret, ndocs = 0;
+
+    memcpy(data, doc, sizeof doc);
+    sjp_parser_init(&p, NULL, 0, NULL, 0);
+    sjp_parser_set_options(&p, SJP_PARSER_STREAM);
+    sjp_parser_more(&p, data, sizeof doc - 1);
+
+    ntest++;
+    for (k=0; k < 3; k++) {
+      if (ret = sjp_parser_skip(&p, NULL), ret == SJP_MORE) {
+        sjp_parser_eos(&p);
+        ret = sjp_parser_skip(&p, NULL);
+      }
+
+      if (ret == SJP_OK && sjp_parser_next(&p, &evt) == SJP_OK && evt.type == SJP_DOC_END) {
+        ndocs++;
+      }
+    }
+
+    if (ndocs != 3 || sjp_parser_next(&p, &evt) != SJP_OK || evt.type != SJP_NONE ||
+        sjp_parser_close(&p) != SJP_OK) {
+      printf("expected 3 skipped documents and the end of the stream, but found %d documents\n", ndocs);
+      nfail++;
+      printf("FAILED: %s\n", __func__);
+    }
+  }
+}
+
+// With SJP_PARSER_HASH_STRINGS, the event that completes a string has
+// the hash of the whole string, however it was split across chunks or
+// joined in the value buffer.
+static void test_string_hashes(void)
+{
+  static const char doc[] =
+    "{\"id\": 1, \"na\\u006de\": \"a value long enough to spill from the value buffer, "
+    "which is thirty three bytes\", \"tags\": [\"a\", \"\\ud83d\\ude00\"], \"\": null}";
+
+  static const size_t bufs[] = { NO_BUF, 33 };
+
+  char stack[DEFAULT_STACK];
+  char buf[64], chunk[256];
+  char str[256];
+  size_t len = strlen(doc), nchunk, b;
+
+  assert(len <= sizeof chunk);
+
+  for (b=0; b < sizeof bufs / sizeof bufs[0]; b++) {
+    for (nchunk=1; nchunk <= len; nchunk++) {
+      struct sjp_parser p;
+      struct sjp_event evt;
+      size_t off = 0, nstr = 0;
+      int ret, nkeys = 0, nnames = 0;
+
+      ntest++;
+
+      sjp_parser_init(&p, stack, sizeof stack, bufs[b] > 0 ? buf : NULL, bufs[b]);
+      sjp_parser_set_options(&p, SJP_PARSER_HASH_STRINGS);
+      feed_chunk(&p, doc, len, &off, nchunk, chunk);
+
+      while (ret = sjp_parser_next(&p, &evt), !SJP_ERROR(ret)) {
+        if (ret == SJP_MORE && evt.text == NULL) {
+          evt.type = SJP_NONE;
+        }
+
+        // each part has the hash of the string so far
+        if (evt.type == SJP_STRING) {
+          memcpy(&str[nstr], evt.text, evt.n);
+          nstr += evt.n;
+
+          if (evt.hash != sjp_hash(str, nstr)) {
+            printf("buf %zu, chunk %zu: string '%.*s': expected hash %08x, but found %08x (%s)\n",
+                bufs[b], nchunk, (int)nstr, str, (unsigned)sjp_hash(str, nstr), (unsigned)evt.hash,
+                ret2name(ret));
+            sjp_parser_close(&p);
+            goto failed;
+          }
+        }
+
+        if (evt.type == SJP_STRING && ret == SJP_OK) {
+          nkeys++;
+          nnames += evt.key;
+          nstr = 0;
+        }
+
+        if (ret == SJP_MORE) {
+          if (off >= len) {
+            break;
+          }
+          feed_chunk(&p, doc, len, &off, nchunk, chunk);
+        }
+      }
+
+      sjp_parser_eos(&p);
+      if (ret = sjp_parser_close(&p), ret != SJP_OK || nkeys != 7 || nnames != 4) {
+        printf("buf %zu, chunk %zu: expected 7 strings, 4 of them keys, and close to return OK, "
+            "but found %d strings, %d keys, and %d (%s)\n", bufs[b], nchunk, nkeys, nnames, ret, ret2name(ret));
+        goto failed;
+      }
+
+      continue;
+
+failed:
+      nfail++;
+      printf("FAILED: %s\n", __func__);
+    }
+  }
+}
+
+// Steps of test_skip: read an event, skip a value, or read a value and
+// skip the rest of it if it's partial
+enum { SKIP_NEXT, SKIP_SKIP, SKIP_PARTIAL };
+
+struct skip_step {
+  int op;
+  enum SJP_EVENT type;  // SKIP_NEXT: type of the event
+  const char *text;     // SKIP_NEXT: text of the event
+  size_t count;         // SKIP_SKIP: elements skipped
+};
+
+// Runs the steps over doc, fed in chunks of nchunk bytes.  Returns 0 if
+// the steps match and the parser closes, and -1 otherwise.
+static int run_skip_steps(const char *doc, size_t nchunk, size_t nbuf,
+    const struct skip_step *steps, size_t nsteps)
+{
+  char stack[DEFAULT_STACK];
+  char buf[SMALL_BUF];
+  static char chunk[4096];
+  char text[256];
+  struct sjp_parser p;
+  size_t off = 0, len = strlen(doc), i, line, col, nl;
+  int ret;
+
+  assert(nchunk <= sizeof chunk);
+
+  sjp_parser_init(&p, stack, sizeof stack, nbuf > 0 ? buf : NULL, nbuf);
+  feed_chunk(&p, doc, len, &off, nchunk, chunk);
+
+  for (i=0; i < nsteps; i++) {
+    const struct skip_step *st = &steps[i];
+    struct sjp_event evt = { 0 };
+    size_t ntext = 0, count = 0;
+    int partial = 0;
+
+    for (;;) {
+      if (st->op == SKIP_SKIP || partial) {
+        ret = sjp_parser_skip(&p, &count);
+      } else {
+        evt.text = NULL;
+        ret = sjp_parser_next(&p, &evt);
+        if (ret == SJP_MORE && evt.text == NULL) {
+          evt.type = SJP_NONE;
+        }
+        if (!SJP_ERROR(ret) && evt.type != SJP_NONE) {
+          memcpy(&text[ntext], evt.text, evt.n);
+          ntext += evt.n;
+          partial = (ret != SJP_OK && st->op == SKIP_PARTIAL);
+        }
+      }
+
+      if (SJP_ERROR(ret)) {
+        printf("step %zu: error %d (%s)\n", i, ret, ret2name(ret));
+        goto failed;
+      }
+
+      if (ret == SJP_OK && (st->op == SKIP_SKIP || partial || evt.type != SJP_NONE)) {
+        break;
+      }
+
+      if (ret == SJP_MORE) {
+        if (off >= len) {
+          printf("step %zu: out of data\n", i);
+          goto failed;
+        }
+        feed_chunk(&p, doc, len, &off, nchunk, chunk);
+      }
+    }
+
+    if (st->op == SKIP_SKIP && count != st->count) {
+      printf("step %zu: expected to skip %zu elements, but skipped %zu\n", i, st->count, count);
+      goto failed;
+    }
+
+    if (st->op != SKIP_SKIP && !partial &&
+        (evt.type != st->type || ntext != strlen(st->text) || memcmp(text, st->text, ntext) != 0)) {
+      printf("step %zu: expected %s '%s', but found %s '%.*s'\n",
+          i, evt2name(st->type), st->text, evt2name(evt.type), (int)ntext, text);
+      goto failed;
+    }
+  }
+
+  // skipping counts newlines like lexing does
+  sjp_parser_position(&p, &line, &col);
+  for (i=0, nl=0; i < sjp_parser_offset(&p); i++) {
+    nl += (doc[i] == '\n');
+  }
+
+  if (line != nl) {
+    printf("expected to be on line %zu, but found line %zu\n", nl, line);
+    goto failed;
+  }
+
+  while (off < len) {
+    feed_chunk(&p, doc, len, &off, nchunk, chunk);
+  }
+  sjp_parser_eos(&p);
+  if (ret = sjp_parser_close(&p), ret != SJP_OK) {
+    printf("expected close to return OK, but found %d (%s)\n", ret, ret2name(ret));
+    return -1;
+  }
+
+  return 0;
+
+failed:
+  sjp_parser_close(&p);
+  return -1;
+}
+
+// Starts an array or object with first, reads until the parser wants
+// more data, and then skips with the rest fed.  Sets *count, and
+// *partial if the parser returned part of the first element, so the
+// skip only finished that element.  Returns 0 if the document then
+// closes without an error, and -1 otherwise.
+static int run_skip_split(const char *first, const char *rest, size_t nbuf, size_t *count, int *partial)
+{
+  char stack[DEFAULT_STACK];
+  char buf[SMALL_BUF];
+  char data1[64], data2[64];
+  struct sjp_parser p;
+  struct sjp_event evt = { 0 };
+  int ret;
+
+  sjp_parser_init(&p, stack, sizeof stack, nbuf > 0 ? buf : NULL, nbuf);
+  strcpy(data1, first);
+  strcpy(data2, rest);
+  sjp_parser_more(&p, data1, strlen(data1));
+
+  if (ret = sjp_parser_next(&p, &evt), ret != SJP_OK ||
+      (evt.type != SJP_ARRAY_BEG && evt.type != SJP_OBJECT_BEG)) {
+    printf("expected an array or object, but found %d (%s)\n", ret, ret2name(ret));
+    return -1;
+  }
+
+  evt.text = NULL;
+  if (ret = sjp_parser_next(&p, &evt), ret != SJP_MORE) {
+    printf("expected SJP_MORE, but found %d (%s)\n", ret, ret2name(ret));
+    return -1;
+  }
+  *partial = (evt.text != NULL);
+
+  if (ret = sjp_parser_skip(&p, count), ret != SJP_MORE) {
+    printf("expected the skip to need more, but found %d (%s)\n", ret, ret2name(ret));
+    return -1;
+  }
+
+  sjp_parser_more(&p, data2, strlen(data2));
+  if (ret = sjp_parser_skip(&p, count), ret != SJP_OK) {
+    printf("expected the skip to return OK, but found %d (%s)\n", ret, ret2name(ret));
+    return -1;
+  }
+
+  // the rest of the array or object, after a partial element
+  while (ret = sjp_parser_next(&p, &evt), ret == SJP_OK) {
+    continue;
+  }
+
+  sjp_parser_eos(&p);
+  if (ret = sjp_parser_close(&p), ret != SJP_OK) {
+    printf("expected close to return OK, but found %d (%s)\n", ret, ret2name(ret));
+    return -1;
+  }
+
+  return 0;
+}
+
+static void test_skip(void)
+{
+  static const char doc[] =
+    "{\"skip\": {\"a\": [1, \"x]}\\\"\", {\"b\": null}],\n"
+    "          \"c\": \"\\\\\"},\n"
+    " \"keep\": [1, 2, 3],\n"
+    " \"arr\": [10, 20, [30, 40], {\"x\": \"[[[\"}],\n"
+    " \"long\": \"a string long enough for the vector kernels, with a \\\" quote, "
+      "a \\\\ backslash, and brackets ] } [ { in it, and then some more text\",\n"
+    " \"big\": [\"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef\",\n"
+    "   \"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef\",\n"
+    "   [[[{\"deep\": [\"]]]]\"]}]]], 1.5e10, true, false, null],\n"
+    " \"s\": \"str\",\n"
+    " \"n\": 12.5e3,\n"
+    " \"e\": [],\n"
+    " \"t\": true}";
+
+  static const struct skip_step steps[] = {
+    { SKIP_NEXT, SJP_OBJECT_BEG, "{" },
+    { SKIP_NEXT, SJP_STRING, "skip" },
+    { SKIP_SKIP, 0, NULL, 2 },
+    { SKIP_NEXT, SJP_STRING, "keep" },
+    { SKIP_NEXT, SJP_ARRAY_BEG, "[" },
+    { SKIP_NEXT, SJP_NUMBER, "1" },
+    { SKIP_SKIP, 0, NULL, 2 },
+    { SKIP_NEXT, SJP_STRING, "arr" },
+    { SKIP_NEXT, SJP_ARRAY_BEG, "[" },
+    { SKIP_SKIP, 0, NULL, 4 },
+    { SKIP_NEXT, SJP_STRING, "long" },
+    { SKIP_PARTIAL, SJP_STRING,
+      "a string long enough for the vector kernels, with a \" quote, "
+      "a \\ backslash, and brackets ] } [ { in it, and then some more text" },
+    { SKIP_NEXT, SJP_STRING, "big" },
+    { SKIP_SKIP, 0, NULL, 7 },
+    { SKIP_NEXT, SJP_STRING, "s" },
+    { SKIP_SKIP, 0, NULL, 0 },
+    { SKIP_NEXT, SJP_STRING, "n" },
+    { SKIP_SKIP, 0, NULL, 0 },
+    { SKIP_NEXT, SJP_STRING, "e" },
+    { SKIP_SKIP, 0, NULL, 0 },
+    { SKIP_NEXT, SJP_STRING, "t" },
+    { SKIP_NEXT, SJP_TRUE, "true" },
+    { SKIP_NEXT, SJP_OBJECT_END, "}" },
+  };
+
+  static const size_t bufs[] = { NO_BUF, SMALL_BUF };
+
+  enum SJP_SIMD saved = sjp_lexer_simd_level();
+  size_t len = strlen(doc), nchunk, b;
+  int lv;
+
+  for (lv = SJP_SIMD_SCALAR; lv <= SJP_SIMD_AVX512; lv++) {
+    if (sjp_lexer_set_simd_level(lv) != lv) {
+      continue;
+    }
+
+    for (b=0; b < sizeof bufs / sizeof bufs[0]; b++) {
+      for (nchunk=1; nchunk <= len; nchunk++) {
+        ntest++;
+
+        if (run_skip_steps(doc, nchunk, bufs[b], steps, sizeof steps / sizeof steps[0]) != 0) {
+          nfail++;
+          printf("FAILED: %s (simd %s, buf %zu, chunk %zu)\n",
+              __func__, sjp_lexer_simd_name(lv), bufs[b], nchunk);
+        }
+      }
+    }
+  }
+
+  sjp_lexer_set_simd_level(saved);
+
+  // Skipping when the first element has started and is held in a
+  // buffer.  Without a value buffer, the parser may return part of the
+  // element instead, and then the skip only finishes the element.
+  for (b=0; b < sizeof bufs / sizeof bufs[0]; b++) {
+    static const struct {
+      const char *first, *rest;
+      size_t count;
+    } splits[] = {
+      { "[true", "]", 1 },
+      { "[12", "]", 1 },
+      { "[\"ab", "c\"]", 1 },
+      { "[\"ab", "c\", 1, [2]]", 3 },
+      { "{\"a", "b\": 1, \"c\": 2}", 2 },
+    };
+    size_t i;
+
+    for (i=0; i < sizeof splits / sizeof splits[0]; i++) {
+      size_t count = 0;
+      int partial = 0;
+
+      ntest++;
+      if (run_skip_split(splits[i].first, splits[i].rest, bufs[b], &count, &partial) != 0 ||
+          (partial && bufs[b] != NO_BUF) || (!partial && count != splits[i].count)) {
+        nfail++;
+        printf("FAILED: %s (buf %zu, '%s' + '%s')\n", __func__, bufs[b], splits[i].first, splits[i].rest);
+        printf("  expected %zu elements, but found %zu%s\n", splits[i].count, count,
+            partial ? " after a partial element" : "");
+      }
+    }
+  }
+}
+
 static void test_simple_objects(void)
 {
   const char *inputs[] = {
@@ -524,6 +1718,64 @@ static void test_buffered_1(void)
   run_parser_test(__func__, DEFAULT_STACK, SMALL_BUF, inputs, outputs);
 }
 
+// A string that overflows the value buffer is returned in parts, and
+// the caller can reuse its chunk buffer whenever the parser asks for
+// more data.
+static void test_buffer_spill(void)
+{
+  static const char doc[] =
+    "[\"abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ\", \"x\", 1]";
+  static const char want[] = "abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ|x|";
+  static const size_t bufs[] = { SJP_LEX_RESTART_SIZE+1, 40 };
+
+  char stack[DEFAULT_STACK];
+  char buf[40], chunk[128];
+  char out[128];
+  size_t len = strlen(doc), nchunk, b;
+
+  assert(len <= sizeof chunk);
+
+  for (b=0; b < sizeof bufs / sizeof bufs[0]; b++) {
+    for (nchunk=1; nchunk <= len; nchunk++) {
+      struct sjp_parser p;
+      struct sjp_event evt;
+      size_t off = 0, nout = 0;
+      int ret;
+
+      ntest++;
+
+      sjp_parser_init(&p, stack, sizeof stack, buf, bufs[b]);
+      feed_chunk(&p, doc, len, &off, nchunk, chunk);
+
+      while (ret = sjp_parser_next(&p, &evt), !SJP_ERROR(ret)) {
+        if (evt.type == SJP_STRING && evt.text != NULL && nout + evt.n < sizeof out) {
+          memcpy(&out[nout], evt.text, evt.n);
+          nout += evt.n;
+          if (ret == SJP_OK) {
+            out[nout++] = '|';
+          }
+        }
+
+        if (ret == SJP_MORE) {
+          if (off >= len) {
+            break;
+          }
+          feed_chunk(&p, doc, len, &off, nchunk, chunk);
+        }
+      }
+
+      sjp_parser_eos(&p);
+      ret = sjp_parser_close(&p);
+      if (ret != SJP_OK || nout != strlen(want) || memcmp(out, want, nout) != 0) {
+        nfail++;
+        printf("FAILED: %s\n", __func__);
+        printf("  buf %zu, chunk %zu: expected strings '%s' and close to return OK, "
+            "but found '%.*s' and %d (%s)\n", bufs[b], nchunk, want, (int)nout, out, ret, ret2name(ret));
+      }
+    }
+  }
+}
+
 static void test_detect_unclosed_things(void)
 {
   const char *inputs[] = {
@@ -673,14 +1925,26 @@ static void test_detect_unclosed_things(void)
 int main(void)
 {
   test_values();
+  test_integer_events();
+  test_raw_number_events();
+  test_long_split_numbers();
+  test_const_input_events();
   test_simple_objects();
   test_simple_arrays();
   test_nested_arrays_and_objects();
   test_restarts_1();
 
   test_buffered_1();
+  test_buffer_spill();
 
   test_detect_unclosed_things();
+  test_growable_stack();
+  test_deep_mixed_nesting();
+  test_next_batch();
+  test_next_batch_empty();
+  test_stream_mode();
+  test_string_hashes();
+  test_skip();
 
   printf("%d tests, %d failures\n", ntest,nfail);
   return nfail == 0 ? 0 : 1;
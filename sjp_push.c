@@ -0,0 +1,6 @@
+#include "sjp_push.h"
+
+enum SJP_RESULT sjp_parse(struct sjp_parser *p, char *data, size_t n, const struct sjp_handlers *h, void *ctx)
+{
+  return sjp_parse_inline(p, data, n, h, ctx);
+}
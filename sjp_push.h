@@ -0,0 +1,157 @@
+#ifndef SJP_PUSH_H
+#define SJP_PUSH_H
+
+#include "sjp_common.h"
+#include "sjp_lexer.h"
+#include "sjp_parser.h"
+
+#define MODULE_NAME SJP_PUSH
+
+// Push (SAX-style) parsing: sjp_parse() reads the events of the data it
+// is given and calls a handler for each one, rather than returning each
+// event to the caller.
+//
+// Events are read with sjp_parser_next_batch(), so the parser's state is
+// loaded once per batch of events rather than once per event.  The loop
+// is also available inline, as sjp_parse_inline(): called with a handler
+// table that the compiler can see (a static const table), the handlers
+// are called directly and can be inlined into the loop.  sjp_parse() is
+// the same loop, compiled once, for handler tables that aren't known
+// until run time.
+//
+// Each handler returns 0 to continue, or a value that stops the parse
+// and is returned by sjp_parse().  To tell these apart from the
+// parser's return values, use values greater than SJP_PARTIAL.  A NULL
+// handler ignores its events.
+//
+// Strings and numbers can arrive in parts (see sjp_parser_next()): the
+// handler is called for each part, with partial set for all but the
+// last.  Keywords are always whole.
+
+enum {
+  SJP_PUSH_BATCH = 64,  // events read at a time
+};
+
+struct sjp_handlers {
+  int (*on_null)(void *ctx);
+  int (*on_bool)(void *ctx, int value);
+  int (*on_number)(void *ctx, const struct sjp_event *evt, int partial);
+  int (*on_string)(void *ctx, const struct sjp_event *evt, int partial);
+  int (*on_key)(void *ctx, const struct sjp_event *evt, int partial);
+  int (*on_begin_object)(void *ctx);
+  int (*on_end_object)(void *ctx);
+  int (*on_begin_array)(void *ctx);
+  int (*on_end_array)(void *ctx);
+  int (*on_doc_end)(void *ctx);  // stream mode (SJP_PARSER_STREAM)
+};
+
+// Gives the parser n more bytes of data, as sjp_parser_more() does, and
+// calls the handlers for the events in it.  Call with data == NULL and
+// n == 0 at the end of the input.
+//
+// Returns:
+//
+//   SJP_MORE   all of the data was read: call sjp_parse() again with
+//              more data, or at the end of the input
+//
+//   SJP_OK     the end of the input was reached.  Close the parser
+//              with sjp_parser_close(), which reports an unfinished
+//              document.
+//
+// or a parser error (as sjp_parser_next() returns them), or the return
+// value of a handler that stopped the parse.  After a handler stops the
+// parse, the parser may have read events past the one that stopped it,
+// so the parse can't be resumed.  Outside of stream mode, input without
+// a value is SJP_INVALID_INPUT.
+//
+// As with sjp_parser_next(), a document that isn't in stream mode can
+// be followed by more values, which are passed to the handlers too.
+enum SJP_RESULT sjp_parse(struct sjp_parser *p, char *data, size_t n, const struct sjp_handlers *h, void *ctx);
+
+#if defined(__GNUC__)
+#  define SJP_PUSH_INLINE static inline __attribute__((always_inline))
+#else
+#  define SJP_PUSH_INLINE static inline
+#endif
+
+// Calls the handler for one event, and returns its return value
+SJP_PUSH_INLINE int sjp_push_event(const struct sjp_handlers *h, void *ctx, const struct sjp_event *evt, int partial)
+{
+  switch (evt->type) {
+    case SJP_NULL:
+      return (h->on_null != NULL) ? h->on_null(ctx) : 0;
+
+    case SJP_TRUE:
+    case SJP_FALSE:
+      return (h->on_bool != NULL) ? h->on_bool(ctx, evt->type == SJP_TRUE) : 0;
+
+    case SJP_NUMBER:
+      return (h->on_number != NULL) ? h->on_number(ctx, evt, partial) : 0;
+
+    case SJP_STRING:
+      if (evt->key) {
+        return (h->on_key != NULL) ? h->on_key(ctx, evt, partial) : 0;
+      }
+      return (h->on_string != NULL) ? h->on_string(ctx, evt, partial) : 0;
+
+    case SJP_OBJECT_BEG:
+      return (h->on_begin_object != NULL) ? h->on_begin_object(ctx) : 0;
+
+    case SJP_OBJECT_END:
+      return (h->on_end_object != NULL) ? h->on_end_object(ctx) : 0;
+
+    case SJP_ARRAY_BEG:
+      return (h->on_begin_array != NULL) ? h->on_begin_array(ctx) : 0;
+
+    case SJP_ARRAY_END:
+      return (h->on_end_array != NULL) ? h->on_end_array(ctx) : 0;
+
+    case SJP_DOC_END:
+      return (h->on_doc_end != NULL) ? h->on_doc_end(ctx) : 0;
+
+    default:
+      return 0;
+  }
+}
+
+// sjp_parse(), inline
+SJP_PUSH_INLINE enum SJP_RESULT sjp_parse_inline(struct sjp_parser *p, char *data, size_t n, const struct sjp_handlers *h, void *ctx)
+{
+  struct sjp_event evts[SJP_PUSH_BATCH];
+
+  sjp_parser_more(p, data, n);
+
+  for (;;) {
+    enum SJP_RESULT ret;
+    size_t i, count;
+
+    ret = sjp_parser_next_batch(p, evts, SJP_PUSH_BATCH, &count);
+
+    for (i=0; i < count; i++) {
+      int partial = (i == count-1) && (ret == SJP_MORE || ret == SJP_PARTIAL);
+      int hret;
+
+      // partial keywords are passed on when they're whole
+      if (partial && evts[i].type != SJP_STRING && evts[i].type != SJP_NUMBER) {
+        continue;
+      }
+
+      if (hret = sjp_push_event(h, ctx, &evts[i], partial), hret != 0) {
+        return (enum SJP_RESULT)hret;
+      }
+    }
+
+    if (ret == SJP_MORE || SJP_ERROR(ret)) {
+      return ret;
+    }
+
+    // the end of the input
+    if (ret == SJP_OK && count == 0) {
+      return SJP_OK;
+    }
+  }
+}
+
+#undef MODULE_NAME
+
+#endif /* SJP_PUSH_H */
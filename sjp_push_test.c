@@ -0,0 +1,297 @@
+#include "sjp_push.h"
+
+#define TEST_LOG_LEVEL 0
+#include "sjp_testing.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define DEFAULT_STACK 16
+#define MAX_DOC     1024
+
+// Writes the events to out, separated by spaces, with the parts of
+// partial values joined
+struct push_out {
+  char text[4096];
+  size_t n;
+  int invalue;  // in the middle of a partial value
+  int count;    // number of handler calls
+  int stop_at;  // stop the parse at this call
+};
+
+static int push_put(struct push_out *out, const char *prefix, const char *text, size_t n, int partial)
+{
+  if (out->n + n + 16 > sizeof out->text) {
+    return SJP_INTERNAL_ERROR;
+  }
+
+  if (!out->invalue) {
+    out->n += sprintf(&out->text[out->n], "%s", prefix);
+  }
+
+  memcpy(&out->text[out->n], text, n);
+  out->n += n;
+
+  out->invalue = partial;
+  if (!partial) {
+    out->text[out->n++] = ' ';
+  }
+  out->text[out->n] = '\0';
+
+  return (++out->count == out->stop_at) ? 42 : 0;
+}
+
+static int on_null(void *ctx)
+{
+  return push_put(ctx, "null", "", 0, 0);
+}
+
+static int on_bool(void *ctx, int value)
+{
+  return push_put(ctx, value ? "true" : "false", "", 0, 0);
+}
+
+static int on_number(void *ctx, const struct sjp_event *evt, int partial)
+{
+  return push_put(ctx, "n:", evt->text, evt->n, partial);
+}
+
+static int on_string(void *ctx, const struct sjp_event *evt, int partial)
+{
+  return push_put(ctx, "s:", evt->text, evt->n, partial);
+}
+
+static int on_key(void *ctx, const struct sjp_event *evt, int partial)
+{
+  return push_put(ctx, "k:", evt->text, evt->n, partial);
+}
+
+static int on_begin_object(void *ctx)
+{
+  return push_put(ctx, "{", "", 0, 0);
+}
+
+static int on_end_object(void *ctx)
+{
+  return push_put(ctx, "}", "", 0, 0);
+}
+
+static int on_begin_array(void *ctx)
+{
+  return push_put(ctx, "[", "", 0, 0);
+}
+
+static int on_end_array(void *ctx)
+{
+  return push_put(ctx, "]", "", 0, 0);
+}
+
+static int on_doc_end(void *ctx)
+{
+  return push_put(ctx, "|", "", 0, 0);
+}
+
+static const struct sjp_handlers handlers = {
+  .on_null = on_null,
+  .on_bool = on_bool,
+  .on_number = on_number,
+  .on_string = on_string,
+  .on_key = on_key,
+  .on_begin_object = on_begin_object,
+  .on_end_object = on_end_object,
+  .on_begin_array = on_begin_array,
+  .on_end_array = on_end_array,
+  .on_doc_end = on_doc_end,
+};
+
+// Pushes doc to the handlers in chunks of the given size, with
+// sjp_parse(), or sjp_parse_inline() if inl is set.  Returns the first
+// error or handler return value, or else the return value of
+// sjp_parser_close().
+static int push_doc(const char *doc, size_t chunk, size_t nbuf, unsigned opts, int inl, struct push_out *out)
+{
+  char stack[DEFAULT_STACK];
+  char data[MAX_DOC];
+  char buf[64];
+  struct sjp_parser p;
+  size_t n, off;
+  int ret = SJP_MORE;
+
+  n = strlen(doc);
+  memcpy(data, doc, n);
+
+  if (sjp_parser_init(&p, stack, sizeof stack, nbuf > 0 ? buf : NULL, nbuf) != SJP_OK) {
+    return SJP_INTERNAL_ERROR;
+  }
+  sjp_parser_set_options(&p, opts);
+
+  for (off = 0; off < n && ret == SJP_MORE; off += chunk) {
+    size_t k = (n - off < chunk) ? n - off : chunk;
+    ret = inl ? sjp_parse_inline(&p, &data[off], k, &handlers, out)
+              : sjp_parse(&p, &data[off], k, &handlers, out);
+  }
+
+  if (ret == SJP_MORE) {
+    ret = inl ? sjp_parse_inline(&p, NULL, 0, &handlers, out)
+              : sjp_parse(&p, NULL, 0, &handlers, out);
+  }
+
+  if (ret == SJP_OK) {
+    return sjp_parser_close(&p);
+  }
+
+  sjp_parser_close(&p);
+  return ret;
+}
+
+struct push_case {
+  const char *doc;
+  unsigned opts;
+  int ret;
+  const char *events;
+};
+
+static void run_push_case(const struct push_case *c)
+{
+  static const size_t bufs[] = { 0, 40 };
+  size_t n = strlen(c->doc), chunk, b;
+  int inl;
+
+  for (b=0; b < sizeof bufs / sizeof bufs[0]; b++) {
+    // empty input is pushed once, with only the end of the input
+    for (chunk = 1; chunk <= n || chunk == 1; chunk++) {
+      for (inl = 0; inl < 2; inl++) {
+        static struct push_out out;
+        int ret;
+
+        ntest++;
+
+        memset(&out, 0, sizeof out);
+        ret = push_doc(c->doc, chunk, bufs[b], c->opts, inl, &out);
+        if (ret != c->ret || strcmp(out.text, c->events) != 0) {
+          nfail++;
+          printf("FAILED: %s\n", __func__);
+          printf("  document: %s\n", c->doc);
+          printf("  %s, chunk %zu, buf %zu: expected %d (%s) and events '%s'\n"
+              "  but found %d (%s) and events '%s'\n",
+              inl ? "inline" : "sjp_parse", chunk, bufs[b],
+              c->ret, ret2name(c->ret), c->events, ret, ret2name(ret), out.text);
+        }
+      }
+    }
+  }
+}
+
+static void test_push_events(void)
+{
+  static const struct push_case cases[] = {
+    {
+      "{\"a\": [1, -2.5e3, \"x\\u0041y\"], \"bb\": {\"c\": null, \"d\": true}, \"e\": false}", 0,
+      SJP_OK, "{ k:a [ n:1 n:-2.5e3 s:xAy ] k:bb { k:c null k:d true } k:e false } ",
+    },
+
+    {
+      "[\"a string that spills out of the forty byte value buffer\", "
+        "{\"a key that is also longer than the forty byte value buffer\": 12345678901234567890123}]", 0,
+      SJP_OK,
+      "[ s:a string that spills out of the forty byte value buffer "
+        "{ k:a key that is also longer than the forty byte value buffer n:12345678901234567890123 } ] ",
+    },
+
+    // keys and values that are the same strings
+    { "{\"k\": \"k\", \"v\": {\"k\": [\"v\"]}}", 0, SJP_OK, "{ k:k s:k k:v { k:k [ s:v ] } } " },
+
+    { "{\"k\":\"v\"} [1] \"s\" 2 ", SJP_PARSER_STREAM, SJP_OK, "{ k:k s:v } | [ n:1 ] | s:s | n:2 | " },
+
+    { "  17  ", 0, SJP_OK, "n:17 " },
+    { "{\"a\" 1}", 0, SJP_INVALID_INPUT, "{ k:a " },
+    { "[1, {\"x\": ", 0, SJP_UNCLOSED_OBJECT, "[ n:1 { k:x " },
+    { "[tru]", 0, SJP_INVALID_INPUT, "[ " },
+
+    // input without a value
+    { "", 0, SJP_INVALID_INPUT, "" },
+    { " \n\t ", 0, SJP_INVALID_INPUT, "" },
+    { "", SJP_PARSER_STREAM, SJP_OK, "" },
+    { " \n\t ", SJP_PARSER_STREAM, SJP_OK, "" },
+  };
+
+  size_t i;
+
+  for (i=0; i < sizeof cases / sizeof cases[0]; i++) {
+    run_push_case(&cases[i]);
+  }
+}
+
+// A non-zero handler return stops the parse
+static void test_push_stop(void)
+{
+  static const char doc[] = "{\"a\": [1, 2, 3], \"b\": {\"c\": null}}";
+  size_t chunk, n = strlen(doc);
+  int stop, inl;
+
+  for (stop = 1; stop <= 10; stop++) {
+    for (chunk = 1; chunk <= n; chunk += 7) {
+      for (inl = 0; inl < 2; inl++) {
+        static struct push_out out;
+        int ret;
+
+        ntest++;
+
+        memset(&out, 0, sizeof out);
+        out.stop_at = stop;
+        ret = push_doc(doc, chunk, 0, 0, inl, &out);
+        if (ret != 42 || out.count != stop) {
+          nfail++;
+          printf("FAILED: %s\n", __func__);
+          printf("  %s, stop at %d, chunk %zu: returned %d after %d events\n",
+              inl ? "inline" : "sjp_parse", stop, chunk, ret, out.count);
+        }
+      }
+    }
+  }
+}
+
+// Handlers that are NULL are skipped
+static void test_push_null_handlers(void)
+{
+  static const char doc[] = "{\"a\": [1, \"s\", true, null], \"b\": {}}";
+  struct sjp_handlers keys_only;
+  static struct push_out out;
+  struct sjp_parser p;
+  char data[sizeof doc];
+  int ret;
+
+  ntest++;
+
+  memset(&keys_only, 0, sizeof keys_only);
+  keys_only.on_key = on_key;
+
+  memset(&out, 0, sizeof out);
+  memcpy(data, doc, sizeof doc);
+  sjp_parser_init(&p, NULL, 0, NULL, 0);
+
+  if (ret = sjp_parse(&p, data, strlen(data), &keys_only, &out), ret == SJP_MORE) {
+    ret = sjp_parse(&p, NULL, 0, &keys_only, &out);
+  }
+
+  if (ret == SJP_OK) {
+    ret = sjp_parser_close(&p);
+  }
+
+  if (ret != SJP_OK || strcmp(out.text, "k:a k:b ") != 0) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  returned %d (%s) and events '%s'\n", ret, ret2name(ret), out.text);
+  }
+}
+
+int main(void)
+{
+  test_push_events();
+  test_push_stop();
+  test_push_null_handlers();
+
+  printf("%d tests, %d failures\n", ntest,nfail);
+  return nfail == 0 ? 0 : 1;
+}
@@ -0,0 +1,395 @@
+#include "sjp_tape.h"
+#include "sjp_number.h"
+
+#include <string.h>
+
+#define TAPE_WORD(type, payload) (((uint64_t)(type) << 56) | (uint64_t)(payload))
+
+enum SJP_RESULT sjp_tape_init(struct sjp_tape *t, struct sjp_parser *p, uint64_t *words, size_t nwords, char *strs, size_t nstrs)
+{
+  if (p == NULL || (words == NULL && nwords > 0) || (strs == NULL && nstrs > 0)) {
+    return SJP_INVALID_PARAMS;
+  }
+
+  memset(t, 0, sizeof *t);
+  t->p = p;
+
+  t->words = t->words0 = words;
+  t->capwords = t->capwords0 = nwords;
+  t->strs = t->strs0 = strs;
+  t->capstrs = t->capstrs0 = nstrs;
+
+  return SJP_OK;
+}
+
+void sjp_tape_set_allocator(struct sjp_tape *t, sjp_parser_alloc_fn alloc, void *ud, size_t maxbytes)
+{
+  t->alloc = alloc;
+  t->alloc_ud = ud;
+  t->maxbytes = maxbytes;
+}
+
+void sjp_tape_reset(struct sjp_tape *t)
+{
+  t->nwords = 0;
+  t->nstrs = 0;
+  t->open = 0;
+  t->depth = 0;
+  t->partial = 0;
+  t->done = 0;
+}
+
+void sjp_tape_close(struct sjp_tape *t)
+{
+  if (t->words != t->words0) {
+    t->alloc(t->alloc_ud, t->words, 0);
+  }
+
+  if (t->strs != t->strs0) {
+    t->alloc(t->alloc_ud, t->strs, 0);
+  }
+
+  t->words = t->words0;
+  t->capwords = t->capwords0;
+  t->strs = t->strs0;
+  t->capstrs = t->capstrs0;
+
+  sjp_tape_reset(t);
+}
+
+// Grows a buffer (the tape or the arena) to hold at least need bytes.
+// The first buffer belongs to the caller, so it's copied rather than
+// reallocated.
+static enum SJP_RESULT tape_grow(struct sjp_tape *t, void **buf, void *buf0, size_t *cap, size_t size, size_t used, size_t need)
+{
+  size_t n = (*cap > 0) ? 2 * *cap * size : 256;
+  void *nbuf;
+
+  if (t->alloc == NULL || need > t->maxbytes) {
+    return SJP_OUT_OF_MEMORY;
+  }
+
+  while (n < need) {
+    n *= 2;
+  }
+  if (n > t->maxbytes) {
+    n = t->maxbytes;
+  }
+
+  if (*buf == buf0) {
+    if (nbuf = t->alloc(t->alloc_ud, NULL, n), nbuf == NULL) {
+      return SJP_OUT_OF_MEMORY;
+    }
+    if (used > 0) {
+      memcpy(nbuf, *buf, used * size);
+    }
+  } else if (nbuf = t->alloc(t->alloc_ud, *buf, n), nbuf == NULL) {
+    return SJP_OUT_OF_MEMORY;
+  }
+
+  *buf = nbuf;
+  *cap = n / size;
+
+  return SJP_OK;
+}
+
+static enum SJP_RESULT tape_push(struct sjp_tape *t, uint64_t w)
+{
+  if (t->nwords >= t->capwords) {
+    void *words = t->words;
+    enum SJP_RESULT ret = tape_grow(t, &words, t->words0, &t->capwords, sizeof t->words[0],
+        t->nwords, (t->nwords + 1) * sizeof t->words[0]);
+
+    if (ret != SJP_OK) {
+      return ret;
+    }
+    t->words = words;
+  }
+
+  t->words[t->nwords++] = w;
+  return SJP_OK;
+}
+
+static enum SJP_RESULT tape_append(struct sjp_tape *t, const char *text, size_t n)
+{
+  if (n > t->capstrs - t->nstrs) {
+    void *strs = t->strs;
+    enum SJP_RESULT ret;
+
+    if (t->nstrs + n < t->nstrs) {
+      return SJP_OUT_OF_MEMORY;
+    }
+
+    ret = tape_grow(t, &strs, t->strs0, &t->capstrs, 1, t->nstrs, t->nstrs + n);
+    if (ret != SJP_OK) {
+      return ret;
+    }
+    t->strs = strs;
+  }
+
+  if (n > 0) {
+    memcpy(&t->strs[t->nstrs], text, n);
+    t->nstrs += n;
+  }
+
+  return SJP_OK;
+}
+
+// Adds a part of a string or raw number to the arena.  The first part
+// leaves room for the length.
+static enum SJP_RESULT tape_text(struct sjp_tape *t, const char *text, size_t n)
+{
+  static const char nolen[sizeof(uint32_t)] = { 0 };
+  enum SJP_RESULT ret;
+
+  if (t->partial == 0) {
+    if (ret = tape_append(t, nolen, sizeof nolen), ret != SJP_OK) {
+      return ret;
+    }
+    t->partial = t->nstrs - sizeof nolen + 1;
+  }
+
+  return tape_append(t, text, n);
+}
+
+// Finishes the string or raw number in the arena, and returns its
+// offset in *off
+static enum SJP_RESULT tape_text_end(struct sjp_tape *t, size_t *off)
+{
+  enum SJP_RESULT ret;
+  size_t len;
+  uint32_t n32;
+
+  if (t->partial == 0 && (ret = tape_text(t, "", 0), ret != SJP_OK)) {
+    return ret;
+  }
+
+  *off = t->partial - 1;
+  t->partial = 0;
+
+  len = t->nstrs - *off - sizeof n32;
+  if (len > UINT32_MAX) {
+    return SJP_OUT_OF_MEMORY;
+  }
+
+  n32 = (uint32_t)len;
+  memcpy(&t->strs[*off], &n32, sizeof n32);
+
+  return tape_append(t, "", 1);
+}
+
+static enum SJP_RESULT tape_number(struct sjp_tape *t, const struct sjp_event *evt)
+{
+  enum SJP_RESULT ret;
+  uint64_t bits;
+  size_t off;
+  int type;
+
+  switch (evt->kind) {
+    case SJP_NUM_INT64:
+      type = 'l';
+      bits = (uint64_t)evt->num.i64;
+      break;
+
+    case SJP_NUM_UINT64:
+      type = 'u';
+      bits = evt->num.u64;
+      break;
+
+    case SJP_NUM_RAW:
+      if ((ret = tape_text(t, evt->text, evt->n)) != SJP_OK) {
+        return ret;
+      }
+
+      if (t->p->opts & SJP_PARSER_RAW_NUMBERS) {
+        if (ret = tape_text_end(t, &off), ret != SJP_OK) {
+          return ret;
+        }
+        return tape_push(t, TAPE_WORD('R', off));
+      }
+
+      // Otherwise the number was too long for the lexer to convert when
+      // it was split between buffers.  The arena has every part, so
+      // convert the whole number from there.
+      {
+        double d;
+
+        off = t->partial - 1 + sizeof(uint32_t);
+        if (ret = sjp_number_to_double(&t->strs[off], t->nstrs - off, &d), ret != SJP_OK) {
+          return ret;
+        }
+        type = 'd';
+        memcpy(&bits, &d, sizeof bits);
+      }
+      break;
+
+    default:
+      type = 'd';
+      memcpy(&bits, &evt->extra.d, sizeof bits);
+      break;
+  }
+
+  // the parts of a partial number are only kept for raw numbers
+  if (t->partial != 0) {
+    t->nstrs = t->partial - 1;
+    t->partial = 0;
+  }
+
+  if (ret = tape_push(t, TAPE_WORD(type, 0)), ret != SJP_OK) {
+    return ret;
+  }
+
+  return tape_push(t, bits);
+}
+
+static enum SJP_RESULT tape_event(struct sjp_tape *t, const struct sjp_event *evt)
+{
+  enum SJP_RESULT ret;
+  size_t off, beg;
+
+  switch (evt->type) {
+    case SJP_NULL:
+      return tape_push(t, TAPE_WORD('n', 0));
+
+    case SJP_TRUE:
+      return tape_push(t, TAPE_WORD('t', 0));
+
+    case SJP_FALSE:
+      return tape_push(t, TAPE_WORD('f', 0));
+
+    case SJP_STRING:
+      if ((ret = tape_text(t, evt->text, evt->n)) != SJP_OK ||
+          (ret = tape_text_end(t, &off)) != SJP_OK) {
+        return ret;
+      }
+      return tape_push(t, TAPE_WORD('"', off));
+
+    case SJP_NUMBER:
+      return tape_number(t, evt);
+
+    case SJP_ARRAY_BEG:
+    case SJP_OBJECT_BEG:
+      // link to the enclosing array or object until this one closes
+      if (ret = tape_push(t, TAPE_WORD(evt->type == SJP_ARRAY_BEG ? '[' : '{', t->open)), ret != SJP_OK) {
+        return ret;
+      }
+      t->open = t->nwords;
+      t->depth++;
+      return SJP_OK;
+
+    case SJP_ARRAY_END:
+    case SJP_OBJECT_END:
+      beg = t->open - 1;
+      if (ret = tape_push(t, TAPE_WORD(evt->type == SJP_ARRAY_END ? ']' : '}', beg)), ret != SJP_OK) {
+        return ret;
+      }
+
+      t->open = (size_t)sjp_tape_payload(t, beg);
+      t->words[beg] = TAPE_WORD(sjp_tape_type(t, beg), t->nwords - 1);
+      t->depth--;
+      return SJP_OK;
+
+    default:
+      return SJP_OK;
+  }
+}
+
+enum SJP_RESULT sjp_tape_build(struct sjp_tape *t)
+{
+  struct sjp_event evt;
+  enum SJP_RESULT ret;
+
+  if (t->done) {
+    sjp_tape_reset(t);
+  }
+
+  for (;;) {
+    if (ret = sjp_parser_next(t->p, &evt), SJP_ERROR(ret)) {
+      return ret;
+    }
+
+    if (evt.type == SJP_NONE) {
+      // SJP_OK is the end of a stream of documents
+      if (ret == SJP_OK) {
+        t->done = 1;
+      }
+      return ret;
+    }
+
+    // in stream mode, documents end before their SJP_DOC_END
+    if (evt.type == SJP_DOC_END) {
+      continue;
+    }
+
+    if (ret != SJP_OK) {
+      // part of a string or number
+      enum SJP_RESULT tret;
+
+      if (tret = tape_text(t, evt.text, evt.n), tret != SJP_OK) {
+        return tret;
+      }
+
+      if (ret == SJP_MORE) {
+        return ret;
+      }
+      continue;
+    }
+
+    if (ret = tape_event(t, &evt), ret != SJP_OK) {
+      return ret;
+    }
+
+    if (t->depth == 0) {
+      t->done = 1;
+      return SJP_OK;
+    }
+  }
+}
+
+double sjp_tape_double(const struct sjp_tape *t, size_t i)
+{
+  const char *text;
+  double d = 0.0;
+  size_t n;
+
+  switch (sjp_tape_type(t, i)) {
+    case 'l':
+      return (double)sjp_tape_int64(t, i);
+
+    case 'u':
+      return (double)sjp_tape_uint64(t, i);
+
+    case 'd':
+      memcpy(&d, &t->words[i+1], sizeof d);
+      return d;
+
+    case 'R':
+      text = sjp_tape_string(t, i, &n);
+      sjp_number_to_double(text, n, &d);
+      return d;
+
+    default:
+      return 0.0;
+  }
+}
+
+size_t sjp_tape_field(const struct sjp_tape *t, size_t obj, const char *key, size_t n)
+{
+  size_t i, end;
+
+  if (sjp_tape_type(t, obj) != '{') {
+    return SJP_TAPE_NOT_FOUND;
+  }
+
+  end = (size_t)sjp_tape_payload(t, obj);
+  for (i = obj+1; i < end; i = sjp_tape_skip(t, i+1)) {
+    size_t klen;
+    const char *k = sjp_tape_string(t, i, &klen);
+
+    if (klen == n && memcmp(k, key, n) == 0) {
+      return i+1;
+    }
+  }
+
+  return SJP_TAPE_NOT_FOUND;
+}
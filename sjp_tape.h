@@ -0,0 +1,175 @@
+#ifndef SJP_TAPE_H
+#define SJP_TAPE_H
+
+#include "sjp_common.h"
+#include "sjp_lexer.h"
+#include "sjp_parser.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define MODULE_NAME SJP_TAPE
+
+// A compact tree of a document: the events of the document recorded in
+// a flat array of 64-bit words (the tape), with the text of strings in
+// a separate arena.
+//
+// Each word has a type in its top 8 bits and a payload in the other 56:
+//
+//   'n' 't' 'f'  null, true, false
+//
+//   '"'          string (a key or a value).  The payload is the offset
+//                of the string in the arena, where it's stored as a
+//                32-bit length, the bytes, and a '\0'.
+//
+//   'l' 'u' 'd'  number: int64_t, uint64_t or double.  The next word
+//                holds the value.
+//
+//   'R'          number that isn't converted (SJP_PARSER_RAW_NUMBERS),
+//                with its text in the arena, as for strings.
+//
+//   '[' '{'      start of an array or object.  The payload is the index
+//                of the word that ends it, so a reader can step over
+//                the whole array or object at once.
+//
+//   ']' '}'      end of an array or object.  The payload is the index
+//                of the word that starts it.
+//
+// The members of an object are its keys and values in turn.
+//
+// The builder reads events from a parser that the caller feeds, so a
+// tape can be built as chunks of the document arrive.  Once a document
+// is finished, the next call to sjp_tape_build() starts a new document
+// on the same tape and arena, and keeps their memory.
+
+// returned by sjp_tape_field() for a missing member
+#define SJP_TAPE_NOT_FOUND ((size_t)-1)
+
+struct sjp_tape {
+  struct sjp_parser *p;
+
+  uint64_t *words;
+  size_t nwords;
+  size_t capwords;
+
+  char *strs;       // the string arena
+  size_t nstrs;
+  size_t capstrs;
+
+  // the buffers given to sjp_tape_init, used until they grow
+  uint64_t *words0;
+  size_t capwords0;
+  char *strs0;
+  size_t capstrs0;
+
+  sjp_parser_alloc_fn alloc;  // see sjp_tape_set_allocator
+  void *alloc_ud;
+  size_t maxbytes;
+
+  // The innermost open array or object, plus one, or zero.  Until it's
+  // closed, the payload of an open array or object holds the one that
+  // contains it, the same way.
+  size_t open;
+  size_t depth;
+
+  size_t partial;   // arena offset of a partial string or number, plus one
+  int done;         // the document is finished
+};
+
+// Initializes a tape that reads events from the parser p.  The tape is
+// stored in words (nwords words) and the strings in strs (nstrs bytes).
+//
+// Returns SJP_INVALID_PARAMS if p is NULL, or if words or strs is NULL
+// and its size isn't zero.
+enum SJP_RESULT sjp_tape_init(struct sjp_tape *t, struct sjp_parser *p, uint64_t *words, size_t nwords, char *strs, size_t nstrs);
+
+// Sets an allocator (see sjp_parser_set_allocator) to grow the tape and
+// the arena when they fill, to at most maxbytes bytes each.  Each
+// doubles when it grows.  A NULL allocator turns off growth.
+void sjp_tape_set_allocator(struct sjp_tape *t, sjp_parser_alloc_fn alloc, void *ud, size_t maxbytes);
+
+// Reads events from the parser and adds them to the tape, until the
+// document is finished or the parser needs more data.
+//
+// Returns SJP_OK when the document is finished, SJP_MORE when the
+// parser needs more data (give it more with sjp_parser_more() or
+// sjp_parser_eos(), and call sjp_tape_build() again), or the parser's
+// error.  Returns SJP_OUT_OF_MEMORY if the tape or arena is full and
+// can't grow.  If the stream ends in the middle of the document, the
+// error is the parser's (sjp_parser_close() tells what is unclosed).
+//
+// In stream mode (SJP_PARSER_STREAM), each call after a finished
+// document builds the next document.  At the end of the stream, returns
+// SJP_OK with an empty tape.
+enum SJP_RESULT sjp_tape_build(struct sjp_tape *t);
+
+// Empties the tape and arena, keeping their memory, for a new document
+// (or after an error).
+void sjp_tape_reset(struct sjp_tape *t);
+
+// Frees a tape and arena grown by the allocator, and returns the tape
+// to the buffers given to sjp_tape_init().
+void sjp_tape_close(struct sjp_tape *t);
+
+static inline int sjp_tape_type(const struct sjp_tape *t, size_t i)
+{
+  return (int)(t->words[i] >> 56);
+}
+
+static inline uint64_t sjp_tape_payload(const struct sjp_tape *t, size_t i)
+{
+  return t->words[i] & (((uint64_t)1 << 56) - 1);
+}
+
+// Returns the index of the value after the value at i: one past the end
+// of an array or object, and past the value word of a number.
+static inline size_t sjp_tape_skip(const struct sjp_tape *t, size_t i)
+{
+  switch (sjp_tape_type(t, i)) {
+    case '[':
+    case '{':
+      return (size_t)sjp_tape_payload(t, i) + 1;
+
+    case 'l':
+    case 'u':
+    case 'd':
+      return i + 2;
+
+    default:
+      return i + 1;
+  }
+}
+
+// Returns the text of the string (or raw number) at i, and sets *n to
+// its length.  The text is followed by a '\0'.
+static inline const char *sjp_tape_string(const struct sjp_tape *t, size_t i, size_t *n)
+{
+  const char *s = &t->strs[sjp_tape_payload(t, i)];
+  uint32_t len;
+
+  memcpy(&len, s, sizeof len);
+  *n = len;
+  return s + sizeof len;
+}
+
+static inline int64_t sjp_tape_int64(const struct sjp_tape *t, size_t i)
+{
+  return (int64_t)t->words[i+1];
+}
+
+static inline uint64_t sjp_tape_uint64(const struct sjp_tape *t, size_t i)
+{
+  return t->words[i+1];
+}
+
+// Returns the value of the number at i as a double, whatever its kind
+double sjp_tape_double(const struct sjp_tape *t, size_t i);
+
+// Returns the index of the value of the first member of the object at
+// obj with the key (n bytes), or SJP_TAPE_NOT_FOUND.  Members before it
+// are stepped over without reading them.
+size_t sjp_tape_field(const struct sjp_tape *t, size_t obj, const char *key, size_t n);
+
+#undef MODULE_NAME
+
+#endif /* SJP_TAPE_H */
@@ -0,0 +1,380 @@
+#include "sjp_tape.h"
+
+#define TEST_LOG_LEVEL 0
+#include "sjp_testing.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define DEFAULT_STACK 16
+#define MAX_DOC     1024
+
+static void *tape_alloc(void *ud, void *ptr, size_t n)
+{
+  int *nlive = ud;
+
+  if (n == 0) {
+    if (ptr != NULL) {
+      --*nlive;
+    }
+    free(ptr);
+    return NULL;
+  }
+
+  if (ptr == NULL) {
+    ++*nlive;
+  }
+  return realloc(ptr, n);
+}
+
+// Returns the index of the word after the one at i, and after the value
+// word of a number
+static size_t next_word(const struct sjp_tape *t, size_t i)
+{
+  int type = sjp_tape_type(t, i);
+  return (type == 'l' || type == 'u' || type == 'd') ? i+2 : i+1;
+}
+
+// Writes the tape to out, one word (or number) at a time, separated by
+// spaces.  Arrays and objects are written with the index of their
+// other end.
+static void dump_tape(const struct sjp_tape *t, char *out, size_t nout)
+{
+  size_t i, k = 0;
+
+  out[0] = '\0';
+  for (i=0; i < t->nwords && k + 64 < nout; i = next_word(t, i)) {
+    int type = sjp_tape_type(t, i);
+    const char *s;
+    size_t n;
+
+    switch (type) {
+      case '"':
+      case 'R':
+        s = sjp_tape_string(t, i, &n);
+        if (k + n + 64 >= nout || s[n] != '\0') {
+          return;
+        }
+        k += sprintf(&out[k], (type == '"') ? "\"%s\" " : "R%s ", s);
+        break;
+
+      case 'l':
+        k += sprintf(&out[k], "l%lld ", (long long)sjp_tape_int64(t, i));
+        break;
+
+      case 'u':
+        k += sprintf(&out[k], "u%llu ", (unsigned long long)sjp_tape_uint64(t, i));
+        break;
+
+      case 'd':
+        k += sprintf(&out[k], "d%g ", sjp_tape_double(t, i));
+        break;
+
+      case '[': case '{': case ']': case '}':
+        k += sprintf(&out[k], "%c%llu ", type, (unsigned long long)sjp_tape_payload(t, i));
+        break;
+
+      default:
+        k += sprintf(&out[k], "%c ", type);
+        break;
+    }
+  }
+}
+
+// Builds the tape of doc, fed to the parser in chunks of the given
+// size.  If grow is set, the tape starts with a few words and bytes and
+// grows; otherwise it has room for the document.  Returns the result of
+// sjp_tape_build(), and the tape in out.
+static int tape_doc(const char *doc, size_t chunk, size_t nbuf, unsigned opts, int grow, char *out, size_t nout)
+{
+  char stack[DEFAULT_STACK];
+  char data[MAX_DOC];
+  char buf[64];
+  static uint64_t words[MAX_DOC];
+  static char strs[2*MAX_DOC];
+  struct sjp_parser p;
+  struct sjp_tape t;
+  size_t n, off;
+  int ret, nlive = 0;
+
+  n = strlen(doc);
+  memcpy(data, doc, n);
+
+  out[0] = '\0';
+  if (sjp_parser_init(&p, stack, sizeof stack, nbuf > 0 ? buf : NULL, nbuf) != SJP_OK ||
+      sjp_tape_init(&t, &p, words, grow ? 3 : MAX_DOC, strs, grow ? 5 : sizeof strs) != SJP_OK) {
+    return SJP_INTERNAL_ERROR;
+  }
+  sjp_parser_set_options(&p, opts);
+  if (grow) {
+    sjp_tape_set_allocator(&t, tape_alloc, &nlive, 1 << 20);
+  }
+
+  off = (chunk < n) ? chunk : n;
+  sjp_parser_more(&p, data, off);
+
+  while (ret = sjp_tape_build(&t), ret == SJP_MORE) {
+    size_t k = (n - off < chunk) ? n - off : chunk;
+
+    if (k == 0) {
+      sjp_parser_eos(&p);
+    } else {
+      sjp_parser_more(&p, &data[off], k);
+      off += k;
+    }
+  }
+
+  if (ret == SJP_OK) {
+    dump_tape(&t, out, nout);
+  }
+
+  sjp_tape_close(&t);
+  sjp_parser_close(&p);
+
+  if (nlive != 0) {
+    return SJP_INTERNAL_ERROR;
+  }
+
+  return ret;
+}
+
+struct tape_case {
+  const char *doc;
+  unsigned opts;
+  int ret;
+  const char *tape;
+};
+
+static void test_tape_build(void)
+{
+  static const struct tape_case cases[] = {
+    {
+      "{\"a\": [1, -2.5, \"x\\u0041y\", true, null], \"bb\": {}, \"c\": 18446744073709551615}", 0,
+      SJP_OK, "{17 \"a\" [10 l1 d-2.5 \"xAy\" t n ]2 \"bb\" {13 }12 \"c\" u18446744073709551615 }0 ",
+    },
+
+    {
+      "[\"a string that is longer than the forty byte value buffer\", 123456789012345]", 0,
+      SJP_OK, "[4 \"a string that is longer than the forty byte value buffer\" l123456789012345 ]0 ",
+    },
+
+    { "[1.5, 12345678901234567890123, 7]", SJP_PARSER_RAW_NUMBERS, SJP_OK, "[5 R1.5 R12345678901234567890123 l7 ]0 " },
+    // numbers longer than the lexer's restart buffer arrive in parts
+    { "[1234567890123456789012345678901234567890.5, \"s\"]", 0, SJP_OK, "[4 d1.23457e+39 \"s\" ]0 " },
+    {
+      "[1234567890123456789012345678901234567890.5, \"s\"]", SJP_PARSER_RAW_NUMBERS,
+      SJP_OK, "[3 R1234567890123456789012345678901234567890.5 \"s\" ]0 ",
+    },
+    // joined whole in a value buffer that's big enough for it
+    { "[49303913109802336928974273568449964.8280768]", 0, SJP_OK, "[3 d4.93039e+34 ]0 " },
+
+    { "[[[]],[{}]]", 0, SJP_OK, "[9 [4 [3 ]2 ]1 [8 {7 }6 ]5 ]0 " },
+    { "  42 ", 0, SJP_OK, "l42 " },
+    { "\"\"", 0, SJP_OK, "\"\" " },
+    { "{\"a\" 1}", 0, SJP_INVALID_INPUT, "" },
+    { "[1, {\"x\": ", 0, SJP_INVALID_INPUT, "" },
+  };
+
+  static const size_t bufs[] = { 0, 40, 64 };
+  char out[4096];
+  size_t i, b, chunk;
+  int grow;
+
+  for (i=0; i < sizeof cases / sizeof cases[0]; i++) {
+    size_t n = strlen(cases[i].doc);
+
+    for (b=0; b < sizeof bufs / sizeof bufs[0]; b++) {
+      for (chunk = 1; chunk <= n; chunk++) {
+        for (grow = 0; grow < 2; grow++) {
+          int ret;
+
+          ntest++;
+
+          ret = tape_doc(cases[i].doc, chunk, bufs[b], cases[i].opts, grow, out, sizeof out);
+          if (ret != cases[i].ret || strcmp(out, cases[i].tape) != 0) {
+            nfail++;
+            printf("FAILED: %s\n", __func__);
+            printf("  document: %s\n", cases[i].doc);
+            printf("  chunk %zu, buf %zu%s: expected %d (%s) and tape '%s'\n"
+                "  but found %d (%s) and tape '%s'\n",
+                chunk, bufs[b], grow ? ", growing" : "",
+                cases[i].ret, ret2name(cases[i].ret), cases[i].tape,
+                ret, ret2name(ret), out);
+          }
+        }
+      }
+    }
+  }
+}
+
+// Finds members by stepping over the values before them
+static void test_tape_field(void)
+{
+  char doc[] = "{\"a\": [1, [2, 3], {\"x\": 4}], \"b\": {\"c\": \"d\"}, \"e\": 5.5, \"a\": 0}";
+  char stack[DEFAULT_STACK];
+  uint64_t words[64];
+  char strs[256];
+  struct sjp_parser p;
+  struct sjp_tape t;
+  size_t i, n;
+  int ret;
+
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  sjp_tape_init(&t, &p, words, 64, strs, sizeof strs);
+  sjp_parser_more(&p, doc, strlen(doc));
+
+  ntest++;
+  if (ret = sjp_tape_build(&t), ret != SJP_OK) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  build returned %d (%s)\n", ret, ret2name(ret));
+    return;
+  }
+
+  ntest++;
+  if (i = sjp_tape_field(&t, 0, "e", 1), i == SJP_TAPE_NOT_FOUND || sjp_tape_type(&t, i) != 'd' ||
+      sjp_tape_double(&t, i) != 5.5) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  member \"e\" not found\n");
+  }
+
+  ntest++;
+  if (i = sjp_tape_field(&t, 0, "b", 1), i == SJP_TAPE_NOT_FOUND ||
+      (i = sjp_tape_field(&t, i, "c", 1), i == SJP_TAPE_NOT_FOUND) ||
+      sjp_tape_type(&t, i) != '"' || strcmp(sjp_tape_string(&t, i, &n), "d") != 0) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  member \"b\"/\"c\" not found\n");
+  }
+
+  // the first member with the key
+  ntest++;
+  if (i = sjp_tape_field(&t, 0, "a", 1), i == SJP_TAPE_NOT_FOUND || sjp_tape_type(&t, i) != '[') {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  member \"a\" not found\n");
+  }
+
+  ntest++;
+  if (sjp_tape_field(&t, 0, "x", 1) != SJP_TAPE_NOT_FOUND ||
+      sjp_tape_field(&t, 0, "", 0) != SJP_TAPE_NOT_FOUND ||
+      sjp_tape_field(&t, i, "x", 1) != SJP_TAPE_NOT_FOUND) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  found a member that isn't there\n");
+  }
+}
+
+// In stream mode, each document is built in turn on the same memory
+static void test_tape_stream(void)
+{
+  static const char *const tapes[] = { "{4 \"a\" l1 }0 ", "[3 l2 ]0 ", "\"s\" ", "[1 ]0 " };
+  char doc[] = "{\"a\":1} [2] \"s\"\n[]  ";
+  char stack[DEFAULT_STACK];
+  char out[256];
+  uint64_t words[4];
+  char strs[4];
+  struct sjp_parser p;
+  struct sjp_tape t;
+  uint64_t *grown = NULL;
+  size_t i;
+  int ret, nlive = 0;
+
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  sjp_parser_set_options(&p, SJP_PARSER_STREAM);
+  sjp_tape_init(&t, &p, words, 4, strs, sizeof strs);
+  sjp_tape_set_allocator(&t, tape_alloc, &nlive, 1 << 20);
+  sjp_parser_more(&p, doc, strlen(doc));
+
+  for (i=0; i <= sizeof tapes / sizeof tapes[0]; i++) {
+    const char *expected = (i < sizeof tapes / sizeof tapes[0]) ? tapes[i] : "";
+
+    ntest++;
+
+    if (ret = sjp_tape_build(&t), ret == SJP_MORE) {
+      sjp_parser_eos(&p);
+      ret = sjp_tape_build(&t);
+    }
+
+    dump_tape(&t, out, sizeof out);
+    if (ret != SJP_OK || strcmp(out, expected) != 0) {
+      nfail++;
+      printf("FAILED: %s\n", __func__);
+      printf("  document %zu: expected tape '%s', but found %d (%s) and '%s'\n",
+          i, expected, ret, ret2name(ret), out);
+    }
+
+    // the first document grows the tape, and the others reuse it
+    if (i == 0) {
+      grown = t.words;
+    }
+  }
+
+  ntest++;
+  if (grown == words || t.words != grown) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  the tape wasn't reused\n");
+  }
+
+  sjp_tape_close(&t);
+
+  ntest++;
+  if (nlive != 0 || t.words != words) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  %d allocations not freed\n", nlive);
+  }
+}
+
+// Without an allocator, a full tape or arena is an error
+static void test_tape_full(void)
+{
+  char doc[] = "[1, 2, \"abcdef\"]";
+  char stack[DEFAULT_STACK];
+  uint64_t words[16];
+  char strs[64];
+  struct sjp_parser p;
+  struct sjp_tape t;
+  int ret;
+
+  ntest++;
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  sjp_tape_init(&t, &p, words, 4, strs, sizeof strs);
+  sjp_parser_more(&p, doc, strlen(doc));
+  if (ret = sjp_tape_build(&t), ret != SJP_OUT_OF_MEMORY) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  full tape returned %d (%s)\n", ret, ret2name(ret));
+  }
+
+  ntest++;
+  sjp_parser_init(&p, stack, sizeof stack, NULL, 0);
+  sjp_tape_init(&t, &p, words, 16, strs, 8);
+  sjp_parser_more(&p, doc, strlen(doc));
+  if (ret = sjp_tape_build(&t), ret != SJP_OUT_OF_MEMORY) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  full arena returned %d (%s)\n", ret, ret2name(ret));
+  }
+
+  ntest++;
+  if (ret = sjp_tape_init(&t, NULL, words, 16, strs, 8), ret != SJP_INVALID_PARAMS) {
+    nfail++;
+    printf("FAILED: %s\n", __func__);
+    printf("  no parser returned %d (%s)\n", ret, ret2name(ret));
+  }
+}
+
+int main(void)
+{
+  test_tape_build();
+  test_tape_field();
+  test_tape_stream();
+  test_tape_full();
+
+  printf("%d tests, %d failures\n", ntest,nfail);
+  return nfail == 0 ? 0 : 1;
+}
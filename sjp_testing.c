@@ -12,6 +12,15 @@ int nfail = 0;
 const char *ret2name(enum SJP_RESULT ret)
 {
   switch (ret) {
+    case SJP_WRONG_TYPE:
+      return "WRONG_TYPE";
+
+    case SJP_OUT_OF_MEMORY:
+      return "OUT_OF_MEMORY";
+
+    case SJP_NUMBER_RANGE:
+      return "NUMBER_RANGE";
+
     case SJP_TOO_MUCH_NESTING:
       return "TOO_MUCH_NESTING";
 
@@ -137,6 +146,7 @@ const char *evt2name(enum SJP_EVENT evt)
     case SJP_OBJECT_END: return "OBJECT_END";
     case SJP_ARRAY_BEG: return "ARRAY_BEG";
     case SJP_ARRAY_END: return "ARRAY_END";
+    case SJP_DOC_END: return "DOC_END";
     default: return "UNKNOWN";
   }
 }